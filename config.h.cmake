@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #cmakedefine ENABLE_SYSTEMD
+#cmakedefine ENABLE_GST_PLAYER
 
 #cmakedefine BUILD_BINDIR "@BUILD_BINDIR@"
 #cmakedefine RELY_UDEV @RELY_UDEV@
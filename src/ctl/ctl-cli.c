@@ -141,6 +141,22 @@ void cli_printf(const char *fmt, ...)
 	va_end(args);
 }
 
+/* the WFD part of "show <peer>", same in every tool */
+void cli_print_peer_wfd(struct ctl_peer *p)
+{
+	if (p->wfd_subelements && *p->wfd_subelements)
+		cli_command_printf("WfdSubelements=%s\n", p->wfd_subelements);
+	if (p->wfd_dev_type && *p->wfd_dev_type) {
+		cli_command_printf("WfdDeviceType=%s\n", p->wfd_dev_type);
+		cli_command_printf("WfdSessionAvailable=%d\n", p->wfd_session_available);
+		cli_command_printf("WfdRtspPort=%u\n", p->wfd_rtsp_port);
+		cli_command_printf("WfdMaxThroughput=%u\n", p->wfd_max_throughput);
+		cli_command_printf("WfdCapabilities=0x%x\n", p->wfd_caps);
+	}
+	if (p->wfd_coupled_sink && *p->wfd_coupled_sink)
+		cli_command_printf("WfdCoupledSink=%s\n", p->wfd_coupled_sink);
+}
+
 int cli_help(const struct cli_cmd *cmds, int whitespace)
 {
 	unsigned int i;
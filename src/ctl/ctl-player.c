@@ -0,0 +1,624 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <gst/gst.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <systemd/sd-event.h>
+#include "ctl.h"
+#include "ctl-player.h"
+#include "ctl-rtp.h"
+#include "shl_macro.h"
+#include "shl_util.h"
+
+/*
+ * Pipeline
+ * udpsrc ! rtpjitterbuffer ! rtpmp2tdepay ! tsdemux
+ *   tsdemux. ! queue ! h264parse ! avdec_h264 ! videoconvert
+ *            [ ! videoscale ! capsfilter ] ! autovideosink
+ *   tsdemux. ! queue ! aacparse ! avdec_aac ! audioconvert
+ *            ! audioresample ! autoaudiosink
+ * tsdemux pads show up once the stream starts, they're linked to the queue
+ * of the matching branch from the streaming thread.
+ * If we got an RTP receiver, udpsrc is replaced by an appsrc that gets the
+ * slots of the receiver ring wrapped into buffers without copying them.
+ */
+
+struct ctl_player {
+	sd_event *event;
+	struct ctl_player_config config;
+
+	GstElement *pipeline;
+	GstElement *src;
+	GstElement *jitterbuffer;
+	GstElement *vqueue;
+	GstElement *aqueue;
+	GstElement *decoder;
+	GstElement *vsink;
+	GstBus *bus;
+	sd_event_source *bus_source;
+
+	int hres;
+	int vres;
+	uint64_t start_time;
+	gint want_first_frame;
+
+	uint64_t rendered;
+	uint64_t dropped;
+
+	bool running : 1;
+};
+
+static GstElement *player_add(struct ctl_player *p,
+			      const char *factory,
+			      const char *name)
+{
+	GstElement *e;
+
+	e = gst_element_factory_make(factory, name);
+	if (!e) {
+		cli_error("cannot create GStreamer element %s", factory);
+		return NULL;
+	}
+
+	gst_bin_add(GST_BIN(p->pipeline), e);
+	return e;
+}
+
+static void player_pad_added_fn(GstElement *demux, GstPad *pad, gpointer data)
+{
+	struct ctl_player *p = data;
+	GstElement *target = NULL;
+	const char *name;
+	GstCaps *caps;
+	GstPad *sink;
+
+	caps = gst_pad_get_current_caps(pad);
+	if (!caps)
+		caps = gst_pad_query_caps(pad, NULL);
+	if (!caps)
+		return;
+
+	name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+	if (g_str_has_prefix(name, "video/x-h264"))
+		target = p->vqueue;
+	else if (g_str_has_prefix(name, "audio/mpeg"))
+		target = p->aqueue;
+	gst_caps_unref(caps);
+
+	if (!target)
+		return;
+
+	sink = gst_element_get_static_pad(target, "sink");
+	if (!gst_pad_is_linked(sink))
+		gst_pad_link(pad, sink);
+	gst_object_unref(sink);
+}
+
+static GstPadProbeReturn player_probe_fn(GstPad *pad,
+					 GstPadProbeInfo *info,
+					 gpointer data)
+{
+	struct ctl_player *p = data;
+	GstStructure *s;
+
+	/* runs in the streaming thread, let the bus carry it over */
+	if (g_atomic_int_compare_and_exchange(&p->want_first_frame, 1, 0)) {
+		s = gst_structure_new_empty("miracle-first-frame");
+		gst_element_post_message(p->pipeline,
+			gst_message_new_application(GST_OBJECT(p->pipeline), s));
+	}
+
+	return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn player_keyframe_fn(GstPad *pad,
+					    GstPadProbeInfo *info,
+					    gpointer data)
+{
+	struct ctl_player *p = data;
+	GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+	GstStructure *s;
+
+	if (GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT))
+		return GST_PAD_PROBE_OK;
+
+	s = gst_structure_new_empty("miracle-keyframe");
+	gst_element_post_message(p->pipeline,
+		gst_message_new_application(GST_OBJECT(p->pipeline), s));
+
+	return GST_PAD_PROBE_OK;
+}
+
+static int player_build_video(struct ctl_player *p)
+{
+	GstElement *parse, *dec, *conv, *scale, *filter, *last;
+	GstCaps *caps;
+	GstPad *pad;
+
+	p->vqueue = player_add(p, "queue", "vqueue");
+	parse = player_add(p, "h264parse", NULL);
+	dec = player_add(p, p->config.decoder ? : "avdec_h264", "decoder");
+	p->decoder = dec;
+	conv = player_add(p, "videoconvert", NULL);
+	p->vsink = player_add(p, "autovideosink", "videosink");
+	if (!p->vqueue || !parse || !dec || !conv || !p->vsink)
+		return -ENOENT;
+
+	g_object_set(p->vqueue,
+		     "max-size-buffers", 0,
+		     "max-size-time", (guint64)0,
+		     NULL);
+
+	if (!gst_element_link_many(p->vqueue, parse, dec, conv, NULL))
+		return -EINVAL;
+
+	/* h264parse marks everything but IDR pictures as delta units */
+	pad = gst_element_get_static_pad(parse, "src");
+	if (!pad)
+		return -EINVAL;
+
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+			  player_keyframe_fn, p, NULL);
+	gst_object_unref(pad);
+
+	last = conv;
+	if (p->config.scale_hres > 0 && p->config.scale_vres > 0) {
+		scale = player_add(p, "videoscale", NULL);
+		filter = player_add(p, "capsfilter", NULL);
+		if (!scale || !filter)
+			return -ENOENT;
+
+		g_object_set(scale, "method", 1, NULL);
+		caps = gst_caps_new_simple("video/x-raw",
+					   "width", G_TYPE_INT,
+					   p->config.scale_hres,
+					   "height", G_TYPE_INT,
+					   p->config.scale_vres,
+					   NULL);
+		g_object_set(filter, "caps", caps, NULL);
+		gst_caps_unref(caps);
+
+		if (!gst_element_link_many(conv, scale, filter, NULL))
+			return -EINVAL;
+		last = filter;
+	}
+
+	if (!gst_element_link(last, p->vsink))
+		return -EINVAL;
+
+	pad = gst_element_get_static_pad(p->vsink, "sink");
+	if (!pad)
+		return -EINVAL;
+
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+			  player_probe_fn, p, NULL);
+	gst_object_unref(pad);
+
+	return 0;
+}
+
+static int player_build_audio(struct ctl_player *p)
+{
+	GstElement *parse, *dec, *conv, *resample, *sink;
+
+	p->aqueue = player_add(p, "queue", "aqueue");
+	parse = player_add(p, "aacparse", NULL);
+	dec = player_add(p, "avdec_aac", NULL);
+	conv = player_add(p, "audioconvert", NULL);
+	resample = player_add(p, "audioresample", NULL);
+	sink = player_add(p, "autoaudiosink", NULL);
+	if (!p->aqueue || !parse || !dec || !conv || !resample || !sink)
+		return -ENOENT;
+
+	g_object_set(p->aqueue,
+		     "max-size-buffers", 0,
+		     "max-size-time", (guint64)0,
+		     NULL);
+
+	if (!gst_element_link_many(p->aqueue, parse, dec, conv, resample,
+				   sink, NULL))
+		return -EINVAL;
+
+	return 0;
+}
+
+static int player_build(struct ctl_player *p)
+{
+	GstElement *depay, *demux;
+	GstCaps *caps;
+	int r;
+
+	p->pipeline = gst_pipeline_new("miracle-player");
+	if (!p->pipeline)
+		return -ENOMEM;
+
+	if (p->config.rtp)
+		p->src = player_add(p, "appsrc", NULL);
+	else
+		p->src = player_add(p, "udpsrc", NULL);
+	p->jitterbuffer = player_add(p, "rtpjitterbuffer", NULL);
+	depay = player_add(p, "rtpmp2tdepay", NULL);
+	demux = player_add(p, "tsdemux", NULL);
+	if (!p->src || !p->jitterbuffer || !depay || !demux)
+		return -ENOENT;
+
+	caps = gst_caps_new_simple("application/x-rtp",
+				   "media", G_TYPE_STRING, "video",
+				   "clock-rate", G_TYPE_INT, 90000,
+				   "encoding-name", G_TYPE_STRING, "MP2T",
+				   NULL);
+	if (p->config.rtp)
+		g_object_set(p->src,
+			     "caps", caps,
+			     "is-live", TRUE,
+			     "do-timestamp", TRUE,
+			     "format", GST_FORMAT_TIME,
+			     NULL);
+	else
+		g_object_set(p->src,
+			     "port", p->config.port,
+			     "caps", caps,
+			     NULL);
+	gst_caps_unref(caps);
+
+	g_object_set(p->jitterbuffer, "latency", p->config.latency, NULL);
+
+	if (!gst_element_link_many(p->src, p->jitterbuffer, depay, demux, NULL))
+		return -EINVAL;
+
+	r = player_build_video(p);
+	if (r < 0)
+		return r;
+
+	if (p->config.audio) {
+		r = player_build_audio(p);
+		if (r < 0)
+			return r;
+	}
+
+	g_signal_connect(demux, "pad-added",
+			 G_CALLBACK(player_pad_added_fn), p);
+
+	return 0;
+}
+
+static void player_halt(struct ctl_player *p)
+{
+	g_atomic_int_set(&p->want_first_frame, 0);
+	p->running = false;
+
+	/* keep everything prepared for the next session */
+	gst_element_set_state(p->pipeline, GST_STATE_READY);
+}
+
+static void player_handle_message(struct ctl_player *p, GstMessage *m)
+{
+	const GstStructure *s;
+	guint64 processed, dropped;
+	GError *err = NULL;
+	gchar *dbg = NULL;
+	GstFormat format;
+
+	switch (GST_MESSAGE_TYPE(m)) {
+	case GST_MESSAGE_ERROR:
+		gst_message_parse_error(m, &err, &dbg);
+		cli_error("player: %s", err->message);
+		if (dbg)
+			cli_debug("player: %s", dbg);
+		g_error_free(err);
+		g_free(dbg);
+
+		if (p->running) {
+			player_halt(p);
+			ctl_fn_player_stopped(p);
+		}
+		break;
+	case GST_MESSAGE_WARNING:
+		gst_message_parse_warning(m, &err, &dbg);
+		cli_warning("player: %s", err->message);
+		g_error_free(err);
+		g_free(dbg);
+
+		/* broken references, the picture is garbage until the next
+		 * IDR */
+		if (p->running &&
+		    gst_object_has_as_ancestor(GST_MESSAGE_SRC(m),
+					       GST_OBJECT(p->decoder)))
+			ctl_fn_player_decode_error(p);
+		break;
+	case GST_MESSAGE_EOS:
+		if (p->running) {
+			player_halt(p);
+			ctl_fn_player_stopped(p);
+		}
+		break;
+	case GST_MESSAGE_LATENCY:
+		gst_bin_recalculate_latency(GST_BIN(p->pipeline));
+		break;
+	case GST_MESSAGE_QOS:
+		if (!gst_object_has_as_ancestor(GST_MESSAGE_SRC(m),
+						GST_OBJECT(p->vsink)))
+			break;
+
+		gst_message_parse_qos_stats(m, &format, &processed, &dropped);
+		if (format == GST_FORMAT_BUFFERS) {
+			p->rendered = processed;
+			p->dropped = dropped;
+		}
+		break;
+	case GST_MESSAGE_APPLICATION:
+		s = gst_message_get_structure(m);
+		if (!p->running)
+			break;
+
+		if (gst_structure_has_name(s, "miracle-first-frame"))
+			ctl_fn_player_first_frame(p,
+				shl_now(CLOCK_MONOTONIC) - p->start_time);
+		else if (gst_structure_has_name(s, "miracle-keyframe"))
+			ctl_fn_player_keyframe(p);
+		break;
+	default:
+		break;
+	}
+}
+
+static int player_bus_fn(sd_event_source *source,
+			 int fd,
+			 uint32_t mask,
+			 void *data)
+{
+	struct ctl_player *p = data;
+	GstMessage *m;
+
+	while ((m = gst_bus_pop(p->bus))) {
+		player_handle_message(p, m);
+		gst_message_unref(m);
+	}
+
+	return 0;
+}
+
+static void player_release_slot_fn(gpointer data)
+{
+	ctl_rtp_release(data);
+}
+
+static void player_rtp_fn(struct ctl_rtp *rtp,
+			  struct ctl_rtp_slot *slot,
+			  void *data)
+{
+	struct ctl_player *p = data;
+	GstFlowReturn ret;
+	GstBuffer *buf;
+
+	if (!p->running) {
+		ctl_rtp_release(slot);
+		return;
+	}
+
+	/* the slot goes back to the ring once the buffer is freed */
+	buf = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
+					  slot->data,
+					  CTL_RTP_SLOT_SIZE,
+					  0,
+					  slot->len,
+					  slot,
+					  player_release_slot_fn);
+
+	/* the action signal doesn't take our reference, unlike the
+	 * gst_app_src_push_buffer() we'd need libgstapp for */
+	g_signal_emit_by_name(p->src, "push-buffer", buf, &ret);
+	gst_buffer_unref(buf);
+}
+
+int ctl_player_new(struct ctl_player **out,
+		   sd_event *event,
+		   const struct ctl_player_config *config)
+{
+	struct ctl_player *p;
+	GError *err = NULL;
+	GPollFD fd;
+	int r;
+
+	if (!out || !event || !config)
+		return cli_EINVAL();
+
+	if (!gst_init_check(NULL, NULL, &err)) {
+		cli_error("cannot initialize GStreamer: %s", err->message);
+		g_error_free(err);
+		return -EIO;
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return cli_ENOMEM();
+
+	p->event = sd_event_ref(event);
+	p->config = *config;
+
+	r = player_build(p);
+	if (r < 0)
+		goto error;
+
+	p->bus = gst_element_get_bus(p->pipeline);
+	gst_bus_get_pollfd(p->bus, &fd);
+
+	r = sd_event_add_io(p->event,
+			    &p->bus_source,
+			    fd.fd,
+			    EPOLLIN,
+			    player_bus_fn,
+			    p);
+	if (r < 0)
+		goto error;
+
+	/* load plugins and open the socket before the session starts */
+	if (gst_element_set_state(p->pipeline, GST_STATE_READY) ==
+	    GST_STATE_CHANGE_FAILURE) {
+		r = -EIO;
+		goto error;
+	}
+
+	if (p->config.rtp)
+		ctl_rtp_set_consumer(p->config.rtp, player_rtp_fn, p);
+
+	*out = p;
+	return 0;
+
+error:
+	ctl_player_free(p);
+	return r;
+}
+
+void ctl_player_free(struct ctl_player *p)
+{
+	if (!p)
+		return;
+
+	if (p->config.rtp)
+		ctl_rtp_set_consumer(p->config.rtp, NULL, NULL);
+
+	if (p->pipeline)
+		gst_element_set_state(p->pipeline, GST_STATE_NULL);
+
+	if (p->bus_source) {
+		sd_event_source_set_enabled(p->bus_source, SD_EVENT_OFF);
+		sd_event_source_unref(p->bus_source);
+	}
+
+	if (p->bus)
+		gst_object_unref(p->bus);
+	if (p->pipeline)
+		gst_object_unref(p->pipeline);
+
+	sd_event_unref(p->event);
+	free(p);
+}
+
+int ctl_player_start(struct ctl_player *p, int hres, int vres)
+{
+	if (!p)
+		return cli_EINVAL();
+
+	p->hres = hres;
+	p->vres = vres;
+
+	/* decoder and sink renegotiate on their own, no need to restart */
+	if (p->running) {
+		cli_debug("player: resolution changed to %dx%d", hres, vres);
+		return 0;
+	}
+
+	p->rendered = 0;
+	p->dropped = 0;
+	p->start_time = shl_now(CLOCK_MONOTONIC);
+	g_atomic_int_set(&p->want_first_frame, 1);
+
+	if (gst_element_set_state(p->pipeline, GST_STATE_PLAYING) ==
+	    GST_STATE_CHANGE_FAILURE) {
+		player_halt(p);
+		return -EIO;
+	}
+
+	p->running = true;
+	return 0;
+}
+
+void ctl_player_stop(struct ctl_player *p)
+{
+	if (!p || !p->running)
+		return;
+
+	player_halt(p);
+}
+
+bool ctl_player_is_running(struct ctl_player *p)
+{
+	return p && p->running;
+}
+
+int ctl_player_set_latency(struct ctl_player *p, unsigned int latency)
+{
+	if (!p)
+		return cli_EINVAL();
+
+	p->config.latency = latency;
+	g_object_set(p->jitterbuffer, "latency", latency, NULL);
+
+	return 0;
+}
+
+int ctl_player_get_stats(struct ctl_player *p, struct ctl_player_stats *st)
+{
+	GstClockTime min = 0, max = 0;
+	GstStructure *s = NULL;
+	guint buffers, bytes;
+	gboolean live;
+	guint64 time;
+	GstQuery *q;
+
+	if (!p || !st)
+		return cli_EINVAL();
+
+	memset(st, 0, sizeof(*st));
+	st->hres = p->hres;
+	st->vres = p->vres;
+
+	q = gst_query_new_latency();
+	if (gst_element_query(p->pipeline, q)) {
+		gst_query_parse_latency(q, &live, &min, &max);
+		if (GST_CLOCK_TIME_IS_VALID(min))
+			st->latency = min / 1000;
+	}
+	gst_query_unref(q);
+
+	g_object_get(p->jitterbuffer,
+		     "latency", &st->jb_latency,
+		     "stats", &s,
+		     NULL);
+	if (s) {
+		gst_structure_get_uint64(s, "num-pushed", &st->jb_pushed);
+		gst_structure_get_uint64(s, "num-lost", &st->jb_lost);
+		gst_structure_get_uint64(s, "num-late", &st->jb_late);
+		gst_structure_get_uint64(s, "num-duplicates",
+					 &st->jb_duplicates);
+		if (gst_structure_get_uint64(s, "avg-jitter", &time))
+			st->jb_avg_jitter = time / 1000;
+		gst_structure_free(s);
+	}
+
+	g_object_get(p->vqueue,
+		     "current-level-buffers", &buffers,
+		     "current-level-bytes", &bytes,
+		     "current-level-time", &time,
+		     NULL);
+	st->queue_buffers = buffers;
+	st->queue_bytes = bytes;
+	st->queue_time = time / 1000;
+
+	st->rendered = p->rendered;
+	st->dropped = p->dropped;
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Built-in Player
+ * Plays the RTP/MPEG-TS stream of a WFD session inside the sinkctl process,
+ * driving the GStreamer bus from our sd-event loop. The pipeline is built
+ * once and kept in READY between sessions, so starting a session only
+ * needs a state change. Only available if built with ENABLE_GST_PLAYER,
+ * otherwise ctl_player_new() fails with -EOPNOTSUPP and users fall back to
+ * an external player.
+ */
+
+#ifndef CTL_PLAYER_H
+#define CTL_PLAYER_H
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <systemd/sd-event.h>
+
+struct ctl_player;
+struct ctl_rtp;
+
+struct ctl_player_config {
+	/* take packets from this receiver instead of listening on port */
+	struct ctl_rtp *rtp;
+	int port;
+	bool audio;
+	/* scale to this resolution if non-zero */
+	int scale_hres;
+	int scale_vres;
+	/* rtpjitterbuffer latency in ms */
+	unsigned int latency;
+	/* H.264 decoder element, avdec_h264 if NULL */
+	const char *decoder;
+};
+
+struct ctl_player_stats {
+	int hres;
+	int vres;
+
+	/* pipeline latency in usec */
+	uint64_t latency;
+
+	/* rtpjitterbuffer */
+	unsigned int jb_latency;
+	uint64_t jb_pushed;
+	uint64_t jb_lost;
+	uint64_t jb_late;
+	uint64_t jb_duplicates;
+	uint64_t jb_avg_jitter;		/* in usec */
+
+	/* QoS of the video sink */
+	uint64_t rendered;
+	uint64_t dropped;
+
+	/* queue in front of the decoder */
+	unsigned int queue_buffers;
+	unsigned int queue_bytes;
+	uint64_t queue_time;		/* in usec */
+};
+
+#ifdef ENABLE_GST_PLAYER
+
+int ctl_player_new(struct ctl_player **out,
+		   sd_event *event,
+		   const struct ctl_player_config *config);
+void ctl_player_free(struct ctl_player *p);
+
+int ctl_player_start(struct ctl_player *p, int hres, int vres);
+void ctl_player_stop(struct ctl_player *p);
+bool ctl_player_is_running(struct ctl_player *p);
+
+int ctl_player_set_latency(struct ctl_player *p, unsigned int latency);
+int ctl_player_get_stats(struct ctl_player *p, struct ctl_player_stats *st);
+
+#else /* ENABLE_GST_PLAYER */
+
+static inline int ctl_player_new(struct ctl_player **out,
+				 sd_event *event,
+				 const struct ctl_player_config *config)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void ctl_player_free(struct ctl_player *p)
+{
+}
+
+static inline int ctl_player_start(struct ctl_player *p, int hres, int vres)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void ctl_player_stop(struct ctl_player *p)
+{
+}
+
+static inline bool ctl_player_is_running(struct ctl_player *p)
+{
+	return false;
+}
+
+static inline int ctl_player_set_latency(struct ctl_player *p,
+					 unsigned int latency)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline int ctl_player_get_stats(struct ctl_player *p,
+				       struct ctl_player_stats *st)
+{
+	return -EOPNOTSUPP;
+}
+
+#endif /* ENABLE_GST_PLAYER */
+
+/* callback functions */
+
+void ctl_fn_player_first_frame(struct ctl_player *p, uint64_t usec);
+void ctl_fn_player_keyframe(struct ctl_player *p);
+void ctl_fn_player_decode_error(struct ctl_player *p);
+void ctl_fn_player_stopped(struct ctl_player *p);
+
+#endif /* CTL_PLAYER_H */
@@ -0,0 +1,398 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "ctl.h"
+#include "ctl-probe.h"
+#include "shl_macro.h"
+#include "shl_util.h"
+
+#define PROBE_CACHE_MAGIC "miraclecast-decoder-probe 2"
+#define PROBE_FRAMES 90
+#define PROBE_TIMEOUT (30 * GST_SECOND)
+
+static const char *probe_encoders[] = {
+	"x264enc speed-preset=ultrafast tune=zerolatency key-int-max=30 bitrate=8000",
+	"openh264enc complexity=low bitrate=8000000",
+	NULL
+};
+
+/* hardware decoders first, they win if they work at all */
+static const char *probe_decoders[] = {
+	"vah264dec",
+	"vaapih264dec",
+	"v4l2h264dec",
+	"nvh264dec",
+	"avdec_h264",
+	NULL
+};
+
+/* the smallest and largest CEA modes */
+static const int probe_res[2][2] = {
+	{ 640, 480 },
+	{ 1920, 1080 },
+};
+
+struct probe_timing {
+	unsigned int frames;
+	uint64_t first;
+	uint64_t last;
+};
+
+static bool probe_have(const char *factory)
+{
+	char name[64];
+	GstElementFactory *f;
+
+	/* strip properties */
+	sscanf(factory, "%63s", name);
+
+	f = gst_element_factory_find(name);
+	if (!f)
+		return false;
+
+	gst_object_unref(f);
+	return true;
+}
+
+/* run a pipeline to completion, synchronously */
+static int probe_run_pipeline(GstElement *pipeline)
+{
+	GstMessage *m;
+	GstBus *bus;
+	int r = 0;
+
+	if (gst_element_set_state(pipeline, GST_STATE_PLAYING) ==
+	    GST_STATE_CHANGE_FAILURE)
+		return -EIO;
+
+	bus = gst_element_get_bus(pipeline);
+	m = gst_bus_timed_pop_filtered(bus, PROBE_TIMEOUT,
+				       GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+	if (!m)
+		r = -ETIMEDOUT;
+	else if (GST_MESSAGE_TYPE(m) == GST_MESSAGE_ERROR)
+		r = -EIO;
+
+	if (m)
+		gst_message_unref(m);
+	gst_object_unref(bus);
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+
+	return r;
+}
+
+/* encode a synthetic clip into a memfd */
+static int probe_encode(const char *encoder, int hres, int vres)
+{
+	GstElement *pipeline;
+	GError *err = NULL;
+	char *desc;
+	int fd, r;
+
+	fd = memfd_create("miracle-probe", MFD_CLOEXEC);
+	if (fd < 0)
+		return cli_ERRNO();
+
+	desc = g_strdup_printf("videotestsrc num-buffers=%u pattern=ball "
+			       "! video/x-raw,format=I420,width=%d,height=%d,framerate=60/1 "
+			       "! %s "
+			       "! video/x-h264,stream-format=byte-stream "
+			       "! filesink location=/proc/self/fd/%d",
+			       PROBE_FRAMES, hres, vres, encoder, fd);
+	pipeline = gst_parse_launch(desc, &err);
+	g_free(desc);
+	if (!pipeline) {
+		cli_debug("probe: cannot build encoder: %s",
+			  err ? err->message : "unknown error");
+		if (err)
+			g_error_free(err);
+		close(fd);
+		return -ENOENT;
+	}
+
+	r = probe_run_pipeline(pipeline);
+	gst_object_unref(pipeline);
+	if (r < 0) {
+		close(fd);
+		return r;
+	}
+
+	return fd;
+}
+
+static void probe_handoff_fn(GstElement *sink,
+			     GstBuffer *buf,
+			     GstPad *pad,
+			     gpointer data)
+{
+	struct probe_timing *t = data;
+
+	t->last = shl_now(CLOCK_MONOTONIC);
+	if (!t->frames++)
+		t->first = t->last;
+}
+
+/* returns the decode time per frame in nsec */
+static int probe_decode(const char *decoder, int fd, double *out)
+{
+	struct probe_timing t = { };
+	GstElement *pipeline, *sink;
+	GError *err = NULL;
+	char *desc;
+	int r;
+
+	desc = g_strdup_printf("filesrc location=/proc/self/fd/%d "
+			       "! h264parse ! %s "
+			       "! fakesink name=sink sync=false signal-handoffs=true",
+			       fd, decoder);
+	pipeline = gst_parse_launch(desc, &err);
+	g_free(desc);
+	if (!pipeline) {
+		if (err)
+			g_error_free(err);
+		return -ENOENT;
+	}
+
+	sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+	g_signal_connect(sink, "handoff", G_CALLBACK(probe_handoff_fn), &t);
+	gst_object_unref(sink);
+
+	r = probe_run_pipeline(pipeline);
+	gst_object_unref(pipeline);
+	if (r < 0)
+		return r;
+
+	/* decoder setup isn't part of the steady state, skip frame one */
+	if (t.frames < PROBE_FRAMES / 2 || t.last <= t.first)
+		return -EIO;
+
+	*out = (t.last - t.first) * 1000.0 / (t.frames - 1);
+	return 0;
+}
+
+static int probe_benchmark(struct ctl_probe *probe)
+{
+	const char *encoder = NULL;
+	unsigned int i, j;
+	double t[2], best = 0;
+	int fds[2] = { -1, -1 }, r = -ENOENT;
+	double p0, p1;
+
+	for (i = 0; probe_encoders[i]; ++i) {
+		if (probe_have(probe_encoders[i])) {
+			encoder = probe_encoders[i];
+			break;
+		}
+	}
+
+	if (!encoder) {
+		cli_debug("probe: no H.264 encoder available");
+		return -ENOENT;
+	}
+
+	for (i = 0; i < 2; ++i) {
+		fds[i] = probe_encode(encoder, probe_res[i][0], probe_res[i][1]);
+		if (fds[i] < 0) {
+			r = fds[i];
+			goto out;
+		}
+	}
+
+	p0 = probe_res[0][0] * probe_res[0][1];
+	p1 = probe_res[1][0] * probe_res[1][1];
+
+	for (i = 0; probe_decoders[i]; ++i) {
+		if (!probe_have(probe_decoders[i]))
+			continue;
+
+		for (j = 0; j < 2; ++j) {
+			if (lseek(fds[j], 0, SEEK_SET) < 0 ||
+			    probe_decode(probe_decoders[i], fds[j], &t[j]) < 0)
+				break;
+		}
+
+		if (j < 2) {
+			cli_debug("probe: %s does not work", probe_decoders[i]);
+			continue;
+		}
+
+		cli_debug("probe: %s takes %.2fms at %dx%d, %.2fms at %dx%d",
+			  probe_decoders[i],
+			  t[0] / 1000000.0, probe_res[0][0], probe_res[0][1],
+			  t[1] / 1000000.0, probe_res[1][0], probe_res[1][1]);
+
+		/* what matters is the large one */
+		if (best && t[1] >= best)
+			continue;
+
+		best = t[1];
+		snprintf(probe->decoder, sizeof(probe->decoder), "%s",
+			 probe_decoders[i]);
+		probe->per_pixel = (t[1] - t[0]) / (p1 - p0);
+		if (probe->per_pixel < 0)
+			probe->per_pixel = 0;
+		probe->base = t[0] - probe->per_pixel * p0;
+		if (probe->base < 0)
+			probe->base = 0;
+		r = 0;
+	}
+
+out:
+	for (i = 0; i < 2; ++i)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	return r;
+}
+
+static char *probe_cache_path(const char *cache)
+{
+	if (cache)
+		return g_strdup(cache);
+
+	return g_build_filename(g_get_user_cache_dir(),
+				"miraclecast",
+				"decoder-probe",
+				NULL);
+}
+
+/*
+ * The model is stored as integers, base in nsec and per-pixel in fsec. %f
+ * follows LC_NUMERIC, so a cache written with a decimal comma would not
+ * read back the same.
+ */
+#define PROBE_FSEC_PER_NSEC 1000000.0
+
+static int probe_load(struct ctl_probe *probe, const char *path)
+{
+	char magic[64], version[64], *ver;
+	struct ctl_probe p = { };
+	uint64_t base, per_pixel;
+	FILE *f;
+	int r;
+
+	f = fopen(path, "re");
+	if (!f)
+		return -errno;
+
+	r = fscanf(f, "%63[^\n]\n"
+		      "gstreamer %63[^\n]\n"
+		      "decoder %63s\n"
+		      "base-nsec %" SCNu64 "\n"
+		      "per-pixel-fsec %" SCNu64 "\n",
+		   magic, version, p.decoder, &base, &per_pixel);
+	fclose(f);
+	if (r != 5 || strcmp(magic, PROBE_CACHE_MAGIC))
+		return -EINVAL;
+
+	p.base = base;
+	p.per_pixel = per_pixel / PROBE_FSEC_PER_NSEC;
+
+	/* decoders change with GStreamer, so does their speed */
+	ver = gst_version_string();
+	r = strcmp(version, ver);
+	g_free(ver);
+	if (r)
+		return -ESTALE;
+
+	*probe = p;
+	return 0;
+}
+
+static int probe_save(const struct ctl_probe *probe, const char *path)
+{
+	char *dir, *ver;
+	FILE *f;
+
+	dir = g_path_get_dirname(path);
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+
+	f = fopen(path, "we");
+	if (!f)
+		return -errno;
+
+	ver = gst_version_string();
+	fprintf(f, "%s\n"
+		   "gstreamer %s\n"
+		   "decoder %s\n"
+		   "base-nsec %" PRIu64 "\n"
+		   "per-pixel-fsec %" PRIu64 "\n",
+		PROBE_CACHE_MAGIC, ver, probe->decoder,
+		(uint64_t)(probe->base + 0.5),
+		(uint64_t)(probe->per_pixel * PROBE_FSEC_PER_NSEC + 0.5));
+	g_free(ver);
+
+	if (fclose(f))
+		return -errno;
+
+	return 0;
+}
+
+int ctl_probe_run(struct ctl_probe *probe, const char *cache, bool refresh)
+{
+	GError *err = NULL;
+	char *path;
+	int r;
+
+	if (!probe)
+		return cli_EINVAL();
+
+	if (!gst_init_check(NULL, NULL, &err)) {
+		cli_error("cannot initialize GStreamer: %s", err->message);
+		g_error_free(err);
+		return -EIO;
+	}
+
+	path = probe_cache_path(cache);
+
+	if (!refresh) {
+		r = probe_load(probe, path);
+		if (r >= 0) {
+			cli_debug("probe: using cached results from %s", path);
+			goto out;
+		}
+	}
+
+	cli_notice("benchmarking H.264 decoders, this takes a moment");
+
+	r = probe_benchmark(probe);
+	if (r < 0)
+		goto out;
+
+	r = probe_save(probe, path);
+	if (r < 0)
+		cli_warning("cannot write decoder probe cache %s (%d)", path, r);
+	r = 0;
+
+out:
+	g_free(path);
+	return r;
+}
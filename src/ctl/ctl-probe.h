@@ -0,0 +1,73 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Decoder Probe
+ * Measures how fast the H.264 decoders GStreamer offers on this machine
+ * really are. Each decoder gets a synthetic stream at a small and a large
+ * resolution, and we fit decode time per frame as a fixed cost plus a cost
+ * per pixel. That is enough to estimate the sustainable frame rate of any
+ * mode of the WFD resolution tables. The fastest decoder and its model are
+ * cached on disk, keyed by the GStreamer version, so the benchmark only
+ * runs once. Only available if built with ENABLE_GST_PLAYER.
+ */
+
+#ifndef CTL_PROBE_H
+#define CTL_PROBE_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct ctl_probe {
+	char decoder[64];
+
+	/* decode time per frame is base + pixels * per_pixel, in nsec */
+	double base;
+	double per_pixel;
+};
+
+/* frames per second @probe decodes at the given resolution */
+static inline unsigned int ctl_probe_fps(const struct ctl_probe *probe,
+					 int hres,
+					 int vres)
+{
+	double t;
+
+	t = probe->base + probe->per_pixel * hres * vres;
+	if (t <= 0)
+		return 0;
+
+	return 1000000000.0 / t;
+}
+
+#ifdef ENABLE_GST_PLAYER
+
+int ctl_probe_run(struct ctl_probe *probe, const char *cache, bool refresh);
+
+#else /* ENABLE_GST_PLAYER */
+
+static inline int ctl_probe_run(struct ctl_probe *probe,
+				const char *cache,
+				bool refresh)
+{
+	return -EOPNOTSUPP;
+}
+
+#endif /* ENABLE_GST_PLAYER */
+
+#endif /* CTL_PROBE_H */
@@ -0,0 +1,653 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <systemd/sd-event.h>
+#include <time.h>
+#include <unistd.h>
+#include "ctl.h"
+#include "ctl-rtp.h"
+#include "rtp.h"
+#include "shl_macro.h"
+#include "shl_util.h"
+
+#define CTL_RTP_CMSG_SIZE \
+	(CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)))
+
+struct ctl_rtp {
+	sd_event *event;
+	int port;
+	int fd;
+	sd_event_source *fd_source;
+	struct sockaddr_in sender;
+	bool have_sender;
+
+	int rtcp_fd;
+	sd_event_source *rtcp_source;
+	sd_event_source *rtcp_timer;
+	unsigned int rtcp_interval;
+	struct sockaddr_in rtcp_peer;
+	bool have_rtcp_peer;
+	uint32_t ssrc;
+
+	int relay_fd;
+	struct sockaddr_in relay_addr;
+
+	ctl_rtp_consumer_fn consumer;
+	void *consumer_data;
+
+	int ring_fd;
+	uint8_t *ring;
+	struct ctl_rtp_slot slots[CTL_RTP_SLOTS];
+	unsigned int head;
+
+	struct ctl_rtp_stats stats;
+	uint32_t kernel_drops_base;
+	uint32_t kernel_drops_last;
+};
+
+static uint64_t rtp_parse_cmsg(struct ctl_rtp *rtp, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	struct timespec ts;
+	uint64_t arrival = 0;
+	uint32_t drops;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			arrival = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+		} else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+			rtp->kernel_drops_last = drops;
+		}
+	}
+
+	/* no kernel timestamp, the next best thing is now */
+	if (!arrival)
+		arrival = shl_now(CLOCK_REALTIME);
+
+	return arrival;
+}
+
+static void rtp_relay(struct ctl_rtp *rtp,
+		      struct mmsghdr *msgs,
+		      struct iovec *iov,
+		      unsigned int n)
+{
+	unsigned int i;
+	int r;
+
+	for (i = 0; i < n; ++i) {
+		iov[i].iov_len = msgs[i].msg_len;
+		msgs[i].msg_hdr.msg_name = &rtp->relay_addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(rtp->relay_addr);
+		msgs[i].msg_hdr.msg_control = NULL;
+		msgs[i].msg_hdr.msg_controllen = 0;
+	}
+
+	/* loopback never blocks for long, if it does the player is stuck */
+	r = sendmmsg(rtp->relay_fd, msgs, n, MSG_DONTWAIT);
+	if (r < 0 && errno != EAGAIN && errno != ECONNREFUSED)
+		cli_debug("cannot relay RTP packets (%d): %m", errno);
+}
+
+/*
+ * Spill slot for when the consumer holds every slot of the ring. With a few
+ * hundred ms in the jitterbuffer that is normal at high bitrates, so the
+ * packet is copied to the heap instead of being dropped.
+ */
+static struct ctl_rtp_slot *rtp_slot_new(void)
+{
+	struct ctl_rtp_slot *slot;
+
+	slot = malloc(sizeof(*slot) + CTL_RTP_SLOT_SIZE);
+	if (!slot)
+		return NULL;
+
+	memset(slot, 0, sizeof(*slot));
+	slot->data = (uint8_t*)(slot + 1);
+	slot->heap = true;
+
+	return slot;
+}
+
+static int rtp_io_fn(sd_event_source *source,
+		     int fd,
+		     uint32_t mask,
+		     void *data)
+{
+	struct ctl_rtp *rtp = data;
+	struct mmsghdr msgs[CTL_RTP_BATCH];
+	struct iovec iov[CTL_RTP_BATCH];
+	union {
+		char buf[CTL_RTP_CMSG_SIZE];
+		struct cmsghdr align;
+	} ctrl[CTL_RTP_BATCH];
+	struct sockaddr_in addrs[CTL_RTP_BATCH];
+	struct ctl_rtp_slot *batch[CTL_RTP_BATCH];
+	struct ctl_rtp_slot *slot, spill = { };
+	uint8_t scratch[CTL_RTP_SLOT_SIZE];
+	struct rtp_hdr h;
+	uint64_t bursts;
+	unsigned int i, n, used;
+	int r;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (n = 0; n < CTL_RTP_BATCH; ++n) {
+		slot = &rtp->slots[(rtp->head + n) % CTL_RTP_SLOTS];
+		if (__atomic_load_n(&slot->busy, __ATOMIC_ACQUIRE))
+			break;
+
+		batch[n] = slot;
+	}
+
+	used = n;
+	if (!n) {
+		/* out of memory, the packet is drained and dropped, but it
+		 * still goes into the statistics so that our own drop is
+		 * not taken for network loss and answered with an IDR */
+		batch[0] = rtp_slot_new();
+		if (!batch[0]) {
+			spill.data = scratch;
+			batch[0] = &spill;
+		}
+		n = 1;
+	}
+
+	for (i = 0; i < n; ++i) {
+		iov[i].iov_base = batch[i]->data;
+		iov[i].iov_len = CTL_RTP_SLOT_SIZE;
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = ctrl[i].buf;
+		msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i].buf);
+	}
+
+	r = recvmmsg(fd, msgs, n, MSG_DONTWAIT, NULL);
+	if (r < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			cli_debug("cannot receive RTP packets (%d): %m", errno);
+		if (!used && batch[0]->heap)
+			free(batch[0]);
+		return 0;
+	}
+
+	n = r;
+	rtp->sender = addrs[n - 1];
+	rtp->have_sender = true;
+	++rtp->stats.batches;
+	rtp->stats.packets += n;
+	bursts = rtp->stats.rtp.bursts;
+
+	for (i = 0; i < n; ++i) {
+		slot = batch[i];
+		slot->len = msgs[i].msg_len;
+		slot->arrival = rtp_parse_cmsg(rtp, &msgs[i].msg_hdr);
+
+		if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ||
+		    rtp_parse_header(&h, slot->data, slot->len) < 0) {
+			++rtp->stats.invalid;
+			continue;
+		}
+
+		rtp_stats_update(&rtp->stats.rtp, &h, slot->len,
+				 slot->arrival);
+	}
+
+	rtp->stats.kernel_drops = rtp->kernel_drops_last -
+				  rtp->kernel_drops_base;
+
+	/* the player sees the hole only once the jitterbuffer gives up */
+	if (rtp->stats.rtp.bursts > bursts)
+		ctl_fn_rtp_loss(rtp, rtp->stats.rtp.bursts - bursts);
+
+	if (rtp->relay_fd >= 0)
+		rtp_relay(rtp, msgs, iov, n);
+
+	if (batch[0] == &spill) {
+		++rtp->stats.spill_drops;
+		return 0;
+	}
+
+	if (!used)
+		++rtp->stats.overruns;
+
+	if (rtp->consumer) {
+		for (i = 0; i < n; ++i) {
+			slot = batch[i];
+			__atomic_store_n(&slot->busy, 1, __ATOMIC_RELAXED);
+			rtp->consumer(rtp, slot, rtp->consumer_data);
+		}
+	} else if (!used) {
+		free(batch[0]);
+	}
+
+	rtp->head += used;
+	return 0;
+}
+
+static void rtp_send_rr(struct ctl_rtp *rtp)
+{
+	struct sockaddr_in addr;
+	struct rtcp_rr rr;
+	uint8_t buf[128];
+	int r;
+
+	/* we learn where the source is from its packets */
+	if (rtp->have_rtcp_peer) {
+		addr = rtp->rtcp_peer;
+	} else if (rtp->have_sender) {
+		addr = rtp->sender;
+		addr.sin_port = htons(ntohs(addr.sin_port) + 1);
+	} else {
+		return;
+	}
+
+	rtp_stats_fill_rr(&rtp->stats.rtp, &rr, shl_now(CLOCK_MONOTONIC));
+	r = rtcp_build_rr(buf, sizeof(buf), rtp->ssrc,
+			  rtp->stats.rtp.valid ? &rr : NULL, CTL_RTP_CNAME);
+	if (r < 0)
+		return cli_vERR(r);
+
+	r = sendto(rtp->rtcp_fd, buf, r, MSG_DONTWAIT,
+		   (struct sockaddr*)&addr, sizeof(addr));
+	if (r < 0)
+		cli_debug("cannot send RTCP receiver report (%d): %m", errno);
+	else
+		++rtp->stats.rtcp_sent;
+}
+
+static void rtp_schedule_rr(struct ctl_rtp *rtp)
+{
+	uint64_t t;
+
+	/* RFC 3550 6.3.1, randomized to [0.5, 1.5] times the interval */
+	t = rtp->rtcp_interval * 1000ULL;
+	t = t / 2 + (uint64_t)rand() % (t + 1);
+
+	sd_event_source_set_time(rtp->rtcp_timer,
+				 shl_now(CLOCK_MONOTONIC) + t);
+	sd_event_source_set_enabled(rtp->rtcp_timer, SD_EVENT_ONESHOT);
+}
+
+static int rtp_rtcp_timer_fn(sd_event_source *source,
+			     uint64_t usec,
+			     void *data)
+{
+	struct ctl_rtp *rtp = data;
+
+	rtp_send_rr(rtp);
+	rtp_schedule_rr(rtp);
+
+	return 0;
+}
+
+static int rtp_rtcp_io_fn(sd_event_source *source,
+			  int fd,
+			  uint32_t mask,
+			  void *data)
+{
+	struct ctl_rtp *rtp = data;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	uint8_t buf[1500];
+	uint32_t ssrc, lsr;
+	ssize_t l;
+	int r;
+
+	l = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT,
+		     (struct sockaddr*)&addr, &len);
+	if (l < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			cli_debug("cannot receive RTCP (%d): %m", errno);
+		return 0;
+	}
+
+	r = rtcp_parse_sr(buf, l, &ssrc, &lsr);
+	if (r < 0)
+		return 0;
+
+	/* reports for a stream we don't see are useless */
+	if (rtp->stats.rtp.valid && ssrc != rtp->stats.rtp.ssrc)
+		return 0;
+
+	rtp_stats_handle_sr(&rtp->stats.rtp, lsr, shl_now(CLOCK_MONOTONIC));
+	rtp->rtcp_peer = addr;
+	rtp->have_rtcp_peer = true;
+	++rtp->stats.rtcp_sr;
+
+	return 0;
+}
+
+static void rtp_close_rtcp(struct ctl_rtp *rtp)
+{
+	if (rtp->rtcp_timer) {
+		sd_event_source_set_enabled(rtp->rtcp_timer, SD_EVENT_OFF);
+		sd_event_source_unref(rtp->rtcp_timer);
+		rtp->rtcp_timer = NULL;
+	}
+
+	if (rtp->rtcp_source) {
+		sd_event_source_set_enabled(rtp->rtcp_source, SD_EVENT_OFF);
+		sd_event_source_unref(rtp->rtcp_source);
+		rtp->rtcp_source = NULL;
+	}
+
+	if (rtp->rtcp_fd >= 0) {
+		close(rtp->rtcp_fd);
+		rtp->rtcp_fd = -1;
+	}
+
+	rtp->rtcp_interval = 0;
+	rtp->have_rtcp_peer = false;
+}
+
+static int rtp_open_rtcp(struct ctl_rtp *rtp)
+{
+	struct sockaddr_in addr = { };
+	int r;
+
+	rtp->rtcp_fd = socket(AF_INET,
+			      SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			      0);
+	if (rtp->rtcp_fd < 0)
+		return cli_ERRNO();
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(rtp->port + 1);
+	r = bind(rtp->rtcp_fd, (struct sockaddr*)&addr, sizeof(addr));
+	if (r < 0)
+		return cli_ERRNO();
+
+	r = sd_event_add_io(rtp->event,
+			    &rtp->rtcp_source,
+			    rtp->rtcp_fd,
+			    EPOLLIN,
+			    rtp_rtcp_io_fn,
+			    rtp);
+	if (r < 0)
+		return cli_ERR(r);
+
+	r = sd_event_add_time(rtp->event,
+			      &rtp->rtcp_timer,
+			      CLOCK_MONOTONIC,
+			      0,
+			      0,
+			      rtp_rtcp_timer_fn,
+			      rtp);
+	if (r < 0)
+		return cli_ERR(r);
+
+	return 0;
+}
+
+static int rtp_open(struct ctl_rtp *rtp, int port, unsigned int rcvbuf)
+{
+	struct sockaddr_in addr = { };
+	socklen_t len;
+	int r, v;
+
+	rtp->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (rtp->fd < 0)
+		return cli_ERRNO();
+
+	/* we run as root, so go past rmem_max if we have to */
+	v = rcvbuf;
+	r = setsockopt(rtp->fd, SOL_SOCKET, SO_RCVBUFFORCE, &v, sizeof(v));
+	if (r < 0)
+		setsockopt(rtp->fd, SOL_SOCKET, SO_RCVBUF, &v, sizeof(v));
+
+	len = sizeof(v);
+	r = getsockopt(rtp->fd, SOL_SOCKET, SO_RCVBUF, &v, &len);
+	if (r >= 0)
+		rtp->stats.rcvbuf = v;
+
+	v = 1;
+	r = setsockopt(rtp->fd, SOL_SOCKET, SO_TIMESTAMPNS, &v, sizeof(v));
+	if (r < 0)
+		cli_debug("no kernel timestamps for RTP (%d): %m", errno);
+
+	v = 1;
+	r = setsockopt(rtp->fd, SOL_SOCKET, SO_RXQ_OVFL, &v, sizeof(v));
+	if (r < 0)
+		cli_debug("no drop counter for RTP (%d): %m", errno);
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	r = bind(rtp->fd, (struct sockaddr*)&addr, sizeof(addr));
+	if (r < 0)
+		return cli_ERRNO();
+
+	return 0;
+}
+
+static int rtp_map_ring(struct ctl_rtp *rtp)
+{
+	size_t size = (size_t)CTL_RTP_SLOTS * CTL_RTP_SLOT_SIZE;
+	void *mem;
+	unsigned int i;
+
+	rtp->ring_fd = memfd_create("miracle-rtp", MFD_CLOEXEC);
+	if (rtp->ring_fd < 0)
+		return cli_ERRNO();
+
+	if (ftruncate(rtp->ring_fd, size) < 0)
+		return cli_ERRNO();
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   rtp->ring_fd, 0);
+	if (mem == MAP_FAILED)
+		return cli_ERRNO();
+
+	rtp->ring = mem;
+	for (i = 0; i < CTL_RTP_SLOTS; ++i)
+		rtp->slots[i].data = rtp->ring + i * CTL_RTP_SLOT_SIZE;
+
+	return 0;
+}
+
+int ctl_rtp_new(struct ctl_rtp **out,
+		sd_event *event,
+		int port,
+		unsigned int rcvbuf)
+{
+	struct ctl_rtp *rtp;
+	int r;
+
+	/* RTCP goes on the port above */
+	if (!out || !event || port <= 0 || port >= 65535)
+		return cli_EINVAL();
+
+	rtp = calloc(1, sizeof(*rtp));
+	if (!rtp)
+		return cli_ENOMEM();
+
+	rtp->event = sd_event_ref(event);
+	rtp->port = port;
+	rtp->fd = -1;
+	rtp->rtcp_fd = -1;
+	rtp->relay_fd = -1;
+	rtp->ring_fd = -1;
+	rtp_stats_init(&rtp->stats.rtp, RTP_MP2T_CLOCK_RATE);
+
+	r = rtp_map_ring(rtp);
+	if (r < 0)
+		goto error;
+
+	r = rtp_open(rtp, port, rcvbuf ? : CTL_RTP_DEFAULT_RCVBUF);
+	if (r < 0)
+		goto error;
+
+	r = sd_event_add_io(rtp->event,
+			    &rtp->fd_source,
+			    rtp->fd,
+			    EPOLLIN,
+			    rtp_io_fn,
+			    rtp);
+	if (r < 0)
+		goto error;
+
+	*out = rtp;
+	return 0;
+
+error:
+	ctl_rtp_free(rtp);
+	return r;
+}
+
+void ctl_rtp_free(struct ctl_rtp *rtp)
+{
+	if (!rtp)
+		return;
+
+	rtp_close_rtcp(rtp);
+
+	if (rtp->fd_source) {
+		sd_event_source_set_enabled(rtp->fd_source, SD_EVENT_OFF);
+		sd_event_source_unref(rtp->fd_source);
+	}
+
+	if (rtp->fd >= 0)
+		close(rtp->fd);
+	if (rtp->relay_fd >= 0)
+		close(rtp->relay_fd);
+	if (rtp->ring)
+		munmap(rtp->ring, (size_t)CTL_RTP_SLOTS * CTL_RTP_SLOT_SIZE);
+	if (rtp->ring_fd >= 0)
+		close(rtp->ring_fd);
+
+	sd_event_unref(rtp->event);
+	free(rtp);
+}
+
+int ctl_rtp_set_relay(struct ctl_rtp *rtp, int port)
+{
+	int fd;
+
+	if (!rtp || port < 0 || port > 65535)
+		return cli_EINVAL();
+
+	if (rtp->relay_fd >= 0) {
+		close(rtp->relay_fd);
+		rtp->relay_fd = -1;
+	}
+
+	if (!port)
+		return 0;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return cli_ERRNO();
+
+	memset(&rtp->relay_addr, 0, sizeof(rtp->relay_addr));
+	rtp->relay_addr.sin_family = AF_INET;
+	rtp->relay_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	rtp->relay_addr.sin_port = htons(port);
+	rtp->relay_fd = fd;
+
+	return 0;
+}
+
+void ctl_rtp_set_consumer(struct ctl_rtp *rtp,
+			  ctl_rtp_consumer_fn fn,
+			  void *data)
+{
+	if (!rtp)
+		return;
+
+	rtp->consumer = fn;
+	rtp->consumer_data = data;
+}
+
+void ctl_rtp_release(struct ctl_rtp_slot *slot)
+{
+	if (slot->heap)
+		free(slot);
+	else
+		__atomic_store_n(&slot->busy, 0, __ATOMIC_RELEASE);
+}
+
+/* send receiver reports every @interval ms, 0 turns RTCP off */
+int ctl_rtp_set_rtcp(struct ctl_rtp *rtp, unsigned int interval)
+{
+	int r;
+
+	if (!rtp)
+		return cli_EINVAL();
+
+	if (!interval) {
+		rtp_close_rtcp(rtp);
+		return 0;
+	}
+
+	if (rtp->rtcp_fd < 0) {
+		r = rtp_open_rtcp(rtp);
+		if (r < 0) {
+			rtp_close_rtcp(rtp);
+			return r;
+		}
+
+		rtp->ssrc = rand() ^ (uint32_t)shl_now(CLOCK_REALTIME) ^
+			    ((uint32_t)getpid() << 16);
+	}
+
+	rtp->rtcp_interval = interval;
+	rtp_schedule_rr(rtp);
+
+	return 0;
+}
+
+void ctl_rtp_reset(struct ctl_rtp *rtp)
+{
+	unsigned int rcvbuf;
+
+	if (!rtp)
+		return;
+
+	rcvbuf = rtp->stats.rcvbuf;
+	memset(&rtp->stats, 0, sizeof(rtp->stats));
+	rtp_stats_init(&rtp->stats.rtp, RTP_MP2T_CLOCK_RATE);
+	rtp->stats.rcvbuf = rcvbuf;
+	rtp->kernel_drops_base = rtp->kernel_drops_last;
+	rtp->have_sender = false;
+	rtp->have_rtcp_peer = false;
+}
+
+void ctl_rtp_get_stats(struct ctl_rtp *rtp, struct ctl_rtp_stats *st)
+{
+	if (!rtp || !st)
+		return;
+
+	*st = rtp->stats;
+}
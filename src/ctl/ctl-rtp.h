@@ -0,0 +1,103 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTP Receiver
+ * Owns the RTP port of the sink, so we see every packet before the player
+ * does. Packets are read in batches with recvmmsg() straight into the slots
+ * of a ring in a memfd, together with their kernel receive timestamp, and
+ * fed into the RTP statistics. If the consumer holds every slot, packets go
+ * to slots on the heap until it catches up.
+ * From there they either go to an in-process consumer, which owns the slot
+ * until it calls ctl_rtp_release() (from any thread), or are relayed to a
+ * local UDP port an external player listens on.
+ * With RTCP enabled, the port above the RTP port takes sender reports and
+ * we send receiver reports from the statistics back to the source.
+ */
+
+#ifndef CTL_RTP_H
+#define CTL_RTP_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <systemd/sd-event.h>
+#include "rtp.h"
+
+#define CTL_RTP_SLOT_SIZE 2048
+#define CTL_RTP_SLOTS 1024
+#define CTL_RTP_BATCH 32
+#define CTL_RTP_DEFAULT_RCVBUF (4 * 1024 * 1024)
+#define CTL_RTP_CNAME "miracle-sink"
+
+struct ctl_rtp;
+
+struct ctl_rtp_slot {
+	uint8_t *data;
+	size_t len;
+	/* kernel receive time, CLOCK_REALTIME in usec */
+	uint64_t arrival;
+	/* set while a consumer owns the slot */
+	int busy;
+	/* not part of the ring, freed by ctl_rtp_release() */
+	bool heap;
+};
+
+struct ctl_rtp_stats {
+	struct rtp_stats rtp;
+
+	uint64_t packets;
+	uint64_t batches;
+	uint64_t invalid;
+	/* copied to the heap as the consumer held every slot of the ring */
+	uint64_t overruns;
+	/* dropped as not even that copy could be allocated */
+	uint64_t spill_drops;
+	/* dropped by the kernel as the socket buffer was full */
+	uint64_t kernel_drops;
+	unsigned int rcvbuf;
+
+	uint64_t rtcp_sent;
+	uint64_t rtcp_sr;
+};
+
+typedef void (*ctl_rtp_consumer_fn) (struct ctl_rtp *rtp,
+				     struct ctl_rtp_slot *slot,
+				     void *data);
+
+int ctl_rtp_new(struct ctl_rtp **out,
+		sd_event *event,
+		int port,
+		unsigned int rcvbuf);
+void ctl_rtp_free(struct ctl_rtp *rtp);
+
+int ctl_rtp_set_relay(struct ctl_rtp *rtp, int port);
+void ctl_rtp_set_consumer(struct ctl_rtp *rtp,
+			  ctl_rtp_consumer_fn fn,
+			  void *data);
+void ctl_rtp_release(struct ctl_rtp_slot *slot);
+int ctl_rtp_set_rtcp(struct ctl_rtp *rtp, unsigned int interval);
+
+void ctl_rtp_reset(struct ctl_rtp *rtp);
+void ctl_rtp_get_stats(struct ctl_rtp *rtp, struct ctl_rtp_stats *st);
+
+/* callback functions */
+
+/* called once per batch that opened new gaps in the sequence space */
+void ctl_fn_rtp_loss(struct ctl_rtp *rtp, unsigned int bursts);
+
+#endif /* CTL_RTP_H */
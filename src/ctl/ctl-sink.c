@@ -18,6 +18,7 @@
  */
 
 #include "ctl-sink.h"
+#include "shl_trace.h"
 
 /*
  * RTSP Session
@@ -35,6 +36,8 @@ static void sink_handle_options(struct ctl_sink *s,
 	_rtsp_message_unref_ struct rtsp_message *rep = NULL;
 	int r;
 
+	SHL_TRACE(rtsp_m1, s->target);
+
 	r = rtsp_message_new_reply_for(m, &rep, RTSP_CODE_OK, NULL);
 	if (r < 0)
 		return cli_vERR(r);
@@ -74,6 +77,8 @@ static void sink_handle_options(struct ctl_sink *s,
 	r = rtsp_call_async(s->rtsp, rep, sink_req_fn, NULL, 0, NULL);
 	if (r < 0)
 		return cli_vERR(r);
+
+	SHL_TRACE(rtsp_m2, s->target);
 }
 
 static void sink_handle_get_parameter(struct ctl_sink *s,
@@ -82,6 +87,8 @@ static void sink_handle_get_parameter(struct ctl_sink *s,
     _rtsp_message_unref_ struct rtsp_message *rep = NULL;
     int r;
 
+    SHL_TRACE(rtsp_m3, s->target);
+
     r = rtsp_message_new_reply_for(m, &rep, RTSP_CODE_OK, NULL);
     if (r < 0)
         return cli_vERR(r);
@@ -140,10 +147,15 @@ static void sink_handle_get_parameter(struct ctl_sink *s,
 
     /* wfd_uibc_capability */
     if (uibc_option) {
-        gchar* wfd_uibc_capability = "input_category_list=GENERIC;"
-                                     "generic_cap_list=Mouse,SingleTouch;"
-                                     "hidc_cap_list=none;"
-                                     "port=none";
+        gchar uibc_capability[512];
+        gchar* wfd_uibc_capability = uibc_capability;
+        snprintf(uibc_capability, sizeof(uibc_capability),
+                 "input_category_list=GENERIC%s;"
+                 "generic_cap_list=Mouse,SingleTouch;"
+                 "hidc_cap_list=%s;"
+                 "port=none",
+                 uibc_hidc_cap_list ? ", HIDC" : "",
+                 uibc_hidc_cap_list ? : "none");
         if (protocol_extensions != NULL) {
             gchar* wfd_uibc_capability_extension = g_hash_table_lookup(protocol_extensions, WFD_UIBC_CAPABILITY);
             if (wfd_uibc_capability_extension != NULL) {
@@ -208,6 +220,7 @@ static int sink_setup_fn(struct rtsp *bus, struct rtsp_message *m, void *data)
 	if (r < 0)
 		return cli_ERR(r);
 
+	SHL_TRACE(rtsp_m7, s->target);
 	return 0;
 }
 
@@ -216,14 +229,15 @@ static int sink_set_format(struct ctl_sink *s,
 					  unsigned int vesa_res,
 					  unsigned int hh_res)
 {
-	int hres, vres;
+	int hres, vres, fps;
 
-	if ((vfd_get_cea_resolution(cea_res, &hres, &vres) == 0) ||
-		(vfd_get_vesa_resolution(vesa_res, &hres, &vres) == 0) ||
-		(vfd_get_hh_resolution(hh_res, &hres, &vres) == 0)) {
+	if ((vfd_get_cea_resolution(cea_res, &hres, &vres, &fps) == 0) ||
+		(vfd_get_vesa_resolution(vesa_res, &hres, &vres, &fps) == 0) ||
+		(vfd_get_hh_resolution(hh_res, &hres, &vres, &fps) == 0)) {
 		if (hres && vres) {
 			s->hres = hres;
 			s->vres = vres;
+			s->fps = fps;
 			ctl_fn_sink_resolution_set(s);
 			return 0;
 		}
@@ -319,6 +333,7 @@ static void sink_handle_set_parameter(struct ctl_sink *s,
 	r = rtsp_message_read(m, "{<****hhh>}", "wfd_video_formats",
 							&cea_res, &vesa_res, &hh_res);
 	if (r == 0) {
+		SHL_TRACE(rtsp_m4, s->target);
 		r = sink_set_format(s, cea_res, vesa_res, hh_res);
 		if (r)
 			return cli_vERR(r);
@@ -330,6 +345,8 @@ static void sink_handle_set_parameter(struct ctl_sink *s,
 		return;
 
 	if (!strcmp(trigger, "SETUP")) {
+		SHL_TRACE(rtsp_m5, s->target);
+
 		if (!s->url) {
 			cli_error("No valid wfd_presentation_URL\n");
 			return;
@@ -343,7 +360,11 @@ static void sink_handle_set_parameter(struct ctl_sink *s,
 			return cli_vERR(r);
 
 		char rtsp_setup[128];
-		sprintf(rtsp_setup, "RTP/AVP/UDP;unicast;client_port=%d", rstp_port);
+		if (rtcp_port)
+			sprintf(rtsp_setup, "RTP/AVP/UDP;unicast;client_port=%d-%d",
+				rstp_port, rtcp_port);
+		else
+			sprintf(rtsp_setup, "RTP/AVP/UDP;unicast;client_port=%d", rstp_port);
 		r = rtsp_message_append(rep, "<s>", "Transport", rtsp_setup);
 		if (r < 0)
 			return cli_vERR(r);
@@ -354,6 +375,8 @@ static void sink_handle_set_parameter(struct ctl_sink *s,
 		r = rtsp_call_async(s->rtsp, rep, sink_setup_fn, s, 0, NULL);
 		if (r < 0)
 			return cli_vERR(r);
+
+		SHL_TRACE(rtsp_m6, s->target);
 	}
 }
 
@@ -439,6 +462,7 @@ static void sink_connected(struct ctl_sink *s)
 		goto error;
 
 	s->connected = true;
+	SHL_TRACE(sink_connected, s->target);
 	ctl_fn_sink_connected(s);
 	return;
 
@@ -532,6 +556,7 @@ static void sink_close(struct ctl_sink *s)
 	s->fd = -1;
 	s->connected = false;
 	s->hup = false;
+	s->idr_pending = false;
 }
 
 /*
@@ -611,6 +636,65 @@ void ctl_sink_close(struct ctl_sink *s)
 	sink_close(s);
 }
 
+static int sink_idr_fn(struct rtsp *bus, struct rtsp_message *m, void *data)
+{
+	struct ctl_sink *s = data;
+
+	s->idr_pending = false;
+	if (!m)
+		return 0;
+
+	cli_debug("INCOMING: %s\n", rtsp_message_get_raw(m));
+	if (rtsp_message_get_code(m) != RTSP_CODE_OK)
+		cli_debug("source refused IDR request (%u)",
+			  rtsp_message_get_code(m));
+
+	return 0;
+}
+
+/*
+ * Ask the source for an IDR picture (M13). Only one request is kept in
+ * flight, everything else is up to the caller.
+ */
+int ctl_sink_request_idr(struct ctl_sink *s)
+{
+	_rtsp_message_unref_ struct rtsp_message *rep = NULL;
+	int r;
+
+	if (!s)
+		return cli_EINVAL();
+	if (!s->connected || !s->session || !s->url)
+		return -ENOTCONN;
+	if (s->idr_pending)
+		return -EALREADY;
+
+	r = rtsp_message_new_request(s->rtsp,
+				     &rep,
+				     "SET_PARAMETER",
+				     s->url);
+	if (r < 0)
+		return cli_ERR(r);
+
+	r = rtsp_message_append(rep, "<s>", "Session", s->session);
+	if (r < 0)
+		return cli_ERR(r);
+
+	r = rtsp_message_append(rep, "{&}", "wfd_idr_request");
+	if (r < 0)
+		return cli_ERR(r);
+
+	rtsp_message_seal(rep);
+	cli_debug("OUTGOING: %s\n", rtsp_message_get_raw(rep));
+
+	r = rtsp_call_async(s->rtsp, rep, sink_idr_fn, s, 0, NULL);
+	if (r < 0)
+		return cli_ERR(r);
+
+	s->idr_pending = true;
+	++s->idr_requests;
+	return 0;
+}
+
 bool ctl_sink_is_connecting(struct ctl_sink *s)
 {
 	return s && s->fd >= 0 && !s->connected;
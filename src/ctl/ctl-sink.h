@@ -45,9 +45,14 @@
 #define WFD_UIBC_CAPABILITY "wfd_uibc_capability"
 
 extern int rstp_port;
+extern int rtcp_port;
 extern bool uibc_option;
 extern bool uibc_enabled;
 extern int uibc_port;
+/* HIDC capabilities of our HID devices, NULL without any */
+extern char *uibc_hidc_cap_list;
+
+#define UIBC_MAX_HID 8
 
 struct ctl_sink {
     sd_event *event;
@@ -66,6 +71,9 @@ struct ctl_sink {
 
     bool connected : 1;
     bool hup : 1;
+    bool idr_pending : 1;
+
+    uint64_t idr_requests;
 
     uint32_t resolutions_cea;
     uint32_t resolutions_vesa;
@@ -73,6 +81,7 @@ struct ctl_sink {
 
     int hres;
     int vres;
+    int fps;
 
     GHashTable* protocol_extensions;
 };
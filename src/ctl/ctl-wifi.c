@@ -17,29 +17,168 @@
  * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <ctype.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <systemd/sd-bus.h>
 #include "ctl.h"
 #include "shl_dlist.h"
+#include "shl_htable.h"
 #include "shl_macro.h"
 #include "shl_util.h"
 #include "util.h"
 
+/*
+ * Indexes
+ * Links and peers are looked up by the user on every command and by the
+ * signal handlers on every event. Each lookup key gets a case-insensitive
+ * htable which stores pointers to the key-member of the object. Keys are
+ * unique in an index: if several objects share a key, the one linked first
+ * is indexed and the next one is promoted once it goes away. Keys are only
+ * indexed while their object is linked.
+ */
+
+static bool ctl_index_compare(const void *a, const void *b)
+{
+	return !strcasecmp(*(char**)a, *(char**)b);
+}
+
+/* DJB's hash function on lower-case characters */
+static size_t ctl_index_rehash(const void *elem, void *priv)
+{
+	const char *str = *(char**)elem;
+	size_t hash = 5381;
+
+	for ( ; *str; ++str)
+		hash = (hash << 5) + hash + (size_t)tolower((unsigned char)*str);
+
+	return hash;
+}
+
+static void ctl_index_init(struct shl_htable *ht)
+{
+	shl_htable_init(ht, ctl_index_compare, ctl_index_rehash, NULL);
+}
+
+static void *ctl_index_lookup(struct shl_htable *ht,
+			      size_t key_off,
+			      const char *key)
+{
+	char **elem;
+
+	if (!shl_htable_lookup(ht, (const void*)&key,
+			       ctl_index_rehash(&key, NULL), (void**)&elem))
+		return NULL;
+
+	return (char*)elem - key_off;
+}
+
+static void ctl_index_add(struct shl_htable *ht, char **key)
+{
+	size_t hash;
+	int r;
+
+	if (!*key)
+		return;
+
+	hash = ctl_index_rehash(key, NULL);
+	if (shl_htable_lookup(ht, key, hash, NULL))
+		return;
+
+	r = shl_htable_insert(ht, key, hash);
+	if (r < 0)
+		cli_vENOMEM();
+}
+
+static void ctl_index_remove(struct shl_htable *ht,
+			     char **key,
+			     struct shl_dlist *list,
+			     size_t list_off,
+			     size_t key_off)
+{
+	struct shl_dlist *i;
+	char **elem, **k;
+	size_t hash;
+
+	if (!*key)
+		return;
+
+	hash = ctl_index_rehash(key, NULL);
+	if (!shl_htable_lookup(ht, key, hash, (void**)&elem) || elem != key)
+		return;
+
+	shl_htable_remove(ht, key, hash, NULL);
+
+	/* promote the next object with the same key, if any */
+	shl_dlist_for_each(i, list) {
+		k = (char**)((char*)i - list_off + key_off);
+		if (k != key && *k && !strcasecmp(*k, *key)) {
+			if (shl_htable_insert(ht, k, hash) < 0)
+				cli_vENOMEM();
+			break;
+		}
+	}
+}
+
 /*
  * Peers
  */
 
+static void ctl_peer_index_key(struct ctl_peer *p,
+			       struct shl_htable *ht,
+			       char **key,
+			       bool add)
+{
+	if (add)
+		ctl_index_add(ht, key);
+	else
+		ctl_index_remove(ht, key, &p->l->peers,
+				 offsetof(struct ctl_peer, list),
+				 (char*)key - (char*)p);
+}
+
+static void ctl_peer_index(struct ctl_peer *p, bool add)
+{
+	ctl_peer_index_key(p, &p->l->peers_by_label, &p->label, add);
+	ctl_peer_index_key(p, &p->l->peers_by_mac, &p->label_mac, add);
+	ctl_peer_index_key(p, &p->l->peers_by_name, &p->friendly_name, add);
+	ctl_peer_index_key(p, &p->l->peers_by_interface, &p->interface, add);
+}
+
+/* replace an indexed string property, takes ownership of @val */
+static void ctl_peer_set_key(struct ctl_peer *p,
+			     struct shl_htable *ht,
+			     char **key,
+			     char *val)
+{
+	bool linked = shl_dlist_linked(&p->list);
+
+	if (linked)
+		ctl_peer_index_key(p, ht, key, false);
+
+	free(*key);
+	*key = val;
+
+	if (linked)
+		ctl_peer_index_key(p, ht, key, true);
+}
+
 static void ctl_peer_free(struct ctl_peer *p)
 {
 	if (!p)
 		return;
 
-	if (shl_dlist_linked(&p->list))
-		ctl_fn_peer_free(p);
+	if (shl_dlist_linked(&p->list)) {
+		if (p->visible)
+			ctl_fn_peer_free(p);
+		ctl_peer_index(p, false);
+	}
 
+	free(p->wfd_coupled_sink);
+	free(p->wfd_dev_type);
 	free(p->wfd_subelements);
 	free(p->remote_address);
 	free(p->local_address);
@@ -48,6 +187,7 @@ static void ctl_peer_free(struct ctl_peer *p)
 	free(p->p2p_mac);
 
 	shl_dlist_unlink(&p->list);
+	free(p->label_mac);
 	free(p->label);
 	free(p);
 }
@@ -81,6 +221,13 @@ static int ctl_peer_new(struct ctl_peer **out,
 		goto error;
 	}
 
+	/* peer labels are "<p2p-mac>@<link>" */
+	p->label_mac = strndup(label, strcspn(label, "@"));
+	if (!p->label_mac) {
+		r = cli_ENOMEM();
+		goto error;
+	}
+
 	if (out)
 		*out = p;
 
@@ -91,13 +238,35 @@ error:
 	return r;
 }
 
+/* announce or retract a linked peer if it started/stopped matching */
+static void ctl_peer_update_visible(struct ctl_peer *p)
+{
+	unsigned int filter = p->l->w->wfd_filter;
+	bool visible;
+
+	visible = !filter || (p->wfd_caps & filter);
+	if (visible == p->visible)
+		return;
+
+	p->visible = visible;
+	if (!visible) {
+		ctl_fn_peer_free(p);
+		return;
+	}
+
+	ctl_fn_peer_new(p);
+	if (p->connected)
+		ctl_fn_peer_connected(p);
+}
+
 static void ctl_peer_link(struct ctl_peer *p)
 {
 	if (!p || shl_dlist_linked(&p->list))
 		return;
 
 	shl_dlist_link_tail(&p->l->peers, &p->list);
-	ctl_fn_peer_new(p);
+	ctl_peer_index(p, true);
+	ctl_peer_update_visible(p);
 }
 
 static int ctl_peer_parse_properties(struct ctl_peer *p,
@@ -106,9 +275,14 @@ static int ctl_peer_parse_properties(struct ctl_peer *p,
 	const char *t, *p2p_mac = NULL, *friendly_name = NULL;
 	const char *interface = NULL, *local_address = NULL;
 	const char *remote_address = NULL, *wfd_subelements = NULL;
-	bool connected_set = false;
+	const char *wfd_dev_type = NULL, *wfd_coupled_sink = NULL;
+	bool connected_set = false, wfd_session_available_set = false;
+	bool wfd_rtsp_port_set = false, wfd_max_throughput_set = false;
+	bool wfd_caps_set = false;
+	uint16_t wfd_rtsp_port, wfd_max_throughput;
+	uint32_t wfd_caps;
 	char *tmp;
-	int connected, r;
+	int connected, wfd_session_available, r;
 
 	if (!p || !m)
 		return cli_EINVAL();
@@ -160,6 +334,43 @@ static int ctl_peer_parse_properties(struct ctl_peer *p,
 							   &wfd_subelements);
 			if (r < 0)
 				return cli_log_parser(r);
+		} else if (!strcmp(t, "WfdDeviceType")) {
+			r = bus_message_read_basic_variant(m, "s",
+							   &wfd_dev_type);
+			if (r < 0)
+				return cli_log_parser(r);
+		} else if (!strcmp(t, "WfdSessionAvailable")) {
+			r = bus_message_read_basic_variant(m, "b",
+						&wfd_session_available);
+			if (r < 0)
+				return cli_log_parser(r);
+
+			wfd_session_available_set = true;
+		} else if (!strcmp(t, "WfdRtspPort")) {
+			r = bus_message_read_basic_variant(m, "q",
+							   &wfd_rtsp_port);
+			if (r < 0)
+				return cli_log_parser(r);
+
+			wfd_rtsp_port_set = true;
+		} else if (!strcmp(t, "WfdMaxThroughput")) {
+			r = bus_message_read_basic_variant(m, "q",
+							   &wfd_max_throughput);
+			if (r < 0)
+				return cli_log_parser(r);
+
+			wfd_max_throughput_set = true;
+		} else if (!strcmp(t, "WfdCoupledSink")) {
+			r = bus_message_read_basic_variant(m, "s",
+							   &wfd_coupled_sink);
+			if (r < 0)
+				return cli_log_parser(r);
+		} else if (!strcmp(t, "WfdCapabilities")) {
+			r = bus_message_read_basic_variant(m, "u", &wfd_caps);
+			if (r < 0)
+				return cli_log_parser(r);
+
+			wfd_caps_set = true;
 		} else {
 			sd_bus_message_skip(m, "v");
 		}
@@ -187,22 +398,20 @@ static int ctl_peer_parse_properties(struct ctl_peer *p,
 
 	if (friendly_name) {
 		tmp = strdup(friendly_name);
-		if (tmp) {
-			free(p->friendly_name);
-			p->friendly_name = tmp;
-		} else {
+		if (tmp)
+			ctl_peer_set_key(p, &p->l->peers_by_name,
+					 &p->friendly_name, tmp);
+		else
 			cli_vENOMEM();
-		}
 	}
 
 	if (interface) {
 		tmp = strdup(interface);
-		if (tmp) {
-			free(p->interface);
-			p->interface = tmp;
-		} else {
+		if (tmp)
+			ctl_peer_set_key(p, &p->l->peers_by_interface,
+					 &p->interface, tmp);
+		else
 			cli_vENOMEM();
-		}
 	}
 
 	if (local_address) {
@@ -235,9 +444,47 @@ static int ctl_peer_parse_properties(struct ctl_peer *p,
 		}
 	}
 
+	if (wfd_dev_type) {
+		tmp = strdup(wfd_dev_type);
+		if (tmp) {
+			free(p->wfd_dev_type);
+			p->wfd_dev_type = tmp;
+		} else {
+			cli_vENOMEM();
+		}
+	}
+
+	if (wfd_session_available_set)
+		p->wfd_session_available = wfd_session_available;
+
+	if (wfd_rtsp_port_set)
+		p->wfd_rtsp_port = wfd_rtsp_port;
+
+	if (wfd_max_throughput_set)
+		p->wfd_max_throughput = wfd_max_throughput;
+
+	if (wfd_coupled_sink) {
+		tmp = strdup(wfd_coupled_sink);
+		if (tmp) {
+			free(p->wfd_coupled_sink);
+			p->wfd_coupled_sink = tmp;
+		} else {
+			cli_vENOMEM();
+		}
+	}
+
+	if (wfd_caps_set)
+		p->wfd_caps = wfd_caps;
+
 	/* do notifications last */
+	if (shl_dlist_linked(&p->list))
+		ctl_peer_update_visible(p);
+
 	if (connected_set && p->connected != connected) {
 		p->connected = connected;
+		if (!p->visible)
+			return 0;
+
 		if (p->connected)
 			ctl_fn_peer_connected(p);
 		else
@@ -320,16 +567,47 @@ int ctl_peer_disconnect(struct ctl_peer *p)
 static struct ctl_peer *ctl_link_find_peer(struct ctl_link *l,
 					   const char *label)
 {
-	struct shl_dlist *i;
-	struct ctl_peer *p;
+	return ctl_index_lookup(&l->peers_by_label,
+				offsetof(struct ctl_peer, label),
+				label);
+}
 
-	shl_dlist_for_each(i, &l->peers) {
-		p = peer_from_dlist(i);
-		if (!strcasecmp(p->label, label))
-			return p;
-	}
+static void ctl_link_index_key(struct ctl_link *l,
+			       struct shl_htable *ht,
+			       char **key,
+			       bool add)
+{
+	if (add)
+		ctl_index_add(ht, key);
+	else
+		ctl_index_remove(ht, key, &l->w->links,
+				 offsetof(struct ctl_link, list),
+				 (char*)key - (char*)l);
+}
 
-	return NULL;
+static void ctl_link_index(struct ctl_link *l, bool add)
+{
+	ctl_link_index_key(l, &l->w->links_by_label, &l->label, add);
+	ctl_link_index_key(l, &l->w->links_by_ifname, &l->ifname, add);
+	ctl_link_index_key(l, &l->w->links_by_name, &l->friendly_name, add);
+}
+
+/* replace an indexed string property, takes ownership of @val */
+static void ctl_link_set_key(struct ctl_link *l,
+			     struct shl_htable *ht,
+			     char **key,
+			     char *val)
+{
+	bool linked = shl_dlist_linked(&l->list);
+
+	if (linked)
+		ctl_link_index_key(l, ht, key, false);
+
+	free(*key);
+	*key = val;
+
+	if (linked)
+		ctl_link_index_key(l, ht, key, true);
 }
 
 static void ctl_link_free(struct ctl_link *l)
@@ -344,8 +622,15 @@ static void ctl_link_free(struct ctl_link *l)
 		ctl_peer_free(p);
 	}
 
-	if (shl_dlist_linked(&l->list))
+	if (shl_dlist_linked(&l->list)) {
 		ctl_fn_link_free(l);
+		ctl_link_index(l, false);
+	}
+
+	shl_htable_clear(&l->peers_by_interface, NULL, NULL);
+	shl_htable_clear(&l->peers_by_name, NULL, NULL);
+	shl_htable_clear(&l->peers_by_mac, NULL, NULL);
+	shl_htable_clear(&l->peers_by_label, NULL, NULL);
 
 	free(l->wfd_subelements);
 	free(l->friendly_name);
@@ -379,6 +664,10 @@ static int ctl_link_new(struct ctl_link **out,
 
 	l->w = w;
 	shl_dlist_init(&l->peers);
+	ctl_index_init(&l->peers_by_label);
+	ctl_index_init(&l->peers_by_mac);
+	ctl_index_init(&l->peers_by_name);
+	ctl_index_init(&l->peers_by_interface);
 
 	l->label = strdup(label);
 	if (!l->label) {
@@ -402,6 +691,7 @@ static void ctl_link_link(struct ctl_link *l)
 		return;
 
 	shl_dlist_link_tail(&l->w->links, &l->list);
+	ctl_link_index(l, true);
 	ctl_fn_link_new(l);
 }
 
@@ -485,22 +775,20 @@ static int ctl_link_parse_properties(struct ctl_link *l,
 
 	if (interface_name) {
 		tmp = strdup(interface_name);
-		if (tmp) {
-			free(l->ifname);
-			l->ifname = tmp;
-		} else {
+		if (tmp)
+			ctl_link_set_key(l, &l->w->links_by_ifname,
+					 &l->ifname, tmp);
+		else
 			cli_vENOMEM();
-		}
 	}
 
 	if (friendly_name) {
 		tmp = strdup(friendly_name);
-		if (tmp) {
-			free(l->friendly_name);
-			l->friendly_name = tmp;
-		} else {
+		if (tmp)
+			ctl_link_set_key(l, &l->w->links_by_name,
+					 &l->friendly_name, tmp);
+		else
 			cli_vENOMEM();
-		}
 	}
 
 	if (managed_set)
@@ -1026,7 +1314,7 @@ static int ctl_wifi_peer_fn(sd_bus_message *m,
 		return 0;
 	} else if (r > 0) {
 		p = ctl_wifi_find_peer(w, label);
-		if (!p)
+		if (!p || !p->visible)
 			return 0;
 	}
 
@@ -1121,6 +1409,9 @@ int ctl_wifi_new(struct ctl_wifi **out, sd_bus *bus)
 
 	w->bus = sd_bus_ref(bus);
 	shl_dlist_init(&w->links);
+	ctl_index_init(&w->links_by_label);
+	ctl_index_init(&w->links_by_ifname);
+	ctl_index_init(&w->links_by_name);
 
 	r = ctl_wifi_init(w);
 	if (r < 0) {
@@ -1145,6 +1436,10 @@ void ctl_wifi_free(struct ctl_wifi *w)
 		ctl_link_free(l);
 	}
 
+	shl_htable_clear(&w->links_by_name, NULL, NULL);
+	shl_htable_clear(&w->links_by_ifname, NULL, NULL);
+	shl_htable_clear(&w->links_by_label, NULL, NULL);
+
 	ctl_wifi_destroy(w);
 	sd_bus_unref(w->bus);
 	free(w);
@@ -1159,6 +1454,11 @@ int ctl_wifi_fetch(struct ctl_wifi *w)
 	if (!w)
 		return cli_EINVAL();
 
+	/* The ObjectManager and Properties signals keep the cache up to date
+	 * once it was populated, there is never a reason to fetch again. */
+	if (w->fetched)
+		return 0;
+
 	r = sd_bus_call_method(w->bus,
 			       "org.freedesktop.miracle.wifi",
 			       "/org/freedesktop/miracle/wifi",
@@ -1195,31 +1495,45 @@ int ctl_wifi_fetch(struct ctl_wifi *w)
 	if (r < 0)
 		return cli_log_parser(r);
 
+	w->fetched = true;
+
 	return 0;
 }
 
-struct ctl_link *ctl_wifi_find_link(struct ctl_wifi *w,
-				    const char *label)
+void ctl_wifi_set_wfd_filter(struct ctl_wifi *w, unsigned int caps)
 {
-	struct shl_dlist *i;
+	struct shl_dlist *i, *j;
 	struct ctl_link *l;
+	struct ctl_peer *p;
 
-	if (!w || shl_isempty(label))
-		return NULL;
+	if (!w || w->wfd_filter == caps)
+		return;
+
+	w->wfd_filter = caps;
 
 	shl_dlist_for_each(i, &w->links) {
 		l = link_from_dlist(i);
-		if (!strcasecmp(l->label, label))
-			return l;
+		shl_dlist_for_each(j, &l->peers) {
+			p = peer_from_dlist(j);
+			ctl_peer_update_visible(p);
+		}
 	}
+}
 
-	return NULL;
+struct ctl_link *ctl_wifi_find_link(struct ctl_wifi *w,
+				    const char *label)
+{
+	if (!w || shl_isempty(label))
+		return NULL;
+
+	return ctl_index_lookup(&w->links_by_label,
+				offsetof(struct ctl_link, label),
+				label);
 }
 
 struct ctl_link *ctl_wifi_search_link(struct ctl_wifi *w,
 				      const char *label)
 {
-	struct shl_dlist *i;
 	struct ctl_link *l;
 
 	if (!w || shl_isempty(label))
@@ -1230,20 +1544,16 @@ struct ctl_link *ctl_wifi_search_link(struct ctl_wifi *w,
 		return l;
 
 	/* try matching on interface */
-	shl_dlist_for_each(i, &w->links) {
-		l = link_from_dlist(i);
-		if (l->ifname && !strcasecmp(l->ifname, label))
-			return l;
-	}
+	l = ctl_index_lookup(&w->links_by_ifname,
+			     offsetof(struct ctl_link, ifname),
+			     label);
+	if (l)
+		return l;
 
 	/* try matching on friendly-name */
-	shl_dlist_for_each(i, &w->links) {
-		l = link_from_dlist(i);
-		if (l->friendly_name && !strcasecmp(l->friendly_name, label))
-			return l;
-	}
-
-	return NULL;
+	return ctl_index_lookup(&w->links_by_name,
+				offsetof(struct ctl_link, friendly_name),
+				label);
 }
 
 struct ctl_link *ctl_wifi_find_link_by_peer(struct ctl_wifi *w,
@@ -1292,6 +1602,28 @@ struct ctl_peer *ctl_wifi_find_peer(struct ctl_wifi *w,
 	return ctl_link_find_peer(l, label);
 }
 
+static struct ctl_peer *ctl_link_search_peer(struct ctl_link *l,
+					     const char *label)
+{
+	struct ctl_peer *p;
+
+	p = ctl_index_lookup(&l->peers_by_mac,
+			     offsetof(struct ctl_peer, label_mac),
+			     label);
+	if (p)
+		return p;
+
+	p = ctl_index_lookup(&l->peers_by_name,
+			     offsetof(struct ctl_peer, friendly_name),
+			     label);
+	if (p)
+		return p;
+
+	return ctl_index_lookup(&l->peers_by_interface,
+				offsetof(struct ctl_peer, interface),
+				label);
+}
+
 struct ctl_peer *ctl_wifi_search_peer(struct ctl_wifi *w,
 				      const char *real_label)
 {
@@ -1322,26 +1654,9 @@ struct ctl_peer *ctl_wifi_search_peer(struct ctl_wifi *w,
 		if (sep)
 			*sep = 0;
 
-		shl_dlist_for_each(j, &l->peers) {
-			p = shl_dlist_entry(j, struct ctl_peer, list);
-			next = shl_startswith(p->label, label);
-			if (next && *next == '@')
-				return p;
-		}
-
-		shl_dlist_for_each(j, &l->peers) {
-			p = shl_dlist_entry(j, struct ctl_peer, list);
-			if (p->friendly_name &&
-			    !strcasecmp(p->friendly_name, label))
-				return p;
-		}
-
-		shl_dlist_for_each(j, &l->peers) {
-			p = shl_dlist_entry(j, struct ctl_peer, list);
-			if (p->interface &&
-			    !strcasecmp(p->interface, label))
-				return p;
-		}
+		p = ctl_link_search_peer(l, label);
+		if (p)
+			return p;
 
 		if (shl_atoi_u(label, 10, &next, &idx) >= 0 && !*next) {
 			cnt = 0;
@@ -1356,34 +1671,32 @@ struct ctl_peer *ctl_wifi_search_peer(struct ctl_wifi *w,
 			*sep = '@';
 	}
 
+	/* MAC first, on all links, then the weaker matches */
 	shl_dlist_for_each(i, &w->links) {
 		l = shl_dlist_entry(i, struct ctl_link, list);
-		shl_dlist_for_each(j, &l->peers) {
-			p = shl_dlist_entry(j, struct ctl_peer, list);
-			next = shl_startswith(p->label, label);
-			if (next && *next == '@')
-				return p;
-		}
+		p = ctl_index_lookup(&l->peers_by_mac,
+				     offsetof(struct ctl_peer, label_mac),
+				     label);
+		if (p)
+			return p;
 	}
 
 	shl_dlist_for_each(i, &w->links) {
 		l = shl_dlist_entry(i, struct ctl_link, list);
-		shl_dlist_for_each(j, &l->peers) {
-			p = shl_dlist_entry(j, struct ctl_peer, list);
-			if (p->friendly_name &&
-			    !strcasecmp(p->friendly_name, label))
-				return p;
-		}
+		p = ctl_index_lookup(&l->peers_by_name,
+				     offsetof(struct ctl_peer, friendly_name),
+				     label);
+		if (p)
+			return p;
 	}
 
 	shl_dlist_for_each(i, &w->links) {
 		l = shl_dlist_entry(i, struct ctl_link, list);
-		shl_dlist_for_each(j, &l->peers) {
-			p = shl_dlist_entry(j, struct ctl_peer, list);
-			if (p->interface &&
-			    !strcasecmp(p->interface, label))
-				return p;
-		}
+		p = ctl_index_lookup(&l->peers_by_interface,
+				     offsetof(struct ctl_peer, interface),
+				     label);
+		if (p)
+			return p;
 	}
 
 	if (shl_atoi_u(label, 10, &next, &idx) < 0 || *next)
@@ -30,7 +30,9 @@
 #include <sys/types.h>
 #include <systemd/sd-bus.h>
 #include "shl_dlist.h"
+#include "shl_htable.h"
 #include "shl_log.h"
+#include "wfd_ie.h"
 
 // Force readline to use va_list variants (fixes gcc15 compilation on certain distros)
 #define HAVE_STDARG_H
@@ -55,6 +57,7 @@ char *  yes_no_generator      (const char *text, int state);
 struct ctl_peer {
 	struct shl_dlist list;
 	char *label;
+	char *label_mac;
 	struct ctl_link *l;
 
 	/* properties */
@@ -65,6 +68,17 @@ struct ctl_peer {
 	char *local_address;
 	char *remote_address;
 	char *wfd_subelements;
+
+	/* decoded by wifid, see wfd_ie.h */
+	char *wfd_dev_type;
+	bool wfd_session_available;
+	uint16_t wfd_rtsp_port;
+	uint16_t wfd_max_throughput;
+	char *wfd_coupled_sink;
+	unsigned int wfd_caps;
+
+	/* matches the WFD filter, ctl_fn_peer_*() is only called if set */
+	bool visible;
 };
 
 #define peer_from_dlist(_p) shl_dlist_entry((_p), struct ctl_peer, list);
@@ -79,6 +93,12 @@ struct ctl_link {
 
 	struct shl_dlist peers;
 
+	/* case-insensitive peer indexes, see ctl_wifi_search_peer() */
+	struct shl_htable peers_by_label;
+	struct shl_htable peers_by_mac;
+	struct shl_htable peers_by_name;
+	struct shl_htable peers_by_interface;
+
 	bool have_p2p_scan;
 
 	/* properties */
@@ -99,13 +119,21 @@ int ctl_link_set_p2p_scanning(struct ctl_link *l, bool val);
 
 struct ctl_wifi {
 	sd_bus *bus;
+	bool fetched;
+	unsigned int wfd_filter;
 
 	struct shl_dlist links;
+
+	/* case-insensitive link indexes, see ctl_wifi_search_link() */
+	struct shl_htable links_by_label;
+	struct shl_htable links_by_ifname;
+	struct shl_htable links_by_name;
 };
 
 int ctl_wifi_new(struct ctl_wifi **out, sd_bus *bus);
 void ctl_wifi_free(struct ctl_wifi *w);
 int ctl_wifi_fetch(struct ctl_wifi *w);
+void ctl_wifi_set_wfd_filter(struct ctl_wifi *w, unsigned int caps);
 
 struct ctl_link *ctl_wifi_find_link(struct ctl_wifi *w,
 				    const char *label);
@@ -133,6 +161,7 @@ void ctl_sink_close(struct ctl_sink *s);
 bool ctl_sink_is_connecting(struct ctl_sink *s);
 bool ctl_sink_is_connected(struct ctl_sink *s);
 bool ctl_sink_is_closed(struct ctl_sink *s);
+int ctl_sink_request_idr(struct ctl_sink *s);
 
 /* CLI handling */
 
@@ -141,22 +170,23 @@ void cli_printv(const char *fmt, bool prefix_time, va_list args);
 void cli_printf_time_prefix();
 void cli_printf(const char *fmt, ...);
 void cli_command_printf(const char *fmt, ...);
+void cli_print_peer_wfd(struct ctl_peer *p);
 
 #define cli_log(_fmt, ...) \
 	cli_printf(_fmt "\n", ##__VA_ARGS__)
 #define cli_log_fn(_fmt, ...) \
 	cli_printf(_fmt " (%s() in %s:%d)\n", ##__VA_ARGS__, __func__, __FILE__, __LINE__)
 #define cli_error(_fmt, ...) \
-	((LOG_ERROR <= cli_max_sev) ? \
+	((LOG_ERROR <= LOG_COMPILE_MAX_SEV && LOG_ERROR <= cli_max_sev) ? \
 	cli_log_fn("ERROR: " _fmt, ##__VA_ARGS__) : (void)0)
 #define cli_warning(_fmt, ...) \
-	((LOG_WARNING <= cli_max_sev) ? \
+	((LOG_WARNING <= LOG_COMPILE_MAX_SEV && LOG_WARNING <= cli_max_sev) ? \
 	cli_log_fn("WARNING: " _fmt, ##__VA_ARGS__) : (void)0)
 #define cli_notice(_fmt, ...) \
-	((LOG_NOTICE <= cli_max_sev) ? \
+	((LOG_NOTICE <= LOG_COMPILE_MAX_SEV && LOG_NOTICE <= cli_max_sev) ? \
 	cli_log("NOTICE: " _fmt, ##__VA_ARGS__) : (void)0)
 #define cli_debug(_fmt, ...) \
-	((LOG_DEBUG <= cli_max_sev) ? \
+	((LOG_DEBUG <= LOG_COMPILE_MAX_SEV && LOG_DEBUG <= cli_max_sev) ? \
 	cli_log_fn("DEBUG: " _fmt, ##__VA_ARGS__) : (void)0)
 
 #define cli_EINVAL() \
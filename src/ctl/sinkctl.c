@@ -20,7 +20,9 @@
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <locale.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -28,7 +30,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/epoll.h>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 #include <systemd/sd-bus.h>
 #include <systemd/sd-event.h>
@@ -40,9 +44,14 @@
 #include <time.h>
 #include <unistd.h>
 #include "ctl.h"
+#include "ctl-player.h"
+#include "ctl-probe.h"
+#include "ctl-rtp.h"
 #include "ctl-sink.h"
 #include "wfd.h"
 #include "shl_macro.h"
+#include "shl_trace.h"
+#include "uibc_hidc.h"
 #include "shl_util.h"
 #include "util.h"
 #include "config.h"
@@ -61,6 +70,19 @@ static unsigned int sink_timeout_time;
 static bool sink_connected;
 static pid_t sink_pid;
 
+static struct ctl_player *builtin;
+static struct ctl_rtp *rtp;
+static struct ctl_probe probe;
+static bool have_probe;
+
+static uint64_t idr_last_time;
+static uint64_t idr_suppressed;
+static uint64_t loss_time;
+static uint64_t recoveries;
+static uint64_t recovery_last;
+static uint64_t recovery_max;
+static uint64_t recovery_sum;
+
 static char *bound_link;
 static struct ctl_link *running_link;
 static struct ctl_peer *running_peer;
@@ -73,8 +95,24 @@ int gst_audio_en = 1;
 static const int DEFAULT_RSTP_PORT = 7236;
 bool uibc_option;
 bool uibc_enabled;
+unsigned int uibc_rate;
+const char *uibc_hid_devs[UIBC_MAX_HID];
+unsigned int uibc_hid_n;
+char *uibc_hidc_cap_list;
 bool external_player;
+bool prewarm_player;
+bool use_builtin_player = true;
+unsigned int jitter_latency = 100;
+unsigned int idr_interval = 500;
+bool probe_decoder = true;
+bool probe_refresh;
+unsigned int probe_headroom = 25;
+bool use_rtp_frontend = true;
+unsigned int rtp_rcvbuf;
+int rtp_relay_port;
+unsigned int rtcp_interval = 1000;
 int rstp_port;
+int rtcp_port;
 int uibc_port;
 char* player;
 GHashTable* protocol_extensions;
@@ -203,8 +241,7 @@ static int cmd_show(char **args, unsigned int n)
 			cli_command_printf("LocalAddress=%s\n", p->local_address);
 		if (p->remote_address && *p->remote_address)
 			cli_command_printf("RemoteAddress=%s\n", p->remote_address);
-		if (p->wfd_subelements && *p->wfd_subelements)
-			cli_command_printf("WfdSubelements=%s\n", p->wfd_subelements);
+		cli_print_peer_wfd(p);
 	} else {
 		cli_command_printf("Show what?\n");
 		return 0;
@@ -344,6 +381,136 @@ static int cmd_set_managed(char **args, unsigned int n)
 	return ctl_link_set_managed(l, managed);
 }
 
+/*
+ * cmd: stats
+ */
+
+static int cmd_stats(char **args, unsigned int n)
+{
+	struct ctl_player_stats st;
+	int r;
+
+	if (!builtin) {
+		cli_error("built-in player not in use");
+		return 0;
+	}
+
+	r = ctl_player_get_stats(builtin, &st);
+	if (r < 0)
+		return r;
+
+	cli_command_printf("Running=%d\n", ctl_player_is_running(builtin));
+	cli_command_printf("Resolution=%dx%d\n", st.hres, st.vres);
+	cli_command_printf("Latency=%" PRIu64 "us\n", st.latency);
+	cli_command_printf("JitterBufferLatency=%ums\n", st.jb_latency);
+	cli_command_printf("JitterBufferPushed=%" PRIu64 "\n", st.jb_pushed);
+	cli_command_printf("JitterBufferLost=%" PRIu64 "\n", st.jb_lost);
+	cli_command_printf("JitterBufferLate=%" PRIu64 "\n", st.jb_late);
+	cli_command_printf("JitterBufferDuplicates=%" PRIu64 "\n",
+			   st.jb_duplicates);
+	cli_command_printf("JitterBufferAvgJitter=%" PRIu64 "us\n",
+			   st.jb_avg_jitter);
+	cli_command_printf("Rendered=%" PRIu64 "\n", st.rendered);
+	cli_command_printf("Dropped=%" PRIu64 "\n", st.dropped);
+	cli_command_printf("DecoderQueueBuffers=%u\n", st.queue_buffers);
+	cli_command_printf("DecoderQueueBytes=%u\n", st.queue_bytes);
+	cli_command_printf("DecoderQueueTime=%" PRIu64 "us\n", st.queue_time);
+	cli_command_printf("IdrRequests=%" PRIu64 "\n", sink->idr_requests);
+	cli_command_printf("IdrSuppressed=%" PRIu64 "\n", idr_suppressed);
+	cli_command_printf("Recoveries=%" PRIu64 "\n", recoveries);
+	cli_command_printf("LastRecovery=%" PRIu64 "ms\n",
+			   recovery_last / 1000);
+	cli_command_printf("MaxRecovery=%" PRIu64 "ms\n",
+			   recovery_max / 1000);
+	cli_command_printf("AvgRecovery=%" PRIu64 "ms\n",
+			   recoveries ? recovery_sum / recoveries / 1000 : 0);
+
+	return 0;
+}
+
+/*
+ * cmd: rtp-stats
+ */
+
+static int cmd_rtp_stats(char **args, unsigned int n)
+{
+	struct ctl_rtp_stats st;
+
+	if (!rtp) {
+		cli_error("RTP receiver not in use");
+		return 0;
+	}
+
+	ctl_rtp_get_stats(rtp, &st);
+
+	cli_command_printf("SSRC=%08" PRIx32 "\n", st.rtp.ssrc);
+	cli_command_printf("Packets=%" PRIu64 "\n", st.packets);
+	cli_command_printf("Batches=%" PRIu64 "\n", st.batches);
+	cli_command_printf("Bytes=%" PRIu64 "\n", st.rtp.bytes);
+	cli_command_printf("Invalid=%" PRIu64 "\n", st.invalid);
+	cli_command_printf("Expected=%" PRIu64 "\n",
+			   rtp_stats_expected(&st.rtp));
+	cli_command_printf("Received=%" PRIu64 "\n", st.rtp.received);
+	cli_command_printf("Lost=%" PRId64 "\n", rtp_stats_lost(&st.rtp));
+	cli_command_printf("LossBursts=%" PRIu64 "\n", st.rtp.bursts);
+	cli_command_printf("MaxLossBurst=%" PRIu32 "\n", st.rtp.max_burst);
+	cli_command_printf("Reordered=%" PRIu64 "\n", st.rtp.reordered);
+	cli_command_printf("Duplicates=%" PRIu64 "\n", st.rtp.duplicates);
+	cli_command_printf("Jitter=%" PRIu64 "us\n",
+			   rtp_stats_jitter_usec(&st.rtp));
+	cli_command_printf("Overruns=%" PRIu64 "\n", st.overruns);
+	cli_command_printf("SpillDrops=%" PRIu64 "\n", st.spill_drops);
+	cli_command_printf("KernelDrops=%" PRIu64 "\n", st.kernel_drops);
+	cli_command_printf("ReceiveBuffer=%u\n", st.rcvbuf);
+	cli_command_printf("RtcpReceiverReports=%" PRIu64 "\n", st.rtcp_sent);
+	cli_command_printf("RtcpSenderReports=%" PRIu64 "\n", st.rtcp_sr);
+
+	return 0;
+}
+
+/*
+ * cmd: set-latency
+ */
+
+static int cmd_set_latency(char **args, unsigned int n)
+{
+	char *end;
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(args[0], &end, 10);
+	if (errno || *end || end == args[0] || v > 10000) {
+		cli_error("invalid latency %s", args[0]);
+		return 0;
+	}
+
+	jitter_latency = v;
+	if (builtin)
+		return ctl_player_set_latency(builtin, jitter_latency);
+
+	return 0;
+}
+
+/*
+ * cmd: request-idr
+ */
+
+static int cmd_request_idr(char **args, unsigned int n)
+{
+	int r;
+
+	r = ctl_sink_request_idr(sink);
+	if (r == -ENOTCONN) {
+		cli_error("no session running");
+		return 0;
+	} else if (r == -EALREADY) {
+		cli_error("IDR request already pending");
+		return 0;
+	}
+
+	return r;
+}
+
 /*
  * cmd: quit/exit
  */
@@ -442,98 +609,378 @@ static const struct cli_cmd cli_cmds[] = {
 	{ "bind",		"<link>",		CLI_M,	CLI_EQUAL,	1,	cmd_bind,		"Like 'run' but bind the link name to run when it is hotplugged", {links_generator, NULL} },
 	{ "set-friendly-name",	"[link] <name>",	CLI_M,	CLI_LESS,	2,	cmd_set_friendly_name,	"Set friendly name of an object", {links_generator, NULL} },
 	{ "set-managed",	"<link> <yes|no>",	CLI_M,	CLI_EQUAL,	2,	cmd_set_managed,	"Manage or unmnage a link", {links_generator, yes_no_generator, NULL} },
+	{ "stats",		NULL,			CLI_M,	CLI_LESS,	0,	cmd_stats,		"Show statistics of the built-in player", {NULL} },
+	{ "rtp-stats",		NULL,			CLI_M,	CLI_LESS,	0,	cmd_rtp_stats,		"Show statistics of the RTP receiver", {NULL} },
+	{ "request-idr",	NULL,			CLI_M,	CLI_LESS,	0,	cmd_request_idr,	"Ask the source for an IDR picture", {NULL} },
+	{ "set-latency",	"<ms>",			CLI_M,	CLI_EQUAL,	1,	cmd_set_latency,	"Set jitter-buffer latency of the built-in player", {NULL} },
 	{ "quit",		NULL,			CLI_Y,	CLI_MORE,	0,	cmd_quit,		"Quit program", {NULL} },
 	{ "exit",		NULL,			CLI_Y,	CLI_MORE,	0,	cmd_quit,		NULL, {NULL} },
 	{ "help",		NULL,			CLI_M,	CLI_MORE,	0,	NULL,			"Print help", {NULL} },
 	{ },
 };
 
-static void spawn_gst(struct ctl_sink *s)
+static void setup_child(void)
 {
-	pid_t pid;
 	int fd_journal;
 	sigset_t mask;
 
-	if (sink_pid > 0)
-		return;
-
-	pid = fork();
-	if (pid < 0) {
-		return cli_vERRNO();
-	} else if (!pid) {
-		/* child */
-
-		sigemptyset(&mask);
-		sigprocmask(SIG_SETMASK, &mask, NULL);
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
 
 #ifdef ENABLE_SYSTEMD
-		/* redirect stdout/stderr to journal */
-		fd_journal = sd_journal_stream_fd("miracle-sinkctl-gst",
-						  LOG_DEBUG,
-						  false);
-		if (fd_journal >= 0) {
-			/* dup journal-fd to stdout and stderr */
-			dup2(fd_journal, 1);
-			dup2(fd_journal, 2);
-		} else {
+	/* redirect stdout/stderr to journal */
+	fd_journal = sd_journal_stream_fd("miracle-sinkctl-gst",
+					  LOG_DEBUG,
+					  false);
+	if (fd_journal >= 0) {
+		/* dup journal-fd to stdout and stderr */
+		dup2(fd_journal, 1);
+		dup2(fd_journal, 2);
+	} else {
 #endif
-			/* no journal? redirect stdout to parent's stderr */
-			dup2(2, 1);
+		/* no journal? redirect stdout to parent's stderr */
+		dup2(2, 1);
 #ifdef ENABLE_SYSTEMD
-		}
+	}
 #endif
+}
 
-		launch_player(s);
-		_exit(1);
-	} else {
-		sink_pid = pid;
-	}
+/*
+ * External players listen on the relay port if our RTP receiver owns the
+ * real one.
+ */
+static int player_port(void)
+{
+	return rtp ? rtp_relay_port : rstp_port;
 }
 
-void launch_player(struct ctl_sink *s) {
+/*
+ * The player is picked and its arguments are built in one place, so a
+ * pre-warmed player is the very same one spawn_gst() would start. Only
+ * gstplayer can be pre-warmed, so it also becomes the default player if
+ * pre-warming is enabled.
+ */
+struct player_argv {
 	char *argv[64];
-	char resolution[64];
-	char port[64];
-	char uibc_portStr[64];
+	char port[16];
+	char resolution[32];
+	char uibc_port[16];
+	char uibc_rate[16];
+	char control_fd[16];
+};
+
+static char *player_binary(void)
+{
+	if (external_player)
+		return player;
+	else if (uibc_enabled)
+		return "uibc-viewer";
+	else if (prewarm_player)
+		return "gstplayer";
+	else
+		return "miracle-gst";
+}
+
+/*
+ * Without @s, the arguments of a pre-warmed player are built, which learns
+ * about the session on @control_fd later on.
+ */
+static void player_build_argv(struct player_argv *a,
+			      struct ctl_sink *s,
+			      int control_fd)
+{
+	unsigned int j;
 	int i = 0;
-   if (!external_player) {
-	   if (uibc_enabled) {
-	   	player = "uibc-viewer";
-	   } else {
-	   	player = "miracle-gst";
-	   }
-   }
 
-	argv[i++] = player;
-	if (uibc_enabled) {
-		argv[i++] = s->target;
-		sprintf(uibc_portStr, "%d", uibc_port);
-		argv[i++] = uibc_portStr;
+	a->argv[i++] = player_binary();
+	if (s && uibc_enabled) {
+		a->argv[i++] = s->target;
+		sprintf(a->uibc_port, "%d", uibc_port);
+		a->argv[i++] = a->uibc_port;
+		if (uibc_rate || s->fps) {
+			sprintf(a->uibc_rate, "%u", uibc_rate ? : s->fps);
+			a->argv[i++] = "--uibc-rate";
+			a->argv[i++] = a->uibc_rate;
+		}
+		/* only if the source picked HIDC in M4 */
+		if (s->uibc_config && strstr(s->uibc_config, "HIDC")) {
+			for (j = 0; j < uibc_hid_n; ++j) {
+				a->argv[i++] = "--uibc-hid";
+				a->argv[i++] = (char*)uibc_hid_devs[j];
+			}
+		}
+	}
+	if (control_fd >= 0) {
+		sprintf(a->control_fd, "%d", control_fd);
+		a->argv[i++] = "--control-fd";
+		a->argv[i++] = a->control_fd;
 	}
 	if (gst_debug) {
-		argv[i++] = "-d";
-		argv[i++] = gst_debug;
+		a->argv[i++] = "-d";
+		a->argv[i++] = gst_debug;
 	} else if (cli_max_sev >= LOG_DEBUG) {
-		argv[i++] = "-d";
-		argv[i++] = "3";
+		a->argv[i++] = "-d";
+		a->argv[i++] = "3";
 	}
 	if (gst_audio_en)
-		argv[i++] = "-a";
+		a->argv[i++] = "-a";
 	if (gst_scale_res) {
-		argv[i++] = "-s";
-		argv[i++] = gst_scale_res;
+		a->argv[i++] = "-s";
+		a->argv[i++] = gst_scale_res;
+	}
+	a->argv[i++] = "-p";
+	sprintf(a->port, "%d", player_port());
+	a->argv[i++] = a->port;
+
+	if (s && s->hres && s->vres) {
+		sprintf(a->resolution, "%dx%d", s->hres, s->vres);
+		a->argv[i++] = "-r";
+		a->argv[i++] = a->resolution;
+	}
+
+	a->argv[i] = NULL;
+}
+
+/*
+ * Pre-warmed player
+ * Loading the GStreamer plugins and preparing the decode pipeline takes a
+ * considerable amount of time. Instead of doing that after M4 told us the
+ * resolution, we start gstplayer right away and let it wait on a control
+ * socket. Once the session is set up, we only send it the negotiated
+ * parameters. The player reports "READY" when its pipeline is prepared and
+ * "FIRST-FRAME" once the first frame hit the video sink.
+ */
+
+static pid_t prewarm_pid;
+static int player_fd = -1;
+static sd_event_source *player_source;
+static char player_buf[128];
+static size_t player_len;
+static uint64_t player_spawn_time;
+static uint64_t player_startup_time;
+static uint64_t session_start_time;
+static uint64_t session_saved_time;
+
+static void player_close(void)
+{
+	if (player_source) {
+		sd_event_source_set_enabled(player_source, SD_EVENT_OFF);
+		sd_event_source_unref(player_source);
+		player_source = NULL;
+	}
+
+	if (player_fd >= 0) {
+		close(player_fd);
+		player_fd = -1;
+	}
+
+	player_len = 0;
+}
+
+static void player_handle_line(const char *line)
+{
+	uint64_t now = shl_now(CLOCK_MONOTONIC);
+
+	if (!strcmp(line, "READY")) {
+		player_startup_time = now - player_spawn_time;
+		cli_debug("player pre-warmed in %" PRIu64 "ms",
+			  player_startup_time / 1000);
+	} else if (!strcmp(line, "FIRST-FRAME") && session_start_time) {
+		cli_printf("SINK first frame after %" PRIu64 "ms (%" PRIu64 "ms of player startup saved)\n",
+			   (now - session_start_time) / 1000,
+			   session_saved_time / 1000);
+		session_start_time = 0;
+	} else {
+		cli_debug("unknown player message: %s", line);
+	}
+}
+
+static int player_io_fn(sd_event_source *source,
+			int fd,
+			uint32_t mask,
+			void *data)
+{
+	char *line, *eol;
+	ssize_t l;
+
+	l = read(fd, player_buf + player_len,
+		 sizeof(player_buf) - player_len - 1);
+	if (l < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+
+	if (l <= 0) {
+		if (prewarm_pid > 0) {
+			cli_debug("pre-warmed player %d exited", (int)prewarm_pid);
+			prewarm_pid = 0;
+		}
+		player_close();
+		return 0;
+	}
+
+	player_len += l;
+	player_buf[player_len] = 0;
+
+	line = player_buf;
+	while ((eol = strchr(line, '\n'))) {
+		*eol = 0;
+		player_handle_line(line);
+		line = eol + 1;
+	}
+
+	player_len -= line - player_buf;
+	memmove(player_buf, line, player_len);
+
+	/* drop overlong lines */
+	if (player_len >= sizeof(player_buf) - 1)
+		player_len = 0;
+
+	return 0;
+}
+
+static void player_prewarm(void)
+{
+	struct player_argv a;
+	int fds[2], r;
+	pid_t pid;
+
+	if (!prewarm_player || external_player || builtin || uibc_enabled)
+		return;
+	if (prewarm_pid > 0 || player_fd >= 0)
+		return;
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	if (r < 0)
+		return cli_vERRNO();
+
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return cli_vERRNO();
+	} else if (!pid) {
+		/* child */
+		setup_child();
+
+		/* dup2() clears FD_CLOEXEC, unless both are the same */
+		if (fds[1] == 3)
+			fcntl(3, F_SETFD, 0);
+		else if (dup2(fds[1], 3) < 0)
+			_exit(1);
+
+		player_build_argv(&a, NULL, 3);
+		execvpe(a.argv[0], a.argv, environ);
+		_exit(1);
+	}
+
+	close(fds[1]);
+	player_fd = fds[0];
+
+	r = sd_event_add_io(cli_event,
+			    &player_source,
+			    player_fd,
+			    EPOLLIN,
+			    player_io_fn,
+			    NULL);
+	if (r < 0) {
+		kill(pid, SIGTERM);
+		player_close();
+		return cli_vERR(r);
+	}
+
+	prewarm_pid = pid;
+	player_spawn_time = shl_now(CLOCK_MONOTONIC);
+	player_startup_time = 0;
+	cli_debug("pre-warming player %d", (int)pid);
+}
+
+static void player_stop(void)
+{
+	if (prewarm_pid > 0) {
+		kill(prewarm_pid, SIGTERM);
+		prewarm_pid = 0;
+	}
+
+	player_close();
+}
+
+/* hand the session over to the pre-warmed player, if there is one */
+static int player_handoff(struct ctl_sink *s)
+{
+	char cmd[128];
+	int l;
+
+	/* the UIBC viewer is a different player */
+	if (prewarm_pid <= 0 || uibc_enabled)
+		return -EAGAIN;
+
+	l = snprintf(cmd, sizeof(cmd),
+		     "PLAY port=%d audio=%d resolution=%dx%d\n",
+		     player_port(), !!gst_audio_en, s->hres, s->vres);
+	if (write(player_fd, cmd, l) != l) {
+		cli_debug("cannot hand session to pre-warmed player: %m");
+		player_stop();
+		return -EIO;
+	}
+
+	if (player_startup_time)
+		session_saved_time = player_startup_time;
+	else
+		session_saved_time = shl_now(CLOCK_MONOTONIC) -
+				     player_spawn_time;
+
+	sink_pid = prewarm_pid;
+	prewarm_pid = 0;
+	cli_debug("handed session to pre-warmed player %d", (int)sink_pid);
+
+	return 0;
+}
+
+static void spawn_gst(struct ctl_sink *s)
+{
+	pid_t pid;
+	int r;
+
+	if (sink_pid > 0)
+		return;
+
+	SHL_TRACE(spawn_gst, s->target);
+
+	/* the UIBC viewer is an external program */
+	if (builtin && !uibc_enabled) {
+		r = ctl_player_start(builtin, s->hres, s->vres);
+		if (r >= 0)
+			return;
+
+		cli_warning("cannot start built-in player (%d), falling back to external player",
+			    r);
 	}
-	argv[i++] = "-p";
-	sprintf(port, "%d", rstp_port);
-	argv[i++] = port;
-
-	if (s->hres && s->vres) {
-		sprintf(resolution, "%dx%d", s->hres, s->vres);
-		argv[i++] = "-r";
-		argv[i++] = resolution;
+
+	if (rtp)
+		ctl_rtp_set_relay(rtp, rtp_relay_port);
+
+	session_start_time = shl_now(CLOCK_MONOTONIC);
+	if (player_handoff(s) >= 0)
+		return;
+
+	pid = fork();
+	if (pid < 0) {
+		return cli_vERRNO();
+	} else if (!pid) {
+		/* child */
+		setup_child();
+		launch_player(s);
+		_exit(1);
+	} else {
+		sink_pid = pid;
 	}
+}
 
-   argv[i] = NULL;
+void launch_player(struct ctl_sink *s) {
+	struct player_argv a;
+	char **argv = a.argv;
+	int i;
+
+	player_build_argv(&a, s, -1);
 
    i = 0;
    size_t size = 0;
@@ -575,11 +1022,93 @@ void launch_uibc_daemon(int port) {
 
 static void kill_gst(void)
 {
+	ctl_player_stop(builtin);
+	loss_time = 0;
+	if (rtp) {
+		ctl_rtp_set_relay(rtp, 0);
+		ctl_rtp_reset(rtp);
+	}
+
 	if (sink_pid <= 0)
 		return;
 
 	kill(sink_pid, SIGTERM);
 	sink_pid = 0;
+	session_start_time = 0;
+
+	/* the control socket belonged to the player we just killed, get the
+	 * next one ready for the following session */
+	if (prewarm_pid <= 0)
+		player_close();
+	player_prewarm();
+}
+
+/*
+ * Loss Recovery
+ * After a loss the picture stays broken until the source sends its next
+ * IDR, which may take seconds if we wait for the periodic one. So we ask
+ * for one right away, but not more often than every idr_interval ms. With
+ * the built-in player we also see when the next IDR reaches the decoder,
+ * which gives the loss-to-clean-picture time.
+ */
+
+static void picture_broken(const char *reason)
+{
+	uint64_t now;
+	int r;
+
+	if (!sink_connected)
+		return;
+
+	now = shl_now(CLOCK_MONOTONIC);
+	if (!loss_time && ctl_player_is_running(builtin))
+		loss_time = now;
+
+	if (!idr_interval)
+		return;
+
+	if (idr_last_time && now - idr_last_time < idr_interval * 1000ULL) {
+		++idr_suppressed;
+		return;
+	}
+
+	r = ctl_sink_request_idr(sink);
+	if (r == -EALREADY)
+		++idr_suppressed;
+	if (r < 0)
+		return;
+
+	idr_last_time = now;
+	cli_debug("requested IDR after %s", reason);
+}
+
+void ctl_fn_rtp_loss(struct ctl_rtp *r, unsigned int bursts)
+{
+	picture_broken("packet loss");
+}
+
+void ctl_fn_player_decode_error(struct ctl_player *p)
+{
+	picture_broken("decoder error");
+}
+
+void ctl_fn_player_keyframe(struct ctl_player *p)
+{
+	uint64_t d;
+
+	if (!loss_time)
+		return;
+
+	d = shl_now(CLOCK_MONOTONIC) - loss_time;
+	loss_time = 0;
+
+	++recoveries;
+	recovery_last = d;
+	recovery_sum += d;
+	if (d > recovery_max)
+		recovery_max = d;
+
+	cli_debug("picture recovered %" PRIu64 "ms after loss", d / 1000);
 }
 
 void ctl_fn_sink_connected(struct ctl_sink *s)
@@ -606,9 +1135,19 @@ void ctl_fn_sink_resolution_set(struct ctl_sink *s)
 		spawn_gst(s);
 }
 
+void ctl_fn_player_first_frame(struct ctl_player *p, uint64_t usec)
+{
+	cli_printf("SINK first frame after %" PRIu64 "ms\n", usec / 1000);
+}
+
+void ctl_fn_player_stopped(struct ctl_player *p)
+{
+	cli_notice("built-in player stopped");
+}
+
 void ctl_fn_peer_new(struct ctl_peer *p)
 {
-	if (p->l != running_link || shl_isempty(p->wfd_subelements))
+	if (p->l != running_link)
 		return;
 
 	if (cli_running())
@@ -618,7 +1157,7 @@ void ctl_fn_peer_new(struct ctl_peer *p)
 
 void ctl_fn_peer_free(struct ctl_peer *p)
 {
-	if (p->l != running_link || shl_isempty(p->wfd_subelements))
+	if (p->l != running_link)
 		return;
 
 	if (p == pending_peer) {
@@ -649,7 +1188,7 @@ void ctl_fn_peer_provision_discovery(struct ctl_peer *p,
 				     const char *prov,
 				     const char *pin)
 {
-	if (p->l != running_link || shl_isempty(p->wfd_subelements))
+	if (p->l != running_link)
 		return;
 
 	if (cli_running())
@@ -661,7 +1200,7 @@ void ctl_fn_peer_go_neg_request(struct ctl_peer *p,
 				     const char *prov,
 				     const char *pin)
 {
-	if (p->l != running_link || shl_isempty(p->wfd_subelements))
+	if (p->l != running_link)
 		return;
 
 	if (cli_running())
@@ -686,7 +1225,7 @@ void ctl_fn_peer_go_neg_request(struct ctl_peer *p,
 
 void ctl_fn_peer_formation_failure(struct ctl_peer *p, const char *reason)
 {
-	if (p->l != running_link || shl_isempty(p->wfd_subelements))
+	if (p->l != running_link)
 		return;
 
 	if (cli_running())
@@ -701,7 +1240,7 @@ void ctl_fn_peer_formation_failure(struct ctl_peer *p, const char *reason)
 
 void ctl_fn_peer_connected(struct ctl_peer *p)
 {
-	if (p->l != running_link || shl_isempty(p->wfd_subelements))
+	if (p->l != running_link)
 		return;
 
 	if (cli_running())
@@ -726,7 +1265,7 @@ void ctl_fn_peer_connected(struct ctl_peer *p)
 
 void ctl_fn_peer_disconnected(struct ctl_peer *p)
 {
-	if (p->l != running_link || shl_isempty(p->wfd_subelements))
+	if (p->l != running_link)
 		return;
 
 	if (p == running_peer) {
@@ -788,6 +1327,7 @@ void cli_fn_help()
 	       "     --log-level <lvl>           Maximum level for log messages\n"
 	       "     --log-time                  Prefix log-messages with timestamp\n"
 	       "     --log-date-time             Prefix log-messages with date time\n"
+	       "     --log-async                 Write log-messages from a background thread\n"
 	       "\n"
 	       "     --log-journal-level <lvl>   Maximum level for journal log messages\n"
 	       "     --gst-debug [cat:]lvl[,...] List of categories an level of debug\n"
@@ -795,7 +1335,27 @@ void cli_fn_help()
 	       "     --scale WxH                 Scale to resolution\n"
 	       "  -p --port <port>                  Port for rtsp (default %d)\n"
 	       "     --uibc                         Enables UIBC\n"
+	       "     --uibc-rate <hz>            Maximum rate of UIBC touch moves, 0 follows\n"
+	       "                                    the negotiated frame rate (default 0)\n"
+	       "     --uibc-hid <hidraw>         Pass a HID device through as UIBC HIDC,\n"
+	       "                                    may be given more than once\n"
 	       "  -e --external-player           Configure player to use\n"
+	       "     --prewarm <0/1>             Use gstplayer and start it before a session\n"
+	       "                                    (default %d)\n"
+	       "     --builtin-player <0/1>      Play in-process if built with GStreamer (default %d)\n"
+	       "     --latency <ms>              Jitter-buffer latency of built-in player (default %u)\n"
+	       "     --idr-interval <ms>         Minimum time between IDR requests on loss,\n"
+	       "                                    0 disables them (default %u)\n"
+	       "     --rtp-frontend <0/1>        Receive RTP in sinkctl to gather statistics (default %d)\n"
+	       "     --rtp-relay-port <port>     Port RTP is relayed to for external players\n"
+	       "                                    (default rtsp port + 2)\n"
+	       "     --rtp-rcvbuf <bytes>        RTP socket receive buffer (default %u)\n"
+	       "     --rtcp-interval <ms>        Interval of RTCP receiver reports on the port\n"
+	       "                                    above the RTP port, 0 disables (default %u)\n"
+	       "     --probe <0/1>               Only advertise resolutions the decoder of the\n"
+	       "                                    built-in player sustains (default %d)\n"
+	       "     --probe-refresh             Benchmark decoders again, ignoring the cache\n"
+	       "     --probe-headroom <percent>  Required decoder headroom (default %u)\n"
 	       "     --res <n,n,n>               Supported resolutions masks (CEA, VESA, HH)\n"
 	       "                                    default CEA  %08X\n"
 	       "                                    default VESA %08X\n"
@@ -803,6 +1363,9 @@ void cli_fn_help()
 	       "     --help-res                  Shows available values for res\n"
 	       "\n"
 	       , program_invocation_short_name, gst_audio_en, DEFAULT_RSTP_PORT,
+		   prewarm_player, use_builtin_player, jitter_latency, idr_interval,
+		   use_rtp_frontend, CTL_RTP_DEFAULT_RCVBUF, rtcp_interval,
+		   probe_decoder, probe_headroom,
 		   wfd_supported_res_cea, wfd_supported_res_vesa, wfd_supported_res_hh
 	       );
 	/*
@@ -811,6 +1374,95 @@ void cli_fn_help()
 	 */
 }
 
+/*
+ * Decoder Probe
+ * Don't advertise modes the decoder can't keep up with. 640x480p60 is
+ * mandatory, so it stays no matter what.
+ */
+
+static bool probe_supports_fn(int hres, int vres, int fps, void *data)
+{
+	uint64_t max = ctl_probe_fps(&probe, hres, vres);
+
+	return max * 100 >= (uint64_t)fps * (100 + probe_headroom);
+}
+
+static void probe_resolutions(void)
+{
+	int r;
+
+	r = ctl_probe_run(&probe, NULL, probe_refresh);
+	if (r == -EOPNOTSUPP) {
+		return;
+	} else if (r < 0) {
+		cli_warning("cannot probe decoders (%d), advertising all resolutions",
+			    r);
+		return;
+	}
+
+	have_probe = true;
+	vfd_filter_resolutions(&wfd_supported_res_cea,
+			       &wfd_supported_res_vesa,
+			       &wfd_supported_res_hh,
+			       probe_supports_fn,
+			       NULL);
+	wfd_supported_res_cea |= 0x1;
+
+	cli_notice("decoder %s: %u fps at 1920x1080, advertising CEA %08X VESA %08X HH %08X",
+		   probe.decoder, ctl_probe_fps(&probe, 1920, 1080),
+		   wfd_supported_res_cea, wfd_supported_res_vesa,
+		   wfd_supported_res_hh);
+}
+
+/*
+ * HIDC
+ * Find out what the HID devices we were given are, so we can advertise
+ * them. Devices we can't use are left out. The reports are passed through
+ * by miracle-uibcctl later on.
+ */
+
+static int probe_hid_devices(void)
+{
+	struct uibc_hidraw *hid;
+	char caps[256] = "", cap[64];
+	unsigned int i, n = 0;
+	int r;
+
+	for (i = 0; i < uibc_hid_n; ++i) {
+		r = uibc_hidraw_open(&hid, uibc_hid_devs[i]);
+		if (r < 0) {
+			cli_warning("cannot use HID device %s (%d)",
+				    uibc_hid_devs[i], r);
+			continue;
+		}
+
+		snprintf(cap, sizeof(cap), "%s/%s",
+			 uibc_hidc_type_to_str(hid->type),
+			 uibc_hidc_path_to_str(hid->path));
+		uibc_hidraw_free(hid);
+
+		if (!strstr(caps, cap) &&
+		    strlen(caps) + strlen(cap) + 2 < sizeof(caps)) {
+			if (*caps)
+				strcat(caps, ", ");
+			strcat(caps, cap);
+		}
+
+		uibc_hid_devs[n++] = uibc_hid_devs[i];
+	}
+
+	uibc_hid_n = n;
+	if (n) {
+		uibc_hidc_cap_list = strdup(caps);
+		if (!uibc_hidc_cap_list)
+			return cli_ENOMEM();
+
+		cli_notice("advertising HIDC %s", caps);
+	}
+
+	return 0;
+}
+
 static int ctl_interactive(char **argv, int argc)
 {
 	int r;
@@ -819,11 +1471,65 @@ static int ctl_interactive(char **argv, int argc)
 	if (r < 0)
 		return r;
 
+	/*
+	 * The sink picks up the resolution masks on creation. The probe
+	 * measures the decoders of the built-in player, it says nothing about
+	 * what an external player uses.
+	 */
+	if (probe_decoder && use_builtin_player && !external_player)
+		probe_resolutions();
+
+	if (uibc_option) {
+		r = probe_hid_devices();
+		if (r < 0)
+			goto error;
+	}
+
 	r = ctl_sink_new(&sink, cli_event);
 	if (r < 0)
 		goto error;
         sink->protocol_extensions = protocol_extensions;
 
+	if (use_rtp_frontend) {
+		if (!rtp_relay_port)
+			rtp_relay_port = rstp_port + 2;
+
+		r = ctl_rtp_new(&rtp, cli_event, rstp_port, rtp_rcvbuf);
+		if (r < 0)
+			cli_warning("cannot open RTP receiver (%d), players receive directly",
+				    r);
+	}
+
+	if (rtp && rtcp_interval) {
+		r = ctl_rtp_set_rtcp(rtp, rtcp_interval);
+		if (r < 0)
+			cli_warning("cannot open RTCP port (%d), no receiver reports",
+				    r);
+		else
+			rtcp_port = rstp_port + 1;
+	}
+
+	if (use_builtin_player && !external_player) {
+		struct ctl_player_config config = {
+			.rtp = rtp,
+			.port = rstp_port,
+			.audio = gst_audio_en,
+			.latency = jitter_latency,
+			.decoder = have_probe ? probe.decoder : NULL,
+		};
+
+		if (gst_scale_res)
+			sscanf(gst_scale_res, "%dx%d",
+			       &config.scale_hres, &config.scale_vres);
+
+		r = ctl_player_new(&builtin, cli_event, &config);
+		if (r < 0 && r != -EOPNOTSUPP)
+			cli_warning("cannot create built-in player (%d), using external player",
+				    r);
+	}
+
+	player_prewarm();
+
 	r = ctl_wifi_fetch(wifi);
 	if (r < 0)
 		goto error;
@@ -837,6 +1543,11 @@ static int ctl_interactive(char **argv, int argc)
 	r = cli_run();
 
 error:
+	player_stop();
+	ctl_player_free(builtin);
+	builtin = NULL;
+	ctl_rtp_free(rtp);
+	rtp = NULL;
 	ctl_sink_free(sink);
 	cli_destroy();
 	return r;
@@ -858,6 +1569,9 @@ static int ctl_main(int argc, char *argv[])
 	if (r < 0)
 		return r;
 
+	/* we are a sink, only ever deal with WFD sources */
+	ctl_wifi_set_wfd_filter(wifi, WFD_CAP_SOURCE);
+
    left = argc - optind;
    left = left <= 0 ? 0 : left;
 	r = ctl_interactive(argv + optind, left);
@@ -880,6 +1594,7 @@ static int parse_argv(int argc, char *argv[])
 		ARG_LOG_LEVEL,
 		ARG_LOG_TIME,
 		ARG_LOG_DATE_TIME,
+		ARG_LOG_ASYNC,
 		ARG_JOURNAL_LEVEL,
 		ARG_GST_DEBUG,
 		ARG_AUDIO,
@@ -887,6 +1602,19 @@ static int parse_argv(int argc, char *argv[])
 		ARG_RES,
 		ARG_HELP_RES,
 		ARG_UIBC,
+		ARG_UIBC_RATE,
+		ARG_UIBC_HID,
+		ARG_PREWARM,
+		ARG_BUILTIN_PLAYER,
+		ARG_LATENCY,
+		ARG_IDR_INTERVAL,
+		ARG_RTP_FRONTEND,
+		ARG_RTP_RELAY_PORT,
+		ARG_RTP_RCVBUF,
+		ARG_RTCP_INTERVAL,
+		ARG_PROBE,
+		ARG_PROBE_REFRESH,
+		ARG_PROBE_HEADROOM,
       ARG_HELP_COMMANDS,
 	};
 	static const struct option options[] = {
@@ -896,6 +1624,7 @@ static int parse_argv(int argc, char *argv[])
 		{ "log-level",		required_argument,	NULL,	ARG_LOG_LEVEL },
 		{ "log-time",	        no_argument,		NULL,	ARG_LOG_TIME },
 		{ "log-date-time",	no_argument,		NULL,	ARG_LOG_DATE_TIME },
+		{ "log-async",		no_argument,		NULL,	ARG_LOG_ASYNC },
 		{ "log-journal-level",	required_argument,	NULL,	ARG_JOURNAL_LEVEL },
 		{ "gst-debug",	required_argument,	NULL,	ARG_GST_DEBUG },
 		{ "audio",	required_argument,	NULL,	ARG_AUDIO },
@@ -904,10 +1633,23 @@ static int parse_argv(int argc, char *argv[])
 		{ "help-res",	no_argument,	NULL,	ARG_HELP_RES },
 		{ "port",		required_argument,	NULL,	'p' },
 		{ "uibc",		no_argument,		NULL,	ARG_UIBC },
+		{ "uibc-rate",		required_argument,	NULL,	ARG_UIBC_RATE },
+		{ "uibc-hid",		required_argument,	NULL,	ARG_UIBC_HID },
 		{ "external-player",		required_argument,		NULL,	'e' },
+		{ "prewarm",		required_argument,	NULL,	ARG_PREWARM },
+		{ "builtin-player",	required_argument,	NULL,	ARG_BUILTIN_PLAYER },
+		{ "latency",		required_argument,	NULL,	ARG_LATENCY },
+		{ "idr-interval",	required_argument,	NULL,	ARG_IDR_INTERVAL },
+		{ "rtp-frontend",	required_argument,	NULL,	ARG_RTP_FRONTEND },
+		{ "rtp-relay-port",	required_argument,	NULL,	ARG_RTP_RELAY_PORT },
+		{ "rtp-rcvbuf",		required_argument,	NULL,	ARG_RTP_RCVBUF },
+		{ "rtcp-interval",	required_argument,	NULL,	ARG_RTCP_INTERVAL },
+		{ "probe",		required_argument,	NULL,	ARG_PROBE },
+		{ "probe-refresh",	no_argument,		NULL,	ARG_PROBE_REFRESH },
+		{ "probe-headroom",	required_argument,	NULL,	ARG_PROBE_HEADROOM },
 		{}
 	};
-	int c;
+	int c, r;
 
 	uibc_option = false;
 	uibc_enabled = false;
@@ -936,6 +1678,11 @@ static int parse_argv(int argc, char *argv[])
 		case ARG_LOG_DATE_TIME:
 			log_date_time = true;
 			break;
+		case ARG_LOG_ASYNC:
+			r = log_async_start();
+			if (r < 0)
+				cli_warning("cannot start async logging (%d)", r);
+			break;
 		case ARG_GST_DEBUG:
 			gst_debug = optarg;
 			break;
@@ -964,6 +1711,49 @@ static int parse_argv(int argc, char *argv[])
 		case ARG_UIBC:
 			uibc_option = true;
 			break;
+		case ARG_UIBC_RATE:
+			uibc_rate = strtoul(optarg, NULL, 10);
+			break;
+		case ARG_UIBC_HID:
+			if (uibc_hid_n >= UIBC_MAX_HID) {
+				cli_error("at most %d HID devices", UIBC_MAX_HID);
+				return -EINVAL;
+			}
+			uibc_hid_devs[uibc_hid_n++] = optarg;
+			break;
+		case ARG_PREWARM:
+			prewarm_player = atoi(optarg);
+			break;
+		case ARG_BUILTIN_PLAYER:
+			use_builtin_player = atoi(optarg);
+			break;
+		case ARG_LATENCY:
+			jitter_latency = strtoul(optarg, NULL, 10);
+			break;
+		case ARG_IDR_INTERVAL:
+			idr_interval = strtoul(optarg, NULL, 10);
+			break;
+		case ARG_RTP_FRONTEND:
+			use_rtp_frontend = atoi(optarg);
+			break;
+		case ARG_RTP_RELAY_PORT:
+			rtp_relay_port = atoi(optarg);
+			break;
+		case ARG_RTP_RCVBUF:
+			rtp_rcvbuf = strtoul(optarg, NULL, 10);
+			break;
+		case ARG_RTCP_INTERVAL:
+			rtcp_interval = strtoul(optarg, NULL, 10);
+			break;
+		case ARG_PROBE:
+			probe_decoder = atoi(optarg);
+			break;
+		case ARG_PROBE_REFRESH:
+			probe_refresh = true;
+			break;
+		case ARG_PROBE_HEADROOM:
+			probe_headroom = strtoul(optarg, NULL, 10);
+			break;
 		case '?':
 			return -EINVAL;
 		}
@@ -1057,6 +1847,7 @@ int main(int argc, char **argv)
 	}
 
 	r = ctl_main(argc, argv);
+	free(uibc_hidc_cap_list);
    g_strfreev(autocmds_free);
    if (free_argv) {
       free(argv);
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include "ctl.h"
+#include "wfd.h"
 
 struct resolution_bitmap {
 	int index;
@@ -168,7 +169,34 @@ void vfd_dump_resolutions(uint32_t cea_mask, uint32_t vesa_mask, uint32_t hh_mas
 	}
 }
 
-int vfd_get_cea_resolution(uint32_t mask, int *hres, int *vres)
+static uint32_t filter_table(const struct resolution_bitmap *table,
+			     uint32_t mask,
+			     vfd_resolution_fn fn,
+			     void *data)
+{
+	int i;
+
+	for (i = 0; table[i].hres != 0; i++)
+		if ((1 << table[i].index) & mask &&
+		    !fn(table[i].hres, table[i].vres, table[i].fps, data))
+			mask &= ~(1 << table[i].index);
+
+	return mask;
+}
+
+/* drop every mode from the masks @fn returns false for */
+void vfd_filter_resolutions(uint32_t *cea_mask,
+			    uint32_t *vesa_mask,
+			    uint32_t *hh_mask,
+			    vfd_resolution_fn fn,
+			    void *data)
+{
+	*cea_mask = filter_table(resolutions_cea, *cea_mask, fn, data);
+	*vesa_mask = filter_table(resolutions_vesa, *vesa_mask, fn, data);
+	*hh_mask = filter_table(resolutions_hh, *hh_mask, fn, data);
+}
+
+int vfd_get_cea_resolution(uint32_t mask, int *hres, int *vres, int *fps)
 {
 	int i;
 
@@ -179,13 +207,14 @@ int vfd_get_cea_resolution(uint32_t mask, int *hres, int *vres)
 		if ((1 << resolutions_cea[i].index) & mask) {
 			*vres = resolutions_cea[i].vres;
 			*hres = resolutions_cea[i].hres;
+			*fps = resolutions_cea[i].fps;
 			return 0;
 		}
 	}
 	return -EINVAL;
 }
 
-int vfd_get_vesa_resolution(uint32_t mask, int *hres, int *vres)
+int vfd_get_vesa_resolution(uint32_t mask, int *hres, int *vres, int *fps)
 {
 	int i;
 
@@ -196,13 +225,14 @@ int vfd_get_vesa_resolution(uint32_t mask, int *hres, int *vres)
 		if ((1 << resolutions_vesa[i].index) & mask) {
 			*vres = resolutions_vesa[i].vres;
 			*hres = resolutions_vesa[i].hres;
+			*fps = resolutions_vesa[i].fps;
 			return 0;
 		}
 	}
 	return -EINVAL;
 }
 
-int vfd_get_hh_resolution(uint32_t mask, int *hres, int *vres)
+int vfd_get_hh_resolution(uint32_t mask, int *hres, int *vres, int *fps)
 {
 	int i;
 
@@ -213,6 +243,7 @@ int vfd_get_hh_resolution(uint32_t mask, int *hres, int *vres)
 		if ((1 << resolutions_hh[i].index) & mask) {
 			*vres = resolutions_hh[i].vres;
 			*hres = resolutions_hh[i].hres;
+			*fps = resolutions_hh[i].fps;
 			return 0;
 		}
 	}
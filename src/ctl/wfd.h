@@ -21,9 +21,16 @@
 #ifndef WFD_H
 #define WFD_H
 
+typedef bool (*vfd_resolution_fn) (int hres, int vres, int fps, void *data);
+
 void wfd_print_resolutions(char * prefix);
-int vfd_get_cea_resolution(uint32_t mask, int *hres, int *vres);
-int vfd_get_vesa_resolution(uint32_t mask, int *hres, int *vres);
-int vfd_get_hh_resolution(uint32_t mask, int *hres, int *vres);
+void vfd_filter_resolutions(uint32_t *cea_mask,
+			    uint32_t *vesa_mask,
+			    uint32_t *hh_mask,
+			    vfd_resolution_fn fn,
+			    void *data);
+int vfd_get_cea_resolution(uint32_t mask, int *hres, int *vres, int *fps);
+int vfd_get_vesa_resolution(uint32_t mask, int *hres, int *vres, int *fps);
+int vfd_get_hh_resolution(uint32_t mask, int *hres, int *vres, int *fps);
 
 #endif /* WFD_H */
@@ -19,6 +19,7 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <locale.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -197,8 +198,7 @@ static int cmd_show(char **args, unsigned int n)
 			cli_command_printf("LocalAddress=%s\n", p->local_address);
 		if (p->remote_address && *p->remote_address)
 			cli_command_printf("RemoteAddress=%s\n", p->remote_address);
-		if (p->wfd_subelements && *p->wfd_subelements)
-			cli_command_printf("WfdSubelements=%s\n", p->wfd_subelements);
+		cli_print_peer_wfd(p);
 	} else {
 		cli_command_printf("Show what?\n");
 		return 0;
@@ -396,6 +396,161 @@ static int cmd_disconnect(char **args, unsigned int n)
 	return ctl_peer_disconnect(p);
 }
 
+/*
+ * cmd: metrics
+ */
+
+static int print_metrics_hist(const char *name, sd_bus_message *m)
+{
+	uint64_t count, sum, max, bound, n;
+	int r;
+
+	r = sd_bus_message_read(m, "ttt", &count, &sum, &max);
+	if (r < 0)
+		return cli_log_parser(r);
+
+	cli_command_printf("%s.Count=%" PRIu64 "\n", name, count);
+	cli_command_printf("%s.AverageUsec=%" PRIu64 "\n",
+			   name, count ? sum / count : 0);
+	cli_command_printf("%s.MaxUsec=%" PRIu64 "\n", name, max);
+
+	r = sd_bus_message_enter_container(m, 'a', "(tt)");
+	if (r < 0)
+		return cli_log_parser(r);
+
+	while ((r = sd_bus_message_read(m, "(tt)", &bound, &n)) > 0) {
+		if (bound == UINT64_MAX)
+			cli_command_printf("%s.Above=%" PRIu64 "\n", name, n);
+		else
+			cli_command_printf("%s.Below%" PRIu64 "=%" PRIu64 "\n",
+					   name, bound, n);
+	}
+	if (r < 0)
+		return cli_log_parser(r);
+
+	r = sd_bus_message_exit_container(m);
+	if (r < 0)
+		return cli_log_parser(r);
+
+	return 0;
+}
+
+/* a{st} or a{su}, depending on @wide */
+static int print_metrics_map(const char *name, sd_bus_message *m, bool wide)
+{
+	const char *entry = wide ? "st" : "su", *key;
+	uint64_t t;
+	uint32_t u;
+	int r;
+
+	r = sd_bus_message_enter_container(m, 'a', wide ? "{st}" : "{su}");
+	if (r < 0)
+		return cli_log_parser(r);
+
+	while ((r = sd_bus_message_enter_container(m, 'e', entry)) > 0) {
+		if (wide) {
+			r = sd_bus_message_read(m, "st", &key, &t);
+		} else {
+			r = sd_bus_message_read(m, "su", &key, &u);
+			t = u;
+		}
+		if (r < 0)
+			return cli_log_parser(r);
+
+		cli_command_printf("%s[%s]=%" PRIu64 "\n", name, key, t);
+
+		r = sd_bus_message_exit_container(m);
+		if (r < 0)
+			return cli_log_parser(r);
+	}
+	if (r < 0)
+		return cli_log_parser(r);
+
+	r = sd_bus_message_exit_container(m);
+	if (r < 0)
+		return cli_log_parser(r);
+
+	return 0;
+}
+
+static int cmd_metrics(char **args, unsigned int n)
+{
+	_sd_bus_message_unref_ sd_bus_message *m = NULL;
+	_sd_bus_error_free_ sd_bus_error err = SD_BUS_ERROR_NULL;
+	const char *name, *sig;
+	uint64_t t;
+	uint32_t u;
+	int r;
+
+	r = sd_bus_call_method(bus,
+			       "org.freedesktop.miracle.wifi",
+			       "/org/freedesktop/miracle/wifi",
+			       "org.freedesktop.DBus.Properties",
+			       "GetAll",
+			       &err,
+			       &m,
+			       "s",
+			       "org.freedesktop.miracle.wifi.Metrics");
+	if (r < 0) {
+		cli_error("cannot retrieve metrics: %s",
+			  bus_error_message(&err, r));
+		return 0;
+	}
+
+	r = sd_bus_message_enter_container(m, 'a', "{sv}");
+	if (r < 0)
+		return cli_log_parser(r);
+
+	while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+		r = sd_bus_message_read(m, "s", &name);
+		if (r < 0)
+			return cli_log_parser(r);
+
+		r = sd_bus_message_peek_type(m, NULL, &sig);
+		if (r < 0)
+			return cli_log_parser(r);
+
+		r = sd_bus_message_enter_container(m, 'v', sig);
+		if (r < 0)
+			return cli_log_parser(r);
+
+		if (!strcmp(sig, "t")) {
+			r = sd_bus_message_read(m, "t", &t);
+			if (r >= 0)
+				cli_command_printf("%s=%" PRIu64 "\n", name, t);
+		} else if (!strcmp(sig, "u")) {
+			r = sd_bus_message_read(m, "u", &u);
+			if (r >= 0)
+				cli_command_printf("%s=%u\n", name, u);
+		} else if (!strcmp(sig, "a{st}") || !strcmp(sig, "a{su}")) {
+			r = print_metrics_map(name, m, sig[3] == 't');
+		} else if (!strcmp(sig, "(ttta(tt))")) {
+			r = sd_bus_message_enter_container(m, 'r', "ttta(tt)");
+			if (r >= 0)
+				r = print_metrics_hist(name, m);
+			if (r >= 0)
+				r = sd_bus_message_exit_container(m);
+		} else {
+			/* newer daemon, skip what we don't know */
+			r = sd_bus_message_skip(m, sig);
+		}
+		if (r < 0)
+			return cli_log_parser(r);
+
+		r = sd_bus_message_exit_container(m);
+		if (r < 0)
+			return cli_log_parser(r);
+
+		r = sd_bus_message_exit_container(m);
+		if (r < 0)
+			return cli_log_parser(r);
+	}
+	if (r < 0)
+		return cli_log_parser(r);
+
+	return 0;
+}
+
 /*
  * cmd: quit/exit
  */
@@ -419,6 +574,7 @@ static const struct cli_cmd cli_cmds[] = {
 	{ "p2p-scan",		"[link] [stop]",			CLI_Y,	CLI_LESS,	2,	cmd_p2p_scan,		"Control neighborhood P2P scanning", {links_generator, NULL} },
 	{ "connect",		"<peer> [provision] [pin]",		CLI_M,	CLI_LESS,	3,	cmd_connect,		"Connect to peer", {peers_generator, NULL} },
 	{ "disconnect",		"<peer>",				CLI_M,	CLI_EQUAL,	1,	cmd_disconnect,		"Disconnect from peer", {peers_generator, NULL} },
+	{ "metrics",		NULL,					CLI_M,	CLI_EQUAL,	0,	cmd_metrics,		"Dump runtime metrics of the daemon", {NULL} },
 	{ "quit",		NULL,					CLI_Y,	CLI_MORE,	0,	cmd_quit,		"Quit program", {NULL} },
 	{ "exit",		NULL,					CLI_Y,	CLI_MORE,	0,	cmd_quit,		NULL , {NULL}},
 	{ "help",		NULL,					CLI_M,	CLI_MORE,	0,	NULL,			"Print help" , {NULL} },
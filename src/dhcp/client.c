@@ -153,6 +153,7 @@ struct _GDHCPClient {
 	time_t last_request;
 	uint32_t expire;
 	bool retransmit;
+	bool rapid_commit;
 	struct timeval start_time;
 };
 
@@ -450,6 +451,13 @@ static int send_discover(GDHCPClient *dhcp_client, uint32_t requested)
 	 * some buggy DHCP servers to NOT send bigger packets */
 	dhcp_add_option_uint16(&packet, DHCP_MAX_SIZE, 576);
 
+	/* RFC 4039: allow the server to answer with an ACK right away */
+	if (dhcp_client->rapid_commit) {
+		uint8_t rapid_commit[] = { DHCP_RAPID_COMMIT, 0 };
+
+		dhcp_add_binary_option(&packet, rapid_commit);
+	}
+
 	add_request_options(dhcp_client, &packet);
 
 	add_send_options(dhcp_client, &packet);
@@ -1597,12 +1605,12 @@ static void start_request(GDHCPClient *dhcp_client)
 							NULL);
 }
 
-static uint32_t get_lease(struct dhcp_packet *packet, uint16_t packet_len)
+static uint32_t get_lease(const struct dhcp_option_index *idx)
 {
 	uint8_t *option;
 	uint32_t lease_seconds;
 
-	option = dhcp_get_option(packet, packet_len, DHCP_LEASE_TIME);
+	option = dhcp_option_index_get(idx, DHCP_LEASE_TIME);
 	if (!option)
 		return 3600;
 
@@ -2187,8 +2195,8 @@ static void get_dhcpv6_request(GDHCPClient *dhcp_client,
 	}
 }
 
-static void get_request(GDHCPClient *dhcp_client, struct dhcp_packet *packet,
-		uint16_t packet_len)
+static void get_request(GDHCPClient *dhcp_client,
+		const struct dhcp_option_index *idx)
 {
 	GDHCPOptionType type;
 	GList *list, *value_list;
@@ -2199,7 +2207,7 @@ static void get_request(GDHCPClient *dhcp_client, struct dhcp_packet *packet,
 	for (list = dhcp_client->request_list; list; list = list->next) {
 		code = (uint8_t) GPOINTER_TO_INT(list->data);
 
-		option = dhcp_get_option(packet, packet_len, code);
+		option = dhcp_option_index_get(idx, code);
 		if (!option) {
 			g_hash_table_remove(dhcp_client->code_value_hash,
 						GINT_TO_POINTER((int) code));
@@ -2226,11 +2234,44 @@ static void get_request(GDHCPClient *dhcp_client, struct dhcp_packet *packet,
 	}
 }
 
+static void handle_ack(GDHCPClient *dhcp_client, struct dhcp_packet *packet,
+		const struct dhcp_option_index *idx)
+{
+	uint8_t *option;
+
+	dhcp_client->retry_times = 0;
+
+	remove_timeouts(dhcp_client);
+
+	dhcp_client->lease_seconds = get_lease(idx);
+
+	get_request(dhcp_client, idx);
+
+	switch_listening_mode(dhcp_client, L_NONE);
+
+	g_free(dhcp_client->assigned_ip);
+	dhcp_client->assigned_ip = get_ip(packet->yiaddr);
+
+	if (dhcp_client->state == REBOOTING) {
+		option = dhcp_option_index_get(idx, DHCP_SERVER_ID);
+		if (option)
+			dhcp_client->server_ip = get_be32(option);
+	}
+
+	/* Address should be set up here */
+	if (dhcp_client->lease_available_cb)
+		dhcp_client->lease_available_cb(dhcp_client,
+				dhcp_client->lease_available_data);
+
+	start_bound(dhcp_client);
+}
+
 static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 							gpointer user_data)
 {
 	GDHCPClient *dhcp_client = user_data;
 	struct dhcp_packet packet;
+	struct dhcp_option_index idx;
 	struct dhcpv6_packet *packet6 = NULL;
 	uint8_t *message_type = NULL, *client_id = NULL, *option,
 		*server_id = NULL;
@@ -2270,6 +2311,7 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 		} else {
 			re = dhcp_recv_l3_packet(&packet,
 						dhcp_client->listener_sockfd);
+			pkt_len = (uint16_t)(unsigned int)re;
 			xid = packet.xid;
 		}
 	} else if (dhcp_client->listen_mode == L_ARP) {
@@ -2319,7 +2361,12 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 			dhcp_client->status_code = status;
 		}
 	} else {
-		message_type = dhcp_get_option(&packet, pkt_len, DHCP_MESSAGE_TYPE);
+		if (dhcp_option_index_build(&idx, &packet, pkt_len) < 0) {
+			debug(dhcp_client, "malformed DHCP packet, discarding");
+			return TRUE;
+		}
+
+		message_type = dhcp_option_index_get(&idx, DHCP_MESSAGE_TYPE);
 		if (!message_type)
 			return TRUE;
 	}
@@ -2333,14 +2380,34 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 
 	switch (dhcp_client->state) {
 	case INIT_SELECTING:
+		if (*message_type == DHCPACK && dhcp_client->rapid_commit &&
+		    dhcp_option_index_get(&idx, DHCP_RAPID_COMMIT)) {
+			option = dhcp_option_index_get(&idx, DHCP_SERVER_ID);
+			if (!option)
+				return TRUE;
+
+			debug(dhcp_client, "rapid commit ACK received");
+
+			dhcp_client->server_ip = get_be32(option);
+			dhcp_client->requested_ip = ntohl(packet.yiaddr);
+			dhcp_client->state = REQUESTING;
+
+			handle_ack(dhcp_client, &packet, &idx);
+
+			return TRUE;
+		}
+
 		if (*message_type != DHCPOFFER)
 			return TRUE;
 
+		option = dhcp_option_index_get(&idx, DHCP_SERVER_ID);
+		if (!option)
+			return TRUE;
+
 		remove_timeouts(dhcp_client);
 		dhcp_client->timeout = 0;
 		dhcp_client->retry_times = 0;
 
-		option = dhcp_get_option(&packet, pkt_len, DHCP_SERVER_ID);
 		dhcp_client->server_ip = get_be32(option);
 		dhcp_client->requested_ip = ntohl(packet.yiaddr);
 
@@ -2354,31 +2421,7 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 	case RENEWING:
 	case REBINDING:
 		if (*message_type == DHCPACK) {
-			dhcp_client->retry_times = 0;
-
-			remove_timeouts(dhcp_client);
-
-			dhcp_client->lease_seconds = get_lease(&packet, pkt_len);
-
-			get_request(dhcp_client, &packet, pkt_len);
-
-			switch_listening_mode(dhcp_client, L_NONE);
-
-			g_free(dhcp_client->assigned_ip);
-			dhcp_client->assigned_ip = get_ip(packet.yiaddr);
-
-			if (dhcp_client->state == REBOOTING) {
-				option = dhcp_get_option(&packet, pkt_len,
-							DHCP_SERVER_ID);
-				dhcp_client->server_ip = get_be32(option);
-			}
-
-			/* Address should be set up here */
-			if (dhcp_client->lease_available_cb)
-				dhcp_client->lease_available_cb(dhcp_client,
-					dhcp_client->lease_available_data);
-
-			start_bound(dhcp_client);
+			handle_ack(dhcp_client, &packet, &idx);
 		} else if (*message_type == DHCPNAK) {
 			dhcp_client->retry_times = 0;
 
@@ -3171,6 +3214,14 @@ void g_dhcp_client_unref(GDHCPClient *dhcp_client)
 	g_free(dhcp_client);
 }
 
+void g_dhcp_client_set_rapid_commit(GDHCPClient *dhcp_client, bool enable)
+{
+	if (!dhcp_client)
+		return;
+
+	dhcp_client->rapid_commit = enable;
+}
+
 void g_dhcp_client_set_debug(GDHCPClient *dhcp_client,
 				GDHCPDebugFunc func, gpointer user_data)
 {
@@ -39,6 +39,7 @@
 
 #include "gdhcp.h"
 #include "common.h"
+#include "shl_csum.h"
 
 static const DHCPOption client_options[] = {
 	{ OPTION_IP,			0x01 }, /* subnet-mask */
@@ -71,78 +72,91 @@ GDHCPOptionType dhcp_get_code_type(uint8_t code)
 	return OPTION_UNKNOWN;
 }
 
-uint8_t *dhcp_get_option(struct dhcp_packet *packet, uint16_t packet_len, int code)
+static int index_option_area(struct dhcp_option_index *idx,
+				uint8_t *area, size_t size, uint8_t *overload)
 {
-	int len, rem;
-	uint8_t *optionptr, *options_end;
-	size_t options_len;
-	uint8_t overload = 0;
+	size_t i = 0, len;
+	uint8_t code, type;
 
 	/* option bytes: [code][len][data1][data2]..[dataLEN] */
-	optionptr = packet->options;
-	rem = sizeof(packet->options);
-	options_len = packet_len - (sizeof(*packet) - sizeof(packet->options));
-	options_end = optionptr + options_len - 1;
-
-	while (1) {
-		if ((rem <= 0) && (optionptr + OPT_CODE > options_end))
-			/* Bad packet, malformed option field */
-			return NULL;
-
-		if (optionptr[OPT_CODE] == DHCP_PADDING) {
-			rem--;
-			optionptr++;
+	while (i < size) {
+		code = area[i + OPT_CODE];
 
+		if (code == DHCP_PADDING) {
+			i++;
 			continue;
 		}
 
-		if (optionptr[OPT_CODE] == DHCP_END) {
-			if (overload & FILE_FIELD) {
-				overload &= ~FILE_FIELD;
+		if (code == DHCP_END)
+			return 0;
 
-				optionptr = packet->file;
-				rem = sizeof(packet->file);
+		if (i + OPT_DATA > size)
+			/* bad packet, length field is OOB */
+			return -EBADMSG;
 
-				continue;
-			} else if (overload & SNAME_FIELD) {
-				overload &= ~SNAME_FIELD;
+		len = area[i + OPT_LEN];
+		if (i + OPT_DATA + len > size)
+			/* bad packet, option length points OOB */
+			return -EBADMSG;
 
-				optionptr = packet->sname;
-				rem = sizeof(packet->sname);
+		/* first occurrence wins, drop options too short for their type */
+		type = dhcp_get_code_type(code) & OPTION_TYPE_MASK;
+		if (!idx->offset[code] && len >= dhcp_option_lengths[type])
+			idx->offset[code] = area + i - (uint8_t *) idx->packet;
 
-				continue;
-			}
+		if (overload && code == DHCP_OPTION_OVERLOAD && len > 0)
+			*overload = area[i + OPT_DATA];
 
-			break;
-		}
+		i += OPT_DATA + len;
+	}
 
-		if (optionptr + OPT_LEN > options_end) {
-			/* bad packet, would read length field from OOB */
-			return NULL;
-		}
+	/* tolerate a missing DHCP_END, the area size bounds the scan */
+	return 0;
+}
+
+/*
+ * Walk all option areas of @packet once, including @file and @sname if they
+ * are overloaded, and remember the offset of the first occurrence of each
+ * option code. Returns -EBADMSG if the packet is malformed, in which case it
+ * must be dropped.
+ */
+int dhcp_option_index_build(struct dhcp_option_index *idx,
+				struct dhcp_packet *packet, uint16_t packet_len)
+{
+	size_t header_len, options_len;
+	uint8_t overload = 0;
+	int err;
 
-		len = 2 + optionptr[OPT_LEN];
+	memset(idx, 0, sizeof(*idx));
+	idx->packet = packet;
 
-		rem -= len;
-		if (rem < 0)
-			continue; /* complain and return NULL */
-
-		if (optionptr[OPT_CODE] == code) {
-			if (optionptr + len > options_end) {
-				/* bad packet, option length points OOB */
-				return NULL;
-			} else {
-				return optionptr + OPT_DATA;
-			}
-		}
+	header_len = sizeof(*packet) - sizeof(packet->options);
+	if (packet_len <= header_len)
+		return -EBADMSG;
 
-		if (optionptr[OPT_CODE] == DHCP_OPTION_OVERLOAD)
-			overload |= optionptr[OPT_DATA];
+	options_len = packet_len - header_len;
+	if (options_len > sizeof(packet->options))
+		options_len = sizeof(packet->options);
 
-		optionptr += len;
+	err = index_option_area(idx, packet->options, options_len, &overload);
+	if (err < 0)
+		return err;
+
+	if (overload & FILE_FIELD) {
+		err = index_option_area(idx, packet->file,
+					sizeof(packet->file), NULL);
+		if (err < 0)
+			return err;
 	}
 
-	return NULL;
+	if (overload & SNAME_FIELD) {
+		err = index_option_area(idx, packet->sname,
+					sizeof(packet->sname), NULL);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
 }
 
 int dhcp_end_option(uint8_t *optionptr)
@@ -420,28 +434,7 @@ uint16_t dhcp_checksum(void *addr, int count)
 	 * Compute Internet Checksum for "count" bytes
 	 * beginning at location "addr".
 	 */
-	int32_t sum = 0;
-	uint16_t *source = (uint16_t *) addr;
-
-	while (count > 1)  {
-		/*  This is the inner loop */
-		sum += *source++;
-		count -= 2;
-	}
-
-	/*  Add left-over byte, if any */
-	if (count > 0) {
-		/* Make sure that the left-over byte is added correctly both
-		 * with little and big endian hosts */
-		uint16_t tmp = 0;
-		*(uint8_t *) &tmp = *(uint8_t *) source;
-		sum += tmp;
-	}
-	/*  Fold 32-bit sum to 16 bits */
-	while (sum >> 16)
-		sum = (sum & 0xffff) + (sum >> 16);
-
-	return ~sum;
+	return shl_csum(addr, count);
 }
 
 #define IN6ADDR_ALL_DHCP_RELAY_AGENTS_AND_SERVERS_MC_INIT \
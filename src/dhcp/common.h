@@ -106,6 +106,7 @@ struct dhcpv6_packet {
 #define DHCP_MAX_SIZE		0x39
 #define DHCP_VENDOR		0x3c
 #define DHCP_CLIENT_ID		0x3d
+#define DHCP_RAPID_COMMIT	0x50	/* RFC 4039 */
 #define DHCP_END		0xff
 
 #define OPT_CODE		0
@@ -170,7 +171,39 @@ static const uint8_t dhcp_option_lengths[] = {
 	[OPTION_U32]	= 4,
 };
 
-uint8_t *dhcp_get_option(struct dhcp_packet *packet, uint16_t packet_len, int code);
+/*
+ * Option index of a received packet, built by a single validating pass over
+ * all option areas. Offsets are relative to @packet and point to the option
+ * code byte, 0 means the option is absent.
+ */
+struct dhcp_option_index {
+	struct dhcp_packet *packet;
+	uint16_t offset[256];
+};
+
+int dhcp_option_index_build(struct dhcp_option_index *idx,
+				struct dhcp_packet *packet, uint16_t packet_len);
+
+static inline uint8_t *dhcp_option_index_get(
+				const struct dhcp_option_index *idx,
+				uint8_t code)
+{
+	if (!idx->offset[code])
+		return NULL;
+
+	return (uint8_t *) idx->packet + idx->offset[code] + OPT_DATA;
+}
+
+static inline uint8_t dhcp_option_index_len(
+				const struct dhcp_option_index *idx,
+				uint8_t code)
+{
+	if (!idx->offset[code])
+		return 0;
+
+	return ((uint8_t *) idx->packet)[idx->offset[code] + OPT_LEN];
+}
+
 uint8_t *dhcpv6_get_option(struct dhcpv6_packet *packet, uint16_t pkt_len,
 			int code, uint16_t *option_len, int *option_count);
 uint8_t *dhcpv6_get_sub_option(unsigned char *option, uint16_t max_len,
@@ -27,19 +27,19 @@
  *
  * This program implements a DHCP server and daemon. See --help for usage
  * information. We build on gdhcp from connman as the underlying DHCP protocol
- * implementation. To configure network devices, we actually invoke the "ip"
- * binary.
+ * implementation. To configure network devices, we talk rtnetlink directly
+ * (see rtnl.c) and only fall back to invoking the "ip" binary if no rtnetlink
+ * socket can be opened.
  *
  * Note that this is a gross hack! We don't intend to provide a fully functional
  * DHCP server or client here. This is only a replacement for the current lack
  * of Wifi-P2P support in common network managers. Once they gain proper
  * support, we will drop this helper!
  *
- * The "ip" invocation is quite fragile and ugly. However, performing these
- * steps directly involves netlink operations and more. As no-one came up with
- * patches, yet, we keep the hack. To anyone trying to fix it: Please, spend
- * this time hacking on NetworkManager, connman and friends instead! If they
- * gain Wifi-P2P support, this whole thing will get trashed.
+ * The "ip" fallback is quite fragile and ugly, and it blocks the main-loop
+ * until the child exited. Please, spend your time hacking on NetworkManager,
+ * connman and friends instead of extending it! If they gain Wifi-P2P support,
+ * this whole thing will get trashed.
  */
 
 #define LOG_SUBSYSTEM "dhcp"
@@ -64,6 +64,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include "gdhcp.h"
+#include "rtnl.h"
 #include "shl_log.h"
 #include "config.h"
 
@@ -89,11 +90,21 @@ struct manager {
 	GIOChannel *sfd_chan;
 	guint sfd_id;
 
+	struct rtnl *rtnl;
+	GIOChannel *rtnl_chan;
+	guint rtnl_id;
+
 	GDHCPClient *client;
 	char *client_addr;
+	char *client_local;
+	char *client_subnet;
+	char *client_dns;
+	char *client_gateway;
 
 	GDHCPServer *server;
 	char *server_addr;
+
+	int error;
 };
 
 /*
@@ -246,6 +257,62 @@ static int add_if_addr(const char *addr)
 	return 0;
 }
 
+/*
+ * Replace all IPv4 addresses on @arg_netdev with @addr. This is done via
+ * rtnetlink if available and @fn is called once the kernel acknowledged the
+ * change. Without rtnetlink, we fall back to the "ip" binary and call @fn
+ * synchronously.
+ */
+static int set_if_addr(struct manager *m, const char *addr, rtnl_fn fn)
+{
+	int r;
+
+	if (m->rtnl) {
+		log_info("setting local if-addr %s", addr);
+		return rtnl_set_addr(m->rtnl, addr, fn, m);
+	}
+
+	r = flush_if_addr();
+	if (r >= 0)
+		r = add_if_addr(addr);
+
+	fn(NULL, r, m);
+	return 0;
+}
+
+/* synchronous flush, used during teardown when the main-loop is gone */
+static void reset_if_addr(struct manager *m)
+{
+	int r;
+
+	if (!m->rtnl) {
+		flush_if_addr();
+		return;
+	}
+
+	/*
+	 * Replies to requests still in flight get dispatched while we wait.
+	 * Their callbacks would start the server or write to the comm-socket
+	 * of a manager that is being torn down, so drop them first.
+	 */
+	rtnl_detach(m->rtnl);
+
+	log_info("flushing local if-addr");
+	r = rtnl_flush_addr(m->rtnl, NULL, NULL);
+	if (r >= 0)
+		r = rtnl_wait(m->rtnl, 1000);
+	if (r < 0)
+		log_error("cannot flush local if-addr (%d): %s",
+			  r, strerror(-r));
+}
+
+static void manager_fail(struct manager *m, int error)
+{
+	if (!m->error)
+		m->error = error;
+	g_main_loop_quit(m->loop);
+}
+
 int if_name_to_index(const char *name)
 {
 	struct ifreq ifr;
@@ -275,6 +342,42 @@ static void sig_dummy(int sig)
 {
 }
 
+static int dup_lease_value(char **out, const char *value)
+{
+	char *v = NULL;
+
+	if (value) {
+		v = strdup(value);
+		if (!v)
+			return log_ENOMEM();
+	}
+
+	free(*out);
+	*out = v;
+	return 0;
+}
+
+static void client_addr_fn(struct rtnl *rtnl, int error, void *data)
+{
+	struct manager *m = data;
+
+	if (error < 0) {
+		log_error("cannot set parameters on local interface %s (%d): %s",
+			  arg_netdev, error, strerror(-error));
+		manager_fail(m, error);
+		return;
+	}
+
+	log_debug("successfully set local if-addr %s", m->client_addr);
+
+	writef_comm("L:%s", m->client_local);
+	writef_comm("S:%s", m->client_subnet);
+	if (m->client_dns)
+		writef_comm("D:%s", m->client_dns);
+	if (m->client_gateway)
+		writef_comm("G:%s", m->client_gateway);
+}
+
 static void client_lease_fn(GDHCPClient *client, gpointer data)
 {
 	struct manager *m = data;
@@ -327,26 +430,22 @@ static void client_lease_fn(GDHCPClient *client, gpointer data)
 		free(m->client_addr);
 		m->client_addr = a;
 
-		r = flush_if_addr();
-		if (r < 0) {
-			log_error("cannot flush addr on local interface %s",
-				  arg_netdev);
+		r = dup_lease_value(&m->client_local, addr);
+		if (r >= 0)
+			r = dup_lease_value(&m->client_subnet, subnet);
+		if (r >= 0)
+			r = dup_lease_value(&m->client_dns, dns);
+		if (r >= 0)
+			r = dup_lease_value(&m->client_gateway, gateway);
+		if (r < 0)
 			goto error;
-		}
 
-		r = add_if_addr(m->client_addr);
+		r = set_if_addr(m, m->client_addr, client_addr_fn);
 		if (r < 0) {
 			log_error("cannot set parameters on local interface %s",
 				  arg_netdev);
 			goto error;
 		}
-
-		writef_comm("L:%s", addr);
-		writef_comm("S:%s", subnet);
-		if (dns)
-			writef_comm("D:%s", dns);
-		if (gateway)
-			writef_comm("G:%s", gateway);
 	}
 
 	g_free(addr);
@@ -406,6 +505,28 @@ static gboolean manager_signal_fn(GIOChannel *chan, GIOCondition mask,
 	return FALSE;
 }
 
+static gboolean manager_rtnl_fn(GIOChannel *chan, GIOCondition mask,
+				gpointer data)
+{
+	struct manager *m = data;
+	int r;
+
+	if (mask & (G_IO_HUP | G_IO_ERR)) {
+		manager_fail(m, log_EPIPE());
+		m->rtnl_id = 0;
+		return FALSE;
+	}
+
+	r = rtnl_dispatch(m->rtnl);
+	if (r < 0) {
+		manager_fail(m, r);
+		m->rtnl_id = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 static void manager_free(struct manager *m)
 {
 	if (!m)
@@ -416,12 +537,17 @@ static void manager_free(struct manager *m)
 			g_dhcp_client_stop(m->client);
 
 			if (m->client_addr) {
-				flush_if_addr();
+				reset_if_addr(m);
 				free(m->client_addr);
 			}
 
 			g_dhcp_client_unref(m->client);
 		}
+
+		free(m->client_local);
+		free(m->client_subnet);
+		free(m->client_dns);
+		free(m->client_gateway);
 	} else {
 		if (m->server) {
 			g_dhcp_server_stop(m->server);
@@ -430,11 +556,19 @@ static void manager_free(struct manager *m)
 		}
 
 		if (m->server_addr) {
-			flush_if_addr();
+			reset_if_addr(m);
 			free(m->server_addr);
 		}
 	}
 
+	if (m->rtnl) {
+		if (m->rtnl_id)
+			g_source_remove(m->rtnl_id);
+		if (m->rtnl_chan)
+			g_io_channel_unref(m->rtnl_chan);
+		rtnl_free(m->rtnl);
+	}
+
 	if (m->sfd >= 0) {
 		g_source_remove(m->sfd_id);
 		g_io_channel_unref(m->sfd_chan);
@@ -461,7 +595,6 @@ static int manager_new(struct manager **out)
 	sigset_t mask;
 	struct sigaction sig;
 	GDHCPClientError cerr;
-	GDHCPServerError serr;
 	struct manager *m;
 
 	m = calloc(1, sizeof(*m));
@@ -515,6 +648,26 @@ static int manager_new(struct manager **out)
 				   manager_signal_fn,
 				   m);
 
+	r = rtnl_new(&m->rtnl, m->ifindex);
+	if (r < 0) {
+		log_warning("cannot open rtnetlink socket (%d): %s, falling back to '%s'",
+			    r, strerror(-r), arg_ip_binary);
+		m->rtnl = NULL;
+
+		if (access(arg_ip_binary, X_OK) < 0) {
+			log_error("execution of ip-binary (%s) not allowed: %m",
+				  arg_ip_binary);
+			r = -EINVAL;
+			goto error;
+		}
+	} else {
+		m->rtnl_chan = g_io_channel_unix_new(rtnl_get_fd(m->rtnl));
+		m->rtnl_id = g_io_add_watch(m->rtnl_chan,
+					    G_IO_HUP | G_IO_ERR | G_IO_IN,
+					    manager_rtnl_fn,
+					    m);
+	}
+
 	if (!arg_server) {
 		m->client = g_dhcp_client_new(G_DHCP_IPV4, m->ifindex,
 					      &cerr);
@@ -559,6 +712,7 @@ static int manager_new(struct manager **out)
 		g_dhcp_client_set_request(m->client, G_DHCP_SUBNET);
 		g_dhcp_client_set_request(m->client, G_DHCP_DNS_SERVER);
 		g_dhcp_client_set_request(m->client, G_DHCP_ROUTER);
+		g_dhcp_client_set_rapid_commit(m->client, true);
 
 		g_dhcp_client_register_event(m->client,
 					     G_DHCP_CLIENT_EVENT_LEASE_AVAILABLE,
@@ -572,98 +726,119 @@ static int manager_new(struct manager **out)
 			r = log_ENOMEM();
 			goto error;
 		}
+	}
 
-		r = flush_if_addr();
-		if (r < 0) {
-			log_error("cannot flush addr on local interface %s",
-				  arg_netdev);
-			goto error;
-		}
+	*out = m;
+	return 0;
 
-		r = add_if_addr(m->server_addr);
-		if (r < 0) {
-			log_error("cannot set parameters on local interface %s",
-				  arg_netdev);
-			goto error;
-		}
+error:
+	manager_free(m);
+	return r;
+}
 
-		m->server = g_dhcp_server_new(G_DHCP_IPV4, m->ifindex,
-					      &serr, server_event_fn, m);
-		if (!m->server) {
-			r = -EINVAL;
+static int manager_start_server(struct manager *m)
+{
+	GDHCPServerError serr;
+	int r;
 
-			switch(serr) {
-			case G_DHCP_SERVER_ERROR_INTERFACE_UNAVAILABLE:
-				log_error("cannot create GDHCP server: interface %s unavailable",
-					  arg_netdev);
-				break;
-			case G_DHCP_SERVER_ERROR_INTERFACE_IN_USE:
-				log_error("cannot create GDHCP server: interface %s in use",
-					  arg_netdev);
-				break;
-			case G_DHCP_SERVER_ERROR_INTERFACE_DOWN:
-				log_error("cannot create GDHCP server: interface %s down",
-					  arg_netdev);
-				break;
-			case G_DHCP_SERVER_ERROR_NOMEM:
-				r = log_ENOMEM();
-				break;
-			case G_DHCP_SERVER_ERROR_INVALID_INDEX:
-				log_error("cannot create GDHCP server: invalid interface %s",
-					  arg_netdev);
-				break;
-			case G_DHCP_SERVER_ERROR_INVALID_OPTION:
-				log_error("cannot create GDHCP server: invalid options");
-				break;
-			case G_DHCP_SERVER_ERROR_IP_ADDRESS_INVALID:
-				log_error("cannot create GDHCP server: invalid ip address");
-				break;
-			default:
-				log_error("cannot create GDHCP server (%d)",
-					  serr);
-				break;
-			}
+	m->server = g_dhcp_server_new(G_DHCP_IPV4, m->ifindex,
+				      &serr, server_event_fn, m);
+	if (!m->server) {
+		r = -EINVAL;
 
-			goto error;
+		switch(serr) {
+		case G_DHCP_SERVER_ERROR_INTERFACE_UNAVAILABLE:
+			log_error("cannot create GDHCP server: interface %s unavailable",
+				  arg_netdev);
+			break;
+		case G_DHCP_SERVER_ERROR_INTERFACE_IN_USE:
+			log_error("cannot create GDHCP server: interface %s in use",
+				  arg_netdev);
+			break;
+		case G_DHCP_SERVER_ERROR_INTERFACE_DOWN:
+			log_error("cannot create GDHCP server: interface %s down",
+				  arg_netdev);
+			break;
+		case G_DHCP_SERVER_ERROR_NOMEM:
+			r = log_ENOMEM();
+			break;
+		case G_DHCP_SERVER_ERROR_INVALID_INDEX:
+			log_error("cannot create GDHCP server: invalid interface %s",
+				  arg_netdev);
+			break;
+		case G_DHCP_SERVER_ERROR_INVALID_OPTION:
+			log_error("cannot create GDHCP server: invalid options");
+			break;
+		case G_DHCP_SERVER_ERROR_IP_ADDRESS_INVALID:
+			log_error("cannot create GDHCP server: invalid ip address");
+			break;
+		default:
+			log_error("cannot create GDHCP server (%d)",
+				  serr);
+			break;
 		}
 
-		g_dhcp_server_set_debug(m->server, server_log_fn, NULL);
-		g_dhcp_server_set_lease_time(m->server, 60 * 60);
+		return r;
+	}
 
-		r = g_dhcp_server_set_option(m->server, G_DHCP_SUBNET,
-					     arg_subnet);
-		if (r != 0) {
-			log_vERR(r);
-			goto error;
-		}
+	g_dhcp_server_set_debug(m->server, server_log_fn, NULL);
+	g_dhcp_server_set_lease_time(m->server, 60 * 60);
+	g_dhcp_server_set_rapid_commit(m->server, true);
 
-		r = g_dhcp_server_set_option(m->server, G_DHCP_ROUTER,
-					     arg_gateway);
-		if (r != 0) {
-			log_vERR(r);
-			goto error;
-		}
+	r = g_dhcp_server_set_option(m->server, G_DHCP_SUBNET,
+				     arg_subnet);
+	if (r != 0) {
+		log_vERR(r);
+		return r;
+	}
 
-		r = g_dhcp_server_set_option(m->server, G_DHCP_DNS_SERVER,
-					     arg_dns);
-		if (r != 0) {
-			log_vERR(r);
-			goto error;
-		}
+	r = g_dhcp_server_set_option(m->server, G_DHCP_ROUTER,
+				     arg_gateway);
+	if (r != 0) {
+		log_vERR(r);
+		return r;
+	}
 
-		r = g_dhcp_server_set_ip_range(m->server, arg_from, arg_to);
-		if (r != 0) {
-			log_vERR(r);
-			goto error;
-		}
+	r = g_dhcp_server_set_option(m->server, G_DHCP_DNS_SERVER,
+				     arg_dns);
+	if (r != 0) {
+		log_vERR(r);
+		return r;
 	}
 
-	*out = m;
+	r = g_dhcp_server_set_ip_range(m->server, arg_from, arg_to);
+	if (r != 0) {
+		log_vERR(r);
+		return r;
+	}
+
+	r = g_dhcp_server_start(m->server);
+	if (r != 0) {
+		log_error("cannot start DHCP server: %d", r);
+		return -EFAULT;
+	}
+
+	writef_comm("L:%s", arg_local);
 	return 0;
+}
 
-error:
-	manager_free(m);
-	return r;
+static void server_addr_fn(struct rtnl *rtnl, int error, void *data)
+{
+	struct manager *m = data;
+	int r;
+
+	if (error < 0) {
+		log_error("cannot set parameters on local interface %s (%d): %s",
+			  arg_netdev, error, strerror(-error));
+		manager_fail(m, error);
+		return;
+	}
+
+	log_debug("successfully set local if-addr %s", m->server_addr);
+
+	r = manager_start_server(m);
+	if (r < 0)
+		manager_fail(m, r);
 }
 
 static int manager_run(struct manager *m)
@@ -672,7 +847,7 @@ static int manager_run(struct manager *m)
 
 	if (!arg_server) {
 		log_info("running dhcp client on %s via '%s'",
-			 arg_netdev, arg_ip_binary);
+			 arg_netdev, m->rtnl ? "rtnetlink" : arg_ip_binary);
 
 		r = g_dhcp_client_start(m->client, NULL);
 		if (r != 0) {
@@ -681,20 +856,24 @@ static int manager_run(struct manager *m)
 		}
 	} else {
 		log_info("running dhcp server on %s via '%s'",
-			 arg_netdev, arg_ip_binary);
+			 arg_netdev, m->rtnl ? "rtnetlink" : arg_ip_binary);
 
-		r = g_dhcp_server_start(m->server);
-		if (r != 0) {
-			log_error("cannot start DHCP server: %d", r);
-			return -EFAULT;
+		/* the server is started once the local address is set */
+		r = set_if_addr(m, m->server_addr, server_addr_fn);
+		if (r < 0) {
+			log_error("cannot set parameters on local interface %s",
+				  arg_netdev);
+			return r;
 		}
-
-		writef_comm("L:%s", arg_local);
 	}
 
+	/* the ip-binary fallback reports failures synchronously */
+	if (m->error)
+		return m->error;
+
 	g_main_loop_run(m->loop);
 
-	return 0;
+	return m->error;
 }
 
 static int make_address(char *buf, const char *prefix, const char *suffix,
@@ -753,7 +932,8 @@ static int help(void)
 	       "     --log-date-time        Prefix log-messages with date time\n"
 	       "\n"
 	       "     --netdev <dev>         Network device to run on\n"
-	       "     --ip-binary <path>     Path to 'ip' binary [default: "XSTR(IP_BINARY)"]\n"
+	       "     --ip-binary <path>     Path to 'ip' binary, used if rtnetlink is\n"
+	       "                            unavailable [default: "XSTR(IP_BINARY)"]\n"
 	       "     --comm-fd <int>        Comm-socket FD passed through execve()\n"
 	       "\n"
 	       "Server Options:\n"
@@ -882,12 +1062,6 @@ static int parse_argv(int argc, char *argv[])
 		return -EINVAL;
 	}
 
-	if (access(arg_ip_binary, X_OK) < 0) {
-		log_error("execution of ip-binary (%s) not allowed: %m",
-			  arg_ip_binary);
-		return -EINVAL;
-	}
-
 	if (!arg_server) {
 		if (prefix || local || gateway ||
 		    dns || subnet || from || to) {
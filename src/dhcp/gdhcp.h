@@ -158,6 +158,7 @@ int g_dhcp_client_get_index(GDHCPClient *client);
 
 void g_dhcp_client_set_debug(GDHCPClient *client,
 				GDHCPDebugFunc func, gpointer user_data);
+void g_dhcp_client_set_rapid_commit(GDHCPClient *client, bool enable);
 int g_dhcpv6_create_duid(GDHCPDuidType duid_type, int index, int type,
 			unsigned char **duid, int *duid_len);
 int g_dhcpv6_client_set_duid(GDHCPClient *dhcp_client, unsigned char *duid,
@@ -225,6 +226,7 @@ void g_dhcp_server_set_lease_time(GDHCPServer *dhcp_server,
 						unsigned int lease_time);
 void g_dhcp_server_set_save_lease(GDHCPServer *dhcp_server,
 				GDHCPSaveLeaseFunc func, gpointer user_data);
+void g_dhcp_server_set_rapid_commit(GDHCPServer *dhcp_server, bool enable);
 #ifdef __cplusplus
 }
 #endif
@@ -70,6 +70,7 @@ struct _GDHCPServer {
 	gpointer debug_data;
 	g_dhcp_event_fn event_fn;
 	void *fn_data;
+	bool rapid_commit;
 };
 
 struct dhcp_lease {
@@ -418,7 +419,8 @@ error:
 }
 
 
-static uint8_t check_packet_type(struct dhcp_packet *packet, uint16_t packet_len)
+static uint8_t check_packet_type(struct dhcp_packet *packet,
+				const struct dhcp_option_index *idx)
 {
 	uint8_t *type;
 
@@ -428,7 +430,7 @@ static uint8_t check_packet_type(struct dhcp_packet *packet, uint16_t packet_len
 	if (packet->op != BOOTREQUEST)
 		return 0;
 
-	type = dhcp_get_option(packet, packet_len, DHCP_MESSAGE_TYPE);
+	type = dhcp_option_index_get(idx, DHCP_MESSAGE_TYPE);
 
 	if (!type)
 		return 0;
@@ -538,6 +540,20 @@ static void send_packet_to_client(GDHCPServer *dhcp_server,
 		dhcp_server->ifindex);
 }
 
+static uint32_t select_nip(GDHCPServer *dhcp_server,
+			struct dhcp_packet *client_packet,
+				struct dhcp_lease *lease,
+					uint32_t requested_nip)
+{
+	if (lease)
+		return lease->lease_nip;
+	else if (check_requested_nip(dhcp_server, requested_nip))
+		return requested_nip;
+	else
+		return find_free_or_expired_nip(dhcp_server,
+						client_packet->chaddr);
+}
+
 static void send_offer(GDHCPServer *dhcp_server,
 			struct dhcp_packet *client_packet,
 				struct dhcp_lease *lease,
@@ -548,13 +564,8 @@ static void send_offer(GDHCPServer *dhcp_server,
 
 	init_packet(dhcp_server, &packet, client_packet, DHCPOFFER);
 
-	if (lease)
-		packet.yiaddr = htonl(lease->lease_nip);
-	else if (check_requested_nip(dhcp_server, requested_nip))
-		packet.yiaddr = htonl(requested_nip);
-	else
-		packet.yiaddr = htonl(find_free_or_expired_nip(
-					dhcp_server, client_packet->chaddr));
+	packet.yiaddr = htonl(select_nip(dhcp_server, client_packet,
+					lease, requested_nip));
 
 	debug(dhcp_server, "find yiaddr %u", packet.yiaddr);
 
@@ -596,7 +607,8 @@ static void save_lease(GDHCPServer *dhcp_server)
 }
 
 static void send_ACK(GDHCPServer *dhcp_server,
-		struct dhcp_packet *client_packet, uint32_t dest)
+		struct dhcp_packet *client_packet, uint32_t dest,
+			bool rapid_commit)
 {
 	struct dhcp_packet packet;
 	uint32_t lease_time_sec;
@@ -609,6 +621,12 @@ static void send_ACK(GDHCPServer *dhcp_server,
 
 	dhcp_add_option_uint32(&packet, DHCP_LEASE_TIME, lease_time_sec);
 
+	if (rapid_commit) {
+		uint8_t option[] = { DHCP_RAPID_COMMIT, 0 };
+
+		dhcp_add_binary_option(&packet, option);
+	}
+
 	add_server_options(dhcp_server, &packet);
 
 	addr.s_addr = htonl(dest);
@@ -625,6 +643,24 @@ static void send_ACK(GDHCPServer *dhcp_server,
 				      dhcp_server->fn_data);
 }
 
+/* RFC 4039: answer a DISCOVER directly with an ACK and commit the lease */
+static void send_rapid_ACK(GDHCPServer *dhcp_server,
+			struct dhcp_packet *client_packet,
+				struct dhcp_lease *lease,
+					uint32_t requested_nip)
+{
+	uint32_t nip;
+
+	nip = select_nip(dhcp_server, client_packet, lease, requested_nip);
+	if (!nip) {
+		debug(dhcp_server, "Err: No free IP addresses. ACK abandoned");
+		return;
+	}
+
+	debug(dhcp_server, "Rapid commit, skipping OFFER");
+	send_ACK(dhcp_server, client_packet, nip, true);
+}
+
 static void send_NAK(GDHCPServer *dhcp_server,
 			struct dhcp_packet *client_packet)
 {
@@ -655,6 +691,7 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 {
 	GDHCPServer *dhcp_server = user_data;
 	struct dhcp_packet packet;
+	struct dhcp_option_index idx;
 	struct dhcp_lease *lease;
 	uint32_t requested_nip = 0;
 	uint8_t type, *server_id_option, *request_ip_option;
@@ -671,11 +708,16 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 		return TRUE;
 	packet_len = (uint16_t)(unsigned int)re;
 
-	type = check_packet_type(&packet, packet_len);
+	if (dhcp_option_index_build(&idx, &packet, packet_len) < 0) {
+		debug(dhcp_server, "Received malformed packet");
+		return TRUE;
+	}
+
+	type = check_packet_type(&packet, &idx);
 	if (type == 0)
 		return TRUE;
 
-	server_id_option = dhcp_get_option(&packet, packet_len, DHCP_SERVER_ID);
+	server_id_option = dhcp_option_index_get(&idx, DHCP_SERVER_ID);
 	if (server_id_option) {
 		uint32_t server_nid = get_be32(server_id_option);
 
@@ -683,7 +725,7 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 			return TRUE;
 	}
 
-	request_ip_option = dhcp_get_option(&packet, packet_len, DHCP_REQUESTED_IP);
+	request_ip_option = dhcp_option_index_get(&idx, DHCP_REQUESTED_IP);
 	if (request_ip_option)
 		requested_nip = get_be32(request_ip_option);
 
@@ -693,6 +735,13 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 	case DHCPDISCOVER:
 		debug(dhcp_server, "Received DISCOVER");
 
+		if (dhcp_server->rapid_commit &&
+				dhcp_option_index_get(&idx, DHCP_RAPID_COMMIT)) {
+			send_rapid_ACK(dhcp_server, &packet, lease,
+							requested_nip);
+			break;
+		}
+
 		send_offer(dhcp_server, &packet, lease, requested_nip);
 		break;
 	case DHCPREQUEST:
@@ -713,7 +762,7 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 		if (lease && requested_nip == lease->lease_nip) {
 			debug(dhcp_server, "Sending ACK");
 			send_ACK(dhcp_server, &packet,
-				lease->lease_nip);
+				lease->lease_nip, false);
 			break;
 		}
 
@@ -904,6 +953,14 @@ void g_dhcp_server_set_lease_time(GDHCPServer *dhcp_server,
 	dhcp_server->lease_seconds = lease_time;
 }
 
+void g_dhcp_server_set_rapid_commit(GDHCPServer *dhcp_server, bool enable)
+{
+	if (!dhcp_server)
+		return;
+
+	dhcp_server->rapid_commit = enable;
+}
+
 void g_dhcp_server_set_debug(GDHCPServer *dhcp_server,
 				GDHCPDebugFunc func, gpointer user_data)
 {
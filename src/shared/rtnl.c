@@ -0,0 +1,642 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define LOG_SUBSYSTEM "rtnl"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtnl.h"
+#include "shl_dlist.h"
+#include "shl_log.h"
+
+#define RTNL_BUFSIZE 8192
+
+struct rtnl_addr {
+	struct in_addr local;
+	struct in_addr address;
+	unsigned char prefixlen;
+};
+
+struct rtnl_op {
+	struct shl_dlist list;
+	uint32_t seq;
+
+	rtnl_fn fn;
+	void *data;
+	int error;
+
+	/* flush: dump all addresses, then delete each of them */
+	bool flush;
+	bool dumping;
+	struct rtnl_addr *found;
+	size_t n_found;
+
+	/* final RTM_NEWADDR/RTM_DELADDR, sent once the flush is done */
+	uint16_t cmd;
+	struct in_addr addr;
+	unsigned char prefixlen;
+
+	unsigned int pending;
+	int ignore_err;
+};
+
+struct rtnl {
+	int fd;
+	int ifindex;
+	uint32_t seq;
+	struct shl_dlist ops;
+};
+
+static int rtnl_parse_addr(const char *str, struct in_addr *addr,
+			   unsigned char *prefixlen)
+{
+	char buf[INET_ADDRSTRLEN * 2];
+	struct in_addr mask;
+	char *prefix, *end;
+	unsigned long l;
+	uint32_t m;
+	int r;
+
+	if (strlen(str) >= sizeof(buf))
+		return -EINVAL;
+
+	strcpy(buf, str);
+	prefix = strchr(buf, '/');
+	if (prefix)
+		*prefix++ = 0;
+
+	r = inet_pton(AF_INET, buf, addr);
+	if (r != 1)
+		return -EINVAL;
+
+	if (!prefix) {
+		*prefixlen = 32;
+	} else if (strchr(prefix, '.')) {
+		r = inet_pton(AF_INET, prefix, &mask);
+		if (r != 1)
+			return -EINVAL;
+
+		m = ntohl(mask.s_addr);
+		l = __builtin_popcount(m);
+		if (l && m != ~0U << (32 - l))
+			return -EINVAL;
+		else if (!l && m)
+			return -EINVAL;
+
+		*prefixlen = l;
+	} else {
+		errno = 0;
+		l = strtoul(prefix, &end, 10);
+		if (errno || *end || end == prefix || l > 32)
+			return -EINVAL;
+
+		*prefixlen = l;
+	}
+
+	return 0;
+}
+
+static void rtnl_put_attr(struct nlmsghdr *nh, unsigned short type,
+			  const void *data, size_t len)
+{
+	struct rtattr *rta;
+
+	rta = (void*)((char*)nh + NLMSG_ALIGN(nh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+static int rtnl_send(struct rtnl *rtnl, struct nlmsghdr *nh)
+{
+	ssize_t l;
+
+	l = send(rtnl->fd, nh, nh->nlmsg_len, 0);
+	if (l < 0)
+		return -errno;
+	else if ((size_t)l != nh->nlmsg_len)
+		return -EIO;
+
+	return 0;
+}
+
+static int rtnl_send_dump(struct rtnl *rtnl, struct rtnl_op *op)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifaddrmsg ifa;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nh.nlmsg_type = RTM_GETADDR;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nh.nlmsg_seq = op->seq;
+	req.ifa.ifa_family = AF_INET;
+
+	return rtnl_send(rtnl, &req.nh);
+}
+
+static int rtnl_send_addr(struct rtnl *rtnl, struct rtnl_op *op,
+			  uint16_t cmd, const struct rtnl_addr *addr)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifaddrmsg ifa;
+		char attrs[2 * RTA_SPACE(sizeof(struct in_addr))];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nh.nlmsg_type = cmd;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	if (cmd == RTM_NEWADDR)
+		req.nh.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+	req.nh.nlmsg_seq = op->seq;
+	req.ifa.ifa_family = AF_INET;
+	req.ifa.ifa_prefixlen = addr->prefixlen;
+	req.ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+	req.ifa.ifa_index = rtnl->ifindex;
+
+	rtnl_put_attr(&req.nh, IFA_LOCAL, &addr->local,
+		      sizeof(addr->local));
+	rtnl_put_attr(&req.nh, IFA_ADDRESS, &addr->address,
+		      sizeof(addr->address));
+
+	return rtnl_send(rtnl, &req.nh);
+}
+
+static void rtnl_op_free(struct rtnl_op *op)
+{
+	if (!op)
+		return;
+
+	shl_dlist_unlink(&op->list);
+	free(op->found);
+	free(op);
+}
+
+static int rtnl_op_start(struct rtnl *rtnl, struct rtnl_op *op)
+{
+	struct rtnl_addr addr;
+	int r;
+
+	if (op->flush) {
+		r = rtnl_send_dump(rtnl, op);
+		if (r < 0)
+			return r;
+
+		op->dumping = true;
+	} else {
+		addr.local = op->addr;
+		addr.address = op->addr;
+		addr.prefixlen = op->prefixlen;
+
+		r = rtnl_send_addr(rtnl, op, op->cmd, &addr);
+		if (r < 0)
+			return r;
+
+		op->cmd = 0;
+		op->pending = 1;
+	}
+
+	return 0;
+}
+
+static void rtnl_op_complete(struct rtnl *rtnl, struct rtnl_op *op);
+
+static void rtnl_op_step(struct rtnl *rtnl, struct rtnl_op *op)
+{
+	struct rtnl_addr addr;
+	size_t i;
+	int r;
+
+	if (op->dumping || op->pending)
+		return;
+
+	if (op->n_found && !op->error) {
+		/* flush: delete everything we found during the dump */
+		op->ignore_err = -EADDRNOTAVAIL;
+		for (i = 0; i < op->n_found; ++i) {
+			r = rtnl_send_addr(rtnl, op, RTM_DELADDR,
+					   &op->found[i]);
+			if (r < 0) {
+				op->error = r;
+				break;
+			}
+
+			++op->pending;
+		}
+
+		free(op->found);
+		op->found = NULL;
+		op->n_found = 0;
+
+		if (op->pending)
+			return;
+	}
+
+	if (op->cmd && !op->error) {
+		op->ignore_err = 0;
+		addr.local = op->addr;
+		addr.address = op->addr;
+		addr.prefixlen = op->prefixlen;
+
+		r = rtnl_send_addr(rtnl, op, op->cmd, &addr);
+		op->cmd = 0;
+		if (r < 0) {
+			op->error = r;
+		} else {
+			op->pending = 1;
+			return;
+		}
+	}
+
+	rtnl_op_complete(rtnl, op);
+}
+
+static void rtnl_op_complete(struct rtnl *rtnl, struct rtnl_op *op)
+{
+	struct rtnl_op *next;
+	rtnl_fn fn = op->fn, fn_next;
+	void *data = op->data, *data_next;
+	int r, error = op->error;
+
+	rtnl_op_free(op);
+
+	/* start the next request before notifying, so callbacks can queue */
+	while (!shl_dlist_empty(&rtnl->ops)) {
+		next = shl_dlist_first_entry(&rtnl->ops, struct rtnl_op, list);
+		r = rtnl_op_start(rtnl, next);
+		if (r >= 0)
+			break;
+
+		log_error("cannot send rtnl request (%d): %s",
+			  r, strerror(-r));
+		fn_next = next->fn;
+		data_next = next->data;
+		rtnl_op_free(next);
+		if (fn_next)
+			fn_next(rtnl, r, data_next);
+	}
+
+	if (fn)
+		fn(rtnl, error, data);
+}
+
+static void rtnl_handle_addr(struct rtnl *rtnl, struct rtnl_op *op,
+			     struct nlmsghdr *nh)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+	struct rtnl_addr addr, *t;
+	struct rtattr *rta;
+	bool has_local = false, has_address = false;
+	int len;
+
+	if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
+		return;
+	if (ifa->ifa_family != AF_INET || (int)ifa->ifa_index != rtnl->ifindex)
+		return;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.prefixlen = ifa->ifa_prefixlen;
+
+	len = IFA_PAYLOAD(nh);
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (RTA_PAYLOAD(rta) != sizeof(struct in_addr))
+			continue;
+
+		if (rta->rta_type == IFA_LOCAL) {
+			memcpy(&addr.local, RTA_DATA(rta), sizeof(addr.local));
+			has_local = true;
+		} else if (rta->rta_type == IFA_ADDRESS) {
+			memcpy(&addr.address, RTA_DATA(rta),
+			       sizeof(addr.address));
+			has_address = true;
+		}
+	}
+
+	if (!has_local && !has_address)
+		return;
+	if (!has_local)
+		addr.local = addr.address;
+	if (!has_address)
+		addr.address = addr.local;
+
+	t = realloc(op->found, (op->n_found + 1) * sizeof(*t));
+	if (!t) {
+		op->error = log_ENOMEM();
+		return;
+	}
+
+	op->found = t;
+	op->found[op->n_found++] = addr;
+}
+
+static void rtnl_handle(struct rtnl *rtnl, struct nlmsghdr *nh)
+{
+	struct nlmsgerr *e;
+	struct rtnl_op *op;
+	int err;
+
+	if (shl_dlist_empty(&rtnl->ops))
+		return;
+
+	op = shl_dlist_first_entry(&rtnl->ops, struct rtnl_op, list);
+	if (nh->nlmsg_seq != op->seq)
+		return;
+
+	switch (nh->nlmsg_type) {
+	case NLMSG_DONE:
+		op->dumping = false;
+		break;
+	case NLMSG_ERROR:
+		if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*e))) {
+			err = -EPROTO;
+		} else {
+			e = NLMSG_DATA(nh);
+			err = e->error;
+		}
+
+		if (op->dumping)
+			op->dumping = false;
+		else if (op->pending)
+			--op->pending;
+
+		if (err < 0 && err != op->ignore_err && !op->error)
+			op->error = err;
+		break;
+	case RTM_NEWADDR:
+		if (op->dumping)
+			rtnl_handle_addr(rtnl, op, nh);
+		break;
+	}
+}
+
+static void rtnl_fail_all(struct rtnl *rtnl, int error)
+{
+	struct rtnl_op *op;
+	rtnl_fn fn;
+	void *data;
+
+	while (!shl_dlist_empty(&rtnl->ops)) {
+		op = shl_dlist_first_entry(&rtnl->ops, struct rtnl_op, list);
+		fn = op->fn;
+		data = op->data;
+		rtnl_op_free(op);
+
+		if (fn)
+			fn(rtnl, error, data);
+	}
+}
+
+int rtnl_dispatch(struct rtnl *rtnl)
+{
+	char buf[RTNL_BUFSIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct rtnl_op *op;
+	struct nlmsghdr *nh;
+	ssize_t l;
+	int len;
+
+	if (!rtnl)
+		return -EINVAL;
+
+	for (;;) {
+		l = recv(rtnl->fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (l < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return 0;
+
+			l = -errno;
+			log_error("cannot read from rtnl socket (%d): %s",
+				  (int)l, strerror(-l));
+			rtnl_fail_all(rtnl, l);
+			return l;
+		} else if (!l) {
+			return 0;
+		}
+
+		len = l;
+		for (nh = (void*)buf; NLMSG_OK(nh, len);
+		     nh = NLMSG_NEXT(nh, len))
+			rtnl_handle(rtnl, nh);
+
+		if (!shl_dlist_empty(&rtnl->ops)) {
+			op = shl_dlist_first_entry(&rtnl->ops,
+						   struct rtnl_op, list);
+			rtnl_op_step(rtnl, op);
+		}
+	}
+}
+
+int rtnl_wait(struct rtnl *rtnl, int timeout_ms)
+{
+	struct pollfd fd;
+	int r;
+
+	if (!rtnl)
+		return -EINVAL;
+
+	while (!rtnl_is_idle(rtnl)) {
+		fd.fd = rtnl->fd;
+		fd.events = POLLIN;
+		fd.revents = 0;
+
+		r = poll(&fd, 1, timeout_ms);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		} else if (!r) {
+			return -ETIMEDOUT;
+		}
+
+		r = rtnl_dispatch(rtnl);
+		if (r < 0)
+			return r;
+	}
+
+	return 0;
+}
+
+/*
+ * Forget the callbacks of all pending requests. The requests themselves still
+ * run to completion, so a later rtnl_wait() leaves the interface in the state
+ * they were queued for, but nothing is called back into the caller anymore.
+ */
+void rtnl_detach(struct rtnl *rtnl)
+{
+	struct shl_dlist *i;
+	struct rtnl_op *op;
+
+	if (!rtnl)
+		return;
+
+	shl_dlist_for_each(i, &rtnl->ops) {
+		op = shl_dlist_entry(i, struct rtnl_op, list);
+		op->fn = NULL;
+		op->data = NULL;
+	}
+}
+
+static int rtnl_queue(struct rtnl *rtnl, bool flush, uint16_t cmd,
+		      const char *addr, rtnl_fn fn, void *data)
+{
+	struct rtnl_op *op;
+	bool idle;
+	int r;
+
+	if (!rtnl)
+		return -EINVAL;
+
+	op = calloc(1, sizeof(*op));
+	if (!op)
+		return log_ENOMEM();
+
+	op->seq = ++rtnl->seq;
+	op->fn = fn;
+	op->data = data;
+	op->flush = flush;
+	op->cmd = cmd;
+
+	if (addr) {
+		r = rtnl_parse_addr(addr, &op->addr, &op->prefixlen);
+		if (r < 0) {
+			log_error("invalid interface address %s", addr);
+			free(op);
+			return r;
+		}
+	}
+
+	idle = rtnl_is_idle(rtnl);
+	shl_dlist_link_tail(&rtnl->ops, &op->list);
+
+	if (idle) {
+		r = rtnl_op_start(rtnl, op);
+		if (r < 0) {
+			rtnl_op_free(op);
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+int rtnl_flush_addr(struct rtnl *rtnl, rtnl_fn fn, void *data)
+{
+	return rtnl_queue(rtnl, true, 0, NULL, fn, data);
+}
+
+int rtnl_add_addr(struct rtnl *rtnl, const char *addr,
+		  rtnl_fn fn, void *data)
+{
+	return rtnl_queue(rtnl, false, RTM_NEWADDR, addr, fn, data);
+}
+
+int rtnl_del_addr(struct rtnl *rtnl, const char *addr,
+		  rtnl_fn fn, void *data)
+{
+	return rtnl_queue(rtnl, false, RTM_DELADDR, addr, fn, data);
+}
+
+int rtnl_set_addr(struct rtnl *rtnl, const char *addr,
+		  rtnl_fn fn, void *data)
+{
+	return rtnl_queue(rtnl, true, RTM_NEWADDR, addr, fn, data);
+}
+
+bool rtnl_is_idle(struct rtnl *rtnl)
+{
+	return !rtnl || shl_dlist_empty(&rtnl->ops);
+}
+
+int rtnl_get_fd(struct rtnl *rtnl)
+{
+	return rtnl ? rtnl->fd : -1;
+}
+
+int rtnl_new(struct rtnl **out, int ifindex)
+{
+	struct sockaddr_nl sa;
+	struct rtnl *rtnl;
+	int r;
+
+	if (!out || ifindex <= 0)
+		return -EINVAL;
+
+	rtnl = calloc(1, sizeof(*rtnl));
+	if (!rtnl)
+		return -ENOMEM;
+
+	rtnl->fd = -1;
+	rtnl->ifindex = ifindex;
+	rtnl->seq = time(NULL);
+	shl_dlist_init(&rtnl->ops);
+
+	rtnl->fd = socket(AF_NETLINK,
+			  SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			  NETLINK_ROUTE);
+	if (rtnl->fd < 0) {
+		r = -errno;
+		goto error;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	r = bind(rtnl->fd, (struct sockaddr*)&sa, sizeof(sa));
+	if (r < 0) {
+		r = -errno;
+		goto error;
+	}
+
+	*out = rtnl;
+	return 0;
+
+error:
+	rtnl_free(rtnl);
+	return r;
+}
+
+/* Pending requests are dropped silently, their callbacks are not invoked. */
+void rtnl_free(struct rtnl *rtnl)
+{
+	struct rtnl_op *op;
+
+	if (!rtnl)
+		return;
+
+	while (!shl_dlist_empty(&rtnl->ops)) {
+		op = shl_dlist_first_entry(&rtnl->ops, struct rtnl_op, list);
+		rtnl_op_free(op);
+	}
+
+	if (rtnl->fd >= 0)
+		close(rtnl->fd);
+	free(rtnl);
+}
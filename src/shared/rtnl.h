@@ -0,0 +1,62 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Minimal rtnetlink Helper
+ * miracle-dhcp and miracle-wifid need to flush and set IPv4 addresses on a
+ * single interface. This helper talks rtnetlink directly, so no "ip" process
+ * has to be spawned for each lease. All requests are asynchronous: they are
+ * queued on the socket and the completion callback is invoked once the kernel
+ * acknowledged every message of the request. Requests are completed in
+ * submission order.
+ *
+ * The caller owns the event-loop integration: watch rtnl_get_fd() for
+ * readability and call rtnl_dispatch() whenever it is readable.
+ */
+
+#ifndef MIRACLE_RTNL_H
+#define MIRACLE_RTNL_H
+
+#include <stdbool.h>
+
+struct rtnl;
+
+/* @error is 0 on success or a negative error code */
+typedef void (*rtnl_fn) (struct rtnl *rtnl, int error, void *data);
+
+int rtnl_new(struct rtnl **out, int ifindex);
+void rtnl_free(struct rtnl *rtnl);
+int rtnl_get_fd(struct rtnl *rtnl);
+bool rtnl_is_idle(struct rtnl *rtnl);
+
+int rtnl_dispatch(struct rtnl *rtnl);
+int rtnl_wait(struct rtnl *rtnl, int timeout_ms);
+void rtnl_detach(struct rtnl *rtnl);
+
+/*
+ * @addr is given as "<ipv4-addr>/<prefix>", where <prefix> is either a prefix
+ * length or a dotted netmask. A missing prefix means /32.
+ */
+int rtnl_flush_addr(struct rtnl *rtnl, rtnl_fn fn, void *data);
+int rtnl_add_addr(struct rtnl *rtnl, const char *addr,
+		  rtnl_fn fn, void *data);
+int rtnl_del_addr(struct rtnl *rtnl, const char *addr,
+		  rtnl_fn fn, void *data);
+int rtnl_set_addr(struct rtnl *rtnl, const char *addr,
+		  rtnl_fn fn, void *data);
+
+#endif /* MIRACLE_RTNL_H */
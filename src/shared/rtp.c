@@ -0,0 +1,336 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtp.h"
+
+#define RTP_SEQ_MOD (1U << 16)
+#define RTP_MAX_DROPOUT 3000
+#define RTP_MAX_MISORDER 100
+#define RTP_MIN_SEQUENTIAL 2
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint16_t get_be16(const uint8_t *p)
+{
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	       ((uint32_t)p[2] << 8) | p[3];
+}
+
+int rtp_parse_header(struct rtp_hdr *h, const void *pkt, size_t len)
+{
+	const uint8_t *p = pkt;
+	size_t off;
+
+	if (len < RTP_HEADER_SIZE)
+		return -EINVAL;
+	if ((p[0] >> 6) != RTP_VERSION)
+		return -EINVAL;
+
+	h->marker = p[1] & 0x80;
+	h->pt = p[1] & 0x7f;
+	h->seq = get_be16(p + 2);
+	h->ts = get_be32(p + 4);
+	h->ssrc = get_be32(p + 8);
+
+	/* CSRC list */
+	off = RTP_HEADER_SIZE + (p[0] & 0x0f) * 4;
+	if (off > len)
+		return -EINVAL;
+
+	/* header extension: 16bit profile, 16bit length in words */
+	if (p[0] & 0x10) {
+		if (off + 4 > len)
+			return -EINVAL;
+		off += 4 + get_be16(p + off + 2) * 4;
+		if (off > len)
+			return -EINVAL;
+	}
+
+	h->len = off;
+	return 0;
+}
+
+void rtp_stats_init(struct rtp_stats *st, uint32_t clock_rate)
+{
+	memset(st, 0, sizeof(*st));
+	st->clock_rate = clock_rate;
+}
+
+static void stats_init_seq(struct rtp_stats *st, uint16_t seq)
+{
+	st->base_seq = seq;
+	st->max_seq = seq;
+	st->bad_seq = RTP_SEQ_MOD + 1;	/* so seq == bad_seq is false */
+	st->cycles = 0;
+	st->received = 0;
+	st->expected_prior = 0;
+	st->received_prior = 0;
+}
+
+/* RFC 3550 A.1 update_seq(), returns true if the packet is valid */
+static bool stats_update_seq(struct rtp_stats *st, uint16_t seq)
+{
+	uint16_t udelta = seq - st->max_seq;
+
+	if (st->probation) {
+		/* packet is in sequence */
+		if (seq == (uint16_t)(st->max_seq + 1)) {
+			st->probation--;
+			st->max_seq = seq;
+			if (!st->probation) {
+				stats_init_seq(st, seq);
+				st->received++;
+				st->valid = true;
+				return true;
+			}
+		} else {
+			st->probation = RTP_MIN_SEQUENTIAL - 1;
+			st->max_seq = seq;
+		}
+		return false;
+	} else if (udelta < RTP_MAX_DROPOUT) {
+		/* in order, with permissible gap */
+		if (!udelta) {
+			++st->duplicates;
+		} else if (udelta > 1) {
+			++st->bursts;
+			st->last_burst = udelta - 1;
+			if (st->last_burst > st->max_burst)
+				st->max_burst = st->last_burst;
+		}
+
+		if (seq < st->max_seq)
+			st->cycles += RTP_SEQ_MOD;
+		st->max_seq = seq;
+	} else if (udelta <= RTP_SEQ_MOD - RTP_MAX_MISORDER) {
+		/* the sequence number made a very large jump */
+		if (seq == st->bad_seq) {
+			/* two sequential packets, assume the other side
+			 * restarted without telling us */
+			stats_init_seq(st, seq);
+		} else {
+			st->bad_seq = (seq + 1) & (RTP_SEQ_MOD - 1);
+			return false;
+		}
+	} else {
+		/* duplicate or reordered packet */
+		++st->reordered;
+	}
+
+	st->received++;
+	return true;
+}
+
+/* convert a wall-clock time in usec into timestamp units */
+static uint32_t stats_usec_to_ts(const struct rtp_stats *st, uint64_t usec)
+{
+	return (usec / 1000000ULL) * st->clock_rate +
+	       (usec % 1000000ULL) * st->clock_rate / 1000000ULL;
+}
+
+void rtp_stats_update(struct rtp_stats *st,
+		      const struct rtp_hdr *h,
+		      size_t len,
+		      uint64_t arrival)
+{
+	uint32_t transit;
+	int32_t d;
+
+	if (!st->probation && !st->valid) {
+		/* first packet of a new source */
+		st->ssrc = h->ssrc;
+		stats_init_seq(st, h->seq);
+		st->max_seq = h->seq - 1;
+		st->probation = RTP_MIN_SEQUENTIAL;
+	} else if (st->ssrc != h->ssrc) {
+		/* the source changed under us, start over */
+		rtp_stats_init(st, st->clock_rate);
+		rtp_stats_update(st, h, len, arrival);
+		return;
+	}
+
+	if (!stats_update_seq(st, h->seq))
+		return;
+
+	st->bytes += len;
+	st->last_arrival = arrival;
+	if (!st->first_arrival)
+		st->first_arrival = arrival;
+
+	/* RFC 3550 A.8 */
+	transit = stats_usec_to_ts(st, arrival) - h->ts;
+	if (st->received > 1) {
+		d = (int32_t)(transit - st->transit);
+		if (d < 0)
+			d = -d;
+		st->jitter += d - ((st->jitter + 8) >> 4);
+	}
+	st->transit = transit;
+}
+
+/* RFC 3550 A.3 and 6.4.1 */
+void rtp_stats_fill_rr(struct rtp_stats *st,
+		       struct rtcp_rr *rr,
+		       uint64_t now)
+{
+	uint64_t expected, expected_interval, received_interval;
+	int64_t lost, lost_interval;
+
+	memset(rr, 0, sizeof(*rr));
+	rr->ssrc = st->ssrc;
+	if (!st->valid)
+		return;
+
+	expected = rtp_stats_expected(st);
+	lost = rtp_stats_lost(st);
+	if (lost > 0x7fffff)
+		lost = 0x7fffff;
+	else if (lost < -0x800000)
+		lost = -0x800000;
+	rr->lost = lost;
+
+	expected_interval = expected - st->expected_prior;
+	received_interval = st->received - st->received_prior;
+	st->expected_prior = expected;
+	st->received_prior = st->received;
+
+	lost_interval = (int64_t)expected_interval - (int64_t)received_interval;
+	if (expected_interval && lost_interval > 0)
+		rr->fraction = (lost_interval << 8) / expected_interval;
+
+	rr->ext_max_seq = rtp_stats_ext_max_seq(st);
+	rr->jitter = rtp_stats_jitter(st);
+
+	if (st->sr_arrival) {
+		rr->lsr = st->lsr;
+		rr->dlsr = (now - st->sr_arrival) * 65536ULL / 1000000ULL;
+	}
+}
+
+void rtp_stats_handle_sr(struct rtp_stats *st, uint32_t lsr, uint64_t now)
+{
+	st->lsr = lsr;
+	st->sr_arrival = now;
+}
+
+/*
+ * Build a compound RR + SDES(CNAME) packet. Without @rr, the RR has no
+ * report block, which is what we send before any source showed up.
+ * Returns the length of the packet.
+ */
+int rtcp_build_rr(void *buf,
+		  size_t size,
+		  uint32_t ssrc,
+		  const struct rtcp_rr *rr,
+		  const char *cname)
+{
+	uint8_t *p = buf;
+	size_t clen, rlen, slen;
+
+	clen = strlen(cname);
+	if (clen > 255)
+		return -EINVAL;
+
+	rlen = rr ? 32 : 8;
+	/* header, SSRC, type, length, text, END; padded to 32bit */
+	slen = (8 + 2 + clen + 1 + 3) & ~3;
+	if (rlen + slen > size)
+		return -ENOBUFS;
+
+	memset(p, 0, rlen + slen);
+
+	p[0] = (RTP_VERSION << 6) | (rr ? 1 : 0);
+	p[1] = RTCP_RR;
+	p[2] = 0;
+	p[3] = rlen / 4 - 1;
+	put_be32(p + 4, ssrc);
+
+	if (rr) {
+		put_be32(p + 8, rr->ssrc);
+		put_be32(p + 12, ((uint32_t)rr->fraction << 24) |
+				 ((uint32_t)rr->lost & 0xffffff));
+		put_be32(p + 16, rr->ext_max_seq);
+		put_be32(p + 20, rr->jitter);
+		put_be32(p + 24, rr->lsr);
+		put_be32(p + 28, rr->dlsr);
+	}
+
+	p += rlen;
+	p[0] = (RTP_VERSION << 6) | 1;
+	p[1] = RTCP_SDES;
+	p[2] = (slen / 4 - 1) >> 8;
+	p[3] = slen / 4 - 1;
+	put_be32(p + 4, ssrc);
+	p[8] = RTCP_SDES_CNAME;
+	p[9] = clen;
+	memcpy(p + 10, cname, clen);
+
+	return rlen + slen;
+}
+
+/*
+ * Find the first SR in a compound packet and return the sender SSRC and
+ * the middle 32 bits of its NTP timestamp, as needed for LSR.
+ */
+int rtcp_parse_sr(const void *pkt,
+		  size_t len,
+		  uint32_t *ssrc,
+		  uint32_t *lsr)
+{
+	const uint8_t *p = pkt;
+	size_t plen;
+
+	while (len >= 4) {
+		if ((p[0] >> 6) != RTP_VERSION)
+			return -EINVAL;
+
+		plen = (get_be16(p + 2) + 1) * 4;
+		if (plen > len)
+			return -EINVAL;
+
+		if (p[1] == RTCP_SR) {
+			if (plen < 28)
+				return -EINVAL;
+
+			*ssrc = get_be32(p + 4);
+			*lsr = (get_be32(p + 8) << 16) |
+			       (get_be32(p + 12) >> 16);
+			return 0;
+		}
+
+		p += plen;
+		len -= plen;
+	}
+
+	return -ENOENT;
+}
@@ -0,0 +1,174 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTP Receiver Statistics
+ * Tracks the sequence space of a single RTP source like RFC 3550 A.1 does
+ * (including probation of new sources and resync on huge jumps) and the
+ * interarrival jitter of A.8. On top, gaps in the sequence space are
+ * recorded as loss bursts, so a single long outage can be told apart from
+ * scattered loss.
+ * The RTCP helpers build receiver reports from these statistics and pick
+ * the timestamps out of sender reports for the LSR/DLSR fields.
+ */
+
+#ifndef MIRACLE_RTP_H
+#define MIRACLE_RTP_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define RTP_VERSION 2
+#define RTP_HEADER_SIZE 12
+
+/* WFD streams are MPEG-TS over RTP with a 90kHz clock */
+#define RTP_MP2T_CLOCK_RATE 90000
+
+struct rtp_hdr {
+	uint8_t pt;
+	bool marker;
+	uint16_t seq;
+	uint32_t ts;
+	uint32_t ssrc;
+	/* offset of the payload, includes CSRCs and extensions */
+	size_t len;
+};
+
+int rtp_parse_header(struct rtp_hdr *h, const void *pkt, size_t len);
+
+struct rtp_stats {
+	uint32_t clock_rate;
+
+	/* RFC 3550 A.1 */
+	uint32_t ssrc;
+	uint16_t max_seq;
+	uint32_t cycles;
+	uint32_t base_seq;
+	uint32_t bad_seq;
+	uint32_t probation;
+	uint64_t received;
+	bool valid;
+
+	/* RFC 3550 A.8, in timestamp units, scaled by 16 */
+	uint32_t jitter;
+	uint32_t transit;
+
+	/* packets that showed up below max_seq, or twice */
+	uint64_t reordered;
+	uint64_t duplicates;
+
+	/* sequence gaps */
+	uint64_t bursts;
+	uint32_t max_burst;
+	uint32_t last_burst;
+
+	uint64_t bytes;
+	uint64_t first_arrival;
+	uint64_t last_arrival;
+
+	/* RFC 3550 A.3, state of the last receiver report */
+	uint64_t expected_prior;
+	uint64_t received_prior;
+
+	/* middle 32 bits of the NTP time of the last SR and when we got it */
+	uint32_t lsr;
+	uint64_t sr_arrival;
+};
+
+void rtp_stats_init(struct rtp_stats *st, uint32_t clock_rate);
+void rtp_stats_update(struct rtp_stats *st,
+		      const struct rtp_hdr *h,
+		      size_t len,
+		      uint64_t arrival);
+
+/* extended highest sequence number received */
+static inline uint32_t rtp_stats_ext_max_seq(const struct rtp_stats *st)
+{
+	return st->cycles + st->max_seq;
+}
+
+static inline uint64_t rtp_stats_expected(const struct rtp_stats *st)
+{
+	if (!st->valid)
+		return 0;
+
+	return (uint64_t)rtp_stats_ext_max_seq(st) - st->base_seq + 1;
+}
+
+/* cumulative number of packets lost, negative if we got duplicates */
+static inline int64_t rtp_stats_lost(const struct rtp_stats *st)
+{
+	if (!st->valid)
+		return 0;
+
+	return (int64_t)rtp_stats_expected(st) - (int64_t)st->received;
+}
+
+/* interarrival jitter in timestamp units */
+static inline uint32_t rtp_stats_jitter(const struct rtp_stats *st)
+{
+	return st->jitter >> 4;
+}
+
+/* interarrival jitter in usec */
+static inline uint64_t rtp_stats_jitter_usec(const struct rtp_stats *st)
+{
+	if (!st->clock_rate)
+		return 0;
+
+	return (uint64_t)rtp_stats_jitter(st) * 1000000ULL / st->clock_rate;
+}
+
+/*
+ * RTCP
+ */
+
+#define RTCP_SR 200
+#define RTCP_RR 201
+#define RTCP_SDES 202
+#define RTCP_SDES_CNAME 1
+
+struct rtcp_rr {
+	/* the source this block is about */
+	uint32_t ssrc;
+	uint8_t fraction;
+	/* 24bit, clamped */
+	int32_t lost;
+	uint32_t ext_max_seq;
+	uint32_t jitter;
+	uint32_t lsr;
+	/* in units of 1/65536 seconds */
+	uint32_t dlsr;
+};
+
+void rtp_stats_fill_rr(struct rtp_stats *st,
+		       struct rtcp_rr *rr,
+		       uint64_t now);
+void rtp_stats_handle_sr(struct rtp_stats *st, uint32_t lsr, uint64_t now);
+
+int rtcp_build_rr(void *buf,
+		  size_t size,
+		  uint32_t ssrc,
+		  const struct rtcp_rr *rr,
+		  const char *cname);
+int rtcp_parse_sr(const void *pkt,
+		  size_t len,
+		  uint32_t *ssrc,
+		  uint32_t *lsr);
+
+#endif /* MIRACLE_RTP_H */
@@ -33,6 +33,7 @@
 #include <unistd.h>
 #include "rtsp.h"
 #include "shl_dlist.h"
+#include "shl_ftable.h"
 #include "shl_htable.h"
 #include "shl_macro.h"
 #include "shl_ring.h"
@@ -61,7 +62,7 @@ struct rtsp {
 	size_t outgoing_cnt;
 
 	/* waiting messages */
-	struct shl_htable waiting;
+	struct shl_ftable waiting;
 	size_t waiting_cnt;
 
 	/* ring parser */
@@ -174,14 +175,14 @@ struct rtsp_message {
 	bool is_sending : 1;
 };
 
-#define rtsp_message_from_htable(_p) \
+#define rtsp_message_from_cookie(_p) \
 	shl_htable_entry((_p), struct rtsp_message, cookie)
 
 #define RTSP_FOREACH_WAITING(_i, _bus) \
-	SHL_HTABLE_FOREACH_MACRO(_i, &(_bus)->waiting, rtsp_message_from_htable)
+	SHL_FTABLE_FOREACH_MACRO(_i, &(_bus)->waiting, rtsp_message_from_cookie)
 
 #define RTSP_FIRST_WAITING(_bus) \
-	SHL_HTABLE_FIRST_MACRO(&(_bus)->waiting, rtsp_message_from_htable)
+	SHL_FTABLE_FIRST_MACRO(&(_bus)->waiting, rtsp_message_from_cookie)
 
 static void rtsp_free_match(struct rtsp_match *match);
 static void rtsp_drop_message(struct rtsp_message *m);
@@ -2602,12 +2603,12 @@ static int rtsp_call_reply(struct rtsp *bus, struct rtsp_message *reply)
 	uint64_t *elem;
 	int r;
 
-	if (!shl_htable_lookup_u64(&bus->waiting,
+	if (!shl_ftable_lookup_u64(&bus->waiting,
 				   reply->cookie & ~RTSP_FLAG_REMOTE_COOKIE,
 				   &elem))
 		return 0;
 
-	m = rtsp_message_from_htable(elem);
+	m = rtsp_message_from_cookie(elem);
 	rtsp_message_ref(m);
 
 	rtsp_drop_message(m);
@@ -2681,7 +2682,7 @@ static int rtsp_link_waiting(struct rtsp_message *m)
 {
 	int r;
 
-	r = shl_htable_insert_u64(&m->bus->waiting, &m->cookie);
+	r = shl_ftable_insert_u64(&m->bus->waiting, &m->cookie);
 	if (r < 0)
 		return r;
 
@@ -2712,7 +2713,7 @@ static int rtsp_link_waiting(struct rtsp_message *m)
 error:
 	sd_event_source_unref(m->timer_source);
 	m->timer_source = NULL;
-	shl_htable_remove_u64(&m->bus->waiting, m->cookie, NULL);
+	shl_ftable_remove_u64(&m->bus->waiting, m->cookie, NULL);
 	return r;
 }
 
@@ -2721,7 +2722,7 @@ static bool rtsp_unlink_waiting(struct rtsp_message *m)
 	if (m->is_waiting) {
 		sd_event_source_unref(m->timer_source);
 		m->timer_source = NULL;
-		shl_htable_remove_u64(&m->bus->waiting, m->cookie, NULL);
+		shl_ftable_remove_u64(&m->bus->waiting, m->cookie, NULL);
 		m->is_waiting = false;
 		--m->bus->waiting_cnt;
 		rtsp_message_unref(m);
@@ -2931,7 +2932,7 @@ int rtsp_open(struct rtsp **out, int fd)
 	bus->fd = fd;
 	shl_dlist_init(&bus->matches);
 	shl_dlist_init(&bus->outgoing);
-	shl_htable_init_u64(&bus->waiting);
+	shl_ftable_init_u64(&bus->waiting);
 
 	*out = bus;
 	bus = NULL;
@@ -3013,7 +3014,7 @@ void rtsp_unref(struct rtsp *bus)
 
 	rtsp_detach_event(bus);
 	shl_ring_clear(&bus->parser.buf);
-	shl_htable_clear_u64(&bus->waiting, NULL, NULL);
+	shl_ftable_clear_u64(&bus->waiting, NULL, NULL);
 	close(bus->fd);
 	free(bus);
 }
@@ -3266,9 +3267,9 @@ void rtsp_call_async_cancel(struct rtsp *bus, uint64_t cookie)
 	if (!bus || !cookie)
 		return;
 
-	if (!shl_htable_lookup_u64(&bus->waiting, cookie, &elem))
+	if (!shl_ftable_lookup_u64(&bus->waiting, cookie, &elem))
 		return;
 
-	m = rtsp_message_from_htable(elem);
+	m = rtsp_message_from_cookie(elem);
 	rtsp_drop_message(m);
 }
@@ -0,0 +1,107 @@
+/*
+ * SHL - Internet checksum
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Internet Checksum
+ * Instead of summing 16bit words one by one, we add 64bit words in host order
+ * and feed the carry back in (end-around carry). As 2^16 == 1 (mod 2^16 - 1),
+ * this yields the same ones-complement sum as summing 16bit words, as long as
+ * all words start at an even offset. Four independent accumulators keep the
+ * carry chains short.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl_csum.h"
+
+static inline uint64_t add64(uint64_t acc, uint64_t v)
+{
+	acc += v;
+	return acc + (acc < v);
+}
+
+static inline uint64_t load64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint32_t shl_csum_partial(const void *buf, size_t len, uint32_t sum)
+{
+	const uint8_t *p = buf;
+	uint64_t a0 = sum, a1 = 0, a2 = 0, a3 = 0;
+	uint32_t v32;
+	uint16_t v16;
+
+	while (len >= 32) {
+		a0 = add64(a0, load64(p));
+		a1 = add64(a1, load64(p + 8));
+		a2 = add64(a2, load64(p + 16));
+		a3 = add64(a3, load64(p + 24));
+		p += 32;
+		len -= 32;
+	}
+
+	a0 = add64(a0, a1);
+	a2 = add64(a2, a3);
+	a0 = add64(a0, a2);
+
+	while (len >= 8) {
+		a0 = add64(a0, load64(p));
+		p += 8;
+		len -= 8;
+	}
+
+	if (len >= 4) {
+		memcpy(&v32, p, sizeof(v32));
+		a0 = add64(a0, v32);
+		p += 4;
+		len -= 4;
+	}
+
+	if (len >= 2) {
+		memcpy(&v16, p, sizeof(v16));
+		a0 = add64(a0, v16);
+		p += 2;
+		len -= 2;
+	}
+
+	/* left-over byte is the first byte of a 16bit word in network order */
+	if (len) {
+		v16 = 0;
+		*(uint8_t*)&v16 = *p;
+		a0 = add64(a0, v16);
+	}
+
+	a0 = (a0 & 0xffffffff) + (a0 >> 32);
+	a0 = (a0 & 0xffffffff) + (a0 >> 32);
+
+	return a0;
+}
+
+uint16_t shl_csum_update(uint16_t check,
+			 const void *from,
+			 const void *to,
+			 size_t len)
+{
+	const uint8_t *f = from, *t = to;
+	uint16_t a, b;
+	uint32_t sum;
+	size_t i;
+
+	sum = (uint16_t)~check;
+	for (i = 0; i + 1 < len; i += 2) {
+		memcpy(&a, f + i, sizeof(a));
+		memcpy(&b, t + i, sizeof(b));
+		sum += (uint16_t)~a + b;
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+
+	return shl_csum_fold(sum);
+}
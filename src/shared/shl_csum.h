@@ -0,0 +1,62 @@
+/*
+ * SHL - Internet checksum
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Internet Checksum (RFC 1071)
+ * The ones-complement sum is byte-order independent, so all helpers work on
+ * data in network order and return the checksum ready to be stored into the
+ * packet as is.
+ *
+ * shl_csum_partial() accumulates data into an unfolded 32bit sum which can be
+ * fed into further calls. Only the final chunk may have an odd length.
+ * shl_csum_update*() adjust an existing checksum for a modified field without
+ * touching the rest of the data (RFC 1624).
+ */
+
+#ifndef SHL_CSUM_H
+#define SHL_CSUM_H
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+/* add @len bytes of @buf to the unfolded sum @sum */
+uint32_t shl_csum_partial(const void *buf, size_t len, uint32_t sum);
+
+/* fold an unfolded sum into the final 16bit checksum */
+static inline uint16_t shl_csum_fold(uint32_t sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+/* checksum of @len bytes at @buf */
+static inline uint16_t shl_csum(const void *buf, size_t len)
+{
+	return shl_csum_fold(shl_csum_partial(buf, len, 0));
+}
+
+/* adjust @check for a 16bit field that changed from @from to @to */
+static inline uint16_t shl_csum_update16(uint16_t check,
+					 uint16_t from,
+					 uint16_t to)
+{
+	uint32_t sum;
+
+	/* HC' = ~(~HC + ~m + m') */
+	sum = (uint16_t)~check + (uint16_t)~from + to;
+
+	return shl_csum_fold(sum);
+}
+
+/* adjust @check for a field of even length @len changed from @from to @to */
+uint16_t shl_csum_update(uint16_t check,
+			 const void *from,
+			 const void *to,
+			 size_t len);
+
+#endif  /* SHL_CSUM_H */
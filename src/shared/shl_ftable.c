@@ -0,0 +1,383 @@
+/*
+ * SHL - Flat hash-table
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * The layout follows the "Swiss table" design: the control bytes of all
+ * slots form an array of their own, and probing walks it group by group.
+ * A control byte is either EMPTY, DELETED or, with the sign bit clear, the
+ * low 7 bits of the hash of the key in the slot (h2). The remaining bits
+ * (h1) select where probing starts. The first group is mirrored behind the
+ * last one so a group can be loaded at any slot without wrapping.
+ * Probing stops at the first group with an EMPTY slot, that is why removal
+ * has to leave DELETED behind unless no probe can have passed the slot.
+ * Resizing drops the rest.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl_ftable.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define FTABLE_EMPTY ((int8_t)-128)
+#define FTABLE_DELETED ((int8_t)-2)
+#define FTABLE_MIN_CAPACITY SHL_FTABLE_GROUP
+
+const int8_t shl__ftable_empty_group[SHL_FTABLE_GROUP] = {
+	FTABLE_EMPTY, FTABLE_EMPTY, FTABLE_EMPTY, FTABLE_EMPTY,
+	FTABLE_EMPTY, FTABLE_EMPTY, FTABLE_EMPTY, FTABLE_EMPTY,
+	FTABLE_EMPTY, FTABLE_EMPTY, FTABLE_EMPTY, FTABLE_EMPTY,
+	FTABLE_EMPTY, FTABLE_EMPTY, FTABLE_EMPTY, FTABLE_EMPTY,
+};
+
+static inline bool ftable_is_full(int8_t c)
+{
+	return c >= 0;
+}
+
+/* bit i of the results stands for control byte i of the group */
+
+#ifdef __SSE2__
+
+static inline unsigned int group_match(const int8_t *g, int8_t h2)
+{
+	__m128i v = _mm_loadu_si128((const __m128i*)g);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), v));
+}
+
+static inline unsigned int group_match_empty(const int8_t *g)
+{
+	return group_match(g, FTABLE_EMPTY);
+}
+
+static inline unsigned int group_match_free(const int8_t *g)
+{
+	/* EMPTY and DELETED are the only ones with the sign bit set */
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)g));
+}
+
+#else /* __SSE2__ */
+
+static inline unsigned int group_match(const int8_t *g, int8_t h2)
+{
+	unsigned int i, r = 0;
+
+	for (i = 0; i < SHL_FTABLE_GROUP; ++i)
+		r |= (unsigned int)(g[i] == h2) << i;
+
+	return r;
+}
+
+static inline unsigned int group_match_empty(const int8_t *g)
+{
+	return group_match(g, FTABLE_EMPTY);
+}
+
+static inline unsigned int group_match_free(const int8_t *g)
+{
+	unsigned int i, r = 0;
+
+	for (i = 0; i < SHL_FTABLE_GROUP; ++i)
+		r |= (unsigned int)(g[i] < 0) << i;
+
+	return r;
+}
+
+#endif /* __SSE2__ */
+
+/* Fibonacci hashing, with the well-mixed high half folded into h2 */
+static inline uint64_t ftable_hash(uint64_t k)
+{
+	k *= 0x9e3779b97f4a7c15ULL;
+
+	return k ^ (k >> 32);
+}
+
+static inline int8_t ftable_h2(uint64_t hash)
+{
+	return hash & 0x7f;
+}
+
+static inline size_t ftable_h1(uint64_t hash)
+{
+	return hash >> 7;
+}
+
+static inline size_t ftable_capacity(const struct shl_ftable *t)
+{
+	return t->slots ? t->mask + 1 : 0;
+}
+
+static inline size_t ftable_max_load(size_t capacity)
+{
+	return capacity - capacity / 8;
+}
+
+static void ftable_set_ctrl(struct shl_ftable *t, size_t i, int8_t c)
+{
+	t->ctrl[i] = c;
+	if (i < SHL_FTABLE_GROUP)
+		t->ctrl[t->mask + 1 + i] = c;
+}
+
+/*
+ * Find @key. If @free is given and @key is not there, it is set to the first
+ * EMPTY or DELETED slot on the way, which is where an insert goes.
+ * Probing jumps by one more group each step. With a power-of-two number of
+ * groups this visits every group once before repeating.
+ */
+static struct shl_ftable_slot *ftable_find(struct shl_ftable *t,
+					   uint64_t key,
+					   uint64_t hash,
+					   size_t *index,
+					   size_t *free)
+{
+	size_t pos, step = 0, i;
+	unsigned int m;
+	int8_t h2 = ftable_h2(hash);
+	bool have_free = false;
+
+	pos = ftable_h1(hash) & t->mask;
+	for (;;) {
+		m = group_match(t->ctrl + pos, h2);
+		while (m) {
+			i = (pos + __builtin_ctz(m)) & t->mask;
+			if (t->slots[i].key == key) {
+				if (index)
+					*index = i;
+				return &t->slots[i];
+			}
+			m &= m - 1;
+		}
+
+		if (free && !have_free) {
+			m = group_match_free(t->ctrl + pos);
+			if (m) {
+				*free = (pos + __builtin_ctz(m)) & t->mask;
+				have_free = true;
+			}
+		}
+
+		if (group_match_empty(t->ctrl + pos))
+			return NULL;
+
+		step += SHL_FTABLE_GROUP;
+		pos = (pos + step) & t->mask;
+	}
+}
+
+static size_t ftable_find_free(struct shl_ftable *t, uint64_t hash)
+{
+	size_t pos, step = 0;
+	unsigned int m;
+
+	pos = ftable_h1(hash) & t->mask;
+	for (;;) {
+		m = group_match_free(t->ctrl + pos);
+		if (m)
+			return (pos + __builtin_ctz(m)) & t->mask;
+
+		step += SHL_FTABLE_GROUP;
+		pos = (pos + step) & t->mask;
+	}
+}
+
+static int ftable_resize(struct shl_ftable *t, size_t capacity)
+{
+	struct shl_ftable_slot *slots, *old_slots = t->slots;
+	int8_t *ctrl, *old_ctrl = t->ctrl;
+	size_t i, j, old_capacity = ftable_capacity(t);
+	uint64_t hash;
+
+	ctrl = malloc(capacity + SHL_FTABLE_GROUP);
+	if (!ctrl)
+		return -ENOMEM;
+
+	slots = malloc(capacity * sizeof(*slots));
+	if (!slots) {
+		free(ctrl);
+		return -ENOMEM;
+	}
+
+	memset(ctrl, FTABLE_EMPTY, capacity + SHL_FTABLE_GROUP);
+	t->ctrl = ctrl;
+	t->slots = slots;
+	t->mask = capacity - 1;
+	t->growth_left = ftable_max_load(capacity) - t->elems;
+
+	for (i = 0; i < old_capacity; ++i) {
+		if (!ftable_is_full(old_ctrl[i]))
+			continue;
+
+		hash = ftable_hash(old_slots[i].key);
+		j = ftable_find_free(t, hash);
+		ftable_set_ctrl(t, j, ftable_h2(hash));
+		t->slots[j] = old_slots[i];
+	}
+
+	if (old_slots) {
+		free(old_ctrl);
+		free(old_slots);
+	}
+
+	return 0;
+}
+
+/* make room for one more entry, dropping tombstones if that is enough */
+static int ftable_grow(struct shl_ftable *t)
+{
+	size_t capacity = ftable_capacity(t);
+
+	if (!capacity)
+		return ftable_resize(t, FTABLE_MIN_CAPACITY);
+
+	if (t->elems + 1 <= ftable_max_load(capacity) / 2)
+		return ftable_resize(t, capacity);
+
+	return ftable_resize(t, capacity * 2);
+}
+
+void shl_ftable_init_u64(struct shl_ftable *t)
+{
+	*t = (struct shl_ftable)SHL_FTABLE_INIT(*t);
+}
+
+void shl_ftable_clear_u64(struct shl_ftable *t,
+			  void (*cb) (uint64_t *elem, void *ctx),
+			  void *ctx)
+{
+	if (cb)
+		shl_ftable_visit_u64(t, cb, ctx);
+
+	if (t->slots) {
+		free(t->ctrl);
+		free(t->slots);
+	}
+
+	shl_ftable_init_u64(t);
+}
+
+void shl_ftable_visit_u64(struct shl_ftable *t,
+			  void (*cb) (uint64_t *elem, void *ctx),
+			  void *ctx)
+{
+	size_t i, capacity = ftable_capacity(t);
+
+	for (i = 0; i < capacity; ++i)
+		if (ftable_is_full(t->ctrl[i]))
+			cb(t->slots[i].elem, ctx);
+}
+
+bool shl_ftable_lookup_u64(struct shl_ftable *t,
+			   uint64_t key,
+			   uint64_t **out)
+{
+	struct shl_ftable_slot *s;
+
+	if (!t->elems)
+		return false;
+
+	s = ftable_find(t, key, ftable_hash(key), NULL, NULL);
+	if (!s)
+		return false;
+
+	if (out)
+		*out = s->elem;
+	return true;
+}
+
+int shl_ftable_insert_u64(struct shl_ftable *t, uint64_t *key)
+{
+	uint64_t hash = ftable_hash(*key);
+	size_t i = 0;
+	int r;
+
+	if (t->slots && ftable_find(t, *key, hash, NULL, &i))
+		return -EALREADY;
+
+	/* reusing a DELETED slot does not make the table any fuller */
+	if (!t->slots || (!t->growth_left && t->ctrl[i] == FTABLE_EMPTY)) {
+		r = ftable_grow(t);
+		if (r < 0)
+			return r;
+
+		i = ftable_find_free(t, hash);
+	}
+
+	if (t->ctrl[i] == FTABLE_EMPTY)
+		--t->growth_left;
+
+	ftable_set_ctrl(t, i, ftable_h2(hash));
+	t->slots[i].key = *key;
+	t->slots[i].elem = key;
+	++t->elems;
+
+	return 0;
+}
+
+bool shl_ftable_remove_u64(struct shl_ftable *t,
+			   uint64_t key,
+			   uint64_t **out)
+{
+	struct shl_ftable_slot *s;
+	unsigned int before, after;
+	size_t i;
+
+	if (!t->elems)
+		return false;
+
+	s = ftable_find(t, key, ftable_hash(key), &i, NULL);
+	if (!s)
+		return false;
+
+	if (out)
+		*out = s->elem;
+
+	/*
+	 * If no run of 16 full slots covers this one, no probe ever went past
+	 * it and it can go back to EMPTY. That keeps insert/remove churn, like
+	 * RTSP cookies, from filling the table with tombstones.
+	 */
+	before = group_match_empty(t->ctrl + ((i - SHL_FTABLE_GROUP) & t->mask));
+	after = group_match_empty(t->ctrl + i);
+	if (before && after &&
+	    __builtin_ctz(after) + __builtin_clz(before << 16) <
+							SHL_FTABLE_GROUP) {
+		ftable_set_ctrl(t, i, FTABLE_EMPTY);
+		++t->growth_left;
+	} else {
+		ftable_set_ctrl(t, i, FTABLE_DELETED);
+	}
+
+	--t->elems;
+
+	return true;
+}
+
+size_t shl_ftable_this_or_next(struct shl_ftable *t, size_t i)
+{
+	size_t capacity = ftable_capacity(t);
+
+	for ( ; i < capacity; ++i)
+		if (ftable_is_full(t->ctrl[i]))
+			return i;
+
+	return i;
+}
+
+uint64_t *shl_ftable_get_entry(struct shl_ftable *t, size_t i)
+{
+	if (i >= ftable_capacity(t))
+		return NULL;
+
+	return t->slots[i].elem;
+}
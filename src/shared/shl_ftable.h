@@ -0,0 +1,115 @@
+/*
+ * SHL - Flat hash-table
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Flat hash-table
+ * Open-addressing table for objects with 64bit keys, an alternative to the
+ * u64 flavour of shl_htable with the same usage: objects are user-allocated
+ * and the table stores a pointer to their key member, shl_htable_entry()
+ * gets back to the object.
+ * Unlike shl_htable, the key is stored inline next to that pointer, so a
+ * lookup never touches the object itself. Every slot has a control byte
+ * holding 7 bits of its hash, or marking it as empty or deleted. A probe
+ * compares 16 control bytes at once (SSE2 if available) and only looks at
+ * slots whose hash bits match. Keys must be unique.
+ *
+ * Removing entries while iterating is fine, inserting is not, as the table
+ * may be resized.
+ */
+
+#ifndef SHL_FTABLE_H
+#define SHL_FTABLE_H
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SHL_FTABLE_GROUP 16
+
+struct shl_ftable_slot {
+	uint64_t key;
+	uint64_t *elem;
+};
+
+struct shl_ftable {
+	/* capacity + SHL_FTABLE_GROUP bytes, the tail mirrors the head */
+	int8_t *ctrl;
+	struct shl_ftable_slot *slots;
+	size_t mask;
+	size_t elems;
+	/* inserts into empty slots left before we have to grow */
+	size_t growth_left;
+};
+
+extern const int8_t shl__ftable_empty_group[SHL_FTABLE_GROUP];
+
+#define SHL_FTABLE_INIT(_obj)						\
+	{								\
+		.ctrl = (int8_t*)shl__ftable_empty_group,		\
+		.slots = NULL,						\
+		.mask = 0,						\
+		.elems = 0,						\
+		.growth_left = 0,					\
+	}
+
+void shl_ftable_init_u64(struct shl_ftable *t);
+void shl_ftable_clear_u64(struct shl_ftable *t,
+			  void (*cb) (uint64_t *elem, void *ctx),
+			  void *ctx);
+void shl_ftable_visit_u64(struct shl_ftable *t,
+			  void (*cb) (uint64_t *elem, void *ctx),
+			  void *ctx);
+bool shl_ftable_lookup_u64(struct shl_ftable *t,
+			   uint64_t key,
+			   uint64_t **out);
+int shl_ftable_insert_u64(struct shl_ftable *t, uint64_t *key);
+bool shl_ftable_remove_u64(struct shl_ftable *t,
+			   uint64_t key,
+			   uint64_t **out);
+
+size_t shl_ftable_this_or_next(struct shl_ftable *t, size_t i);
+uint64_t *shl_ftable_get_entry(struct shl_ftable *t, size_t i);
+
+#define SHL_FTABLE_FOREACH(_iter, _ft) for ( \
+		size_t ftable__i = shl_ftable_this_or_next((_ft), 0); \
+		(_iter = shl_ftable_get_entry((_ft), ftable__i)); \
+		ftable__i = shl_ftable_this_or_next((_ft), ftable__i + 1) \
+	)
+
+#define SHL_FTABLE_FOREACH_MACRO(_iter, _ft, _accessor) for ( \
+		size_t ftable__i = shl_ftable_this_or_next((_ft), 0); \
+		(_iter = (void*)shl_ftable_get_entry((_ft), ftable__i), \
+		 _iter = _iter ? _accessor((void*)_iter) : NULL); \
+		ftable__i = shl_ftable_this_or_next((_ft), ftable__i + 1) \
+	)
+
+#define SHL_FTABLE_FIRST_MACRO(_ft, _accessor) ({ \
+		void *ftable__i = shl_ftable_get_entry((_ft), \
+					shl_ftable_this_or_next((_ft), 0)); \
+		ftable__i ? _accessor(ftable__i) : NULL; })
+
+/* pack a MAC address like "aa:bb:cc:dd:ee:ff" into a key */
+static inline int shl_ftable_key_mac(const char *mac, uint64_t *out)
+{
+	unsigned int b[6], i;
+	uint64_t key = 0;
+	int n = 0;
+
+	if (sscanf(mac, "%2x:%2x:%2x:%2x:%2x:%2x%n",
+		   &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &n) != 6 ||
+	    mac[n])
+		return -EINVAL;
+
+	for (i = 0; i < 6; ++i)
+		key = (key << 8) | b[i];
+
+	*out = key;
+	return 0;
+}
+
+#endif /* SHL_FTABLE_H */
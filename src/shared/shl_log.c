@@ -6,15 +6,19 @@
  */
 
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
 #include <time.h>
-#include <math.h>
 #include <limits.h>
+#include <unistd.h>
 #include "shl_log.h"
 
 /*
@@ -50,17 +54,16 @@ void log_init_time(void)
 		gettimeofday(&log__ftime, NULL);
 }
 
-void log__time(long long *sec, long long *usec)
+static void log__elapsed(const struct timeval *t,
+			 long long *sec,
+			 long long *usec)
 {
-	struct timeval t;
-
 	/* In case this is called in parallel to log_init_time(), we need to
 	 * catch negative time-diffs. Other than that, this can be called
 	 * unlocked. */
 
-	gettimeofday(&t, NULL);
-	*sec = t.tv_sec - log__ftime.tv_sec;
-	*usec = (long long)t.tv_usec - (long long)log__ftime.tv_usec;
+	*sec = t->tv_sec - log__ftime.tv_sec;
+	*usec = (long long)t->tv_usec - (long long)log__ftime.tv_usec;
 	if (*usec < 0) {
 		*sec -= 1;
 		if (*sec < 0)
@@ -69,6 +72,41 @@ void log__time(long long *sec, long long *usec)
 	}
 }
 
+void log__time(long long *sec, long long *usec)
+{
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	log__elapsed(&t, sec, usec);
+}
+
+/*
+ * The local date only changes once a second, so each thread keeps the
+ * strftime() result of the last second it logged in and only appends the
+ * milliseconds.
+ */
+
+static __thread time_t log__date_sec = -1;
+static __thread char log__date[80];
+
+static void log__date_time(const struct timeval *t, char *buf, size_t size)
+{
+	struct tm tm;
+	int millisec;
+
+	if (t->tv_sec != log__date_sec) {
+		localtime_r(&t->tv_sec, &tm);
+		strftime(log__date, sizeof(log__date), "%x - %X.%03d", &tm);
+		log__date_sec = t->tv_sec;
+	}
+
+	millisec = (t->tv_usec + 500) / 1000;
+	if (millisec >= 1000)
+		millisec -= 1000;
+
+	snprintf(buf, size, "%s.%03d", log__date, millisec);
+}
+
 /*
  * Default Values
  * Several logging-parameters may be omitted by applications. To provide sane
@@ -88,6 +126,92 @@ const char *LOG_SUBSYSTEM = NULL;
 unsigned int log_max_sev = LOG_NOTICE;
 bool log_date_time = false;
 
+/*
+ * Subsystem Severities
+ * Overrides are only ever added or changed, never removed, so readers on other
+ * threads can walk the table without locking. The count is published last.
+ */
+
+struct log_subsystem {
+	char name[32];
+	unsigned int sev;
+};
+
+static struct log_subsystem log__subsystems[LOG_SUBSYSTEM_MAX];
+unsigned int log__subsystem_count;
+
+int log_set_subsystem_sev(const char *subs, unsigned int sev)
+{
+	struct log_subsystem *s;
+	unsigned int i;
+
+	if (!subs || !*subs || strlen(subs) >= sizeof(s->name))
+		return -EINVAL;
+
+	for (i = 0; i < log__subsystem_count; ++i) {
+		s = &log__subsystems[i];
+		if (!strcmp(s->name, subs)) {
+			__atomic_store_n(&s->sev, sev, __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+
+	if (i >= LOG_SUBSYSTEM_MAX)
+		return -ENOSPC;
+
+	s = &log__subsystems[i];
+	strcpy(s->name, subs);
+	s->sev = sev;
+	__atomic_store_n(&log__subsystem_count, i + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+unsigned int log_subsystem_sev(const char *subs)
+{
+	unsigned int i, n;
+
+	if (!subs)
+		return log_max_sev;
+
+	n = __atomic_load_n(&log__subsystem_count, __ATOMIC_ACQUIRE);
+	for (i = 0; i < n; ++i) {
+		if (!strcmp(log__subsystems[i].name, subs))
+			return __atomic_load_n(&log__subsystems[i].sev,
+					       __ATOMIC_RELAXED);
+	}
+
+	return log_max_sev;
+}
+
+int log_parse_subsystems(const char *arg)
+{
+	char *list, *entry, *level, *save = NULL;
+	int r = 0;
+
+	list = strdup(arg);
+	if (!list)
+		return -ENOMEM;
+
+	for (entry = strtok_r(list, ",", &save);
+	     entry;
+	     entry = strtok_r(NULL, ",", &save)) {
+		level = strchr(entry, '=');
+		if (!level) {
+			r = -EINVAL;
+			break;
+		}
+
+		*level++ = 0;
+		r = log_set_subsystem_sev(entry, log_parse_arg(level));
+		if (r < 0)
+			break;
+	}
+
+	free(list);
+	return r;
+}
+
 char *gst_debug = NULL;
 
 /*
@@ -129,88 +253,66 @@ static const char *log__sev2str[LOG_SEV_NUM] = {
 	[LOG_FATAL] = "FATAL",
 };
 
-static void log__submit(const char *file,
-			int line,
-			const char *func,
-			const char *subs,
-			unsigned int sev,
-			const char *format,
-			va_list args)
-{
-	int saved_errno = errno;
-	const char *prefix = NULL;
-	FILE *out;
-	long long sec, usec;
-	time_t now;
-	struct tm *timeinfo;
-	struct timeval tv;
-	char buffertmp[80];
-	char buffer[120];
-	int millisec;
+struct log_buf {
+	char *p;
+	size_t size;
+	size_t len;
+};
 
-	out = stderr;
+/* like vsnprintf(), @b->len counts what would have been written */
+__attribute__((format(printf, 2, 0)))
+static void log__vappend(struct log_buf *b, const char *format, va_list args)
+{
+	size_t off = b->len < b->size ? b->len : b->size;
+	int r;
 
-	if (sev < LOG_SEV_NUM && sev > log_max_sev)
-		return;
+	r = vsnprintf(b->p + off, b->size - off, format, args);
+	if (r > 0)
+		b->len += r;
+}
 
-	log__time(&sec, &usec);
+__attribute__((format(printf, 2, 3)))
+static void log__append(struct log_buf *b, const char *format, ...)
+{
+	va_list args;
 
-	if (log_date_time) {
-        	gettimeofday(&tv, NULL);
-		millisec = lrint(tv.tv_usec/1000.0);
-		if (millisec>=1000) {
-			millisec -=1000;
-			tv.tv_sec++;
-		}
+	va_start(args, format);
+	log__vappend(b, format, args);
+	va_end(args);
+}
 
-		time(&now);
-		timeinfo = localtime(&now);
+/* formats a whole line into @buf, returns its length like vsnprintf() */
+static size_t log__format(char *buf,
+			  size_t size,
+			  const struct timeval *tv,
+			  const char *file,
+			  int line,
+			  const char *func,
+			  const char *subs,
+			  unsigned int sev,
+			  int saved_errno,
+			  const char *format,
+			  va_list args)
+{
+	struct log_buf b = { .p = buf, .size = size };
+	long long sec, usec;
+	char date[120];
 
-		strftime(buffertmp, 80, "%x - %X.%03d", timeinfo);
-		sprintf(buffer, "%s.%03d", buffertmp, millisec);
+	if (log_date_time) {
+		log__date_time(tv, date, sizeof(date));
+		log__append(&b, "[%s] ", date);
+	} else if (log__have_time()) {
+		log__elapsed(tv, &sec, &usec);
+		log__append(&b, "[%.4lld.%.6lld] ", sec, usec);
 	}
 
-	if (sev < LOG_SEV_NUM)
-		prefix = log__sev2str[sev];
-
-	if (prefix) {
-		if (subs) {
-			if (log_date_time)
-				fprintf(out, "[%s] %s: %s: ", buffer, prefix, subs);
-			else if (log__have_time())
-				fprintf(out, "[%.4lld.%.6lld] %s: %s: ",
-					sec, usec, prefix, subs);
-			else
-				fprintf(out, "%s: %s: ", prefix, subs);
-		} else {
-			if (log_date_time)
-				fprintf(out, "[%s] %s: ", buffer, prefix);
-			else if (log__have_time())
-				fprintf(out, "[%.4lld.%.6lld] %s: ",
-					sec, usec, prefix);
-			else
-				fprintf(out, "%s: ", prefix);
-		}
-	} else {
-		if (subs) {
-			if (log_date_time)
-				fprintf(out, "[%s] %s: ",
-					buffer, subs);
-			else if (log__have_time())
-				fprintf(out, "[%.4lld.%.6lld] %s: ",
-					sec, usec, subs);
-			else
-				fprintf(out, "%s: ", subs);
-		} else {
-			if (log_date_time)
-				fprintf(out, "[%s] ", buffer);
-			else if (log__have_time())
-				fprintf(out, "[%.4lld.%.6lld] ", sec, usec);
-		}
-	}
+	if (sev < LOG_SEV_NUM && log__sev2str[sev])
+		log__append(&b, "%s: ", log__sev2str[sev]);
+	if (subs)
+		log__append(&b, "%s: ", subs);
 
 	errno = saved_errno;
-	vfprintf(out, format, args);
+	log__vappend(&b, format, args);
 
 	if (sev == LOG_DEBUG || sev <= LOG_WARNING) {
 		if (!func)
@@ -219,10 +321,366 @@ static void log__submit(const char *file,
 			file = "<unknown>";
 		if (line < 0)
 			line = 0;
-		fprintf(out, " (%s() in %s:%d)\n", func, file, line);
+		log__append(&b, " (%s() in %s:%d)\n", func, file, line);
 	} else {
-		fprintf(out, "\n");
+		log__append(&b, "\n");
 	}
+
+	return b.len;
+}
+
+/*
+ * Asynchronous Backend
+ * Every thread that logs gets a ring of its own, so the fast path needs no
+ * lock: the thread is the only one advancing head, the writer the only one
+ * advancing tail. Rings are pushed onto a lock-free list the writer walks.
+ * The writer sleeps on an eventfd, and producers only kick it if it said it
+ * went idle, so a busy writer costs producers no syscalls at all.
+ * Rings of exited threads are freed by the writer once they are empty.
+ */
+
+#define LOG_LINE_MAX 1024
+#define LOG_RING_SIZE (64 * 1024)
+#define LOG_BATCH_SIZE (16 * 1024)
+#define LOG_WRITER_TIMEOUT 1000
+
+struct log_ring {
+	struct log_ring *next;
+
+	unsigned long head __attribute__((aligned(64)));
+	unsigned long dropped;
+
+	unsigned long tail __attribute__((aligned(64)));
+	unsigned long reported;
+	bool dead;
+
+	char buf[LOG_RING_SIZE];
+};
+
+static bool log__async;
+static bool log__writer_idle;
+static bool log__writer_stop;
+static int log__writer_efd = -1;
+static pthread_t log__writer;
+static pid_t log__writer_pid;
+static pthread_key_t log__ring_key;
+static bool log__ring_key_init;
+static struct log_ring *log__rings;
+
+static __thread struct log_ring *log__ring;
+static __thread char log__line[LOG_LINE_MAX];
+
+static void log__ring_exit(void *data)
+{
+	struct log_ring *ring = data;
+
+	__atomic_store_n(&ring->dead, true, __ATOMIC_RELEASE);
+}
+
+static struct log_ring *log__ring_get(void)
+{
+	struct log_ring *ring;
+
+	if (log__ring)
+		return log__ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->next = __atomic_load_n(&log__rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&log__rings, &ring->next, ring,
+					    true, __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+
+	pthread_setspecific(log__ring_key, ring);
+	log__ring = ring;
+	return ring;
+}
+
+/* returns false if the message has to be written synchronously */
+static bool log__submit_async(const struct timeval *tv,
+			      const char *file,
+			      int line,
+			      const char *func,
+			      const char *subs,
+			      unsigned int sev,
+			      int saved_errno,
+			      const char *format,
+			      va_list args)
+{
+	struct log_ring *ring;
+	unsigned long head, tail, off;
+	size_t len, n;
+
+	ring = log__ring_get();
+	if (!ring)
+		return false;
+
+	len = log__format(log__line, sizeof(log__line), tv, file, line, func,
+			  subs, sev, saved_errno, format, args);
+	if (len >= sizeof(log__line)) {
+		len = sizeof(log__line) - 1;
+		log__line[len - 1] = '\n';
+	}
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (LOG_RING_SIZE - (head - tail) < len) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1,
+				 __ATOMIC_RELAXED);
+		return true;
+	}
+
+	off = head % LOG_RING_SIZE;
+	n = LOG_RING_SIZE - off < len ? LOG_RING_SIZE - off : len;
+	memcpy(ring->buf + off, log__line, n);
+	memcpy(ring->buf, log__line + n, len - n);
+
+	__atomic_store_n(&ring->head, head + len, __ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&log__writer_idle, false, __ATOMIC_SEQ_CST))
+		eventfd_write(log__writer_efd, 1);
+
+	return true;
+}
+
+static void log__write_all(const char *buf, size_t len)
+{
+	ssize_t l;
+
+	while (len) {
+		l = write(STDERR_FILENO, buf, len);
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l <= 0)
+			return;
+
+		buf += l;
+		len -= l;
+	}
+}
+
+static bool log__pending(void)
+{
+	struct log_ring *ring;
+
+	ring = __atomic_load_n(&log__rings, __ATOMIC_ACQUIRE);
+	for ( ; ring; ring = ring->next) {
+		if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail)
+			return true;
+	}
+
+	return false;
+}
+
+/* move everything queued to stderr, in as few writes as possible */
+static void log__drain(void)
+{
+	static char batch[LOG_BATCH_SIZE];
+	struct log_ring *ring, *prev, *next;
+	unsigned long head, dropped, off;
+	size_t len = 0, n;
+	bool dead;
+	int r;
+
+	prev = NULL;
+	ring = __atomic_load_n(&log__rings, __ATOMIC_ACQUIRE);
+	for ( ; ring; ring = next) {
+		next = ring->next;
+		dead = __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		while (ring->tail != head) {
+			if (len == sizeof(batch)) {
+				log__write_all(batch, len);
+				len = 0;
+			}
+
+			off = ring->tail % LOG_RING_SIZE;
+			n = LOG_RING_SIZE - off;
+			if (n > head - ring->tail)
+				n = head - ring->tail;
+			if (n > sizeof(batch) - len)
+				n = sizeof(batch) - len;
+
+			memcpy(batch + len, ring->buf + off, n);
+			len += n;
+			__atomic_store_n(&ring->tail, ring->tail + n,
+					 __ATOMIC_RELEASE);
+		}
+
+		dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (dropped != ring->reported) {
+			if (sizeof(batch) - len < 64) {
+				log__write_all(batch, len);
+				len = 0;
+			}
+
+			r = snprintf(batch + len, sizeof(batch) - len,
+				     "NOTICE: log: %lu messages dropped\n",
+				     dropped - ring->reported);
+			len += r;
+			ring->reported = dropped;
+		}
+
+		/* the list head may race with new rings, leave it to later */
+		if (dead && prev) {
+			prev->next = next;
+			free(ring);
+		} else {
+			prev = ring;
+		}
+	}
+
+	if (len)
+		log__write_all(batch, len);
+}
+
+static void *log__writer_fn(void *data)
+{
+	struct pollfd fd = {
+		.fd = log__writer_efd,
+		.events = POLLIN,
+	};
+	eventfd_t v;
+
+	while (!__atomic_load_n(&log__writer_stop, __ATOMIC_ACQUIRE)) {
+		log__drain();
+
+		__atomic_store_n(&log__writer_idle, true, __ATOMIC_SEQ_CST);
+		if (log__pending()) {
+			__atomic_store_n(&log__writer_idle, false,
+					 __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		if (poll(&fd, 1, LOG_WRITER_TIMEOUT) > 0)
+			eventfd_read(log__writer_efd, &v);
+	}
+
+	log__drain();
+	return NULL;
+}
+
+/*
+ * A forked child inherits the flag but not the writer thread, so nobody
+ * would ever drain its rings. It logs synchronously from now on and starts
+ * from scratch if it calls log_async_start() itself. The eventfd is still
+ * the parent's, so the child gets its own on restart.
+ */
+static void log__atfork_child(void)
+{
+	log__async = false;
+	log__writer_idle = false;
+	log__rings = NULL;
+	log__ring = NULL;
+	if (log__writer_efd >= 0) {
+		close(log__writer_efd);
+		log__writer_efd = -1;
+	}
+}
+
+int log_async_start(void)
+{
+	static bool registered;
+	sigset_t mask, old;
+	int r;
+
+	if (log__async)
+		return 0;
+
+	if (!log__ring_key_init) {
+		r = pthread_key_create(&log__ring_key, log__ring_exit);
+		if (r)
+			return -r;
+		log__ring_key_init = true;
+	}
+
+	/* kept open after log_async_stop(), late producers may still kick it */
+	if (log__writer_efd < 0) {
+		log__writer_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (log__writer_efd < 0)
+			return -errno;
+	}
+
+	/* signals are for the threads that asked for them */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old);
+	log__writer_stop = false;
+	r = pthread_create(&log__writer, NULL, log__writer_fn, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (r)
+		return -r;
+
+	log__writer_pid = getpid();
+	if (!registered) {
+		atexit(log_async_stop);
+		pthread_atfork(NULL, NULL, log__atfork_child);
+		registered = true;
+	}
+
+	__atomic_store_n(&log__async, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void log_async_stop(void)
+{
+	/* a forked child has no writer to stop */
+	if (!log__async || getpid() != log__writer_pid)
+		return;
+
+	__atomic_store_n(&log__async, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&log__writer_stop, true, __ATOMIC_RELEASE);
+	eventfd_write(log__writer_efd, 1);
+	pthread_join(log__writer, NULL);
+}
+
+static void log__submit(const char *file,
+			int line,
+			const char *func,
+			const char *subs,
+			unsigned int sev,
+			const char *format,
+			va_list args)
+{
+	int saved_errno = errno;
+	char stackbuf[LOG_LINE_MAX], *buf = stackbuf;
+	struct timeval tv;
+	va_list copy;
+	size_t len;
+
+	if (!log__enabled(subs, sev))
+		return;
+
+	gettimeofday(&tv, NULL);
+
+	if (__atomic_load_n(&log__async, __ATOMIC_ACQUIRE) &&
+	    log__submit_async(&tv, file, line, func, subs, sev, saved_errno,
+			      format, args))
+		return;
+
+	/* stderr is unbuffered, hand it whole lines */
+	va_copy(copy, args);
+	len = log__format(buf, sizeof(stackbuf), &tv, file, line, func, subs,
+			  sev, saved_errno, format, args);
+	if (len >= sizeof(stackbuf)) {
+		buf = malloc(len + 1);
+		if (buf) {
+			log__format(buf, len + 1, &tv, file, line, func, subs,
+				    sev, saved_errno, format, copy);
+		} else {
+			buf = stackbuf;
+			len = sizeof(stackbuf) - 1;
+		}
+	}
+	va_end(copy);
+
+	fwrite(buf, 1, len, stderr);
+
+	if (buf != stackbuf)
+		free(buf);
 }
 
 void log_submit(const char *file,
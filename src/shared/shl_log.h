@@ -61,6 +61,48 @@ enum log_severity {
 
 extern unsigned int log_max_sev;
 
+/*
+ * Compile-Time Floor
+ * Messages with severities above LOG_COMPILE_MAX_SEV are compiled out
+ * entirely, including the evaluation of their arguments. Set it from the
+ * build system to one of the severities above; it defaults to LOG_TRACE if
+ * debugging is enabled and to LOG_INFO otherwise.
+ */
+
+#ifndef LOG_COMPILE_MAX_SEV
+#  ifdef BUILD_ENABLE_DEBUG
+#    define LOG_COMPILE_MAX_SEV LOG_TRACE
+#  else
+#    define LOG_COMPILE_MAX_SEV LOG_INFO
+#  endif
+#endif
+
+/*
+ * Subsystem Severities
+ * log_max_sev can be overridden per subsystem at runtime, for instance to
+ * trace "wpa" while everything else stays at notice. log_parse_subsystems()
+ * takes a list like "wpa=trace,link=debug" as given on the command line.
+ * Without overrides, checking a severity is a single compare.
+ */
+
+#define LOG_SUBSYSTEM_MAX 16
+
+extern unsigned int log__subsystem_count;
+
+int log_set_subsystem_sev(const char *subs, unsigned int sev);
+unsigned int log_subsystem_sev(const char *subs);
+int log_parse_subsystems(const char *arg);
+
+static inline bool log__enabled(const char *subs, unsigned int sev)
+{
+	if (sev >= LOG_SEV_NUM)
+		return true;
+	if (__builtin_expect(!log__subsystem_count, 1))
+		return sev <= log_max_sev;
+
+	return sev <= log_subsystem_sev(subs);
+}
+
 /*
  * Defines if log time should use local time
  * Default: false
@@ -84,6 +126,20 @@ void log__time(long long *sec, long long *usec);
 
 bool log__have_time(void);
 
+/*
+ * Asynchronous Logging
+ * Once log_async_start() was called, messages are formatted into a ring of
+ * the calling thread and a background thread writes them to stderr in
+ * batches, so logging no longer blocks the caller. Lines of different
+ * threads may be reordered slightly. If a ring is full, messages are dropped
+ * and counted; the writer notes how many were lost once there is room again.
+ * log_async_stop() writes out what is left, it is run at exit. Forked
+ * children go back to synchronous logging.
+ */
+
+int log_async_start(void);
+void log_async_stop(void);
+
 /*
  * Log-Functions
  * These functions pass a log-message to the log-subsystem. Handy helpers are
@@ -161,7 +217,9 @@ void log_dummyf(unsigned int sev, const char *format, ...)
  *              "your format string: %s %d", "some args", 5, ...);
  *
  * log_printf is the same as log_format(LOG_DEFAULT, sev, format, ...) and is
- * the most basic wrapper that you can use.
+ * the most basic wrapper that you can use. Unlike log_format, it checks the
+ * severity before evaluating any argument, and compiles to nothing if the
+ * severity is above LOG_COMPILE_MAX_SEV.
  */
 
 #ifndef LOG_SUBSYSTEM
@@ -172,29 +230,23 @@ extern const char *LOG_SUBSYSTEM;
 #define LOG_DEFAULT LOG_DEFAULT_BASE, LOG_SUBSYSTEM
 
 #define log_printf(sev, format, ...) \
-	log_format(LOG_DEFAULT, (sev), (format), ##__VA_ARGS__)
+	(((sev) <= LOG_COMPILE_MAX_SEV && \
+	  log__enabled(LOG_SUBSYSTEM, (sev))) ? \
+	 log_format(LOG_DEFAULT, (sev), (format), ##__VA_ARGS__) : (void)0)
 
 /*
  * Helpers
  * These pick up all the default values and submit the message to the
- * log-subsystem. The log_debug() function produces zero-code if
- * BUILD_ENABLE_DEBUG is not defined. Therefore, it can be heavily used for
- * debugging and will not have any side-effects.
- * Even if disabled, parameters are evaluated! So it only produces zero code
- * if there are no side-effects and the compiler can optimized it away.
+ * log-subsystem. Parameters are only evaluated if the message is logged, and
+ * helpers above LOG_COMPILE_MAX_SEV produce no code at all. Therefore,
+ * log_debug() and log_trace() can be heavily used for debugging without
+ * costing release builds anything.
  */
 
-#ifdef BUILD_ENABLE_DEBUG
-	#define log_debug(format, ...) \
-		log_printf(LOG_DEBUG, (format), ##__VA_ARGS__)
-	#define log_trace(format, ...) \
-		log_printf(LOG_TRACE, (format), ##__VA_ARGS__)
-#else
-	#define log_debug(format, ...) \
-		log_dummyf(LOG_DEBUG, (format), ##__VA_ARGS__)
-	#define log_trace(format, ...) \
-		log_dummyf(LOG_TRACE, (format), ##__VA_ARGS__)
-#endif
+#define log_debug(format, ...) \
+	log_printf(LOG_DEBUG, (format), ##__VA_ARGS__)
+#define log_trace(format, ...) \
+	log_printf(LOG_TRACE, (format), ##__VA_ARGS__)
 
 #define log_info(format, ...) \
 	log_printf(LOG_INFO, (format), ##__VA_ARGS__)
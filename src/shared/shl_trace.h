@@ -0,0 +1,39 @@
+/*
+ * SHL - Static Tracepoints
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Static Tracepoints
+ * SHL_TRACE(name, arg) marks a milestone that external tracers can attach to
+ * without touching the code, like bpftrace or perf. Each probe carries one
+ * string argument, usually the peer or interface it is about. With
+ * <sys/sdt.h> (systemtap-sdt-dev) available, a probe is a USDT probe of the
+ * "miracle" provider: a single nop plus an ELF note describing it. Without
+ * it, probes compile to nothing and their argument is not evaluated.
+ *
+ * Probes are listed with:
+ *   readelf -n miracle-wifid | grep -A2 stapsdt
+ * res/miracle-trace records them and turns a trace into a per-phase latency
+ * report.
+ */
+
+#ifndef SHL_TRACE_H
+#define SHL_TRACE_H
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define SHL_TRACE(_name, _arg) \
+	DTRACE_PROBE1(miracle, _name, (const char*)(_arg))
+
+#else /* HAVE_SYS_SDT_H */
+
+#define SHL_TRACE(_name, _arg) \
+	do { if (0) (void)(_arg); } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* SHL_TRACE_H */
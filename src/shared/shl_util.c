@@ -924,3 +924,26 @@ good:
 	++r->num;
 	return true;
 }
+
+void shl_hist_add(struct shl_hist *h, uint64_t val)
+{
+	unsigned int i;
+
+	i = val ? 64 - __builtin_clzll(val) : 0;
+	if (i >= SHL_HIST_BUCKETS)
+		i = SHL_HIST_BUCKETS - 1;
+
+	++h->buckets[i];
+	++h->count;
+	h->sum += val;
+	if (val > h->max)
+		h->max = val;
+}
+
+uint64_t shl_hist_bound(unsigned int bucket)
+{
+	if (bucket >= SHL_HIST_BUCKETS - 1)
+		return UINT64_MAX;
+
+	return 1ULL << bucket;
+}
@@ -165,4 +165,23 @@ struct shl_ratelimit {
 
 bool shl_ratelimit_test(struct shl_ratelimit *r);
 
+/*
+ * histogram
+ * Buckets are powers of two: bucket i counts values below 2^i that did not fit
+ * into bucket i - 1, the last bucket counts everything else. The largest
+ * bound is 2^22, about 4s for microseconds.
+ */
+
+#define SHL_HIST_BUCKETS 24
+
+struct shl_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[SHL_HIST_BUCKETS];
+};
+
+void shl_hist_add(struct shl_hist *h, uint64_t val);
+uint64_t shl_hist_bound(unsigned int bucket);
+
 #endif  /* SHL_UTIL_H */
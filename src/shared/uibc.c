@@ -0,0 +1,155 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl_macro.h"
+#include "uibc.h"
+
+shl_assert_cc(sizeof(struct uibc_event) == 32);
+
+static void put_be16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+/* returns the length of the packet written to @buf */
+int uibc_encode(const struct uibc_event *ev, void *buf, size_t size)
+{
+	uint8_t *p = buf;
+	size_t body, len;
+	unsigned int i;
+
+	switch (ev->type) {
+	case UIBC_GENERIC_TOUCH_DOWN:
+	case UIBC_GENERIC_TOUCH_UP:
+	case UIBC_GENERIC_TOUCH_MOVE:
+		if (!ev->count || ev->count > UIBC_EVENT_MAX_POINTERS)
+			return -EINVAL;
+		body = 1 + ev->count * 5;
+		break;
+	case UIBC_GENERIC_KEY_DOWN:
+	case UIBC_GENERIC_KEY_UP:
+		body = 5;
+		break;
+	case UIBC_GENERIC_ZOOM:
+		body = 6;
+		break;
+	case UIBC_GENERIC_VERTICAL_SCROLL:
+	case UIBC_GENERIC_HORIZONTAL_SCROLL:
+	case UIBC_GENERIC_ROTATE:
+		body = 2;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* padded to 16bit */
+	len = UIBC_HEADER_SIZE + UIBC_GENERIC_HEADER_SIZE + body;
+	len = (len + 1) & ~(size_t)1;
+	if (len > size)
+		return -ENOBUFS;
+
+	memset(p, 0, len);
+
+	/* version 0, no timestamp, generic category */
+	p[1] = UIBC_CATEGORY_GENERIC;
+	put_be16(p + 2, len);
+
+	p[4] = ev->type;
+	put_be16(p + 5, body);
+	p += UIBC_HEADER_SIZE + UIBC_GENERIC_HEADER_SIZE;
+
+	switch (ev->type) {
+	case UIBC_GENERIC_TOUCH_DOWN:
+	case UIBC_GENERIC_TOUCH_UP:
+	case UIBC_GENERIC_TOUCH_MOVE:
+		*p++ = ev->count;
+		for (i = 0; i < ev->count; ++i) {
+			p[0] = ev->pointers[i].id;
+			put_be16(p + 1, ev->pointers[i].x);
+			put_be16(p + 3, ev->pointers[i].y);
+			p += 5;
+		}
+		break;
+	case UIBC_GENERIC_KEY_DOWN:
+	case UIBC_GENERIC_KEY_UP:
+		/* p[0] is reserved */
+		put_be16(p + 1, ev->key.code1);
+		put_be16(p + 3, ev->key.code2);
+		break;
+	case UIBC_GENERIC_ZOOM:
+		put_be16(p, ev->zoom.x);
+		put_be16(p + 2, ev->zoom.y);
+		p[4] = ev->zoom.integer;
+		p[5] = ev->zoom.fraction;
+		break;
+	case UIBC_GENERIC_VERTICAL_SCROLL:
+	case UIBC_GENERIC_HORIZONTAL_SCROLL:
+		put_be16(p, ev->scroll);
+		break;
+	case UIBC_GENERIC_ROTATE:
+		p[0] = ev->rotate.integer;
+		p[1] = ev->rotate.fraction;
+		break;
+	}
+
+	return len;
+}
+
+/*
+ * The @len bytes of the report or descriptor are already in @buf at
+ * UIBC_HIDC_OFFSET. Returns the length of the whole packet, including the
+ * padding byte, which also has to fit into @size.
+ */
+int uibc_encode_hidc(void *buf,
+		     size_t size,
+		     unsigned int path,
+		     unsigned int type,
+		     unsigned int usage,
+		     size_t len)
+{
+	uint8_t *p = buf;
+	size_t total;
+
+	if (path >= UIBC_HIDC_PATH_CNT || type >= UIBC_HIDC_TYPE_CNT ||
+	    usage > UIBC_HIDC_USAGE_DESCRIPTOR)
+		return -EINVAL;
+
+	total = (UIBC_HIDC_OFFSET + len + 1) & ~(size_t)1;
+	if (len > 0xffff || total > 0xffff)
+		return -EINVAL;
+	if (total > size)
+		return -ENOBUFS;
+
+	p[0] = 0;
+	p[1] = UIBC_CATEGORY_HIDC;
+	put_be16(p + 2, total);
+
+	p[4] = path;
+	p[5] = type;
+	p[6] = usage;
+	put_be16(p + 7, len);
+
+	if (total > UIBC_HIDC_OFFSET + len)
+		p[total - 1] = 0;
+
+	return total;
+}
@@ -0,0 +1,133 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * UIBC Generic Input
+ * Players hand user input to miracle-uibcctl as a stream of fixed-size
+ * struct uibc_event records in host byte order, so it never has to parse
+ * text and can read many events with a single read(). uibc_encode() turns
+ * one record into a generic-category UIBC packet in a caller-provided
+ * buffer without allocating.
+ * HIDC packets carry raw HID reports or report descriptors. The caller puts
+ * the report right where it belongs in the packet, at UIBC_HIDC_OFFSET, and
+ * uibc_encode_hidc() only fills in the headers around it.
+ */
+
+#ifndef MIRACLE_UIBC_H
+#define MIRACLE_UIBC_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+enum uibc_generic_type {
+	UIBC_GENERIC_TOUCH_DOWN			= 0,
+	UIBC_GENERIC_TOUCH_UP			= 1,
+	UIBC_GENERIC_TOUCH_MOVE			= 2,
+	UIBC_GENERIC_KEY_DOWN			= 3,
+	UIBC_GENERIC_KEY_UP			= 4,
+	UIBC_GENERIC_ZOOM			= 5,
+	UIBC_GENERIC_VERTICAL_SCROLL		= 6,
+	UIBC_GENERIC_HORIZONTAL_SCROLL		= 7,
+	UIBC_GENERIC_ROTATE			= 8,
+};
+
+enum uibc_hidc_path {
+	UIBC_HIDC_PATH_INFRARED			= 0,
+	UIBC_HIDC_PATH_USB			= 1,
+	UIBC_HIDC_PATH_BT			= 2,
+	UIBC_HIDC_PATH_ZIGBEE			= 3,
+	UIBC_HIDC_PATH_WIFI			= 4,
+	UIBC_HIDC_PATH_NO_SP			= 5,
+	UIBC_HIDC_PATH_CNT,
+};
+
+enum uibc_hidc_type {
+	UIBC_HIDC_TYPE_KEYBOARD			= 0,
+	UIBC_HIDC_TYPE_MOUSE			= 1,
+	UIBC_HIDC_TYPE_SINGLE_TOUCH		= 2,
+	UIBC_HIDC_TYPE_MULTI_TOUCH		= 3,
+	UIBC_HIDC_TYPE_JOYSTICK			= 4,
+	UIBC_HIDC_TYPE_CAMERA			= 5,
+	UIBC_HIDC_TYPE_GESTURE			= 6,
+	UIBC_HIDC_TYPE_REMOTE_CONTROL		= 7,
+	UIBC_HIDC_TYPE_CNT,
+};
+
+enum uibc_hidc_usage {
+	UIBC_HIDC_USAGE_REPORT			= 0,
+	UIBC_HIDC_USAGE_DESCRIPTOR		= 1,
+};
+
+#define UIBC_CATEGORY_GENERIC 0
+#define UIBC_CATEGORY_HIDC 1
+#define UIBC_HEADER_SIZE 4
+#define UIBC_GENERIC_HEADER_SIZE 3
+#define UIBC_HIDC_HEADER_SIZE 5
+/* where the report goes in a HIDC packet */
+#define UIBC_HIDC_OFFSET (UIBC_HEADER_SIZE + UIBC_HIDC_HEADER_SIZE)
+
+#define UIBC_EVENT_MAX_POINTERS 3
+/* largest packet uibc_encode() produces */
+#define UIBC_MAX_PACKET 24
+
+struct uibc_pointer {
+	uint8_t id;
+	uint8_t reserved;
+	uint16_t x;
+	uint16_t y;
+};
+
+struct uibc_event {
+	/* CLOCK_MONOTONIC in usec, when the player saw the event */
+	uint64_t time;
+	uint8_t type;
+	/* number of pointers of touch events */
+	uint8_t count;
+	uint16_t reserved;
+
+	union {
+		struct uibc_pointer pointers[UIBC_EVENT_MAX_POINTERS];
+		struct {
+			uint16_t code1;
+			uint16_t code2;
+		} key;
+		struct {
+			uint16_t x;
+			uint16_t y;
+			uint8_t integer;
+			uint8_t fraction;
+		} zoom;
+		/* unit, direction and amount, bit by bit as on the wire */
+		uint16_t scroll;
+		struct {
+			uint8_t integer;
+			uint8_t fraction;
+		} rotate;
+		uint8_t raw[20];
+	};
+};
+
+int uibc_encode(const struct uibc_event *ev, void *buf, size_t size);
+int uibc_encode_hidc(void *buf,
+		     size_t size,
+		     unsigned int path,
+		     unsigned int type,
+		     unsigned int usage,
+		     size_t len);
+
+#endif /* MIRACLE_UIBC_H */
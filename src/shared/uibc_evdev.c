@@ -0,0 +1,597 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include "shl_macro.h"
+#include "uibc_evdev.h"
+
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define NLONGS(x) (((x) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+/* ASCII codes of the keys of a US layout, without and with shift */
+static const char evdev_keys[][2] = {
+	[KEY_ESC] = { 0x1b, 0x1b },
+	[KEY_1] = { '1', '!' },
+	[KEY_2] = { '2', '@' },
+	[KEY_3] = { '3', '#' },
+	[KEY_4] = { '4', '$' },
+	[KEY_5] = { '5', '%' },
+	[KEY_6] = { '6', '^' },
+	[KEY_7] = { '7', '&' },
+	[KEY_8] = { '8', '*' },
+	[KEY_9] = { '9', '(' },
+	[KEY_0] = { '0', ')' },
+	[KEY_MINUS] = { '-', '_' },
+	[KEY_EQUAL] = { '=', '+' },
+	[KEY_BACKSPACE] = { 0x08, 0x08 },
+	[KEY_TAB] = { '\t', '\t' },
+	[KEY_Q] = { 'q', 'Q' },
+	[KEY_W] = { 'w', 'W' },
+	[KEY_E] = { 'e', 'E' },
+	[KEY_R] = { 'r', 'R' },
+	[KEY_T] = { 't', 'T' },
+	[KEY_Y] = { 'y', 'Y' },
+	[KEY_U] = { 'u', 'U' },
+	[KEY_I] = { 'i', 'I' },
+	[KEY_O] = { 'o', 'O' },
+	[KEY_P] = { 'p', 'P' },
+	[KEY_LEFTBRACE] = { '[', '{' },
+	[KEY_RIGHTBRACE] = { ']', '}' },
+	[KEY_ENTER] = { '\r', '\r' },
+	[KEY_A] = { 'a', 'A' },
+	[KEY_S] = { 's', 'S' },
+	[KEY_D] = { 'd', 'D' },
+	[KEY_F] = { 'f', 'F' },
+	[KEY_G] = { 'g', 'G' },
+	[KEY_H] = { 'h', 'H' },
+	[KEY_J] = { 'j', 'J' },
+	[KEY_K] = { 'k', 'K' },
+	[KEY_L] = { 'l', 'L' },
+	[KEY_SEMICOLON] = { ';', ':' },
+	[KEY_APOSTROPHE] = { '\'', '"' },
+	[KEY_GRAVE] = { '`', '~' },
+	[KEY_BACKSLASH] = { '\\', '|' },
+	[KEY_Z] = { 'z', 'Z' },
+	[KEY_X] = { 'x', 'X' },
+	[KEY_C] = { 'c', 'C' },
+	[KEY_V] = { 'v', 'V' },
+	[KEY_B] = { 'b', 'B' },
+	[KEY_N] = { 'n', 'N' },
+	[KEY_M] = { 'm', 'M' },
+	[KEY_COMMA] = { ',', '<' },
+	[KEY_DOT] = { '.', '>' },
+	[KEY_SLASH] = { '/', '?' },
+	[KEY_SPACE] = { ' ', ' ' },
+	[KEY_DELETE] = { 0x7f, 0x7f },
+};
+
+static bool test_bit(const unsigned long *bits, unsigned int bit)
+{
+	return bits[bit / BITS_PER_LONG] & (1UL << (bit % BITS_PER_LONG));
+}
+
+int uibc_evdev_new(struct uibc_evdev **out,
+		   unsigned int kind,
+		   unsigned int width,
+		   unsigned int height)
+{
+	struct uibc_evdev *dev;
+	unsigned int i;
+
+	if (!out || !width || !height || width > 0xffff || height > 0xffff)
+		return -EINVAL;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return -ENOMEM;
+
+	dev->fd = -1;
+	dev->kind = kind;
+	dev->width = width;
+	dev->height = height;
+	for (i = 0; i < UIBC_EVDEV_SLOTS; ++i)
+		dev->slots[i].tracking_id = -1;
+
+	/* mice start in the middle of the screen */
+	dev->slots[0].x = width / 2;
+	dev->slots[0].y = height / 2;
+
+	uibc_evdev_set_range(dev, 0, width - 1, 0, height - 1);
+
+	*out = dev;
+	return 0;
+}
+
+int uibc_evdev_open(struct uibc_evdev **out,
+		    const char *path,
+		    unsigned int width,
+		    unsigned int height,
+		    bool grab)
+{
+	unsigned long evbits[NLONGS(EV_CNT)] = { };
+	unsigned long absbits[NLONGS(ABS_CNT)] = { };
+	unsigned long relbits[NLONGS(REL_CNT)] = { };
+	unsigned long keybits[NLONGS(KEY_CNT)] = { };
+	struct input_absinfo ax, ay;
+	struct uibc_evdev *dev;
+	unsigned int kind, xcode = ABS_X, ycode = ABS_Y;
+	int fd, r, clk = CLOCK_MONOTONIC;
+
+	if (!out || !path)
+		return -EINVAL;
+
+	fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(evbits)), evbits) < 0 ||
+	    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits) < 0 ||
+	    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(relbits)), relbits) < 0 ||
+	    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits) < 0) {
+		r = -errno;
+		goto err_close;
+	}
+
+	if (test_bit(evbits, EV_ABS) &&
+	    test_bit(absbits, ABS_MT_POSITION_X) &&
+	    test_bit(absbits, ABS_MT_SLOT)) {
+		kind = UIBC_EVDEV_TOUCH;
+		xcode = ABS_MT_POSITION_X;
+		ycode = ABS_MT_POSITION_Y;
+	} else if (test_bit(evbits, EV_ABS) &&
+		   test_bit(absbits, ABS_X) &&
+		   test_bit(keybits, BTN_TOUCH)) {
+		kind = UIBC_EVDEV_TOUCH;
+	} else if (test_bit(evbits, EV_REL) &&
+		   test_bit(relbits, REL_X) &&
+		   test_bit(keybits, BTN_LEFT)) {
+		kind = UIBC_EVDEV_MOUSE;
+	} else if (test_bit(evbits, EV_KEY) &&
+		   test_bit(keybits, KEY_A)) {
+		kind = UIBC_EVDEV_KEYBOARD;
+	} else {
+		r = -ENODEV;
+		goto err_close;
+	}
+
+	r = uibc_evdev_new(&dev, kind, width, height);
+	if (r < 0)
+		goto err_close;
+
+	dev->fd = fd;
+	dev->mt = xcode == ABS_MT_POSITION_X;
+
+	if (kind == UIBC_EVDEV_TOUCH) {
+		if (ioctl(fd, EVIOCGABS(xcode), &ax) < 0 ||
+		    ioctl(fd, EVIOCGABS(ycode), &ay) < 0) {
+			r = -errno;
+			goto err_free;
+		}
+
+		uibc_evdev_set_range(dev, ax.minimum, ax.maximum,
+				     ay.minimum, ay.maximum);
+	}
+
+	/* same clock as the rest of the pipeline, for latency figures */
+	ioctl(fd, EVIOCSCLOCKID, &clk);
+
+	if (grab && ioctl(fd, EVIOCGRAB, (void*)1) < 0) {
+		r = -errno;
+		goto err_free;
+	}
+
+	*out = dev;
+	return 0;
+
+err_free:
+	uibc_evdev_free(dev);
+	return r;
+err_close:
+	close(fd);
+	return r;
+}
+
+void uibc_evdev_free(struct uibc_evdev *dev)
+{
+	if (!dev)
+		return;
+
+	if (dev->fd >= 0)
+		close(dev->fd);
+	free(dev);
+}
+
+void uibc_evdev_set_range(struct uibc_evdev *dev,
+			  int32_t min_x,
+			  int32_t max_x,
+			  int32_t min_y,
+			  int32_t max_y)
+{
+	dev->min_x = min_x;
+	dev->max_x = max_x > min_x ? max_x : min_x + 1;
+	dev->min_y = min_y;
+	dev->max_y = max_y > min_y ? max_y : min_y + 1;
+}
+
+static uint16_t evdev_scale(int32_t v, int32_t min, int32_t max,
+			    unsigned int size)
+{
+	int64_t r;
+
+	r = (int64_t)(v - min) * (size - 1) / (max - min);
+
+	return shl_max_t(int64_t, shl_min_t(int64_t, r, size - 1), 0);
+}
+
+static void evdev_pointer(struct uibc_evdev *dev,
+			  struct uibc_event *ev,
+			  unsigned int slot)
+{
+	struct uibc_pointer *p = &ev->pointers[ev->count++];
+
+	p->id = slot;
+	p->x = dev->slots[slot].x;
+	p->y = dev->slots[slot].y;
+}
+
+/* downs, then a move of everything that moved, then ups */
+static void evdev_frame(struct uibc_evdev *dev, uibc_evdev_fn fn, void *data)
+{
+	struct uibc_evdev_slot *s;
+	struct uibc_event ev;
+	unsigned int i;
+
+	for (i = 0; i < UIBC_EVDEV_SLOTS; ++i) {
+		s = &dev->slots[i];
+		if (!s->active || s->was_active)
+			continue;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.time = dev->time;
+		ev.type = UIBC_GENERIC_TOUCH_DOWN;
+		evdev_pointer(dev, &ev, i);
+		fn(dev, &ev, data);
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.time = dev->time;
+	ev.type = UIBC_GENERIC_TOUCH_MOVE;
+	for (i = 0; i < UIBC_EVDEV_SLOTS; ++i) {
+		s = &dev->slots[i];
+		if (!s->active || !s->was_active || !s->moved)
+			continue;
+
+		/* a packet takes three contacts, send what doesn't fit next */
+		if (ev.count == UIBC_EVENT_MAX_POINTERS) {
+			fn(dev, &ev, data);
+			ev.count = 0;
+		}
+		evdev_pointer(dev, &ev, i);
+	}
+	if (ev.count)
+		fn(dev, &ev, data);
+
+	for (i = 0; i < UIBC_EVDEV_SLOTS; ++i) {
+		s = &dev->slots[i];
+		if (s->active || !s->was_active)
+			continue;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.time = dev->time;
+		ev.type = UIBC_GENERIC_TOUCH_UP;
+		evdev_pointer(dev, &ev, i);
+		fn(dev, &ev, data);
+	}
+
+	for (i = 0; i < UIBC_EVDEV_SLOTS; ++i) {
+		dev->slots[i].was_active = dev->slots[i].active;
+		dev->slots[i].moved = false;
+	}
+}
+
+static void evdev_key(struct uibc_evdev *dev,
+		      const struct input_event *ie,
+		      uibc_evdev_fn fn,
+		      void *data)
+{
+	struct uibc_event ev = { };
+
+	if (ie->code == KEY_LEFTSHIFT || ie->code == KEY_RIGHTSHIFT) {
+		dev->shift = !!ie->value;
+		return;
+	}
+
+	if (ie->code >= SHL_ARRAY_LENGTH(evdev_keys) ||
+	    !evdev_keys[ie->code][0])
+		return;
+
+	if (ie->value)
+		dev->keys[ie->code / 8] |= 1 << (ie->code % 8);
+	else
+		dev->keys[ie->code / 8] &= ~(1 << (ie->code % 8));
+
+	/* autorepeat is a key down again */
+	ev.time = dev->time;
+	ev.type = ie->value ? UIBC_GENERIC_KEY_DOWN : UIBC_GENERIC_KEY_UP;
+	ev.key.code1 = (uint8_t)evdev_keys[ie->code][dev->shift];
+	fn(dev, &ev, data);
+}
+
+static void evdev_abs(struct uibc_evdev *dev, const struct input_event *ie)
+{
+	struct uibc_evdev_slot *s;
+
+	if (ie->code == ABS_MT_SLOT) {
+		dev->slot = ie->value;
+		return;
+	}
+
+	/* ignore contacts beyond what we track */
+	if (dev->slot >= UIBC_EVDEV_SLOTS)
+		return;
+
+	s = &dev->slots[dev->slot];
+
+	switch (ie->code) {
+	case ABS_MT_TRACKING_ID:
+		dev->mt = true;
+		s->tracking_id = ie->value;
+		s->active = ie->value >= 0;
+		break;
+	case ABS_MT_POSITION_X:
+		dev->mt = true;
+		s->x = evdev_scale(ie->value, dev->min_x, dev->max_x,
+				   dev->width);
+		s->moved = true;
+		break;
+	case ABS_MT_POSITION_Y:
+		dev->mt = true;
+		s->y = evdev_scale(ie->value, dev->min_y, dev->max_y,
+				   dev->height);
+		s->moved = true;
+		break;
+	case ABS_X:
+		/* multi-touch screens emulate a single contact, skip it */
+		if (dev->mt)
+			break;
+		dev->slots[0].x = evdev_scale(ie->value, dev->min_x,
+					      dev->max_x, dev->width);
+		dev->slots[0].moved = true;
+		break;
+	case ABS_Y:
+		if (dev->mt)
+			break;
+		dev->slots[0].y = evdev_scale(ie->value, dev->min_y,
+					      dev->max_y, dev->height);
+		dev->slots[0].moved = true;
+		break;
+	}
+}
+
+static void evdev_rel(struct uibc_evdev *dev, const struct input_event *ie)
+{
+	struct uibc_evdev_slot *s = &dev->slots[0];
+	int64_t v;
+
+	switch (ie->code) {
+	case REL_X:
+		v = (int64_t)s->x + ie->value;
+		s->x = shl_max_t(int64_t, shl_min_t(int64_t, v, dev->width - 1), 0);
+		s->moved = true;
+		break;
+	case REL_Y:
+		v = (int64_t)s->y + ie->value;
+		s->y = shl_max_t(int64_t, shl_min_t(int64_t, v, dev->height - 1), 0);
+		s->moved = true;
+		break;
+	}
+}
+
+/* read the contacts back from the kernel, false if that is not possible */
+static bool evdev_sync_slots(struct uibc_evdev *dev)
+{
+	struct {
+		uint32_t code;
+		int32_t values[UIBC_EVDEV_SLOTS];
+	} id, x, y;
+	struct input_absinfo info;
+	struct uibc_evdev_slot *s;
+	unsigned int i;
+
+	if (dev->fd < 0)
+		return false;
+
+	if (!dev->mt) {
+		if (ioctl(dev->fd, EVIOCGABS(ABS_X), &info) < 0)
+			return false;
+		dev->slots[0].x = evdev_scale(info.value, dev->min_x,
+					      dev->max_x, dev->width);
+
+		if (ioctl(dev->fd, EVIOCGABS(ABS_Y), &info) < 0)
+			return false;
+		dev->slots[0].y = evdev_scale(info.value, dev->min_y,
+					      dev->max_y, dev->height);
+
+		dev->slots[0].moved = true;
+		return true;
+	}
+
+	id.code = ABS_MT_TRACKING_ID;
+	x.code = ABS_MT_POSITION_X;
+	y.code = ABS_MT_POSITION_Y;
+	if (ioctl(dev->fd, EVIOCGMTSLOTS(sizeof(id)), &id) < 0 ||
+	    ioctl(dev->fd, EVIOCGMTSLOTS(sizeof(x)), &x) < 0 ||
+	    ioctl(dev->fd, EVIOCGMTSLOTS(sizeof(y)), &y) < 0 ||
+	    ioctl(dev->fd, EVIOCGABS(ABS_MT_SLOT), &info) < 0)
+		return false;
+
+	dev->slot = info.value;
+	for (i = 0; i < UIBC_EVDEV_SLOTS; ++i) {
+		s = &dev->slots[i];
+		s->tracking_id = id.values[i];
+		s->active = id.values[i] >= 0;
+		if (!s->active)
+			continue;
+
+		s->x = evdev_scale(x.values[i], dev->min_x, dev->max_x,
+				   dev->width);
+		s->y = evdev_scale(y.values[i], dev->min_y, dev->max_y,
+				   dev->height);
+		s->moved = true;
+	}
+
+	return true;
+}
+
+/*
+ * The kernel dropped events, so our idea of what is pressed may be wrong.
+ * Read the state back and send the difference like a regular frame. Ups
+ * that got lost are what matters most, a contact or key that stays down on
+ * the source is much worse than a missed down.
+ */
+static void evdev_resync(struct uibc_evdev *dev, uibc_evdev_fn fn, void *data)
+{
+	unsigned long keys[NLONGS(KEY_CNT)] = { };
+	struct uibc_event ev;
+	bool have_keys;
+	unsigned int i;
+
+	have_keys = dev->fd >= 0 &&
+		    ioctl(dev->fd, EVIOCGKEY(sizeof(keys)), keys) >= 0;
+
+	switch (dev->kind) {
+	case UIBC_EVDEV_TOUCH:
+		if (!evdev_sync_slots(dev)) {
+			for (i = 0; i < UIBC_EVDEV_SLOTS; ++i) {
+				dev->slots[i].tracking_id = -1;
+				dev->slots[i].active = false;
+			}
+		} else if (!dev->mt) {
+			dev->slots[0].active = have_keys &&
+					       test_bit(keys, BTN_TOUCH);
+		}
+		break;
+	case UIBC_EVDEV_MOUSE:
+		dev->slots[0].active = have_keys && test_bit(keys, BTN_LEFT);
+		break;
+	case UIBC_EVDEV_KEYBOARD:
+		for (i = 0; i < KEY_CNT; ++i) {
+			if (!(dev->keys[i / 8] & (1 << (i % 8))))
+				continue;
+			if (have_keys && test_bit(keys, i))
+				continue;
+
+			dev->keys[i / 8] &= ~(1 << (i % 8));
+
+			memset(&ev, 0, sizeof(ev));
+			ev.time = dev->time;
+			ev.type = UIBC_GENERIC_KEY_UP;
+			ev.key.code1 = (uint8_t)evdev_keys[i][dev->shift];
+			fn(dev, &ev, data);
+		}
+
+		dev->shift = have_keys && (test_bit(keys, KEY_LEFTSHIFT) ||
+					   test_bit(keys, KEY_RIGHTSHIFT));
+		return;
+	}
+
+	evdev_frame(dev, fn, data);
+}
+
+void uibc_evdev_feed(struct uibc_evdev *dev,
+		     const struct input_event *ie,
+		     uibc_evdev_fn fn,
+		     void *data)
+{
+	dev->time = (uint64_t)ie->input_event_sec * 1000000ULL +
+		    ie->input_event_usec;
+
+	if (ie->type == EV_SYN) {
+		if (ie->code == SYN_DROPPED) {
+			dev->dropped = true;
+		} else if (ie->code == SYN_REPORT) {
+			/* half a frame is worse than none */
+			if (dev->dropped)
+				evdev_resync(dev, fn, data);
+			else
+				evdev_frame(dev, fn, data);
+			dev->dropped = false;
+		}
+		return;
+	}
+
+	if (dev->dropped)
+		return;
+
+	switch (dev->kind) {
+	case UIBC_EVDEV_TOUCH:
+		if (ie->type == EV_ABS)
+			evdev_abs(dev, ie);
+		else if (ie->type == EV_KEY && ie->code == BTN_TOUCH &&
+			 !dev->mt)
+			dev->slots[0].active = !!ie->value;
+		break;
+	case UIBC_EVDEV_MOUSE:
+		if (ie->type == EV_REL)
+			evdev_rel(dev, ie);
+		else if (ie->type == EV_KEY && ie->code == BTN_LEFT)
+			dev->slots[0].active = !!ie->value;
+		break;
+	case UIBC_EVDEV_KEYBOARD:
+		if (ie->type == EV_KEY)
+			evdev_key(dev, ie, fn, data);
+		break;
+	}
+}
+
+/* read everything pending on the device */
+int uibc_evdev_dispatch(struct uibc_evdev *dev, uibc_evdev_fn fn, void *data)
+{
+	struct input_event ie[64];
+	ssize_t l;
+	size_t i;
+
+	for (;;) {
+		l = read(dev->fd, ie, sizeof(ie));
+		if (l < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 0;
+			return -errno;
+		} else if (!l) {
+			return -ENODEV;
+		}
+
+		for (i = 0; i < l / sizeof(*ie); ++i)
+			uibc_evdev_feed(dev, &ie[i], fn, data);
+	}
+}
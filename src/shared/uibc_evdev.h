@@ -0,0 +1,120 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * UIBC evdev Capture
+ * Turns the events of a Linux input device into generic UIBC events, so
+ * input can go from the kernel to the source without a player in between.
+ * Devices are classified by what they report:
+ *  - touchscreens (multi-touch protocol B or a single BTN_TOUCH contact)
+ *    have their absolute axes scaled to the negotiated resolution, every
+ *    slot is a pointer
+ *  - mice move a cursor in the negotiated resolution and touch with the
+ *    left button
+ *  - keyboards send key down/up with the ASCII code of the key, as far as
+ *    it has one
+ * Events of one device are collected until SYN_REPORT, so a frame of a
+ * multi-touch screen results in downs and ups per contact and a single
+ * move carrying all contacts that moved.
+ * If the kernel drops events, contacts and keys are read back from the
+ * device and whatever changed meanwhile is sent, so nothing stays pressed
+ * on the source. Devices without an fd release everything instead.
+ */
+
+#ifndef MIRACLE_UIBC_EVDEV_H
+#define MIRACLE_UIBC_EVDEV_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <linux/input.h>
+#include "uibc.h"
+
+#define UIBC_EVDEV_SLOTS 10
+
+enum uibc_evdev_kind {
+	UIBC_EVDEV_TOUCH,
+	UIBC_EVDEV_MOUSE,
+	UIBC_EVDEV_KEYBOARD,
+};
+
+struct uibc_evdev_slot {
+	int32_t tracking_id;
+	uint16_t x;
+	uint16_t y;
+	bool active : 1;
+	bool was_active : 1;
+	bool moved : 1;
+};
+
+struct uibc_evdev {
+	int fd;
+	unsigned int kind;
+
+	/* negotiated resolution events are mapped to */
+	unsigned int width;
+	unsigned int height;
+
+	/* range of the absolute axes of touchscreens */
+	int32_t min_x;
+	int32_t max_x;
+	int32_t min_y;
+	int32_t max_y;
+
+	unsigned int slot;
+	struct uibc_evdev_slot slots[UIBC_EVDEV_SLOTS];
+
+	/* time of the frame being collected, usec */
+	uint64_t time;
+
+	/* keys we sent a down for and no up yet */
+	uint8_t keys[(KEY_CNT + 7) / 8];
+
+	/* ABS_X/Y are only the emulated first contact if set */
+	bool mt : 1;
+	/* the kernel lost events, resync at the end of the frame */
+	bool dropped : 1;
+	bool shift : 1;
+};
+
+typedef void (*uibc_evdev_fn) (struct uibc_evdev *dev,
+			       const struct uibc_event *ev,
+			       void *data);
+
+int uibc_evdev_new(struct uibc_evdev **out,
+		   unsigned int kind,
+		   unsigned int width,
+		   unsigned int height);
+int uibc_evdev_open(struct uibc_evdev **out,
+		    const char *path,
+		    unsigned int width,
+		    unsigned int height,
+		    bool grab);
+void uibc_evdev_free(struct uibc_evdev *dev);
+
+void uibc_evdev_set_range(struct uibc_evdev *dev,
+			  int32_t min_x,
+			  int32_t max_x,
+			  int32_t min_y,
+			  int32_t max_y);
+void uibc_evdev_feed(struct uibc_evdev *dev,
+		     const struct input_event *ie,
+		     uibc_evdev_fn fn,
+		     void *data);
+int uibc_evdev_dispatch(struct uibc_evdev *dev, uibc_evdev_fn fn, void *data);
+
+#endif /* MIRACLE_UIBC_EVDEV_H */
@@ -0,0 +1,221 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/hidraw.h>
+#include <linux/input.h>
+#include "shl_macro.h"
+#include "uibc_hidc.h"
+
+#define HID_PAGE_GENERIC_DESKTOP 0x01
+#define HID_PAGE_DIGITIZER 0x0d
+#define HID_PAGE_CONSUMER 0x0c
+
+static const char *hidc_types[] = {
+	[UIBC_HIDC_TYPE_KEYBOARD] = "Keyboard",
+	[UIBC_HIDC_TYPE_MOUSE] = "Mouse",
+	[UIBC_HIDC_TYPE_SINGLE_TOUCH] = "SingleTouch",
+	[UIBC_HIDC_TYPE_MULTI_TOUCH] = "MultiTouch",
+	[UIBC_HIDC_TYPE_JOYSTICK] = "Joystick",
+	[UIBC_HIDC_TYPE_CAMERA] = "Camera",
+	[UIBC_HIDC_TYPE_GESTURE] = "Gesture",
+	[UIBC_HIDC_TYPE_REMOTE_CONTROL] = "RemoteControl",
+};
+
+static const char *hidc_paths[] = {
+	[UIBC_HIDC_PATH_INFRARED] = "Infrared",
+	[UIBC_HIDC_PATH_USB] = "USB",
+	[UIBC_HIDC_PATH_BT] = "BT",
+	[UIBC_HIDC_PATH_ZIGBEE] = "Zigbee",
+	[UIBC_HIDC_PATH_WIFI] = "Wi-Fi",
+	[UIBC_HIDC_PATH_NO_SP] = "No-SP",
+};
+
+const char *uibc_hidc_type_to_str(unsigned int type)
+{
+	if (type >= SHL_ARRAY_LENGTH(hidc_types))
+		return NULL;
+
+	return hidc_types[type];
+}
+
+const char *uibc_hidc_path_to_str(unsigned int path)
+{
+	if (path >= SHL_ARRAY_LENGTH(hidc_paths))
+		return NULL;
+
+	return hidc_paths[path];
+}
+
+int uibc_hidc_path_from_bus(unsigned int bus)
+{
+	switch (bus) {
+	case BUS_USB:
+		return UIBC_HIDC_PATH_USB;
+	case BUS_BLUETOOTH:
+		return UIBC_HIDC_PATH_BT;
+	default:
+		return UIBC_HIDC_PATH_NO_SP;
+	}
+}
+
+/*
+ * Only the usage page and usage in front of the first collection matter,
+ * so this walks the short items up to there and ignores everything else.
+ */
+int uibc_hidc_type_from_descriptor(const uint8_t *desc, size_t len)
+{
+	unsigned int page = 0, usage = 0, size, tag;
+	size_t i = 0;
+	uint32_t v;
+
+	while (i < len) {
+		/* long items carry their size in the next byte */
+		if (desc[i] == 0xfe) {
+			if (i + 1 >= len)
+				break;
+			i += 3 + desc[i + 1];
+			continue;
+		}
+
+		size = desc[i] & 0x03;
+		size = size == 3 ? 4 : size;
+		tag = desc[i] & 0xfc;
+		if (i + 1 + size > len)
+			break;
+
+		v = 0;
+		memcpy(&v, desc + i + 1, size);
+		v = le32toh(v);
+		i += 1 + size;
+
+		if (tag == 0x04) {
+			/* Usage Page */
+			page = v;
+		} else if (tag == 0x08) {
+			/* Usage, possibly with the page in the upper half */
+			usage = v & 0xffff;
+			if (size == 4)
+				page = v >> 16;
+		} else if (tag == 0xa0) {
+			/* Collection */
+			break;
+		}
+	}
+
+	if (page == HID_PAGE_GENERIC_DESKTOP) {
+		switch (usage) {
+		case 0x01:
+		case 0x02:
+			return UIBC_HIDC_TYPE_MOUSE;
+		case 0x04:
+		case 0x05:
+			return UIBC_HIDC_TYPE_JOYSTICK;
+		case 0x06:
+		case 0x07:
+			return UIBC_HIDC_TYPE_KEYBOARD;
+		}
+	} else if (page == HID_PAGE_DIGITIZER) {
+		switch (usage) {
+		case 0x04:
+			return UIBC_HIDC_TYPE_MULTI_TOUCH;
+		case 0x01:
+		case 0x02:
+		case 0x05:
+			return UIBC_HIDC_TYPE_SINGLE_TOUCH;
+		}
+	} else if (page == HID_PAGE_CONSUMER && usage == 0x01) {
+		return UIBC_HIDC_TYPE_REMOTE_CONTROL;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+int uibc_hidraw_open(struct uibc_hidraw **out, const char *path)
+{
+	struct hidraw_report_descriptor *rdesc;
+	struct hidraw_devinfo info;
+	struct uibc_hidraw *hid;
+	int r, size;
+
+	if (!out || !path)
+		return -EINVAL;
+
+	hid = calloc(1, sizeof(*hid));
+	if (!hid)
+		return -ENOMEM;
+	hid->fd = -1;
+
+	rdesc = calloc(1, sizeof(*rdesc));
+	if (!rdesc) {
+		r = -ENOMEM;
+		goto error;
+	}
+
+	hid->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (hid->fd < 0) {
+		r = -errno;
+		goto error;
+	}
+
+	if (ioctl(hid->fd, HIDIOCGRAWINFO, &info) < 0 ||
+	    ioctl(hid->fd, HIDIOCGRDESCSIZE, &size) < 0) {
+		r = -errno;
+		goto error;
+	}
+
+	rdesc->size = size;
+	if (ioctl(hid->fd, HIDIOCGRDESC, rdesc) < 0) {
+		r = -errno;
+		goto error;
+	}
+
+	r = uibc_hidc_type_from_descriptor(rdesc->value, rdesc->size);
+	if (r < 0)
+		goto error;
+
+	hid->type = r;
+	hid->path = uibc_hidc_path_from_bus(info.bustype);
+	hid->desc_len = rdesc->size;
+	memcpy(hid->desc, rdesc->value, rdesc->size);
+	free(rdesc);
+
+	*out = hid;
+	return 0;
+
+error:
+	free(rdesc);
+	uibc_hidraw_free(hid);
+	return r;
+}
+
+void uibc_hidraw_free(struct uibc_hidraw *hid)
+{
+	if (!hid)
+		return;
+
+	if (hid->fd >= 0)
+		close(hid->fd);
+	free(hid);
+}
@@ -0,0 +1,56 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * UIBC HIDC Devices
+ * HIDC passes the reports of a HID device through unchanged, the source
+ * interprets them with the report descriptor we send first. We read both
+ * from hidraw. The HIDC type of a device is derived from the top-level
+ * collection of its descriptor and the input path from the bus it is on.
+ */
+
+#ifndef MIRACLE_UIBC_HIDC_H
+#define MIRACLE_UIBC_HIDC_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <linux/hidraw.h>
+#include "uibc.h"
+
+/* largest report we pass through, real devices stay far below */
+#define UIBC_HIDC_MAX_REPORT 4096
+
+struct uibc_hidraw {
+	int fd;
+	unsigned int path;
+	unsigned int type;
+
+	size_t desc_len;
+	uint8_t desc[HID_MAX_DESCRIPTOR_SIZE];
+};
+
+int uibc_hidraw_open(struct uibc_hidraw **out, const char *path);
+void uibc_hidraw_free(struct uibc_hidraw *hid);
+
+int uibc_hidc_type_from_descriptor(const uint8_t *desc, size_t len);
+int uibc_hidc_path_from_bus(unsigned int bus);
+
+const char *uibc_hidc_type_to_str(unsigned int type);
+const char *uibc_hidc_path_to_str(unsigned int path);
+
+#endif /* MIRACLE_UIBC_HIDC_H */
@@ -0,0 +1,245 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wfd_ie.h"
+
+static int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -EINVAL;
+}
+
+/* decode @len bytes of @hex into @out, @out may be NULL to skip them */
+static int hex_read(const char **hex, uint8_t *out, size_t len)
+{
+	const char *p = *hex;
+	int hi, lo;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		hi = hex_nibble(p[0]);
+		if (hi < 0)
+			return -EINVAL;
+		lo = hex_nibble(p[1]);
+		if (lo < 0)
+			return -EINVAL;
+
+		if (out)
+			out[i] = (hi << 4) | lo;
+		p += 2;
+	}
+
+	*hex = p;
+	return 0;
+}
+
+static uint16_t get_be16(const uint8_t *p)
+{
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static void parse_dev_info(struct wfd_ie *ie, const uint8_t *body)
+{
+	ie->dev_info = get_be16(body);
+	ie->rtsp_port = get_be16(body + 2);
+	ie->max_throughput = get_be16(body + 4);
+	ie->present |= 1U << WFD_SUBELEM_DEV_INFO;
+}
+
+static int parse_subelem(struct wfd_ie *ie,
+			 unsigned int id,
+			 const uint8_t *body,
+			 size_t len)
+{
+	/* first occurrence wins, later ones are ignored */
+	if (id < sizeof(ie->present) * 8 && wfd_ie_has(ie, id))
+		return 0;
+
+	switch (id) {
+	case WFD_SUBELEM_DEV_INFO:
+		if (len < 6)
+			return -EINVAL;
+		parse_dev_info(ie, body);
+		break;
+	case WFD_SUBELEM_ASSOC_BSSID:
+		if (len < 6)
+			return -EINVAL;
+		memcpy(ie->bssid, body, 6);
+		ie->present |= 1U << id;
+		break;
+	case WFD_SUBELEM_COUPLED_SINK:
+		if (len < 1)
+			return -EINVAL;
+		ie->coupled_sink_status = body[0];
+		if (len >= 7)
+			memcpy(ie->coupled_sink_mac, body + 1, 6);
+		ie->present |= 1U << id;
+		break;
+	case WFD_SUBELEM_EXT_CAP:
+		if (len < 2)
+			return -EINVAL;
+		ie->ext_cap = get_be16(body);
+		ie->present |= 1U << id;
+		break;
+	}
+
+	return 0;
+}
+
+/* parse length and body of subelement @id */
+static int parse_len_body(struct wfd_ie *ie, unsigned int id, const char **hex)
+{
+	uint8_t hdr[2], body[256];
+	size_t len;
+	int r;
+
+	r = hex_read(hex, hdr, sizeof(hdr));
+	if (r < 0)
+		return r;
+
+	len = get_be16(hdr);
+	if (len <= sizeof(body)) {
+		r = hex_read(hex, body, len);
+	} else {
+		/* none of the subelements we parse is that big */
+		r = hex_read(hex, NULL, len);
+		len = 0;
+	}
+	if (r < 0)
+		return r;
+
+	return parse_subelem(ie, id, body, len);
+}
+
+int wfd_ie_parse(struct wfd_ie *ie, const char *hex)
+{
+	uint8_t id, body[6];
+	int r;
+
+	if (!ie)
+		return -EINVAL;
+
+	memset(ie, 0, sizeof(*ie));
+
+	if (!hex || !*hex)
+		return 0;
+
+	/* "0x" prefix: device-information body only */
+	if (hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X')) {
+		hex += 2;
+		r = hex_read(&hex, body, 6);
+		if (r < 0 || *hex)
+			goto error;
+
+		parse_dev_info(ie, body);
+		return 0;
+	}
+
+	while (*hex) {
+		r = hex_read(&hex, &id, 1);
+		if (r < 0)
+			goto error;
+
+		r = parse_len_body(ie, id, &hex);
+		if (r < 0)
+			goto error;
+	}
+
+	return 0;
+
+error:
+	memset(ie, 0, sizeof(*ie));
+	return -EINVAL;
+}
+
+int wfd_ie_parse_subelem(struct wfd_ie *ie, unsigned int id, const char *hex)
+{
+	int r;
+
+	if (!ie || id > 0xff)
+		return -EINVAL;
+
+	memset(ie, 0, sizeof(*ie));
+
+	if (!hex || !*hex)
+		return 0;
+
+	r = parse_len_body(ie, id, &hex);
+	if (r < 0 || *hex) {
+		memset(ie, 0, sizeof(*ie));
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+unsigned int wfd_ie_get_caps(const struct wfd_ie *ie)
+{
+	static const unsigned int type_caps[] = {
+		[WFD_DEV_SOURCE] = WFD_CAP_SOURCE,
+		[WFD_DEV_PRIMARY_SINK] = WFD_CAP_PRIMARY_SINK,
+		[WFD_DEV_SECONDARY_SINK] = WFD_CAP_SECONDARY_SINK,
+		[WFD_DEV_DUAL_ROLE] = WFD_CAP_SOURCE | WFD_CAP_PRIMARY_SINK,
+	};
+	unsigned int caps;
+
+	if (!ie || !wfd_ie_has(ie, WFD_SUBELEM_DEV_INFO))
+		return 0;
+
+	caps = type_caps[wfd_ie_get_dev_type(ie)];
+
+	if ((ie->dev_info & WFD_DEV_INFO_SESSION_MASK) ==
+	    WFD_DEV_INFO_SESSION_AVAILABLE)
+		caps |= WFD_CAP_SESSION_AVAILABLE;
+	if (ie->dev_info & (WFD_DEV_INFO_COUPLED_SOURCE |
+			    WFD_DEV_INFO_COUPLED_SINK))
+		caps |= WFD_CAP_COUPLED_SINK;
+	if (ie->dev_info & WFD_DEV_INFO_CONTENT_PROTECTION)
+		caps |= WFD_CAP_CONTENT_PROTECTION;
+	if (wfd_ie_has(ie, WFD_SUBELEM_EXT_CAP) &&
+	    (ie->ext_cap & WFD_EXT_CAP_UIBC))
+		caps |= WFD_CAP_UIBC;
+
+	return caps;
+}
+
+const char *wfd_dev_type_to_str(enum wfd_dev_type type)
+{
+	switch (type) {
+	case WFD_DEV_SOURCE:
+		return "source";
+	case WFD_DEV_PRIMARY_SINK:
+		return "primary-sink";
+	case WFD_DEV_SECONDARY_SINK:
+		return "secondary-sink";
+	case WFD_DEV_DUAL_ROLE:
+		return "dual-role";
+	}
+
+	return "unknown";
+}
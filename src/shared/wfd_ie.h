@@ -0,0 +1,107 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * WFD Information Elements
+ * wpas reports the WFD IE of a peer as hex-encoded subelements (each one is
+ * an 8bit ID, a 16bit big-endian length and the body), or, in some events,
+ * as "0x"-prefixed body of the device-information subelement only.
+ * wfd_ie_parse() decodes both into a compact struct so users never have to
+ * touch the hex string again. Unknown subelements are skipped.
+ * wfd_ie_parse_subelem() decodes a single subelement without ID, which is
+ * the format WFD_SUBELEM_SET takes.
+ */
+
+#ifndef MIRACLE_WFD_IE_H
+#define MIRACLE_WFD_IE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+enum wfd_subelem_id {
+	WFD_SUBELEM_DEV_INFO			= 0,
+	WFD_SUBELEM_ASSOC_BSSID			= 1,
+	WFD_SUBELEM_COUPLED_SINK		= 6,
+	WFD_SUBELEM_EXT_CAP			= 7,
+};
+
+/* device information bitmap */
+#define WFD_DEV_INFO_TYPE_MASK			0x0003
+#define WFD_DEV_INFO_COUPLED_SOURCE		0x0004
+#define WFD_DEV_INFO_COUPLED_SINK		0x0008
+#define WFD_DEV_INFO_SESSION_MASK		0x0030
+#define WFD_DEV_INFO_SESSION_AVAILABLE		0x0010
+#define WFD_DEV_INFO_CONTENT_PROTECTION		0x0100
+
+/* extended capability bitmap */
+#define WFD_EXT_CAP_UIBC			0x0001
+
+enum wfd_dev_type {
+	WFD_DEV_SOURCE				= 0,
+	WFD_DEV_PRIMARY_SINK			= 1,
+	WFD_DEV_SECONDARY_SINK			= 2,
+	WFD_DEV_DUAL_ROLE			= 3,
+};
+
+/* capability mask as returned by wfd_ie_get_caps() */
+enum wfd_cap {
+	WFD_CAP_SOURCE				= 0x0001,
+	WFD_CAP_PRIMARY_SINK			= 0x0002,
+	WFD_CAP_SECONDARY_SINK			= 0x0004,
+	WFD_CAP_SESSION_AVAILABLE		= 0x0008,
+	WFD_CAP_COUPLED_SINK			= 0x0010,
+	WFD_CAP_CONTENT_PROTECTION		= 0x0020,
+	WFD_CAP_UIBC				= 0x0040,
+};
+
+struct wfd_ie {
+	/* bitmask of (1U << subelem-id) of all decoded subelements */
+	unsigned int present;
+
+	/* WFD_SUBELEM_DEV_INFO */
+	uint16_t dev_info;
+	uint16_t rtsp_port;
+	uint16_t max_throughput;	/* in Mbps */
+
+	/* WFD_SUBELEM_ASSOC_BSSID */
+	uint8_t bssid[6];
+
+	/* WFD_SUBELEM_COUPLED_SINK */
+	uint8_t coupled_sink_status;
+	uint8_t coupled_sink_mac[6];
+
+	/* WFD_SUBELEM_EXT_CAP */
+	uint16_t ext_cap;
+};
+
+int wfd_ie_parse(struct wfd_ie *ie, const char *hex);
+int wfd_ie_parse_subelem(struct wfd_ie *ie, unsigned int id, const char *hex);
+unsigned int wfd_ie_get_caps(const struct wfd_ie *ie);
+const char *wfd_dev_type_to_str(enum wfd_dev_type type);
+
+static inline bool wfd_ie_has(const struct wfd_ie *ie, unsigned int id)
+{
+	return ie->present & (1U << id);
+}
+
+static inline enum wfd_dev_type wfd_ie_get_dev_type(const struct wfd_ie *ie)
+{
+	return ie->dev_info & WFD_DEV_INFO_TYPE_MASK;
+}
+
+#endif /* MIRACLE_WFD_IE_H */
@@ -58,6 +58,7 @@ struct wpas_message {
 	void *data;
 	uint64_t cookie;
 	uint64_t timeout;
+	uint64_t sent_time;
 	struct sockaddr_un peer;
 
 	char *raw;
@@ -106,6 +107,9 @@ struct wpas {
 	struct shl_dlist msg_list;
 	char recvbuf[WPAS_MAX_LEN];
 
+	/* request round-trip times in usecs, owned by the caller */
+	struct shl_hist *latency;
+
 	bool server : 1;
 	bool dead : 1;
 	bool calling : 1;
@@ -1343,6 +1347,7 @@ static int wpas__write(struct wpas *w)
 		return r;
 
 	m->sent = true;
+	m->sent_time = shl_now(CLOCK_MONOTONIC);
 	if (!m->cookie)
 		wpas__unlink_message(w, m);
 
@@ -1400,6 +1405,10 @@ static int wpas__read(struct wpas *w)
 		if (!m || !m->sent)
 			break;
 
+		if (w->latency)
+			shl_hist_add(w->latency,
+				     shl_now(CLOCK_MONOTONIC) - m->sent_time);
+
 		wpas__unlink_message(w, m);
 		if (m->removed)
 			break;
@@ -1657,3 +1666,15 @@ bool wpas_is_server(struct wpas *w)
 {
 	return w && w->server;
 }
+
+/* requests queued or waiting for their reply */
+size_t wpas_get_pending(struct wpas *w)
+{
+	return w ? w->msg_list_cnt : 0;
+}
+
+void wpas_set_latency_hist(struct wpas *w, struct shl_hist *h)
+{
+	if (w)
+		w->latency = h;
+}
@@ -30,6 +30,7 @@
 
 struct wpas;
 struct wpas_message;
+struct shl_hist;
 
 typedef int (*wpas_callback_fn) (struct wpas *w,
 				 struct wpas_message *m,
@@ -84,6 +85,8 @@ void wpas_remove_match(struct wpas *w, wpas_callback_fn cb_fn, void *data);
 
 bool wpas_is_dead(struct wpas *w);
 bool wpas_is_server(struct wpas *w);
+size_t wpas_get_pending(struct wpas *w);
+void wpas_set_latency_hist(struct wpas *w, struct shl_hist *h);
 
 static inline void wpas_unref_p(struct wpas **w)
 {
@@ -1,30 +1,111 @@
-
 #include "miracle-uibcctl.h"
 
+static volatile sig_atomic_t quit;
+
+static void quit_fn(int sig) {
+  quit = 1;
+}
+
 int main(int argc, char *argv[]) {
     //TODO: Add miracle TUI interface
-    //TODO: Add parsearg
-    //--daemon (read stdin)
 
+  static const struct option options[] = {
+    { "rate", required_argument, NULL, 'r' },
+    { "input", required_argument, NULL, 'i' },
+    { "size", required_argument, NULL, 's' },
+    { "grab", no_argument, NULL, 'g' },
+    { "hid", required_argument, NULL, 'h' },
+    {}
+  };
+  static struct uibc_sender sender;
+  struct uibc_evdev *devs[UIBC_MAX_INPUTS];
+  const char *inputs[UIBC_MAX_INPUTS];
+  struct uibc_hidraw *hids[UIBC_MAX_INPUTS];
+  const char *hid_paths[UIBC_MAX_INPUTS];
+  size_t n_inputs = 0, n_hids = 0, i;
+  unsigned int width = 1920, height = 1080;
+  bool grab = false;
+  struct uibc_stats *stats = &sender.stats;
   int portno;
   struct hostent *server;
   int sockfd;
   struct sockaddr_in serv_addr;
-  char buffer[256];
-  int r;
+  struct sigaction sa;
+  int c, r, one = 1;
 
   log_max_sev = LOG_INFO;
 
-  if (argc < 3) {
+  while ((c = getopt_long(argc, argv, "r:", options, NULL)) >= 0) {
+    switch (c) {
+    case 'r':
+      sender.rate = strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      if (n_inputs >= UIBC_MAX_INPUTS) {
+        fprintf(stderr, "at most %d input devices\n", UIBC_MAX_INPUTS);
+        return EXIT_FAILURE;
+      }
+      inputs[n_inputs++] = optarg;
+      break;
+    case 's':
+      if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+        fprintf(stderr, "invalid size %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'g':
+      grab = true;
+      break;
+    case 'h':
+      if (n_hids >= UIBC_MAX_INPUTS) {
+        fprintf(stderr, "at most %d HID devices\n", UIBC_MAX_INPUTS);
+        return EXIT_FAILURE;
+      }
+      hid_paths[n_hids++] = optarg;
+      break;
+    default:
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind < 2) {
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "   %s <hostname> <port>\n", argv[0]);
+    fprintf(stderr, "   %s [options] <hostname> <port>\n", argv[0]);
+    fprintf(stderr, "Reads struct uibc_event records from stdin, or input devices.\n");
+    fprintf(stderr, "  --rate <hz>        limit how often touch moves are sent\n");
+    fprintf(stderr, "  --input <device>   read /dev/input/eventX instead of stdin,\n");
+    fprintf(stderr, "                     touchscreens, mice and keyboards\n");
+    fprintf(stderr, "  --size WxH         negotiated resolution input is mapped to\n");
+    fprintf(stderr, "  --grab             keep input devices from everybody else\n");
+    fprintf(stderr, "  --hid <device>     pass the reports of /dev/hidrawX through\n");
+    fprintf(stderr, "                     as HIDC, if the source accepted HIDC\n");
     return EXIT_FAILURE;
   }
 
-  server = gethostbyname(argv[1]);
-  portno = atoi(argv[2]);
+  for (i = 0; i < n_inputs; i++) {
+    r = uibc_evdev_open(&devs[i], inputs[i], width, height, grab);
+    if (r < 0) {
+      log_error("cannot use input device %s (%d)", inputs[i], r);
+      return EXIT_FAILURE;
+    }
+    log_info("input device %s", inputs[i]);
+  }
 
-  log_info("server %s port %d", argv[1], portno);
+  for (i = 0; i < n_hids; i++) {
+    r = uibc_hidraw_open(&hids[i], hid_paths[i]);
+    if (r < 0) {
+      log_error("cannot use HID device %s (%d)", hid_paths[i], r);
+      return EXIT_FAILURE;
+    }
+    log_info("HID device %s: %s/%s", hid_paths[i],
+        uibc_hidc_type_to_str(hids[i]->type),
+        uibc_hidc_path_to_str(hids[i]->path));
+  }
+
+  server = gethostbyname(argv[optind]);
+  portno = atoi(argv[optind + 1]);
+
+  log_info("server %s port %d", argv[optind], portno);
 
   if (server == NULL) {
     fprintf(stderr,"ERROR, no such host\n");
@@ -48,577 +129,449 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  bool daemon = true;
-  while(1) {
-    if (!daemon) {
-      printf("enter event <type>,<count>,<id>,<x>,<y>: ");
-    }
-    bzero(buffer, 256);
-    fgets(buffer, 255, stdin);
-    if (strlen(buffer) == 0) {
-      break;
-    }
-    if (!daemon) {
-      printf("input: %s", buffer);
-    }
-    char type = buffer[0];
-    UibcMessage uibcmessage;
-    if (type == '0' || type == '1') {
-      uibcmessage = buildUibcMessage(GENERIC_TOUCH_DOWN, buffer, 1, 1);
-    } else if (type == '3' || type == '4') {
-      uibcmessage = buildUibcMessage(GENERIC_KEY_DOWN, buffer, 1, 1);
-    } else {
-      if (!daemon) {
-        printf("unknow event type: %s", buffer);
-      }
-      continue;
-    }
+  // input packets are tiny and must not wait for an ACK
+  if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+    log_warning("cannot set TCP_NODELAY: %m");
 
-    r = sendUibcMessage(&uibcmessage, sockfd);
-    if (r) {
-      return r;
-    }
+  // the source can't make sense of reports before it has the descriptor
+  for (i = 0; i < n_hids; i++) {
+    r = sendHidDescriptor(sockfd, hids[i]);
+    if (r < 0)
+      return EXIT_FAILURE;
   }
 
+  // we want to know when the socket is full, to merge moves meanwhile
+  fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+  sender.sockfd = sockfd;
+
+  // no SA_RESTART, so a blocking epoll_wait() returns and we get to print stats
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = quit_fn;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+
+  // HID devices come on top of what the player sends, evdev replaces it
+  r = forwardUibcEvents(n_inputs ? -1 : STDIN_FILENO,
+      devs, n_inputs, hids, n_hids, &sender);
+
+  if (stats->events) {
+    log_info("%" PRIu64 " events in %" PRIu64 " batches, %" PRIu64 " invalid",
+        stats->events, stats->batches, stats->invalid);
+    log_info("%" PRIu64 " moves coalesced, %" PRIu64 " events dropped",
+        stats->coalesced, stats->dropped);
+    log_info("input-to-wire latency avg %" PRIu64 "us max %" PRIu64 "us, %" PRIu64 "ns CPU per event",
+        stats->latency_sum / stats->events, stats->latency_max,
+        stats->cpu * 1000 / stats->events);
+  }
+  if (stats->hid_reports)
+    log_info("%" PRIu64 " HID reports passed through, %" PRIu64 " dropped",
+        stats->hid_reports, stats->hid_dropped);
+
+  for (i = 0; i < n_inputs; i++)
+    uibc_evdev_free(devs[i]);
+  for (i = 0; i < n_hids; i++)
+    uibc_hidraw_free(hids[i]);
   close(sockfd);
-  return EXIT_SUCCESS;
+  return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-const char *int2binary(int x, int padding)
-{
-  char *b;
-  int min_padding = x > 0 ? floor(log2(x)) : 0;
-  if (padding < min_padding) {
-    padding = min_padding;
+static bool isMove(const struct uibc_event *ev) {
+  return ev->type == UIBC_GENERIC_TOUCH_MOVE;
+}
+
+// same pointers in the same order, so @b can replace @a
+static bool samePointers(const struct uibc_event *a, const struct uibc_event *b) {
+  unsigned int i;
+
+  if (a->count != b->count)
+    return false;
+
+  for (i = 0; i < a->count && i < UIBC_EVENT_MAX_POINTERS; i++)
+    if (a->pointers[i].id != b->pointers[i].id)
+      return false;
+
+  return true;
+}
+
+static uint64_t nextSend(struct uibc_sender *s) {
+  if (!s->rate || !s->last_send)
+    return 0;
+
+  return s->last_send + 1000000ULL / s->rate;
+}
+
+// can't send right now, be it the socket or the rate limit
+static bool isBlocked(struct uibc_sender *s, uint64_t now) {
+  return s->out_len || now < nextSend(s);
+}
+
+/*
+ * Add an event to the queue. While the sender is blocked, a move replaces a
+ * move of the same pointers right before it, as the source only cares about
+ * where the fingers are now. Anything else is never merged nor reordered, so
+ * down and up keep their place relative to the moves around them.
+ */
+void queueUibcEvent(struct uibc_sender *s, const struct uibc_event *ev, uint64_t now) {
+  struct uibc_event *tail;
+  size_t i;
+
+  tail = s->queued ? &s->queue[s->queued - 1] : NULL;
+  if (tail && isMove(ev) && isMove(tail) && samePointers(tail, ev) &&
+      isBlocked(s, now)) {
+    *tail = *ev;
+    s->stats.coalesced++;
+    return;
   }
 
-  b = (char *)malloc (sizeof (char *) * padding + 1);
-  strcpy(b, "");
+  if (s->queued >= UIBC_QUEUE) {
+    // make room by giving up the oldest move, never a down or up, so a new
+    // move always gets in and the queue never sticks to stale positions
+    for (i = 0; i < s->queued; i++)
+      if (isMove(&s->queue[i]))
+        break;
+
+    s->stats.dropped++;
+    if (i == s->queued) {
+      log_warning("input queue full, dropping event of type %u", ev->type);
+      return;
+    }
 
-  int z;
-  for (z = pow(2,padding); z > 0; z >>= 1) {
-    strcat(b, ((x & z) == z) ? "1" : "0");
+    memmove(&s->queue[i], &s->queue[i + 1],
+        (s->queued - i - 1) * sizeof(*s->queue));
+    s->queued--;
   }
 
-  return b;
+  s->queue[s->queued++] = *ev;
 }
 
-int sendUibcMessage(UibcMessage* uibcmessage, int sockfd) {
-  ssize_t n;
+static int writeUibcPackets(struct uibc_sender *s) {
+  uint64_t now, lat;
+  ssize_t l;
+  size_t i;
+
+  while (s->out_off < s->out_len) {
+    l = write(s->sockfd, s->out + s->out_off, s->out_len - s->out_off);
+    if (l < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN)
+        return 0;
+      log_error("cannot write to socket: %m");
+      return -errno;
+    }
 
-  printf("sending %zu bytes\n", uibcmessage->m_PacketDataLen);
+    s->out_off += l;
+  }
 
-  n = write(sockfd, uibcmessage->m_PacketData , uibcmessage->m_PacketDataLen);
+  now = shl_now(CLOCK_MONOTONIC);
+  for (i = 0; i < s->out_events; i++) {
+    if (!s->out_times[i] || s->out_times[i] > now)
+      continue;
 
-  if (n < 0) {
-    perror("ERROR writing to socket");
-    return EXIT_FAILURE;
+    lat = now - s->out_times[i];
+    s->stats.latency_sum += lat;
+    if (lat > s->stats.latency_max)
+      s->stats.latency_max = lat;
   }
 
-  return EXIT_SUCCESS;
+  s->stats.events += s->out_events;
+  s->stats.batches++;
+  s->out_len = 0;
+  s->out_off = 0;
+  s->out_events = 0;
+
+  return 0;
 }
 
-UibcMessage buildUibcMessage(MessageType type,
-    const char* inEventDesc,
-    double widthRatio,
-    double heightRatio) {
-  UibcMessage uibcmessage;
-  uibcmessage.m_PacketData = NULL;
-  uibcmessage.m_PacketDataLen = 0;
-  uibcmessage.m_DataValid = false;
-
-  switch (type) {
-    case GENERIC_TOUCH_DOWN:
-    case GENERIC_TOUCH_UP:
-    case GENERIC_TOUCH_MOVE:
-      getUIBCGenericTouchPacket(inEventDesc,
-          &uibcmessage,
-          widthRatio,
-          heightRatio);
-      break;
+/*
+ * Encode the queue and hand it to the socket, unless the socket still has
+ * our last batch or the rate limit says to wait. Only moves are held back
+ * by the rate limit, a queued down, up or key goes out right away.
+ */
+int flushUibcEvents(struct uibc_sender *s, uint64_t now) {
+  bool urgent = false;
+  size_t i;
+  int r;
 
-    case GENERIC_KEY_DOWN:
-    case GENERIC_KEY_UP:
-      getUIBCGenericKeyPacket(inEventDesc, &uibcmessage);
-      break;
+  if (s->out_len)
+    return writeUibcPackets(s);
 
-    case GENERIC_ZOOM:
-      getUIBCGenericZoomPacket(inEventDesc, &uibcmessage);
-      break;
+  if (!s->queued)
+    return 0;
 
-    case GENERIC_VERTICAL_SCROLL:
-    case GENERIC_HORIZONTAL_SCROLL:
-      getUIBCGenericScalePacket(inEventDesc, &uibcmessage);
-      break;
+  for (i = 0; i < s->queued && !urgent; i++)
+    urgent = !isMove(&s->queue[i]);
 
-    case GENERIC_ROTATE:
-      getUIBCGenericRotatePacket(inEventDesc, &uibcmessage);
-      break;
-  };
-  return uibcmessage;
-}
+  if (!urgent && now < nextSend(s))
+    return 0;
 
+  for (i = 0; i < s->queued; i++) {
+    r = uibc_encode(&s->queue[i], s->out + s->out_len,
+        sizeof(s->out) - s->out_len);
+    if (r < 0) {
+      log_warning("dropping invalid event of type %u", s->queue[i].type);
+      s->stats.invalid++;
+      continue;
+    }
 
-// format: "typeId, number of pointers, pointer Id1, X coordnate, Y coordinate, pointer Id2, X coordnate, Y coordnate,..."
-void getUIBCGenericTouchPacket(const char *inEventDesc,
-    UibcMessage* uibcmessage,
-    double widthRatio,
-    double heightRatio) {
-  log_info("getUIBCGenericTouchPacket (%s)", inEventDesc);
-  char* outData;
-  int32_t typeId = 0;
-  int32_t numberOfPointers = 0;
-  size_t uibcBodyLen = 0;
-  int32_t genericPacketLen = 0;
-  int32_t temp;
-  size_t size;
-
-  char** splitedStr = str_split((char*)inEventDesc, ",", &size);
-
-  if ((int)size - 5 < 0 || ((int)size - 5) % 3 != 0) {
-    log_error("getUIBCGenericTouchPacket (%s)", "bad input event");
-    return;
-  }
-  int offset_split = 0;
-  typeId = atoi(*(splitedStr + offset_split++));
-  numberOfPointers = atoi(*(splitedStr + offset_split++));
-
-  genericPacketLen = numberOfPointers * 5 + 1;
-  uibcBodyLen = genericPacketLen + 7; // Generic header length = 7
-  //Padding to even number
-  uibcBodyLen = (uibcBodyLen % 2 == 0) ? uibcBodyLen : (uibcBodyLen + 1);
-
-  outData = (char*)malloc(uibcBodyLen);
-  // UIBC header Octets
-  int offset_header = 0;
-  //Version (3 bits),T (1 bit),Reserved(8 bits),Input Category (4 bits)
-  outData[offset_header++] = 0x00; // 000 0 0000
-  outData[offset_header++] = 0x00; // 0000 0000
-
-  //Length(16 bits)
-  outData[offset_header++] = (uibcBodyLen >> 8) & 0xFF; // first 8 bytes
-  outData[offset_header++] = uibcBodyLen & 0xFF; // last 8 bytes
-
-  //Generic Input Body Format
-  outData[offset_header++] = typeId & 0xFF; // Tyoe ID, 1 octet
-
-  // Length, 2 octets
-  outData[offset_header++] = (genericPacketLen >> 8) & 0xFF; // first 8 bytes
-  outData[offset_header++] = genericPacketLen & 0xFF; //last 8 bytes
-
-  // Number of pointers, 1 octet
-  outData[offset_header++] = numberOfPointers & 0xFF; 
-
-  int offset = 0;
-  log_info("getUIBCGenericTouchPacket numberOfPointers=[%d]\n", numberOfPointers);
-  for (int i = 0; i < numberOfPointers; i++) {
-    int splitoffset = offset_split + (i * 3);
-    temp = atoi(*(splitedStr + splitoffset++));
-    offset = offset_header + ( i * 5);
-    outData[offset++] = temp & 0xFF;
-    log_info("getUIBCGenericTouchPacket PointerId=[%d]\n", temp);
-
-    temp = atoi(*(splitedStr + splitoffset++));
-    temp = (int32_t)((double)temp / widthRatio);
-    log_info("getUIBCGenericTouchPacket X-coordinate=[%d]\n", temp);
-    outData[offset++] = (temp >> 8) & 0xFF;
-    outData[offset++] = temp & 0xFF;
-
-    temp = atoi(*(splitedStr + splitoffset++));
-    temp = (int32_t)((double)temp / heightRatio);
-    log_info("getUIBCGenericTouchPacket Y-coordinate=[%d]\n", temp);
-    outData[offset++] = (temp >> 8) & 0xFF;
-    outData[offset++] = temp & 0xFF;
-  }
+    if (log_max_sev >= LOG_DEBUG)
+      hexdump(s->out + s->out_len, r);
 
-  while (offset <= uibcBodyLen) {
-    outData[offset++] = 0x00;
+    s->out_len += r;
+    s->out_times[s->out_events++] = s->queue[i].time;
   }
 
-  for (int i = 0; i < size; i++) {
-    free(*(splitedStr + i));
-  }
-  free(splitedStr);
+  s->queued = 0;
+  if (!s->out_len)
+    return 0;
 
-  binarydump(outData, uibcBodyLen);
-  uibcmessage->m_DataValid = true;
-  uibcmessage->m_PacketData = outData;
-  uibcmessage->m_PacketDataLen = uibcBodyLen;
+  s->last_send = now;
+  return writeUibcPackets(s);
 }
 
-void hexdump(void *_data, size_t len)
-{
-  unsigned char *data = _data;
-  size_t count;
+int sendHidDescriptor(int sockfd, struct uibc_hidraw *hid) {
+  static uint8_t buf[UIBC_HIDC_OFFSET + HID_MAX_DESCRIPTOR_SIZE + 1];
+  size_t off = 0;
+  ssize_t l;
+  int r;
 
-  int line = 15;
-  for (count = 0; count < len; count++) {
-    if ((count & line) == 0) {
-      fprintf(stderr,"%04zu: ", count);
-    }
-    fprintf(stderr,"%02x ", *data);
-    data++;
-    if ((count & line) == line) {
-      fprintf(stderr,"\n");
+  memcpy(buf + UIBC_HIDC_OFFSET, hid->desc, hid->desc_len);
+  r = uibc_encode_hidc(buf, sizeof(buf), hid->path, hid->type,
+      UIBC_HIDC_USAGE_DESCRIPTOR, hid->desc_len);
+  if (r < 0)
+    return r;
+
+  while (off < (size_t)r) {
+    l = write(sockfd, buf + off, r - off);
+    if (l < 0) {
+      if (errno == EINTR)
+        continue;
+      log_error("cannot write to socket: %m");
+      return -errno;
     }
+    off += l;
   }
-  if ((count & line) != 0) {
-    fprintf(stderr,"\n");
-  }
+
+  return 0;
 }
 
-void binarydump(void *_data, size_t len)
-{
-  unsigned char *data = _data;
-  size_t count;
+/*
+ * Reports are read straight into the output buffer behind the room for
+ * the HIDC header, no copy, no translation. They are neither queued nor
+ * coalesced, a relative mouse report dropped would be a jump.
+ */
+static int readHidReport(struct uibc_sender *s, struct uibc_hidraw *hid) {
+  static uint8_t discard[UIBC_HIDC_MAX_REPORT];
+  uint8_t *p = s->out + s->out_len;
+  size_t room = sizeof(s->out) - s->out_len;
+  bool drop;
+  ssize_t l;
+  int r;
 
-  int line = 7;
-  for (count = 0; count < len; count++) {
-    if ((count & line) == 0) {
-      fprintf(stderr,"%04zu: ", count);
-    }
-    fprintf(stderr,"%s ", int2binary(*data, 8));
-    data++;
-    if ((count & line) == line) {
-      fprintf(stderr,"\n");
-    }
-  }
-  if ((count & line) != 0) {
-    fprintf(stderr,"\n");
-  }
-}
-// format: "typeId, Key code 1(0x00), Key code 2(0x00)"
-void getUIBCGenericKeyPacket(const char *inEventDesc,
-    UibcMessage* uibcmessage) {
-  log_info("getUIBCGenericKeyPacket (%s)", inEventDesc);
-  char* outData = uibcmessage->m_PacketData;
-  int32_t typeId = 0;
-  int32_t uibcBodyLen = 0;
-  int32_t genericPacketLen = 0;
-  int32_t temp = 0;
-  size_t size;
-  char** splitedStr = str_split((char*)inEventDesc, ",", &size);
-
-  if (size > 0) {
-
-    if (((int)size) % 3 != 0) {
-        log_error("getUIBCGenericKeyPacket (%s)", "bad input event");
-        return;
-    }
-    int i;
-    for (i = 0; i < size; i++) {
-      log_info("getUIBCGenericKeyPacket splitedStr tokens=[%s]\n", *(splitedStr + i));
-
-      switch (i) {
-        case 0: {
-                  typeId = atoi(*(splitedStr + i));
-                  log_info("getUIBCGenericKeyPacket typeId=[%d]\n", typeId);
-                  genericPacketLen = 5;
-                  uibcBodyLen = genericPacketLen + 7; // Generic header length = 7
-                  outData = (char*)malloc(uibcBodyLen + 1);
-                  // UIBC header
-                  outData[0] = 0x00; //Version (3 bits),T (1 bit),Reserved(8 bits),Input Category (4 bits)
-                  outData[1] = 0x00; //Version (3 bits),T (1 bit),Reserved(8 bits),Input Category (4 bits)
-                  outData[2] = (uibcBodyLen >> 8) & 0xFF; //Length(16 bits)
-                  outData[3] = uibcBodyLen & 0xFF; //Length(16 bits)
-                  //Generic Input Body Format
-                  outData[4] = typeId & 0xFF; // Tyoe ID, 1 octet
-                  outData[5] = (genericPacketLen >> 8) & 0xFF; // Length, 2 octets
-                  outData[6] = genericPacketLen & 0xFF; // Length, 2 octets
-                  outData[7] = 0x00; // reserved
-                  break;
-                }
-        case 1: {
-                  sscanf(*(splitedStr + i), " 0x%04X", &temp);
-                  if (temp == 0) {
-                    outData[8] = 0x00;
-                    outData[9] = 0x00;
-                  }
-                  log_info("getUIBCGenericKeyPacket key code 1=[%d]\n", temp);
-                  outData[8] = (temp >> 8) & 0xFF;
-                  outData[9] = temp & 0xFF;
-
-                  break;
-                }
-        case 2: {
-                  sscanf(*(splitedStr + i), " 0x%04X", &temp);
-                  if (temp == 0) {
-                    outData[10] = 0x00;
-                    outData[11] = 0x00;
-                  }
-                  log_info("getUIBCGenericKeyPacket key code 2=[%d]\n", temp);
-                  outData[10] = (temp >> 8) & 0xFF;
-                  outData[11] = temp & 0xFF;
-
-                  break;
-                }
-        default: {
-                 }
-                 break;
-      }
-      free(*(splitedStr + i));
-    }
+  // hidraw cuts reports that don't fit, so leave room for the largest
+  drop = room < UIBC_HIDC_OFFSET + UIBC_HIDC_MAX_REPORT + 1;
+  if (drop)
+    l = read(hid->fd, discard, sizeof(discard));
+  else
+    l = read(hid->fd, p + UIBC_HIDC_OFFSET, UIBC_HIDC_MAX_REPORT);
+
+  if (l < 0) {
+    if (errno == EINTR || errno == EAGAIN)
+      return 0;
+    return -errno;
+  } else if (!l) {
+    return -ENODEV;
+  } else if (drop) {
+    // the source doesn't keep up, nowhere to put it
+    s->stats.hid_dropped++;
+    return 0;
   }
-  free(splitedStr);
 
-  binarydump(outData, uibcBodyLen);
-  uibcmessage->m_DataValid = true;
-  uibcmessage->m_PacketData = outData;
-  uibcmessage->m_PacketDataLen = uibcBodyLen;
+  r = uibc_encode_hidc(p, room, hid->path, hid->type,
+      UIBC_HIDC_USAGE_REPORT, l);
+  if (r < 0)
+    return r;
+
+  if (log_max_sev >= LOG_DEBUG)
+    hexdump(p, r);
+
+  s->out_len += r;
+  s->stats.hid_reports++;
+
+  return 0;
 }
 
-// format: "typeId,  X coordnate, Y coordnate, integer part, fraction part"
-void getUIBCGenericZoomPacket(const char *inEventDesc, UibcMessage* uibcmessage) {
-  log_info("getUIBCGenericZoomPacket (%s)", inEventDesc);
-  char* outData = uibcmessage->m_PacketData;
-  int32_t typeId;
-  int32_t uibcBodyLen, genericPacketLen;
-  int32_t xCoord, yCoord, integerPart, FractionPart;
-  size_t size;
-
-  char** splitedStr = str_split((char*)inEventDesc, ",", &size);
-
-  if (splitedStr) {
-    int i;
-    for (i = 0; * (splitedStr + i); i++) {
-      //log_info("getUIBCGenericZoomPacket splitedStr tokens=[%s]\n", *(splitedStr + i));
-
-      switch (i) {
-        case 0: {
-                  typeId = atoi(*(splitedStr + i));
-                  //log_info("getUIBCGenericZoomPacket typeId=[%d]\n", typeId);
-
-                  genericPacketLen = 6;
-                  uibcBodyLen = genericPacketLen + 7; // Generic herder leh = 7
-                  outData = (char*)malloc(uibcBodyLen + 1);
-                  // UIBC header
-                  outData[0] = 0x00; //Version (3 bits),T (1 bit),Reserved(8 bits),Input Category (4 bits)
-                  outData[1] = 0x00; //Version (3 bits),T (1 bit),Reserved(8 bits),Input Category (4 bits)
-                  outData[2] = (uibcBodyLen >> 8) & 0xFF; //Length(16 bits)
-                  outData[3] = uibcBodyLen & 0xFF; //Length(16 bits)
-                  //Generic Input Body Format
-                  outData[4] = typeId & 0xFF; // Tyoe ID, 1 octet
-                  outData[5] = (genericPacketLen >> 8) & 0xFF; // Length, 2 octets
-                  outData[6] = genericPacketLen & 0xFF; // Length, 2 octets
-                  break;
-                }
-
-        case 1: {
-                  xCoord = atoi(*(splitedStr + i));
-                  outData[7] = (xCoord >> 8) & 0xFF;
-                  outData[8] = xCoord & 0xFF;
-                  log_info("getUIBCGenericZoomPacket xCoord=[%d]\n", xCoord);
-                  break;
-                }
-        case 2: {
-                  yCoord = atoi(*(splitedStr + i));
-                  log_info("getUIBCGenericZoomPacket yCoord=[%d]\n", yCoord);
-                  break;
-                }
-        case 3: {
-                  integerPart = atoi(*(splitedStr + i));
-                  outData[11] = integerPart & 0xFF;
-                  //log_info("getUIBCGenericZoomPacket integerPart=[%d]\n", integerPart);
-                  break;
-                }
-        case 4: {
-                  FractionPart = atoi(*(splitedStr + i));
-                  outData[12] = FractionPart & 0xFF;
-                  //log_info("getUIBCGenericZoomPacket FractionPart=[%d]\n", FractionPart);
-
-                  break;
-                }
-        default: {
-                   break;
-                 }
-      }
+static void evdevEvent(struct uibc_evdev *dev, const struct uibc_event *ev, void *data) {
+  queueUibcEvent(data, ev, shl_now(CLOCK_MONOTONIC));
+}
 
-      free(*(splitedStr + i));
-    }
-    free(splitedStr);
+static int readStdin(int infd, struct uibc_sender *s) {
+  static struct uibc_event events[UIBC_BATCH];
+  static size_t have;
+  size_t n, i;
+  uint64_t now;
+  ssize_t l;
+
+  l = read(infd, (uint8_t*)events + have, sizeof(events) - have);
+  if (l < 0) {
+    if (errno == EINTR || errno == EAGAIN)
+      return 0;
+    log_error("cannot read events: %m");
+    return -errno;
+  } else if (!l) {
+    return -EPIPE;
   }
-  //hexdump(outData, uibcBodyLen);
-  uibcmessage->m_DataValid = true;
-  uibcmessage->m_PacketDataLen = uibcBodyLen;
-}
 
-// format: "typeId,  unit, direction, amount to scroll"
-void getUIBCGenericScalePacket(const char *inEventDesc, UibcMessage* uibcmessage) {
-  log_info("getUIBCGenericScalePacket (%s)", inEventDesc);
-  char* outData = uibcmessage->m_PacketData;
-  int32_t typeId;
-  int32_t uibcBodyLen, genericPacketLen;
-  int32_t temp;
-  size_t size;
-  char** splitedStr = str_split((char*)inEventDesc, ",", &size);
-
-  if (splitedStr) {
-    int i;
-    for (i = 0; * (splitedStr + i); i++) {
-      //log_info("getUIBCGenericScalePacket splitedStr tokens=[%s]\n", *(splitedStr + i));
-
-      switch (i) {
-        case 0: {
-                  typeId = atoi(*(splitedStr + i));
-                  //log_info("getUIBCGenericScalePacket typeId=[%d]\n", typeId);
-                  genericPacketLen = 2;
-                  uibcBodyLen = genericPacketLen + 7; // Generic herder leh = 7
-                  outData = (char*)malloc(uibcBodyLen + 1);
-                  // UIBC header
-                  outData[0] = 0x00; //Version (3 bits),T (1 bit),Reserved(8 bits),Input Category (4 bits)
-                  outData[1] = 0x00; //Version (3 bits),T (1 bit),Reserved(8 bits),Input Category (4 bits)
-                  outData[2] = (uibcBodyLen >> 8) & 0xFF; //Length(16 bits)
-                  outData[3] = uibcBodyLen & 0xFF; //Length(16 bits)
-                  //Generic Input Body Format
-                  outData[4] = typeId & 0xFF; // Tyoe ID, 1 octet
-                  outData[5] = (genericPacketLen >> 8) & 0xFF; // Length, 2 octets
-                  outData[6] = genericPacketLen & 0xFF; // Length, 2 octets
-                  outData[7] = 0x00; // Clear the byte
-                  outData[8] = 0x00; // Clear the byte
-                  /*
-                     B15B14; Scroll Unit Indication bits.
-                     0b00; the unit is a pixel (normalized with respect to the WFD Source display resolution that is conveyed in an RTSP M4 request message).
-                     0b01; the unit is a mouse notch (where the application is responsible for representing the number of pixels per notch).
-                     0b10-0b11; Reserved.
-
-                     B13; Scroll Direction Indication bit.
-                     0b0; Scrolling to the right. Scrolling to the right means the displayed content being shifted to the left from a user perspective.
-                     0b1; Scrolling to the left. Scrolling to the left means the displayed content being shifted to the right from a user perspective.
-
-B12:B0; Number of Scroll bits.
-Number of units for a Horizontal scroll.
-*/
-                  break;
-                }
-        case 1: {
-                  temp = atoi(*(splitedStr + i));
-                  //log_info("getUIBCGenericScalePacket unit=[%d]\n", temp);
-                  outData[7] = (temp >> 8) & 0xFF;
-                  break;
-                }
-        case 2: {
-                  temp = atoi(*(splitedStr + i));
-                  //log_info("getUIBCGenericScalePacket direction=[%d]\n", temp);
-                  outData[7] |= ((temp >> 10) & 0xFF);
-                  break;
-
-                }
-        case 3: {
-                  temp = atoi(*(splitedStr + i));
-                  //log_info("getUIBCGenericScalePacket amount to scroll=[%d]\n", temp);
-                  outData[7] |= ((temp >> 12) & 0xFF);
-                  outData[8] = temp & 0xFF;
-
-                  break;
-                }
-        default: {
-                   break;
-                 }
-      }
+  now = shl_now(CLOCK_MONOTONIC);
+  have += l;
+  n = have / sizeof(*events);
 
-      free(*(splitedStr + i));
-    }
+  for (i = 0; i < n; i++)
+    queueUibcEvent(s, &events[i], now);
 
-    free(splitedStr);
-  }
-  //hexdump(outData, uibcBodyLen);
-  uibcmessage->m_DataValid = true;
-  uibcmessage->m_PacketDataLen = uibcBodyLen;
+  // keep a partial record for the next read
+  have -= n * sizeof(*events);
+  memmove(events, events + n, have);
+
+  return 0;
 }
 
-// format: "typeId,  integer part, fraction part"
-void getUIBCGenericRotatePacket(const char * inEventDesc, UibcMessage* uibcmessage) {
-  log_info("getUIBCGenericRotatePacket (%s)", inEventDesc);
-  char* outData = uibcmessage->m_PacketData;
-  int32_t typeId;
-  int32_t uibcBodyLen, genericPacketLen;
-  int32_t integerPart, FractionPart;
-  size_t size;
-
-  char** splitedStr = str_split((char*)inEventDesc, ",", &size);
-
-  if (splitedStr) {
-    int i;
-    for (i = 0; * (splitedStr + i); i++) {
-      //log_info("getUIBCGenericRotatePacket splitedStr tokens=[%s]\n", *(splitedStr + i));
-
-      switch (i) {
-        case 0: {
-                  typeId = atoi(*(splitedStr + i));
-                  //log_info("getUIBCGenericRotatePacket typeId=[%d]\n", typeId);
-                  genericPacketLen = 2;
-                  uibcBodyLen = genericPacketLen + 7; // Generic herder leh = 7
-                  outData = (char*)malloc(uibcBodyLen + 1);
-                  // UIBC header
-                  outData[0] = 0x00; //Version (3 bits),T (1 bit),Reserved(8 bits),Input Category (4 bits)
-                  outData[1] = 0x00; //Version (3 bits),T (1 bit),Reserved(8 bits),Input Category (4 bits)
-                  outData[2] = (uibcBodyLen >> 8) & 0xFF; //Length(16 bits)
-                  outData[3] = uibcBodyLen & 0xFF; //Length(16 bits)
-                  //Generic Input Body Format
-                  outData[4] = typeId & 0xFF; // Tyoe ID, 1 octet
-                  outData[5] = (genericPacketLen >> 8) & 0xFF; // Length, 2 octets
-                  outData[6] = genericPacketLen & 0xFF; // Length, 2 octets
-                  break;
-                }
-        case 1: {
-                  integerPart = atoi(*(splitedStr + i));
-                  outData[7] = integerPart & 0xFF;
-                  //log_info("getUIBCGenericRotatePacket integerPart=[%d]\n", integerPart);
-                  break;
-                }
-        case 2: {
-                  FractionPart = atoi(*(splitedStr + i));
-                  outData[8] = FractionPart & 0xFF;
-                  //log_info("getUIBCGenericRotatePacket FractionPart=[%d]\n", FractionPart);
-
-                  break;
-                }
-        default: {
-                   break;
-                 }
-      }
-      free(*(splitedStr + i));
-    }
+/* what an epoll event is about, devices add their index */
+#define TAG_SOCKET 0
+#define TAG_STDIN 1
+#define TAG_EVDEV 0x100
+#define TAG_HID 0x200
 
-    free(splitedStr);
-  }
-  //hexdump(outData, uibcBodyLen);
-  uibcmessage->m_DataValid = true;
-  uibcmessage->m_PacketDataLen = uibcBodyLen;
+static int watchFd(int efd, int op, int fd, uint32_t events, uint64_t tag) {
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.u64 = tag;
+  if (epoll_ctl(efd, op, fd, &ev) < 0)
+    return -errno;
+
+  return 0;
 }
 
+/*
+ * Wait for input on stdin (infd >= 0), evdev and hidraw devices, queue it
+ * and send it off as the socket and the rate limit allow. Returns once all
+ * input is gone and everything queued has been sent.
+ */
+int forwardUibcEvents(int infd, struct uibc_evdev **devs, size_t n_devs,
+    struct uibc_hidraw **hids, size_t n_hids, struct uibc_sender *s) {
+  struct epoll_event events[16];
+  uint32_t sock_events = 0;
+  size_t inputs = n_devs + n_hids + (infd >= 0);
+  uint64_t now, cpu, tag;
+  int efd, timeout, n, i, r;
+
+  efd = epoll_create1(EPOLL_CLOEXEC);
+  if (efd < 0)
+    return -errno;
+
+  // the socket is registered without events, it is only polled when full
+  r = watchFd(efd, EPOLL_CTL_ADD, s->sockfd, 0, TAG_SOCKET);
+  if (r >= 0 && infd >= 0)
+    r = watchFd(efd, EPOLL_CTL_ADD, infd, EPOLLIN, TAG_STDIN);
+  for (i = 0; r >= 0 && i < (int)n_devs; i++)
+    r = watchFd(efd, EPOLL_CTL_ADD, devs[i]->fd, EPOLLIN, TAG_EVDEV + i);
+  for (i = 0; r >= 0 && i < (int)n_hids; i++)
+    r = watchFd(efd, EPOLL_CTL_ADD, hids[i]->fd, EPOLLIN, TAG_HID + i);
+  if (r < 0)
+    goto out;
+
+  while (!quit) {
+    if (!inputs && !s->queued && !s->out_len)
+      break;
 
-char** str_split(char* pStr, const char* pDelim, size_t* size) {
-  char** result    = 0;
-  size_t count     = 0;
-  char* tmp        = pStr;
-  char* tmpStr     = NULL;
-  char* last_comma = 0;
+    if (sock_events != (s->out_len ? EPOLLOUT : 0)) {
+      sock_events = s->out_len ? EPOLLOUT : 0;
+      watchFd(efd, EPOLL_CTL_MOD, s->sockfd, sock_events, TAG_SOCKET);
+    }
 
-  asprintf(&tmpStr, "%s", pStr);
+    timeout = -1;
+    if (s->queued && !s->out_len) {
+      now = shl_now(CLOCK_MONOTONIC);
+      timeout = nextSend(s) > now ? (nextSend(s) - now + 999) / 1000 : 0;
+    }
 
-  /* Count how many elements will be extracted. */
-  while (*tmp) {
-    if (*pDelim == *tmp) {
-      count++;
-      last_comma = tmp;
+    n = epoll_wait(efd, events, SHL_ARRAY_LENGTH(events), timeout);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      log_error("cannot poll: %m");
+      r = -errno;
+      goto out;
     }
-    tmp++;
-  }
 
-  /* Add space for trailing token. */
-  count += last_comma < (pStr + strlen(pStr) - 1) ? 1 : 0;
+    cpu = shl_now(CLOCK_THREAD_CPUTIME_ID);
+
+    for (i = 0; i < n; i++) {
+      tag = events[i].data.u64;
+
+      if (tag == TAG_SOCKET) {
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+          log_error("connection to the source lost");
+          r = -ECONNRESET;
+          goto out;
+        }
+      } else if (tag == TAG_STDIN) {
+        if (readStdin(infd, s) < 0) {
+          epoll_ctl(efd, EPOLL_CTL_DEL, infd, NULL);
+          inputs--;
+        }
+      } else if (tag >= TAG_HID) {
+        struct uibc_hidraw *hid = hids[tag - TAG_HID];
+
+        r = readHidReport(s, hid);
+        if (r < 0) {
+          log_warning("HID device gone (%d)", r);
+          epoll_ctl(efd, EPOLL_CTL_DEL, hid->fd, NULL);
+          inputs--;
+        }
+      } else {
+        struct uibc_evdev *dev = devs[tag - TAG_EVDEV];
+
+        r = uibc_evdev_dispatch(dev, evdevEvent, s);
+        if (r < 0) {
+          log_warning("input device gone (%d)", r);
+          epoll_ctl(efd, EPOLL_CTL_DEL, dev->fd, NULL);
+          inputs--;
+        }
+      }
+    }
+
+    r = flushUibcEvents(s, shl_now(CLOCK_MONOTONIC));
+    if (r < 0)
+      goto out;
+
+    s->stats.cpu += shl_now(CLOCK_THREAD_CPUTIME_ID) - cpu;
+  }
 
-  result = (char**)malloc(sizeof(char*) * count);
+out:
+  close(efd);
+  return r;
+}
 
-  *size = count;
+void hexdump(void *_data, size_t len)
+{
+  unsigned char *data = _data;
+  size_t count;
 
-  tmp = tmpStr = strdup(pStr);
-  size_t idx  = 0;
-  char* token;
-  while ((token = strsep(&tmp, pDelim)) != NULL) {
-    * (result + idx++) = strdup(token);
+  int line = 15;
+  for (count = 0; count < len; count++) {
+    if ((count & line) == 0) {
+      fprintf(stderr,"%04zu: ", count);
+    }
+    fprintf(stderr,"%02x ", *data);
+    data++;
+    if ((count & line) == line) {
+      fprintf(stderr,"\n");
+    }
+  }
+  if ((count & line) != 0) {
+    fprintf(stderr,"\n");
   }
-  free(tmpStr);
-  return result;
 }
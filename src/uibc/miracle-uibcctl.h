@@ -9,40 +9,70 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <netinet/tcp.h>
 #include<arpa/inet.h>
-#include <math.h>
 #include "shl_log.h"
+#include "shl_util.h"
+#include "uibc.h"
+#include "uibc_evdev.h"
+#include "uibc_hidc.h"
 
-typedef enum {
-        GENERIC_TOUCH_DOWN = 0,
-        GENERIC_TOUCH_UP,
-        GENERIC_TOUCH_MOVE,
-        GENERIC_KEY_DOWN,
-        GENERIC_KEY_UP,
-        GENERIC_ZOOM,
-        GENERIC_VERTICAL_SCROLL,
-        GENERIC_HORIZONTAL_SCROLL,
-        GENERIC_ROTATE
-} MessageType;
-
-typedef struct {
-   char* m_PacketData;
-   size_t m_PacketDataLen;
-   bool m_DataValid;
-} UibcMessage;
-
-UibcMessage buildUibcMessage(MessageType type, const char* inEventDesc, double widthRatio, double heightRatio);
-
-static char** str_split(char* pStr, const char* pDelim, size_t* size);
-
-void getUIBCGenericTouchPacket(const char *inEventDesc, UibcMessage* uibcmessage, double widthRatio, double heightRatio);
-void getUIBCGenericKeyPacket(const char *inEventDesc, UibcMessage* uibcmessage);
-void getUIBCGenericZoomPacket(const char *inEventDesc,UibcMessage* uibcmessage);
-void getUIBCGenericScalePacket(const char *inEventDesc, UibcMessage* uibcmessage);
-void getUIBCGenericRotatePacket(const char *inEventDesc, UibcMessage* uibcmessage);
+/* events read at once */
+#define UIBC_BATCH 64
+/* events waiting for the socket */
+#define UIBC_QUEUE 256
+#define UIBC_MAX_INPUTS 8
+/* generic packets of a full queue plus a good number of HID reports */
+#define UIBC_OUT_SIZE (UIBC_QUEUE * UIBC_MAX_PACKET + 64 * 1024)
 
-void hexdump(void *_data, size_t len);
-void binarydump(void *_data, size_t len);
+struct uibc_stats {
+  uint64_t events;
+  uint64_t batches;
+  uint64_t invalid;
+  /* touch moves merged into a newer one before they were sent */
+  uint64_t coalesced;
+  /* events lost as the queue was full */
+  uint64_t dropped;
+  uint64_t hid_reports;
+  uint64_t hid_dropped;
+  /* from the player seeing the event to the packet being on the socket */
+  uint64_t latency_sum;
+  uint64_t latency_max;
+  /* CPU time spent on encoding and sending, in usec */
+  uint64_t cpu;
+};
+
+struct uibc_sender {
+  int sockfd;
+  /* maximum batches per second, 0 for no limit */
+  unsigned int rate;
+  uint64_t last_send;
+
+  /* events not encoded yet, in input order */
+  struct uibc_event queue[UIBC_QUEUE];
+  size_t queued;
+
+  /* encoded packets not on the socket yet, and the times of their events */
+  uint8_t out[UIBC_OUT_SIZE];
+  size_t out_len;
+  size_t out_off;
+  uint64_t out_times[UIBC_QUEUE];
+  size_t out_events;
 
-int sendUibcMessage(UibcMessage* uibcmessage, int sockfd);
+  struct uibc_stats stats;
+};
+
+int forwardUibcEvents(int infd, struct uibc_evdev **devs, size_t n_devs,
+    struct uibc_hidraw **hids, size_t n_hids, struct uibc_sender *s);
+int sendHidDescriptor(int sockfd, struct uibc_hidraw *hid);
+void queueUibcEvent(struct uibc_sender *s, const struct uibc_event *ev, uint64_t now);
+int flushUibcEvents(struct uibc_sender *s, uint64_t now);
+
+void hexdump(void *_data, size_t len);
 #endif
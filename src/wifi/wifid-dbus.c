@@ -20,6 +20,9 @@
 #define LOG_SUBSYSTEM "dbus"
 
 #include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <systemd/sd-bus.h>
@@ -29,7 +32,9 @@
 #include "util.h"
 #include "wifid.h"
 
-static char *peer_dbus_get_path(struct peer *p)
+/* escaped object paths, computed once by peer_new() and link_new() */
+
+char *peer_dbus_get_path(struct peer *p)
 {
 	char buf[128], *node;
 	int r;
@@ -47,7 +52,7 @@ static char *peer_dbus_get_path(struct peer *p)
 	return node;
 }
 
-static char *link_dbus_get_path(struct link *l)
+char *link_dbus_get_path(struct link *l)
 {
 	char buf[128], *node;
 	int r;
@@ -65,6 +70,158 @@ static char *link_dbus_get_path(struct link *l)
 	return node;
 }
 
+/*
+ * Property Change Coalescing
+ * A single wpas event often changes several properties of an object back to
+ * back (eg., a connecting peer changes Connected, Interface, LocalAddress and
+ * RemoteAddress). Instead of sending one PropertiesChanged signal per change,
+ * we collect changed properties per object and send a single signal from an
+ * idle-priority defer source, once all pending events have been dispatched.
+ * Other signals of an object flush its pending changes first, so clients
+ * still see everything in order.
+ */
+
+static const char *const peer_dbus_props[] = {
+	"FriendlyName",
+	"Connected",
+	"Interface",
+	"LocalAddress",
+	"RemoteAddress",
+	"WfdSubelements",
+	"WfdDeviceType",
+	"WfdSessionAvailable",
+	"WfdRtspPort",
+	"WfdMaxThroughput",
+	"WfdCoupledSink",
+	"WfdCapabilities",
+	NULL
+};
+
+static const char *const link_dbus_props[] = {
+	"InterfaceName",
+	"FriendlyName",
+	"Managed",
+	"P2PScanning",
+	"WfdSubelements",
+	"WfdDeviceType",
+	"WfdSessionAvailable",
+	"WfdRtspPort",
+	"WfdMaxThroughput",
+	"WfdCoupledSink",
+	"WfdCapabilities",
+	NULL
+};
+
+static unsigned int dbus_props_mask(const char *const *props,
+				    const char *prop,
+				    va_list args)
+{
+	unsigned int mask = 0, i;
+
+	for ( ; prop; prop = va_arg(args, const char*)) {
+		for (i = 0; props[i]; ++i)
+			if (!strcmp(props[i], prop))
+				break;
+
+		if (props[i])
+			mask |= 1U << i;
+		else
+			log_warning("unknown property %s changed", prop);
+	}
+
+	return mask;
+}
+
+static void dbus_props_emit(struct manager *m,
+			    const char *node,
+			    const char *interface,
+			    const char *const *props,
+			    unsigned int mask)
+{
+	const char *strv[sizeof(mask) * 8 + 1];
+	unsigned int i, n = 0;
+	int r;
+
+	for (i = 0; props[i]; ++i)
+		if (mask & (1U << i))
+			strv[n++] = props[i];
+	strv[n] = NULL;
+
+	r = sd_bus_emit_properties_changed_strv(m->bus,
+						node,
+						interface,
+						(char**)strv);
+	if (r < 0)
+		log_vERR(r);
+	else
+		++m->metrics.dbus_signals;
+}
+
+static void manager_dbus_schedule_flush(struct manager *m);
+static void manager_dbus_invalidate_nodes(struct manager *m);
+
+/*
+ * WFD Properties
+ * Links and peers expose the decoded WFD IE as typed properties next to the
+ * raw WfdSubelements string. Fields of missing subelements read as empty/0.
+ */
+
+#define WFD_DBUS_PROPERTY(_name, _sig, _get) \
+	SD_BUS_PROPERTY((_name), (_sig), (_get), 0, \
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE)
+
+#define WFD_DBUS_PROPERTIES(_get) \
+	WFD_DBUS_PROPERTY("WfdDeviceType", "s", (_get)), \
+	WFD_DBUS_PROPERTY("WfdSessionAvailable", "b", (_get)), \
+	WFD_DBUS_PROPERTY("WfdRtspPort", "q", (_get)), \
+	WFD_DBUS_PROPERTY("WfdMaxThroughput", "q", (_get)), \
+	WFD_DBUS_PROPERTY("WfdCoupledSink", "s", (_get)), \
+	WFD_DBUS_PROPERTY("WfdCapabilities", "u", (_get))
+
+static int wfd_dbus_append(sd_bus_message *reply,
+			   const char *property,
+			   const struct wfd_ie *ie)
+{
+	static const struct wfd_ie empty;
+	char mac[MAC_STRLEN];
+	const uint8_t *c;
+	unsigned int caps;
+
+	if (!ie)
+		ie = &empty;
+
+	caps = wfd_ie_get_caps(ie);
+
+	if (!strcmp(property, "WfdDeviceType")) {
+		if (!wfd_ie_has(ie, WFD_SUBELEM_DEV_INFO))
+			return sd_bus_message_append(reply, "s", "");
+
+		return sd_bus_message_append(reply, "s",
+				wfd_dev_type_to_str(wfd_ie_get_dev_type(ie)));
+	} else if (!strcmp(property, "WfdSessionAvailable")) {
+		return sd_bus_message_append(reply, "b",
+				!!(caps & WFD_CAP_SESSION_AVAILABLE));
+	} else if (!strcmp(property, "WfdRtspPort")) {
+		return sd_bus_message_append(reply, "q", ie->rtsp_port);
+	} else if (!strcmp(property, "WfdMaxThroughput")) {
+		return sd_bus_message_append(reply, "q", ie->max_throughput);
+	} else if (!strcmp(property, "WfdCoupledSink")) {
+		/* status 1 means coupled, the MAC is the coupled device */
+		if (!wfd_ie_has(ie, WFD_SUBELEM_COUPLED_SINK) ||
+		    (ie->coupled_sink_status & 0x3) != 1)
+			return sd_bus_message_append(reply, "s", "");
+
+		c = ie->coupled_sink_mac;
+		sprintf(mac, "%02x:%02x:%02x:%02x:%02x:%02x",
+			c[0], c[1], c[2], c[3], c[4], c[5]);
+		return sd_bus_message_append(reply, "s", mac);
+	} else if (!strcmp(property, "WfdCapabilities")) {
+		return sd_bus_message_append(reply, "u", caps);
+	}
+
+	return -EINVAL;
+}
+
 /*
  * Peer DBus
  */
@@ -109,15 +266,10 @@ static int peer_dbus_get_link(sd_bus *bus,
 			      void *data,
 			      sd_bus_error *err)
 {
-	_shl_free_ char *node = NULL;
 	struct peer *p = data;
 	int r;
 
-	node = link_dbus_get_path(p->l);
-	if (!node)
-		return -ENOMEM;
-
-	r = sd_bus_message_append_basic(reply, 'o', node);
+	r = sd_bus_message_append_basic(reply, 'o', p->l->dbus_path);
 	if (r < 0)
 		return r;
 
@@ -255,6 +407,24 @@ static int peer_dbus_get_wfd_subelements(sd_bus *bus,
 	return 1;
 }
 
+static int peer_dbus_get_wfd(sd_bus *bus,
+			     const char *path,
+			     const char *interface,
+			     const char *property,
+			     sd_bus_message *reply,
+			     void *data,
+			     sd_bus_error *err)
+{
+	struct peer *p = data;
+	int r;
+
+	r = wfd_dbus_append(reply, property, peer_get_wfd(p));
+	if (r < 0)
+		return r;
+
+	return 1;
+}
+
 static const sd_bus_vtable peer_dbus_vtable[] = {
 	SD_BUS_VTABLE_START(0),
 	SD_BUS_METHOD("Connect",
@@ -307,6 +477,7 @@ static const sd_bus_vtable peer_dbus_vtable[] = {
 			peer_dbus_get_wfd_subelements,
 			0,
 			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	WFD_DBUS_PROPERTIES(peer_dbus_get_wfd),
 	SD_BUS_SIGNAL("ProvisionDiscovery", "ss", 0),
 	SD_BUS_SIGNAL("GoNegRequest", "ss", 0),
 	SD_BUS_SIGNAL("FormationFailure", "s", 0),
@@ -363,33 +534,51 @@ static int peer_dbus_find(sd_bus *bus,
 	return 1;
 }
 
+static void peer_dbus_flush(struct peer *p)
+{
+	unsigned int mask = p->dbus_changed;
+
+	if (!mask)
+		return;
+
+	p->dbus_changed = 0;
+	shl_dlist_unlink(&p->dbus_changed_list);
+
+	dbus_props_emit(p->l->m,
+			p->dbus_path,
+			"org.freedesktop.miracle.wifi.Peer",
+			peer_dbus_props,
+			mask);
+}
+
 void peer_dbus_properties_changed(struct peer *p, const char *prop, ...)
 {
-	_shl_free_ char *node = NULL;
-	char **strv;
-	int r;
+	struct manager *m = p->l->m;
+	unsigned int mask;
+	va_list args;
 
 	if (!p->public)
 		return;
 
-	node = peer_dbus_get_path(p);
-	if (!node)
+	va_start(args, prop);
+	mask = dbus_props_mask(peer_dbus_props, prop, args);
+	va_end(args);
+
+	if (!mask)
 		return;
 
-	strv = strv_from_stdarg_alloca(prop);
-	r = sd_bus_emit_properties_changed_strv(p->l->m->bus,
-						node,
-						"org.freedesktop.miracle.wifi.Peer",
-						strv);
-	if (r < 0)
-		log_vERR(r);
+	if (!p->dbus_changed)
+		shl_dlist_link_tail(&m->dbus_changed_peers,
+				    &p->dbus_changed_list);
+
+	p->dbus_changed |= mask;
+	manager_dbus_schedule_flush(m);
 }
 
 void peer_dbus_provision_discovery(struct peer *p,
 				   const char *type,
 				   const char *pin)
 {
-	_shl_free_ char *node = NULL;
 	int r;
 
 	if (!type)
@@ -397,24 +586,23 @@ void peer_dbus_provision_discovery(struct peer *p,
 	if (!pin)
 		pin = "";
 
-	node = peer_dbus_get_path(p);
-	if (!node)
-		return;
+	peer_dbus_flush(p);
 
 	r = sd_bus_emit_signal(p->l->m->bus,
-			       node,
+			       p->dbus_path,
 			       "org.freedesktop.miracle.wifi.Peer",
 			       "ProvisionDiscovery",
 			       "ss", type, pin);
 	if (r < 0)
 		log_vERR(r);
+	else
+		++p->l->m->metrics.dbus_signals;
 }
 
 void peer_dbus_go_neg_request(struct peer *p,
 				   const char *type,
 				   const char *pin)
 {
-	_shl_free_ char *node = NULL;
 	int r;
 
 	if (!type)
@@ -422,65 +610,63 @@ void peer_dbus_go_neg_request(struct peer *p,
 	if (!pin)
 		pin = "";
 
-	node = peer_dbus_get_path(p);
-	if (!node)
-		return;
+	peer_dbus_flush(p);
 
 	r = sd_bus_emit_signal(p->l->m->bus,
-			       node,
+			       p->dbus_path,
 			       "org.freedesktop.miracle.wifi.Peer",
 			       "GoNegRequest",
 			       "ss", type, pin);
 	if (r < 0)
 		log_vERR(r);
+	else
+		++p->l->m->metrics.dbus_signals;
 }
 
 void peer_dbus_formation_failure(struct peer *p, const char *reason)
 {
-	_shl_free_ char *node = NULL;
 	int r;
 
-	node = peer_dbus_get_path(p);
-	if (!node)
-		return;
+	peer_dbus_flush(p);
 
 	r = sd_bus_emit_signal(p->l->m->bus,
-			       node,
+			       p->dbus_path,
 			       "org.freedesktop.miracle.wifi.Peer",
 			       "FormationFailure",
 			       "s", reason);
 	if (r < 0)
 		log_vERR(r);
+	else
+		++p->l->m->metrics.dbus_signals;
 }
 
 void peer_dbus_added(struct peer *p)
 {
-	_shl_free_ char *node = NULL;
 	int r;
 
-	node = peer_dbus_get_path(p);
-	if (!node)
-		return;
+	manager_dbus_invalidate_nodes(p->l->m);
 
 	r = sd_bus_emit_interfaces_added(p->l->m->bus,
-					 node,
+					 p->dbus_path,
 					 "org.freedesktop.miracle.wifi.Peer",
 					 NULL);
 	if (r < 0)
 		log_vERR(r);
+	else
+		++p->l->m->metrics.dbus_signals;
 }
 
 void peer_dbus_removed(struct peer *p)
 {
-	_shl_free_ char *node = NULL;
 	int r;
 
-	node = peer_dbus_get_path(p);
-	if (!node)
-		return;
+	/* drop pending changes, the object is gone for clients */
+	p->dbus_changed = 0;
+	shl_dlist_unlink(&p->dbus_changed_list);
+	manager_dbus_invalidate_nodes(p->l->m);
 
 	r = sd_bus_emit_interfaces_removed(p->l->m->bus,
-					   node,
+					   p->dbus_path,
 					   /*
 					   "org.freedesktop.DBus.Properties",
 					   "org.freedesktop.DBus.Introspectable",
@@ -489,6 +675,8 @@ void peer_dbus_removed(struct peer *p)
 					   NULL);
 	if (r < 0)
 		log_vERR(r);
+	else
+		++p->l->m->metrics.dbus_signals;
 }
 
 /*
@@ -680,6 +868,24 @@ static int link_dbus_set_wfd_subelements(sd_bus *bus,
 	return link_set_wfd_subelements(l, val);
 }
 
+static int link_dbus_get_wfd(sd_bus *bus,
+			     const char *path,
+			     const char *interface,
+			     const char *property,
+			     sd_bus_message *reply,
+			     void *data,
+			     sd_bus_error *err)
+{
+	struct link *l = data;
+	int r;
+
+	r = wfd_dbus_append(reply, property, link_get_wfd(l));
+	if (r < 0)
+		return r;
+
+	return 1;
+}
+
 static const sd_bus_vtable link_dbus_vtable[] = {
 	SD_BUS_VTABLE_START(0),
 	SD_BUS_PROPERTY("InterfaceIndex",
@@ -716,6 +922,7 @@ static const sd_bus_vtable link_dbus_vtable[] = {
 				 link_dbus_set_wfd_subelements,
 				 0,
 				 SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	WFD_DBUS_PROPERTIES(link_dbus_get_wfd),
 	SD_BUS_VTABLE_END
 };
 
@@ -745,39 +952,55 @@ static int link_dbus_find(sd_bus *bus,
 	return 1;
 }
 
+static void link_dbus_flush(struct link *l)
+{
+	unsigned int mask = l->dbus_changed;
+
+	if (!mask)
+		return;
+
+	l->dbus_changed = 0;
+	shl_dlist_unlink(&l->dbus_changed_list);
+
+	dbus_props_emit(l->m,
+			l->dbus_path,
+			"org.freedesktop.miracle.wifi.Link",
+			link_dbus_props,
+			mask);
+}
+
 void link_dbus_properties_changed(struct link *l, const char *prop, ...)
 {
-	_shl_free_ char *node = NULL;
-	char **strv;
-	int r;
+	struct manager *m = l->m;
+	unsigned int mask;
+	va_list args;
 
 	if (!l->public)
 		return;
 
-	node = link_dbus_get_path(l);
-	if (!node)
+	va_start(args, prop);
+	mask = dbus_props_mask(link_dbus_props, prop, args);
+	va_end(args);
+
+	if (!mask)
 		return;
 
-	strv = strv_from_stdarg_alloca(prop);
-	r = sd_bus_emit_properties_changed_strv(l->m->bus,
-						node,
-						"org.freedesktop.miracle.wifi.Link",
-						strv);
-	if (r < 0)
-		log_vERR(r);
+	if (!l->dbus_changed)
+		shl_dlist_link_tail(&m->dbus_changed_links,
+				    &l->dbus_changed_list);
+
+	l->dbus_changed |= mask;
+	manager_dbus_schedule_flush(m);
 }
 
 void link_dbus_added(struct link *l)
 {
-	_shl_free_ char *node = NULL;
 	int r;
 
-	node = link_dbus_get_path(l);
-	if (!node)
-		return;
+	manager_dbus_invalidate_nodes(l->m);
 
 	r = sd_bus_emit_interfaces_added(l->m->bus,
-					 node,
+					 l->dbus_path,
 					 /*
 					 "org.freedesktop.DBus.Properties",
 					 "org.freedesktop.DBus.Introspectable",
@@ -786,19 +1009,24 @@ void link_dbus_added(struct link *l)
 					 NULL);
 	if (r < 0)
 		log_vERR(r);
+	else
+		++l->m->metrics.dbus_signals;
 }
 
 void link_dbus_removed(struct link *l)
 {
-	_shl_free_ char *node = NULL;
 	int r;
 
-	node = link_dbus_get_path(l);
-	if (!node)
+	l->dbus_changed = 0;
+	shl_dlist_unlink(&l->dbus_changed_list);
+	manager_dbus_invalidate_nodes(l->m);
+
+	/* link_new() failed early */
+	if (!l->dbus_path)
 		return;
 
 	r = sd_bus_emit_interfaces_removed(l->m->bus,
-					   node,
+					   l->dbus_path,
 					   /*
 					   "org.freedesktop.DBus.Properties",
 					   "org.freedesktop.DBus.Introspectable",
@@ -807,82 +1035,402 @@ void link_dbus_removed(struct link *l)
 					   NULL);
 	if (r < 0)
 		log_vERR(r);
+	else
+		++l->m->metrics.dbus_signals;
 }
 
 /*
  * Manager DBus
  */
 
+static void manager_dbus_flush(struct manager *m)
+{
+	struct link *l;
+	struct peer *p;
+
+	/* links first, so peer changes never precede their link's changes */
+	while (!shl_dlist_empty(&m->dbus_changed_links)) {
+		l = shl_dlist_first_entry(&m->dbus_changed_links,
+					  struct link,
+					  dbus_changed_list);
+		link_dbus_flush(l);
+	}
+
+	while (!shl_dlist_empty(&m->dbus_changed_peers)) {
+		p = shl_dlist_first_entry(&m->dbus_changed_peers,
+					  struct peer,
+					  dbus_changed_list);
+		peer_dbus_flush(p);
+	}
+}
+
+static int manager_dbus_flush_fn(sd_event_source *source, void *data)
+{
+	manager_dbus_flush(data);
+	return 0;
+}
+
+static void manager_dbus_schedule_flush(struct manager *m)
+{
+	int r;
+
+	if (m->dbus_flush_source) {
+		r = sd_event_source_set_enabled(m->dbus_flush_source,
+						SD_EVENT_ONESHOT);
+		if (r >= 0)
+			return;
+
+		log_vERR(r);
+	}
+
+	/* no event source, send everything right away */
+	manager_dbus_flush(m);
+}
+
 static const sd_bus_vtable manager_dbus_vtable[] = {
 	SD_BUS_VTABLE_START(0),
 	SD_BUS_VTABLE_END
 };
 
-static int manager_dbus_enumerate(sd_bus *bus,
+/*
+ * Metrics
+ * Counters only ever grow, gauges (Peers, Groups, WpasPending) are sampled on
+ * each read. Histograms are (count, sum, max, [(bound, count)]) in usecs,
+ * each bucket counting values below its bound that did not fit into the
+ * previous one; empty buckets are left out. None of these emit
+ * PropertiesChanged, clients poll them.
+ */
+
+static int metrics_dbus_append_hist(sd_bus_message *reply,
+				    const struct shl_hist *h)
+{
+	unsigned int i;
+	int r;
+
+	r = sd_bus_message_open_container(reply, 'r', "ttta(tt)");
+	if (r < 0)
+		return r;
+
+	r = sd_bus_message_append(reply, "ttt", h->count, h->sum, h->max);
+	if (r < 0)
+		return r;
+
+	r = sd_bus_message_open_container(reply, 'a', "(tt)");
+	if (r < 0)
+		return r;
+
+	for (i = 0; i < SHL_HIST_BUCKETS; ++i) {
+		if (!h->buckets[i])
+			continue;
+
+		r = sd_bus_message_append(reply, "(tt)",
+					  shl_hist_bound(i),
+					  h->buckets[i]);
+		if (r < 0)
+			return r;
+	}
+
+	r = sd_bus_message_close_container(reply);
+	if (r < 0)
+		return r;
+
+	return sd_bus_message_close_container(reply);
+}
+
+static int metrics_dbus_get_wpas_events(sd_bus *bus,
+					const char *path,
+					const char *interface,
+					const char *property,
+					sd_bus_message *reply,
+					void *data,
+					sd_bus_error *err)
+{
+	struct manager *m = data;
+	struct metrics_event *e;
+	int r;
+
+	r = sd_bus_message_open_container(reply, 'a', "{st}");
+	if (r < 0)
+		return r;
+
+	SHL_HTABLE_FOREACH_MACRO(e, &m->metrics.wpas_events,
+				 metrics_event_from_htable) {
+		r = sd_bus_message_append(reply, "{st}", e->name, e->count);
+		if (r < 0)
+			return r;
+	}
+
+	if (m->metrics.wpas_events_other) {
+		r = sd_bus_message_append(reply, "{st}", "other",
+					  m->metrics.wpas_events_other);
+		if (r < 0)
+			return r;
+	}
+
+	r = sd_bus_message_close_container(reply);
+	if (r < 0)
+		return r;
+
+	return 1;
+}
+
+static int metrics_dbus_get_wpas_latency(sd_bus *bus,
+					 const char *path,
+					 const char *interface,
+					 const char *property,
+					 sd_bus_message *reply,
+					 void *data,
+					 sd_bus_error *err)
+{
+	struct manager *m = data;
+	int r;
+
+	r = metrics_dbus_append_hist(reply, &m->metrics.wpas_latency);
+	if (r < 0)
+		return r;
+
+	return 1;
+}
+
+static int metrics_dbus_get_wpas_pending(sd_bus *bus,
+					 const char *path,
+					 const char *interface,
+					 const char *property,
+					 sd_bus_message *reply,
+					 void *data,
+					 sd_bus_error *err)
+{
+	struct manager *m = data;
+	struct link *l;
+	size_t global, dev;
+	char buf[128];
+	int r;
+
+	r = sd_bus_message_open_container(reply, 'a', "{su}");
+	if (r < 0)
+		return r;
+
+	MANAGER_FOREACH_LINK(l, m) {
+		supplicant_get_pending(l->s, &global, &dev);
+
+		snprintf(buf, sizeof(buf), "%s/global", l->ifname);
+		r = sd_bus_message_append(reply, "{su}", buf,
+					  (uint32_t)global);
+		if (r < 0)
+			return r;
+
+		if (!dev)
+			continue;
+
+		snprintf(buf, sizeof(buf), "%s/dev", l->ifname);
+		r = sd_bus_message_append(reply, "{su}", buf, (uint32_t)dev);
+		if (r < 0)
+			return r;
+	}
+
+	r = sd_bus_message_close_container(reply);
+	if (r < 0)
+		return r;
+
+	return 1;
+}
+
+static int metrics_dbus_get_peers(sd_bus *bus,
 				  const char *path,
+				  const char *interface,
+				  const char *property,
+				  sd_bus_message *reply,
 				  void *data,
-				  char ***out,
 				  sd_bus_error *err)
 {
 	struct manager *m = data;
 	struct link *l;
-	struct peer *p;
-	size_t i, peer_cnt;
-	char **nodes, *node;
+	uint32_t cnt = 0;
+	int r;
+
+	MANAGER_FOREACH_LINK(l, m)
+		cnt += l->peer_cnt;
+
+	r = sd_bus_message_append(reply, "u", cnt);
+	if (r < 0)
+		return r;
+
+	return 1;
+}
+
+static int metrics_dbus_get_groups(sd_bus *bus,
+				   const char *path,
+				   const char *interface,
+				   const char *property,
+				   sd_bus_message *reply,
+				   void *data,
+				   sd_bus_error *err)
+{
+	struct manager *m = data;
+	struct link *l;
+	uint32_t cnt = 0;
 	int r;
 
-	peer_cnt = 0;
+	MANAGER_FOREACH_LINK(l, m)
+		cnt += supplicant_get_group_cnt(l->s);
+
+	r = sd_bus_message_append(reply, "u", cnt);
+	if (r < 0)
+		return r;
+
+	return 1;
+}
+
+static int metrics_dbus_get_loop_duration(sd_bus *bus,
+					  const char *path,
+					  const char *interface,
+					  const char *property,
+					  sd_bus_message *reply,
+					  void *data,
+					  sd_bus_error *err)
+{
+	struct manager *m = data;
+	int r;
+
+	r = metrics_dbus_append_hist(reply, &m->metrics.loop_duration);
+	if (r < 0)
+		return r;
+
+	return 1;
+}
+
+static const sd_bus_vtable metrics_dbus_vtable[] = {
+	SD_BUS_VTABLE_START(0),
+	SD_BUS_PROPERTY("WpasEvents",
+			"a{st}",
+			metrics_dbus_get_wpas_events,
+			0,
+			0),
+	SD_BUS_PROPERTY("WpasRequestLatency",
+			"(ttta(tt))",
+			metrics_dbus_get_wpas_latency,
+			0,
+			0),
+	SD_BUS_PROPERTY("WpasPending",
+			"a{su}",
+			metrics_dbus_get_wpas_pending,
+			0,
+			0),
+	SD_BUS_PROPERTY("SignalsEmitted",
+			"t",
+			NULL,
+			offsetof(struct manager, metrics.dbus_signals),
+			0),
+	SD_BUS_PROPERTY("Peers",
+			"u",
+			metrics_dbus_get_peers,
+			0,
+			0),
+	SD_BUS_PROPERTY("Groups",
+			"u",
+			metrics_dbus_get_groups,
+			0,
+			0),
+	SD_BUS_PROPERTY("DhcpSpawns",
+			"t",
+			NULL,
+			offsetof(struct manager, metrics.dhcp_spawns),
+			0),
+	SD_BUS_PROPERTY("SupplicantRestarts",
+			"t",
+			NULL,
+			offsetof(struct manager, metrics.supplicant_restarts),
+			0),
+	SD_BUS_PROPERTY("LoopDuration",
+			"(ttta(tt))",
+			metrics_dbus_get_loop_duration,
+			0,
+			0),
+	SD_BUS_VTABLE_END
+};
+
+/*
+ * Node Enumeration
+ * Every Introspect and GetManagedObjects call enumerates all objects. We
+ * cache the vector of object paths of public links and peers, and only
+ * rebuild it after an object was added or removed. The vector borrows the
+ * paths from the objects, sd-bus gets a copy it can free.
+ */
+
+static void manager_dbus_invalidate_nodes(struct manager *m)
+{
+	free(m->dbus_nodes);
+	m->dbus_nodes = NULL;
+	m->dbus_node_cnt = 0;
+}
+
+static int manager_dbus_build_nodes(struct manager *m)
+{
+	struct link *l;
+	struct peer *p;
+	size_t i, cnt;
+	char **nodes;
+
+	cnt = 0;
 	MANAGER_FOREACH_LINK(l, m)
 		if (l->public)
-			peer_cnt += l->peer_cnt;
+			cnt += 1 + l->peer_cnt;
 
-	nodes = malloc(sizeof(*nodes) * (m->link_cnt + peer_cnt + 2));
+	/* +1 so an empty vector is still a valid cache */
+	nodes = malloc(sizeof(*nodes) * (cnt + 1));
 	if (!nodes)
 		return log_ENOMEM();
 
 	i = 0;
 	MANAGER_FOREACH_LINK(l, m) {
-		if (i >= m->link_cnt + peer_cnt) {
-			log_warning("overflow: skipping link %s",
-				    l->ifname);
-			continue;
-		}
-
 		if (!l->public)
 			continue;
 
-		node = link_dbus_get_path(l);
-		if (!node)
-			goto error;
+		nodes[i++] = l->dbus_path;
 
-		nodes[i++] = node;
+		LINK_FOREACH_PEER(p, l)
+			if (p->public)
+				nodes[i++] = p->dbus_path;
+	}
 
-		LINK_FOREACH_PEER(p, l) {
-			if (i >= m->link_cnt + peer_cnt) {
-				log_warning("overflow: skipping peer %s",
-					    p->p2p_mac);
-				continue;
-			}
+	m->dbus_nodes = nodes;
+	m->dbus_node_cnt = i;
 
-			if (!p->public)
-				continue;
+	return 0;
+}
 
-			node = peer_dbus_get_path(p);
-			if (!node)
-				goto error;
+static int manager_dbus_enumerate(sd_bus *bus,
+				  const char *path,
+				  void *data,
+				  char ***out,
+				  sd_bus_error *err)
+{
+	struct manager *m = data;
+	char **nodes;
+	size_t i;
+	int r;
 
-			nodes[i++] = node;
-		}
+	if (!m->dbus_nodes) {
+		r = manager_dbus_build_nodes(m);
+		if (r < 0)
+			return r;
 	}
 
-	node = strdup("/org/freedesktop/miracle/wifi");
-	if (!node) {
-		r = log_ENOMEM();
-		goto error;
+	nodes = malloc(sizeof(*nodes) * (m->dbus_node_cnt + 2));
+	if (!nodes)
+		return log_ENOMEM();
+
+	for (i = 0; i < m->dbus_node_cnt; ++i) {
+		nodes[i] = strdup(m->dbus_nodes[i]);
+		if (!nodes[i])
+			goto error;
 	}
 
-	nodes[i++] = node;
-	nodes[i] = NULL;
+	nodes[i] = strdup("/org/freedesktop/miracle/wifi");
+	if (!nodes[i])
+		goto error;
+
+	nodes[++i] = NULL;
 	*out = nodes;
 
 	return 0;
@@ -891,13 +1439,30 @@ error:
 	while (i--)
 		free(nodes[i]);
 	free(nodes);
-	return r;
+	return log_ENOMEM();
 }
 
 int manager_dbus_connect(struct manager *m)
 {
 	int r;
 
+	r = sd_event_add_defer(m->event,
+			       &m->dbus_flush_source,
+			       manager_dbus_flush_fn,
+			       m);
+	if (r < 0)
+		goto error;
+
+	r = sd_event_source_set_enabled(m->dbus_flush_source, SD_EVENT_OFF);
+	if (r < 0)
+		goto error;
+
+	/* run after all other pending events to merge as much as possible */
+	r = sd_event_source_set_priority(m->dbus_flush_source,
+					 SD_EVENT_PRIORITY_IDLE);
+	if (r < 0)
+		goto error;
+
 	r = sd_bus_add_object_vtable(m->bus, NULL,
 				     "/org/freedesktop/miracle/wifi",
 				     "org.freedesktop.miracle.wifi.Manager",
@@ -906,6 +1471,14 @@ int manager_dbus_connect(struct manager *m)
 	if (r < 0)
 		goto error;
 
+	r = sd_bus_add_object_vtable(m->bus, NULL,
+				     "/org/freedesktop/miracle/wifi",
+				     "org.freedesktop.miracle.wifi.Metrics",
+				     metrics_dbus_vtable,
+				     m);
+	if (r < 0)
+		goto error;
+
 	r = sd_bus_add_node_enumerator(m->bus, NULL,
 				       "/org/freedesktop/miracle/wifi",
 				       manager_dbus_enumerate,
@@ -957,7 +1530,13 @@ error_silent:
 
 void manager_dbus_disconnect(struct manager *m)
 {
-	if (!m || !m->bus)
+	if (!m)
+		return;
+
+	m->dbus_flush_source = sd_event_source_unref(m->dbus_flush_source);
+	manager_dbus_invalidate_nodes(m);
+
+	if (!m->bus)
 		return;
 
 	sd_bus_release_name(m->bus, "org.freedesktop.miracle.wifi");
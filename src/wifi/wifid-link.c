@@ -84,6 +84,12 @@ int link_new(struct manager *m,
 		goto error;
 	}
 
+	l->dbus_path = link_dbus_get_path(l);
+	if (!l->dbus_path) {
+		r = log_ENOMEM();
+		goto error;
+	}
+
 	r = supplicant_new(l, &l->s);
 	if (r < 0)
 		goto error;
@@ -120,6 +126,7 @@ void link_free(struct link *l)
 
 	link_dbus_removed(l);
 	l->public = false;
+	shl_dlist_unlink(&l->dbus_changed_list);
 
 	if (shl_htable_remove_uint(&l->m->links, l->ifindex, NULL)) {
 		log_info("remove link: %s", l->ifname);
@@ -136,6 +143,7 @@ void link_free(struct link *l)
 	free(l->ifname);
 	free(l->config_methods);
 	free(l->ip_binary);
+	free(l->dbus_path);
 	free(l);
 }
 
@@ -149,6 +157,16 @@ bool link_is_using_dev(struct link *l)
 	return l->use_dev;
 }
 
+void link_use_ip_alloc(struct link *l)
+{
+	l->ip_alloc = true;
+}
+
+bool link_is_using_ip_alloc(struct link *l)
+{
+	return l->ip_alloc;
+}
+
 int link_set_driver_param(struct link *l, char *driver_param)
 {
 	char *dp;
@@ -298,6 +316,7 @@ const char *link_get_friendly_name(struct link *l)
 
 int link_set_wfd_subelements(struct link *l, const char *val)
 {
+	struct wfd_ie wfd;
 	char *t;
 	int r;
 
@@ -307,6 +326,14 @@ int link_set_wfd_subelements(struct link *l, const char *val)
 	if (!l->managed)
 		return log_EUNMANAGED();
 
+	/* this is the argument of "WFD_SUBELEM_SET 0", so no subelem-ID */
+	r = wfd_ie_parse_subelem(&wfd, WFD_SUBELEM_DEV_INFO, val);
+	if (r < 0) {
+		log_error("invalid WFD subelements for link %s: %s",
+			  l->ifname, val);
+		return r;
+	}
+
 	t = strdup(val);
 	if (!t)
 		return log_ENOMEM();
@@ -321,7 +348,15 @@ int link_set_wfd_subelements(struct link *l, const char *val)
 
 	free(l->wfd_subelements);
 	l->wfd_subelements = t;
-	link_dbus_properties_changed(l, "WfdSubelements", NULL);
+	l->wfd = wfd;
+	link_dbus_properties_changed(l, "WfdSubelements",
+				     "WfdDeviceType",
+				     "WfdSessionAvailable",
+				     "WfdRtspPort",
+				     "WfdMaxThroughput",
+				     "WfdCoupledSink",
+				     "WfdCapabilities",
+				     NULL);
 
 	return 0;
 }
@@ -334,6 +369,14 @@ const char *link_get_wfd_subelements(struct link *l)
 	return l->wfd_subelements;
 }
 
+const struct wfd_ie *link_get_wfd(struct link *l)
+{
+	if (!l)
+		return NULL;
+
+	return &l->wfd;
+}
+
 int link_set_p2p_scanning(struct link *l, bool set)
 {
 	if (!l)
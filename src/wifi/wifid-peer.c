@@ -64,6 +64,12 @@ int peer_new(struct link *l,
 	strncpy(p->p2p_mac, mac, MAC_STRLEN);
 	p->p2p_mac[MAC_STRLEN - 1] = 0;
 
+	p->dbus_path = peer_dbus_get_path(p);
+	if (!p->dbus_path) {
+		r = log_ENOMEM();
+		goto error;
+	}
+
 	r = shl_htable_insert_str(&l->peers, &p->p2p_mac, NULL);
 	if (r < 0) {
 		log_vERR(r);
@@ -95,6 +101,8 @@ void peer_free(struct peer *p)
 		--p->l->peer_cnt;
 	}
 
+	shl_dlist_unlink(&p->dbus_changed_list);
+	free(p->dbus_path);
 	free(p->p2p_mac);
 	free(p);
 }
@@ -139,6 +147,14 @@ const char *peer_get_wfd_subelements(struct peer *p)
 	return supplicant_peer_get_wfd_subelements(p->sp);
 }
 
+const struct wfd_ie *peer_get_wfd(struct peer *p)
+{
+	if (!p)
+		return NULL;
+
+	return supplicant_peer_get_wfd(p->sp);
+}
+
 int peer_connect(struct peer *p, const char *prov, const char *pin)
 {
 	if (!p)
@@ -188,7 +204,14 @@ void peer_supplicant_wfd_subelements_changed(struct peer *p)
 	if (!p || !p->public)
 		return;
 
-	peer_dbus_properties_changed(p, "WfdSubelements", NULL);
+	peer_dbus_properties_changed(p, "WfdSubelements",
+				     "WfdDeviceType",
+				     "WfdSessionAvailable",
+				     "WfdRtspPort",
+				     "WfdMaxThroughput",
+				     "WfdCoupledSink",
+				     "WfdCapabilities",
+				     NULL);
 }
 
 void peer_supplicant_provision_discovery(struct peer *p,
@@ -23,6 +23,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <net/if.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <sys/socket.h>
@@ -35,8 +36,10 @@
 #endif
 
 #include <unistd.h>
+#include "rtnl.h"
 #include "shl_dlist.h"
 #include "shl_log.h"
+#include "shl_trace.h"
 #include "shl_util.h"
 #include "util.h"
 #include "wifid.h"
@@ -57,6 +60,10 @@ struct supplicant_group {
 	pid_t dhcp_pid;
 	sd_event_source *dhcp_pid_source;
 
+	struct rtnl *rtnl;
+	sd_event_source *rtnl_source;
+	char *ip_alloc_addr;
+
 	bool go : 1;
 };
 
@@ -68,6 +75,7 @@ struct supplicant_peer {
 	char *friendly_name;
 	char *remote_addr;
 	char *wfd_subelements;
+	struct wfd_ie wfd;
 	char *prov;
 	char *pin;
 	char *sta_mac;
@@ -112,6 +120,18 @@ enum wps_dev_password_id {
 	DEV_PW_NFC_CONNECTION_HANDOVER = 0x0007
 };
 
+/*
+ * In-EAPOL IP address allocation
+ * If enabled, wpas hands out client addresses during the 4-way handshake of
+ * local groups. Local groups pick their subnet starting at IP_ALLOC_SUBNET, so
+ * the first GO group matches the pool we write into the wpas config. The pool
+ * must not overlap the range of miracle-dhcp (.100 - .199), which still serves
+ * peers that do not support in-EAPOL allocation.
+ */
+#define IP_ALLOC_SUBNET 50
+#define IP_ALLOC_START 200
+#define IP_ALLOC_END 254
+
 static void supplicant_failed(struct supplicant *s);
 static void supplicant_peer_drop_group(struct supplicant_peer *sp);
 
@@ -217,17 +237,46 @@ static void supplicant_group_free(struct supplicant_group *g)
 		g->dhcp_comm = -1;
 	}
 
+	if (g->rtnl) {
+		sd_event_source_unref(g->rtnl_source);
+		g->rtnl_source = NULL;
+		rtnl_free(g->rtnl);
+		g->rtnl = NULL;
+	}
+
 	LINK_FOREACH_PEER(p, g->s->l)
 		if (p->sp->g == g)
 			supplicant_peer_drop_group(p->sp);
 
 	shl_dlist_unlink(&g->list);
 
+	free(g->ip_alloc_addr);
 	free(g->local_addr);
 	free(g->ifname);
 	free(g);
 }
 
+static void supplicant_group_update_connected(struct supplicant_group *g)
+{
+	struct peer *p;
+
+	if (!g->local_addr)
+		return;
+
+	if (g->sp) {
+		p = g->sp->p;
+		if (p->sp->remote_addr)
+			peer_supplicant_connected_changed(p, true);
+	} else {
+		LINK_FOREACH_PEER(p, g->s->l) {
+			if (p->sp->g != g || !p->sp->remote_addr)
+				continue;
+
+			peer_supplicant_connected_changed(p, true);
+		}
+	}
+}
+
 static int supplicant_group_comm_fn(sd_event_source *source,
 				    int fd,
 				    uint32_t mask,
@@ -235,7 +284,6 @@ static int supplicant_group_comm_fn(sd_event_source *source,
 {
 	struct supplicant_group *g = data;
 	struct supplicant_peer *sp;
-	struct peer *p;
 	char buf[512], *t, *ip;
 	ssize_t l;
 	char mac[MAC_STRLEN];
@@ -270,6 +318,10 @@ static int supplicant_group_comm_fn(sd_event_source *source,
 
 	switch (buf[0]) {
 	case 'L':
+		/* a GO sends its own static address as soon as it starts */
+		if (!g->go)
+			SHL_TRACE(dhcp_lease, buf);
+
 		free(g->local_addr);
 		g->local_addr = t;
 		break;
@@ -304,6 +356,7 @@ static int supplicant_group_comm_fn(sd_event_source *source,
 
 			free(sp->remote_addr);
 			sp->remote_addr = ip;
+			SHL_TRACE(dhcp_lease, buf);
 		} else {
 			log_debug("ignore 'R' line for unknown mac");
 			free(t);
@@ -315,20 +368,7 @@ static int supplicant_group_comm_fn(sd_event_source *source,
 		break;
 	}
 
-	if (g->local_addr) {
-		if (g->sp) {
-			p = g->sp->p;
-			if (p->sp->remote_addr)
-				peer_supplicant_connected_changed(p, true);
-		} else {
-			LINK_FOREACH_PEER(p, g->s->l) {
-				if (p->sp->g != g || !p->sp->remote_addr)
-					continue;
-
-				peer_supplicant_connected_changed(p, true);
-			}
-		}
-	}
+	supplicant_group_update_connected(g);
 
 	return 0;
 
@@ -421,6 +461,7 @@ static int supplicant_group_spawn_dhcp_server(struct supplicant_group *g,
 	close(fds[1]);
 	g->dhcp_comm = fds[0];
 	g->dhcp_pid = pid;
+	++g->s->l->m->metrics.dhcp_spawns;
 
 	return 0;
 }
@@ -490,10 +531,160 @@ static int supplicant_group_spawn_dhcp_client(struct supplicant_group *g)
 	close(fds[1]);
 	g->dhcp_comm = fds[0];
 	g->dhcp_pid = pid;
+	++g->s->l->m->metrics.dhcp_spawns;
+
+	return 0;
+}
+
+static int supplicant_group_start_dhcp(struct supplicant_group *g)
+{
+	int r;
+
+	if (g->go) {
+		if (!g->subnet) {
+			log_warning("out of free subnets for local groups");
+			return -EINVAL;
+		}
+
+		r = supplicant_group_spawn_dhcp_server(g, g->subnet);
+	} else {
+		r = supplicant_group_spawn_dhcp_client(g);
+	}
+	if (r < 0)
+		return r;
+
+	r = sd_event_add_io(g->s->l->m->event,
+			    &g->dhcp_comm_source,
+			    g->dhcp_comm,
+			    EPOLLHUP | EPOLLERR | EPOLLIN,
+			    supplicant_group_comm_fn,
+			    g);
+	if (r < 0)
+		return log_ERR(r);
+
+	r = sd_event_add_child(g->s->l->m->event,
+			       &g->dhcp_pid_source,
+			       g->dhcp_pid,
+			       WEXITED,
+			       supplicant_group_pid_fn,
+			       g);
+	if (r < 0)
+		return log_ERR(r);
+
+	return 0;
+}
+
+static void supplicant_group_rtnl_addr_fn(struct rtnl *rtnl,
+					  int error,
+					  void *data)
+{
+	struct supplicant_group *g = data;
+	char *t;
+
+	if (error < 0) {
+		log_error("cannot set in-EAPOL address %s on %s (%d): %s",
+			  g->ip_alloc_addr, g->ifname, error, strerror(-error));
+		return;
+	}
+
+	t = strdup(g->ip_alloc_addr);
+	if (!t)
+		return log_vENOMEM();
+
+	/* strip the netmask, "local_addr" is a plain address */
+	t[strcspn(t, "/")] = 0;
+
+	log_debug("in-EAPOL address %s set on %s", t, g->ifname);
+
+	free(g->local_addr);
+	g->local_addr = t;
+
+	supplicant_group_update_connected(g);
+}
+
+static int supplicant_group_rtnl_fn(sd_event_source *source,
+				    int fd,
+				    uint32_t mask,
+				    void *data)
+{
+	struct supplicant_group *g = data;
+	int r;
+
+	r = rtnl_dispatch(g->rtnl);
+
+	/* never free @g from within rtnl callbacks, only once rtnl is idle */
+	if (r < 0 || (rtnl_is_idle(g->rtnl) && !g->local_addr)) {
+		log_error("cannot configure in-EAPOL address on %s, stopping connection",
+			  g->ifname);
+		supplicant_group_free(g);
+	}
+
+	return 0;
+}
+
+/*
+ * The GO assigned our address during EAPOL already (P2P-GROUP-STARTED carried
+ * ip_addr/ip_mask/go_ip_addr), so there is no need for a DHCP client. We only
+ * configure the address on the group interface ourselves.
+ */
+static int supplicant_group_start_ip_alloc(struct supplicant_group *g,
+					   const char *ip_addr,
+					   const char *ip_mask,
+					   const char *go_ip_addr)
+{
+	unsigned int ifindex;
+	int r;
+
+	ifindex = if_nametoindex(g->ifname);
+	if (!ifindex)
+		return log_ERRNO();
+
+	r = asprintf(&g->ip_alloc_addr, "%s/%s", ip_addr, ip_mask);
+	if (r < 0) {
+		g->ip_alloc_addr = NULL;
+		return log_ENOMEM();
+	}
+
+	r = rtnl_new(&g->rtnl, ifindex);
+	if (r < 0)
+		return r;
+
+	r = sd_event_add_io(g->s->l->m->event,
+			    &g->rtnl_source,
+			    rtnl_get_fd(g->rtnl),
+			    EPOLLHUP | EPOLLERR | EPOLLIN,
+			    supplicant_group_rtnl_fn,
+			    g);
+	if (r < 0)
+		return log_ERR(r);
+
+	r = rtnl_set_addr(g->rtnl,
+			  g->ip_alloc_addr,
+			  supplicant_group_rtnl_addr_fn,
+			  g);
+	if (r < 0)
+		return r;
+
+	if (g->sp) {
+		free(g->sp->remote_addr);
+		g->sp->remote_addr = strdup(go_ip_addr);
+		if (!g->sp->remote_addr)
+			return log_ENOMEM();
+	}
 
 	return 0;
 }
 
+static void supplicant_group_stop_ip_alloc(struct supplicant_group *g)
+{
+	sd_event_source_unref(g->rtnl_source);
+	g->rtnl_source = NULL;
+	rtnl_free(g->rtnl);
+	g->rtnl = NULL;
+	free(g->ip_alloc_addr);
+	g->ip_alloc_addr = NULL;
+}
+
 static int supplicant_group_new(struct supplicant *s,
 				struct supplicant_group **out,
 				const char *ifname,
@@ -525,7 +716,7 @@ static int supplicant_group_new(struct supplicant *s,
 
 	if (g->go) {
 		/* find free subnet */
-		for (subnet = 50; subnet < 256; ++subnet) {
+		for (subnet = IP_ALLOC_SUBNET; subnet < 256; ++subnet) {
 			shl_dlist_for_each(i, &s->groups) {
 				j = shl_dlist_entry(i,
 						    struct supplicant_group,
@@ -539,39 +730,6 @@ static int supplicant_group_new(struct supplicant *s,
 				break;
 			}
 		}
-
-		if (g->subnet) {
-			r = supplicant_group_spawn_dhcp_server(g, g->subnet);
-		} else {
-			log_warning("out of free subnets for local groups");
-			r = -EINVAL;
-		}
-	} else {
-		r = supplicant_group_spawn_dhcp_client(g);
-	}
-	if (r < 0)
-		goto error;
-
-	r = sd_event_add_io(s->l->m->event,
-			    &g->dhcp_comm_source,
-			    g->dhcp_comm,
-			    EPOLLHUP | EPOLLERR | EPOLLIN,
-			    supplicant_group_comm_fn,
-			    g);
-	if (r < 0) {
-		log_vERR(r);
-		goto error;
-	}
-
-	r = sd_event_add_child(s->l->m->event,
-			       &g->dhcp_pid_source,
-			       g->dhcp_pid,
-			       WEXITED,
-			       supplicant_group_pid_fn,
-			       g);
-	if (r < 0) {
-		log_vERR(r);
-		goto error;
 	}
 
 	shl_dlist_link(&s->groups, &g->list);
@@ -737,6 +895,38 @@ const char *supplicant_peer_get_wfd_subelements(struct supplicant_peer *sp)
 	return sp->wfd_subelements;
 }
 
+const struct wfd_ie *supplicant_peer_get_wfd(struct supplicant_peer *sp)
+{
+	if (!sp)
+		return NULL;
+
+	return &sp->wfd;
+}
+
+static void supplicant_peer_set_wfd_subelements(struct supplicant_peer *sp,
+						const char *val)
+{
+	char *t;
+	int r;
+
+	/* P2P-DEVICE-FOUND is repeated on every scan, decode changes only */
+	if (sp->wfd_subelements && !strcmp(sp->wfd_subelements, val))
+		return;
+
+	t = strdup(val);
+	if (!t)
+		return log_vENOMEM();
+
+	r = wfd_ie_parse(&sp->wfd, t);
+	if (r < 0)
+		log_debug("invalid WFD subelements of peer %s: %s",
+			  sp->p->p2p_mac, t);
+
+	free(sp->wfd_subelements);
+	sp->wfd_subelements = t;
+	peer_supplicant_wfd_subelements_changed(sp->p);
+}
+
 int supplicant_peer_connect(struct supplicant_peer *sp,
 			    const char *prov_type,
 			    const char *pin)
@@ -762,6 +952,8 @@ int supplicant_peer_connect(struct supplicant_peer *sp,
 	else
 		log_debug("connect to %s via %s", sp->p->p2p_mac, prov_type);
 
+	SHL_TRACE(peer_connect, sp->p->p2p_mac);
+
 	r = wpas_message_new_request(sp->s->bus_global,
 				     "P2P_CONNECT",
 				     &m);
@@ -888,31 +1080,15 @@ static void supplicant_parse_peer(struct supplicant *s,
 
 	r = wpas_message_dict_read(m, "wfd_subelems", 's', &val);
 	if (r >= 0) {
-		t = strdup(val);
-		if (!t) {
-			log_vENOMEM();
-		} else {
-			free(sp->wfd_subelements);
-			sp->wfd_subelements = t;
-			peer_supplicant_wfd_subelements_changed(sp->p);
-		}
+		supplicant_peer_set_wfd_subelements(sp, val);
 	} else {
-		/* TODO: wfd_dev_info only contains the dev-info sub-elem,
-		 * while wfd_sublemens contains all. Fix that! The user has no
-		 * chance to distinguish both.
-		 * We currently use it only as boolean (set/unset) but once we
-		 * parse it we _definitely_ have to provide proper data. */
+		/* wfd_dev_info only contains the dev-info sub-elem, while
+		 * wfd_subelems contains all. The raw WfdSubelements property
+		 * differs, but wfd_ie_parse() understands both, so the typed
+		 * properties are consistent. */
 		r = wpas_message_dict_read(m, "wfd_dev_info", 's', &val);
-		if (r >= 0) {
-			t = strdup(val);
-			if (!t) {
-				log_vENOMEM();
-			} else {
-				free(sp->wfd_subelements);
-				sp->wfd_subelements = t;
-				peer_supplicant_wfd_subelements_changed(sp->p);
-			}
-		}
+		if (r >= 0)
+			supplicant_peer_set_wfd_subelements(sp, val);
 	}
 
 	if (s->running)
@@ -962,6 +1138,8 @@ static void supplicant_event_p2p_device_found(struct supplicant *s,
 		return;
 	}
 
+	SHL_TRACE(p2p_device_found, mac);
+
 	supplicant_parse_peer(s, ev);
 
 	r = wpas_message_new_request(s->bus_global,
@@ -1190,6 +1368,8 @@ static void supplicant_event_p2p_go_neg_success(struct supplicant *s,
 		return;
 	}
 
+	SHL_TRACE(go_neg_success, mac);
+
 	sp = find_peer_by_p2p_mac(s, mac);
 	if (!sp) {
 		log_debug("stale P2P-GO-NEG-SUCCESS: %s",
@@ -1229,7 +1409,8 @@ static void supplicant_event_p2p_group_started(struct supplicant *s,
 	struct supplicant_peer *sp;
 	struct supplicant_group *g;
 	const char *mac, *ssid, *ifname, *go;
-	bool is_go;
+	const char *ip_addr, *ip_mask, *go_ip_addr;
+	bool is_go, ip_alloc;
 	int r;
 
 	r = wpas_message_dict_read(ev, "go_dev_addr", 's', &mac);
@@ -1251,6 +1432,8 @@ static void supplicant_event_p2p_group_started(struct supplicant *s,
 		return;
 	}
 
+	SHL_TRACE(group_started, ifname);
+
 	r = wpas_message_argv_read(ev, 1, 's', &go);
 	if (r < 0) {
 		log_debug("no GO/client type in P2P-GROUP-STARTED: %s",
@@ -1260,6 +1443,12 @@ static void supplicant_event_p2p_group_started(struct supplicant *s,
 
 	is_go = !strcmp(go, "GO");
 
+	/* clients get their address during EAPOL if the GO supports it */
+	ip_alloc = !is_go &&
+		   wpas_message_dict_read(ev, "ip_addr", 's', &ip_addr) >= 0 &&
+		   wpas_message_dict_read(ev, "ip_mask", 's', &ip_mask) >= 0 &&
+		   wpas_message_dict_read(ev, "go_ip_addr", 's', &go_ip_addr) >= 0;
+
 	sp = find_peer_by_p2p_mac(s, mac);
 	if (!sp) {
 		if (!s->p2p_mac || strcmp(s->p2p_mac, mac)) {
@@ -1270,23 +1459,50 @@ static void supplicant_event_p2p_group_started(struct supplicant *s,
 	}
 
 	g = find_group_by_ifname(s, ifname);
-	if (!g) {
-		r = supplicant_group_new(s, &g, ifname, is_go);
-		if (r < 0)
-			return;
-
-		log_debug("start %s group on new group %s as %s/%d",
-			  sp ? "remote" : "local", g->ifname, go, is_go);
-	} else {
+	if (g) {
 		log_debug("start %s group on existing group %s as %s/%d",
 			  sp ? "remote" : "local", g->ifname, go, is_go);
+
+		if (sp) {
+			supplicant_peer_set_group(sp, g);
+			g->sp = sp;
+		}
+
+		return;
 	}
 
+	r = supplicant_group_new(s, &g, ifname, is_go);
+	if (r < 0)
+		return;
+
+	log_debug("start %s group on new group %s as %s/%d",
+		  sp ? "remote" : "local", g->ifname, go, is_go);
+
 	if (sp) {
 		supplicant_peer_set_group(sp, g);
 		g->sp = sp;
 	}
 
+	if (ip_alloc) {
+		log_debug("in-EAPOL address %s/%s (GO %s) on %s",
+			  ip_addr, ip_mask, go_ip_addr, g->ifname);
+
+		r = supplicant_group_start_ip_alloc(g, ip_addr, ip_mask,
+						    go_ip_addr);
+		if (r >= 0)
+			return;
+
+		log_warning("cannot use in-EAPOL address on %s, falling back to DHCP",
+			    g->ifname);
+		supplicant_group_stop_ip_alloc(g);
+	}
+
+	r = supplicant_group_start_dhcp(g);
+	if (r < 0) {
+		supplicant_group_free(g);
+		return;
+	}
+
 	/* TODO: For local-groups, we should schedule some timer so the
 	 * group gets removed in case the remote side never connects. */
 }
@@ -1352,7 +1568,7 @@ static void supplicant_event_ap_sta_connected(struct supplicant *s,
 {
 	struct supplicant_peer *sp;
 	struct supplicant_group *g;
-	const char *sta_mac, *p2p_mac, *ifname;
+	const char *sta_mac, *p2p_mac, *ifname, *ip_addr;
 	char *t;
 	int r;
 
@@ -1411,6 +1627,20 @@ static void supplicant_event_ap_sta_connected(struct supplicant *s,
 
 	log_debug("bind peer %s to existing local group %s", p2p_mac, ifname);
 	supplicant_peer_set_group(sp, g);
+
+	/* peer got its address during EAPOL, it won't ask our DHCP server */
+	r = wpas_message_dict_read(ev, "ip_addr", 's', &ip_addr);
+	if (r >= 0) {
+		t = strdup(ip_addr);
+		if (!t)
+			return log_vENOMEM();
+
+		log_debug("peer %s got in-EAPOL address %s", p2p_mac, t);
+
+		free(sp->remote_addr);
+		sp->remote_addr = t;
+		supplicant_group_update_connected(g);
+	}
 }
 
 static void supplicant_event_ap_sta_disconnected(struct supplicant *s,
@@ -1458,6 +1688,8 @@ static void supplicant_event(struct supplicant *s, struct wpas_message *m)
 			return;
 		}
 
+		manager_count_wpas_event(s->l->m, name);
+
 		/* ignored events */
 		if (!strcmp(name, "CTRL-EVENT-SCAN-STARTED") ||
 		    !strcmp(name, "CTRL-EVENT-SCAN-RESULTS") ||
@@ -2098,6 +2330,24 @@ bool supplicant_p2p_scanning(struct supplicant *s)
 	return s && s->running && s->has_p2p && s->p2p_scanning;
 }
 
+/* requests queued on each wpas socket, @dev is 0 if both share one */
+void supplicant_get_pending(struct supplicant *s, size_t *global, size_t *dev)
+{
+	*global = wpas_get_pending(s->bus_global);
+	*dev = s->bus_dev != s->bus_global ? wpas_get_pending(s->bus_dev) : 0;
+}
+
+size_t supplicant_get_group_cnt(struct supplicant *s)
+{
+	struct shl_dlist *i;
+	size_t cnt = 0;
+
+	shl_dlist_for_each(i, &s->groups)
+		++cnt;
+
+	return cnt;
+}
+
 /*
  * Supplicant Control
  * This is the core supplicant-handling, each object manages one external
@@ -2245,6 +2495,9 @@ static int supplicant_global_attach_fn(struct wpas *w,
 
 	r = wpas_open(s->dev_ctrl, &s->bus_dev);
 	if (r >= 0) {
+		wpas_set_latency_hist(s->bus_dev,
+				      &s->l->m->metrics.wpas_latency);
+
 		r = wpas_attach_event(s->bus_dev, s->l->m->event, 0);
 		if (r < 0)
 			goto error;
@@ -2298,6 +2551,8 @@ static int supplicant_open(struct supplicant *s)
 		return r;
 	}
 
+	wpas_set_latency_hist(s->bus_global, &s->l->m->metrics.wpas_latency);
+
 	r = wpas_attach_event(s->bus_global, s->l->m->event, 0);
 	if (r < 0)
 		goto error;
@@ -2348,6 +2603,8 @@ static void supplicant_failed(struct supplicant *s)
 	uint64_t ms;
 	int r;
 
+	++s->l->m->metrics.supplicant_restarts;
+
 	if (shl_ratelimit_test(&s->restart_rate)) {
 		ms = 200ULL;
 		log_error("wpas (pid:%d) failed unexpectedly, relaunching after short grace period..",
@@ -2632,8 +2889,7 @@ static int supplicant_write_config(struct supplicant *s)
 		"config_methods=%s\n"
 		"driver_param=%s\n"
 		"ap_scan=%s\n"
-		"p2p_go_intent=%d\n"
-		"# End of configuration\n",
+		"p2p_go_intent=%d\n",
 
 		s->l->friendly_name ?: "unknown",
 		"1-0050F204-1",
@@ -2647,6 +2903,30 @@ static int supplicant_write_config(struct supplicant *s)
 		return r;
 	}
 
+	if (link_is_using_ip_alloc(s->l)) {
+		r = fprintf(f,
+			"ip_addr_go=192.168.%u.1\n"
+			"ip_addr_mask=255.255.255.0\n"
+			"ip_addr_start=192.168.%u.%u\n"
+			"ip_addr_end=192.168.%u.%u\n",
+
+			IP_ALLOC_SUBNET,
+			IP_ALLOC_SUBNET, IP_ALLOC_START,
+			IP_ALLOC_SUBNET, IP_ALLOC_END);
+		if (r < 0) {
+			r = log_ERRNO();
+			fclose(f);
+			return r;
+		}
+	}
+
+	r = fprintf(f, "# End of configuration\n");
+	if (r < 0) {
+		r = log_ERRNO();
+		fclose(f);
+		return r;
+	}
+
 	fclose(f);
 	free(s->conf_path);
 	s->conf_path = path;
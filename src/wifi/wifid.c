@@ -49,6 +49,7 @@ unsigned int go_intent = 0;
 const char *driver_param = NULL;
 bool wpa_syslog = false;
 bool use_dev = false;
+bool ip_alloc = false;
 bool lazy_managed = false;
 const char *ip_binary = NULL;
 
@@ -82,6 +83,53 @@ struct link *manager_find_link_by_label(struct manager *m, const char *label)
 	return manager_find_link(m, idx);
 }
 
+void manager_count_wpas_event(struct manager *m, const char *name)
+{
+	struct metrics *mt = &m->metrics;
+	struct metrics_event *e;
+	char **elem;
+	int r;
+
+	if (shl_htable_lookup_str(&mt->wpas_events, name, NULL, &elem)) {
+		++metrics_event_from_htable(elem)->count;
+		return;
+	}
+
+	/* wpas sends free-form lines, too; don't let them grow the table */
+	if (mt->wpas_event_cnt >= METRICS_WPAS_EVENTS_MAX)
+		goto other;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		goto other;
+
+	e->name = strdup(name);
+	if (!e->name)
+		goto error;
+
+	r = shl_htable_insert_str(&mt->wpas_events, &e->name, NULL);
+	if (r < 0)
+		goto error;
+
+	++mt->wpas_event_cnt;
+	e->count = 1;
+	return;
+
+error:
+	free(e->name);
+	free(e);
+other:
+	++mt->wpas_events_other;
+}
+
+static void manager_free_wpas_event(char **elem, void *ctx)
+{
+	struct metrics_event *e = metrics_event_from_htable(elem);
+
+	free(e->name);
+	free(e);
+}
+
 static void manager_add_udev_link(struct manager *m,
 				  struct udev_device *d)
 {
@@ -120,6 +168,8 @@ static void manager_add_udev_link(struct manager *m,
 
 	if(use_dev)
 		link_use_dev(l);
+	if(ip_alloc)
+		link_use_ip_alloc(l);
 	if(ip_binary)
 		link_set_ip_binary(l, ip_binary);
 
@@ -221,6 +271,9 @@ static void manager_free(struct manager *m)
 	manager_dbus_disconnect(m);
 
 	shl_htable_clear_uint(&m->links, NULL, NULL);
+	shl_htable_clear_str(&m->metrics.wpas_events,
+			     manager_free_wpas_event,
+			     NULL);
 
 	sd_event_source_unref(m->udev_mon_source);
 	udev_monitor_unref(m->udev_mon);
@@ -252,6 +305,9 @@ static int manager_new(struct manager **out)
 		return log_ENOMEM();
 
 	shl_htable_init_uint(&m->links);
+	shl_htable_init_str(&m->metrics.wpas_events);
+	shl_dlist_init(&m->dbus_changed_links);
+	shl_dlist_init(&m->dbus_changed_peers);
 
 
 	if (config_methods) {
@@ -480,9 +536,39 @@ static int manager_startup(struct manager *m)
 	return 0;
 }
 
+/*
+ * Same as sd_event_loop(), but records how long each iteration keeps us
+ * busy, not counting the time spent waiting for events.
+ */
 static int manager_run(struct manager *m)
 {
-	return sd_event_loop(m->event);
+	uint64_t start, busy;
+	int r, code;
+
+	while (sd_event_get_state(m->event) != SD_EVENT_FINISHED) {
+		start = shl_now(CLOCK_MONOTONIC);
+		r = sd_event_prepare(m->event);
+		busy = shl_now(CLOCK_MONOTONIC) - start;
+		if (r == 0)
+			r = sd_event_wait(m->event, (uint64_t)-1);
+		if (r < 0)
+			return r;
+		if (r == 0)
+			continue;
+
+		start = shl_now(CLOCK_MONOTONIC);
+		r = sd_event_dispatch(m->event);
+		busy += shl_now(CLOCK_MONOTONIC) - start;
+		shl_hist_add(&m->metrics.loop_duration, busy);
+		if (r < 0)
+			return r;
+	}
+
+	r = sd_event_get_exit_code(m->event, &code);
+	if (r < 0)
+		return r;
+
+	return code;
 }
 
 static int help(void)
@@ -498,6 +584,9 @@ static int help(void)
 	       "     --log-level <lvl>     Maximum level for log messages\n"
 	       "     --log-time            Prefix log-messages with timestamp\n"
 	       "     --log-date-time       Prefix log-messages with date time\n"
+	       "     --log-async           Write log-messages from a background thread\n"
+	       "     --log-subsystem-level <subs=lvl,...>\n"
+	       "                           Maximum log level per subsystem\n"
 	       "\n"
 	       "  -i --interface           Choose the interface to use\n"
 	       "     --config-methods      Define config methods for pairing, default 'pbc'\n"
@@ -505,6 +594,7 @@ static int help(void)
 	       "     --wpa-loglevel <lvl>  wpa_supplicant log-level\n"
 	       "     --wpa-syslog          wpa_supplicant use syslog\n"
 	       "     --use-dev             enable workaround for 'no ifname' issue\n"
+	       "     --ip-alloc            assign P2P client addresses during EAPOL\n"
 	       "     --lazy-managed        manage interface only when user decide to do\n"
 	       "     --ip-binary <path>    path to 'ip' binary [default: "XSTR(IP_BINARY)"]\n"
 	       "     --go-intent <0-15>    group owner intent, 0-15, the higher number indicates preference to become the GO, default 0\n"
@@ -524,9 +614,12 @@ static int parse_argv(int argc, char *argv[])
 		ARG_LOG_LEVEL,
 		ARG_LOG_TIME,
 		ARG_LOG_DATE_TIME,
+		ARG_LOG_ASYNC,
+		ARG_LOG_SUBSYSTEM_LEVEL,
 		ARG_WPA_LOGLEVEL,
 		ARG_WPA_SYSLOG,
 		ARG_USE_DEV,
+		ARG_IP_ALLOC,
 		ARG_CONFIG_METHODS,
 		ARG_LAZY_MANAGED,
 		ARG_IP_BINARY,
@@ -539,11 +632,14 @@ static int parse_argv(int argc, char *argv[])
 		{ "log-level",	        required_argument,	NULL,	ARG_LOG_LEVEL },
 		{ "log-time",	        no_argument,		NULL,	ARG_LOG_TIME },
 		{ "log-date-time",	no_argument,		NULL,	ARG_LOG_DATE_TIME },
+		{ "log-async",		no_argument,		NULL,	ARG_LOG_ASYNC },
+		{ "log-subsystem-level",	required_argument,	NULL,	ARG_LOG_SUBSYSTEM_LEVEL },
 
 		{ "wpa-loglevel",	required_argument,	NULL,	ARG_WPA_LOGLEVEL },
 		{ "wpa-syslog",	no_argument,	NULL,	ARG_WPA_SYSLOG },
 		{ "interface",	required_argument,	NULL,	'i' },
 		{ "use-dev",	no_argument,	NULL,	ARG_USE_DEV },
+		{ "ip-alloc",	no_argument,	NULL,	ARG_IP_ALLOC },
 		{ "config-methods",	required_argument,	NULL,	ARG_CONFIG_METHODS },
 		{ "lazy-managed",	no_argument,	NULL,	ARG_LAZY_MANAGED },
 		{ "ip-binary",	required_argument,	NULL,	ARG_IP_BINARY },
@@ -551,7 +647,7 @@ static int parse_argv(int argc, char *argv[])
 		{ "driver-param",	required_argument,	NULL,	ARG_DRIVER_PARAM },
 		{}
 	};
-	int c;
+	int c, r;
 
 	while ((c = getopt_long(argc, argv, "hi:", options, NULL)) >= 0) {
 		switch (c) {
@@ -572,9 +668,25 @@ static int parse_argv(int argc, char *argv[])
 		case ARG_LOG_DATE_TIME:
 			log_date_time = true;
 			break;
+		case ARG_LOG_ASYNC:
+			r = log_async_start();
+			if (r < 0)
+				log_warning("cannot start async logging (%d)", r);
+			break;
+		case ARG_LOG_SUBSYSTEM_LEVEL:
+			r = log_parse_subsystems(optarg);
+			if (r < 0) {
+				log_error("invalid subsystem log levels: %s",
+					  optarg);
+				return r;
+			}
+			break;
 		case ARG_USE_DEV:
 			use_dev = true;
 			break;
+		case ARG_IP_ALLOC:
+			ip_alloc = true;
+			break;
 		case ARG_CONFIG_METHODS:
 			config_methods = optarg;
 			break;
@@ -625,9 +737,17 @@ void load_ini_config()
 			log_max_sev = log_parse_arg(log_level_tmp);
 			g_free(log_level_tmp);
 		}
+		log_level_tmp = g_key_file_get_string (gkf, "wifid", "log-subsystem-level", NULL);
+		if (log_level_tmp) {
+			if (log_parse_subsystems(log_level_tmp) < 0)
+				log_warning("invalid log-subsystem-level: %s",
+					    log_level_tmp);
+			g_free(log_level_tmp);
+		}
 		ip_binary = g_key_file_get_string (gkf, "wifid", "ip-binary", NULL);
 		lazy_managed = g_key_file_get_boolean (gkf, "wifid", "lazy-managed", NULL);
 		use_dev = g_key_file_get_boolean (gkf, "wifid", "use-dev", NULL);
+		ip_alloc = g_key_file_get_boolean (gkf, "wifid", "ip-alloc", NULL);
 		wpa_syslog = g_key_file_get_boolean (gkf, "wifid", "wpa-syslog", NULL);
 		config_methods = g_key_file_get_string (gkf, "wifid", "config_methods", NULL);
 		go_intent = g_key_file_get_uint64 (gkf, "wifid", "go-intent", NULL);
@@ -25,6 +25,8 @@
 #include <systemd/sd-event.h>
 #include "shl_dlist.h"
 #include "shl_htable.h"
+#include "shl_util.h"
+#include "wfd_ie.h"
 
 #ifndef WIFID_H
 #define WIFID_H
@@ -52,6 +54,8 @@ int supplicant_set_wfd_subelements(struct supplicant *s, const char *val);
 int supplicant_p2p_start_scan(struct supplicant *s);
 void supplicant_p2p_stop_scan(struct supplicant *s);
 bool supplicant_p2p_scanning(struct supplicant *s);
+void supplicant_get_pending(struct supplicant *s, size_t *global, size_t *dev);
+size_t supplicant_get_group_cnt(struct supplicant *s);
 
 /* supplicant peer */
 
@@ -60,6 +64,7 @@ const char *supplicant_peer_get_interface(struct supplicant_peer *sp);
 const char *supplicant_peer_get_local_address(struct supplicant_peer *sp);
 const char *supplicant_peer_get_remote_address(struct supplicant_peer *sp);
 const char *supplicant_peer_get_wfd_subelements(struct supplicant_peer *sp);
+const struct wfd_ie *supplicant_peer_get_wfd(struct supplicant_peer *sp);
 int supplicant_peer_connect(struct supplicant_peer *sp,
 			    const char *prov_type,
 			    const char *pin);
@@ -70,8 +75,13 @@ void supplicant_peer_disconnect(struct supplicant_peer *sp);
 struct peer {
 	struct link *l;
 	char *p2p_mac;
+	char *dbus_path;
 	struct supplicant_peer *sp;
 
+	/* properties with pending PropertiesChanged, see wifid-dbus.c */
+	unsigned int dbus_changed;
+	struct shl_dlist dbus_changed_list;
+
 	bool public : 1;
 	bool connected : 1;
 };
@@ -89,6 +99,7 @@ const char *peer_get_interface(struct peer *p);
 const char *peer_get_local_address(struct peer *p);
 const char *peer_get_remote_address(struct peer *p);
 const char *peer_get_wfd_subelements(struct peer *p);
+const struct wfd_ie *peer_get_wfd(struct peer *p);
 int peer_connect(struct peer *p, const char *prov, const char *pin);
 void peer_disconnect(struct peer *p);
 
@@ -108,6 +119,7 @@ void peer_supplicant_go_neg_request(struct peer *p,
 void peer_supplicant_formation_failure(struct peer *p, const char *reason);
 void peer_supplicant_connected_changed(struct peer *p, bool connected);
 
+char *peer_dbus_get_path(struct peer *p);
 _shl_sentinel_
 void peer_dbus_properties_changed(struct peer *p, const char *prop, ...);
 void peer_dbus_provision_discovery(struct peer *p,
@@ -125,11 +137,13 @@ void peer_dbus_removed(struct peer *p);
 struct link {
 	struct manager *m;
 	unsigned int ifindex;
+	char *dbus_path;
 	struct supplicant *s;
 
 	char *ifname;
 	char *friendly_name;
 	char *wfd_subelements;
+	struct wfd_ie wfd;
 	char *config_methods;
 	char *ip_binary;
 	int go_intent;
@@ -138,9 +152,13 @@ struct link {
 	size_t peer_cnt;
 	struct shl_htable peers;
 
+	unsigned int dbus_changed;
+	struct shl_dlist dbus_changed_list;
+
 	bool managed : 1;
 	bool public : 1;
 	bool use_dev : 1;
+	bool ip_alloc : 1;
 };
 
 #define link_from_htable(_l) \
@@ -163,6 +181,10 @@ void link_free(struct link *l);
 void link_use_dev(struct link *l);
 bool link_is_using_dev(struct link *l);
 
+/* P2P in-EAPOL IP address allocation */
+void link_use_ip_alloc(struct link *l);
+bool link_is_using_ip_alloc(struct link *l);
+
 int link_set_ip_binary(struct link *l, const char *ip_binary);
 
 int link_set_managed(struct link *l, bool set);
@@ -176,6 +198,7 @@ int link_set_go_intent(struct link *l, unsigned int go_intent);
 const char *link_get_friendly_name(struct link *l);
 int link_set_wfd_subelements(struct link *l, const char *val);
 const char *link_get_wfd_subelements(struct link *l);
+const struct wfd_ie *link_get_wfd(struct link *l);
 int link_set_p2p_scanning(struct link *l, bool set);
 bool link_get_p2p_scanning(struct link *l);
 
@@ -183,11 +206,39 @@ void link_supplicant_started(struct link *l);
 void link_supplicant_stopped(struct link *l);
 void link_supplicant_p2p_scan_changed(struct link *l, bool new_value);
 
+char *link_dbus_get_path(struct link *l);
 _shl_sentinel_
 void link_dbus_properties_changed(struct link *l, const char *prop, ...);
 void link_dbus_added(struct link *l);
 void link_dbus_removed(struct link *l);
 
+/* metrics, exported on the manager object by wifid-dbus.c */
+
+/* distinct wpas event names counted, the rest is counted as "other" */
+#define METRICS_WPAS_EVENTS_MAX 64
+
+struct metrics_event {
+	char *name;
+	uint64_t count;
+};
+
+#define metrics_event_from_htable(_e) \
+	shl_htable_entry((_e), struct metrics_event, name)
+
+struct metrics {
+	size_t wpas_event_cnt;
+	struct shl_htable wpas_events;
+	uint64_t wpas_events_other;
+
+	/* usecs */
+	struct shl_hist wpas_latency;
+	struct shl_hist loop_duration;
+
+	uint64_t dbus_signals;
+	uint64_t dhcp_spawns;
+	uint64_t supplicant_restarts;
+};
+
 /* manager */
 
 struct manager {
@@ -205,6 +256,17 @@ struct manager {
 
 	size_t link_cnt;
 	struct shl_htable links;
+
+	/* links/peers with pending PropertiesChanged signals */
+	struct shl_dlist dbus_changed_links;
+	struct shl_dlist dbus_changed_peers;
+	sd_event_source *dbus_flush_source;
+
+	/* cached object paths of public links and peers, NULL if stale */
+	char **dbus_nodes;
+	size_t dbus_node_cnt;
+
+	struct metrics metrics;
 };
 
 #define MANAGER_FIRST_LINK(_m) \
@@ -214,6 +276,7 @@ struct manager {
 
 struct link *manager_find_link(struct manager *m, unsigned int ifindex);
 struct link *manager_find_link_by_label(struct manager *m, const char *label);
+void manager_count_wpas_event(struct manager *m, const char *name);
 
 /* dbus */
 
@@ -0,0 +1,129 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checksum Microbenchmark
+ * Compares the 16bit-at-a-time checksum gdhcp used to have against
+ * shl_csum() and against an incremental update of a fixed packet template,
+ * on DHCP-sized (576 byte) packets. Usage: bench_csum [iterations]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "shl_csum.h"
+
+#define PACKET_SIZE 576
+
+static uint16_t ref_csum(const void *addr, size_t count)
+{
+	const uint8_t *source = addr;
+	uint32_t sum = 0;
+	uint16_t tmp;
+
+	while (count > 1) {
+		memcpy(&tmp, source, sizeof(tmp));
+		sum += tmp;
+		source += 2;
+		count -= 2;
+	}
+
+	if (count > 0) {
+		tmp = 0;
+		*(uint8_t*)&tmp = *source;
+		sum += tmp;
+	}
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+static uint64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t nsec, unsigned long n)
+{
+	printf("%-12s %8.1f ns/packet %10.1f MB/s\n",
+	       name,
+	       (double)nsec / n,
+	       (double)PACKET_SIZE * n * 1000.0 / nsec);
+}
+
+int main(int argc, char **argv)
+{
+	static uint8_t buf[PACKET_SIZE];
+	unsigned long i, n = 1000000;
+	volatile uint16_t sink = 0;
+	uint16_t check, from, to;
+	uint64_t start;
+
+	if (argc > 1)
+		n = strtoul(argv[1], NULL, 10);
+	if (!n)
+		n = 1;
+
+	srand(576);
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = rand();
+
+	if (ref_csum(buf, sizeof(buf)) != shl_csum(buf, sizeof(buf))) {
+		fprintf(stderr, "checksum mismatch\n");
+		return 1;
+	}
+
+	start = now_nsec();
+	for (i = 0; i < n; ++i) {
+		buf[i % sizeof(buf)] ^= 1;
+		sink += ref_csum(buf, sizeof(buf));
+	}
+	report("reference", now_nsec() - start, n);
+
+	start = now_nsec();
+	for (i = 0; i < n; ++i) {
+		buf[i % sizeof(buf)] ^= 1;
+		sink += shl_csum(buf, sizeof(buf));
+	}
+	report("shl_csum", now_nsec() - start, n);
+
+	/* only the transaction-id changes between packets of a template */
+	check = shl_csum(buf, sizeof(buf));
+	start = now_nsec();
+	for (i = 0; i < n; ++i) {
+		memcpy(&from, buf + 32, sizeof(from));
+		to = from + 1;
+		memcpy(buf + 32, &to, sizeof(to));
+		check = shl_csum_update16(check, from, to);
+	}
+	report("incremental", now_nsec() - start, n);
+	sink += check;
+
+	if (check != ref_csum(buf, sizeof(buf))) {
+		fprintf(stderr, "incremental checksum mismatch\n");
+		return 1;
+	}
+
+	return 0;
+}
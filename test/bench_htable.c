@@ -0,0 +1,219 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Hash-Table Microbenchmark
+ * Compares shl_htable with u64 keys against shl_ftable: insert, lookup of
+ * present and missing keys, iteration and remove, from 10 to 100k entries.
+ * Entries are separately allocated objects the size of an RTSP message, so
+ * touching them costs what it costs in real life. Keys are either sequential,
+ * like RTSP cookies, or random 48bit values, like MAC addresses, and are
+ * looked up in random order. Usage: bench_htable [operations per size]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "shl_ftable.h"
+#include "shl_htable.h"
+
+struct entry {
+	uint64_t key;
+	char payload[248];
+};
+
+static const unsigned int sizes[] = { 10, 100, 1000, 10000, 100000 };
+
+static uint64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct result {
+	double insert;
+	double hit;
+	double miss;
+	double iterate;
+	double remove;
+};
+
+static int run_htable(struct entry **e, const unsigned int *order,
+		      unsigned int n, unsigned int rounds, struct result *res)
+{
+	struct shl_htable t = SHL_HTABLE_INIT_U64(t);
+	unsigned int i, j, found = 0;
+	uint64_t start, *elem, sum = 0;
+
+	res->insert = res->hit = res->miss = res->iterate = res->remove = 0;
+
+	for (j = 0; j < rounds; ++j) {
+		start = now_nsec();
+		for (i = 0; i < n; ++i)
+			shl_htable_insert_u64(&t, &e[i]->key);
+		res->insert += now_nsec() - start;
+
+		start = now_nsec();
+		for (i = 0; i < n; ++i)
+			found += shl_htable_lookup_u64(&t, e[order[i]]->key,
+						       &elem);
+		res->hit += now_nsec() - start;
+
+		start = now_nsec();
+		for (i = 0; i < n; ++i)
+			found += shl_htable_lookup_u64(&t, ~e[order[i]]->key,
+						       NULL);
+		res->miss += now_nsec() - start;
+
+		start = now_nsec();
+		SHL_HTABLE_FOREACH(elem, &t)
+			sum += *elem;
+		res->iterate += now_nsec() - start;
+
+		start = now_nsec();
+		for (i = 0; i < n; ++i)
+			shl_htable_remove_u64(&t, e[i]->key, NULL);
+		res->remove += now_nsec() - start;
+	}
+
+	shl_htable_clear_u64(&t, NULL, NULL);
+	return (found == n * rounds && sum) ? 0 : -1;
+}
+
+static int run_ftable(struct entry **e, const unsigned int *order,
+		      unsigned int n, unsigned int rounds, struct result *res)
+{
+	struct shl_ftable t = SHL_FTABLE_INIT(t);
+	unsigned int i, j, found = 0;
+	uint64_t start, *elem, sum = 0;
+
+	res->insert = res->hit = res->miss = res->iterate = res->remove = 0;
+
+	for (j = 0; j < rounds; ++j) {
+		start = now_nsec();
+		for (i = 0; i < n; ++i)
+			shl_ftable_insert_u64(&t, &e[i]->key);
+		res->insert += now_nsec() - start;
+
+		start = now_nsec();
+		for (i = 0; i < n; ++i)
+			found += shl_ftable_lookup_u64(&t, e[order[i]]->key,
+						       &elem);
+		res->hit += now_nsec() - start;
+
+		start = now_nsec();
+		for (i = 0; i < n; ++i)
+			found += shl_ftable_lookup_u64(&t, ~e[order[i]]->key,
+						       NULL);
+		res->miss += now_nsec() - start;
+
+		start = now_nsec();
+		SHL_FTABLE_FOREACH(elem, &t)
+			sum += *elem;
+		res->iterate += now_nsec() - start;
+
+		start = now_nsec();
+		for (i = 0; i < n; ++i)
+			shl_ftable_remove_u64(&t, e[i]->key, NULL);
+		res->remove += now_nsec() - start;
+	}
+
+	shl_ftable_clear_u64(&t, NULL, NULL);
+	return (found == n * rounds && sum) ? 0 : -1;
+}
+
+static void report(const char *name, const char *keys, unsigned int n,
+		   unsigned int rounds, const struct result *res)
+{
+	double ops = (double)n * rounds;
+
+	printf("%-6s %-10s %6u: insert %6.1f hit %6.1f miss %6.1f iterate %6.1f remove %6.1f ns/entry\n",
+	       name, keys, n, res->insert / ops, res->hit / ops, res->miss / ops,
+	       res->iterate / ops, res->remove / ops);
+}
+
+static uint64_t rand48(void)
+{
+	return ((uint64_t)(rand() & 0xffffff) << 24) | (rand() & 0xffffff);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *patterns[] = { "sequential", "random" };
+	unsigned long ops = 2000000;
+	unsigned int i, j, k, p, t, n, max, rounds, *order;
+	struct entry **e;
+	struct result res;
+
+	if (argc > 1)
+		ops = strtoul(argv[1], NULL, 10);
+
+	max = sizes[sizeof(sizes) / sizeof(*sizes) - 1];
+	e = calloc(max, sizeof(*e));
+	order = calloc(max, sizeof(*order));
+	if (!e || !order)
+		return 1;
+
+	for (i = 0; i < max; ++i) {
+		e[i] = calloc(1, sizeof(**e));
+		if (!e[i])
+			return 1;
+	}
+
+	srand(1);
+	for (p = 0; p < 2; ++p) {
+		/*
+		 * Misses look for ~key, which is never a key of either kind.
+		 * With a fixed seed, the random keys do not collide.
+		 */
+		for (i = 0; i < max; ++i)
+			e[i]->key = p ? rand48() | 1 : (uint64_t)i + 1;
+
+		for (k = 0; k < sizeof(sizes) / sizeof(*sizes); ++k) {
+			n = sizes[k];
+			rounds = ops / n ? ops / n : 1;
+
+			for (i = 0; i < n; ++i)
+				order[i] = i;
+			for (i = n - 1; i > 0; --i) {
+				j = rand() % (i + 1);
+				t = order[i];
+				order[i] = order[j];
+				order[j] = t;
+			}
+
+			if (run_htable(e, order, n, rounds, &res) < 0)
+				return 1;
+			report("htable", patterns[p], n, rounds, &res);
+
+			if (run_ftable(e, order, n, rounds, &res) < 0)
+				return 1;
+			report("ftable", patterns[p], n, rounds, &res);
+		}
+	}
+
+	for (i = 0; i < max; ++i)
+		free(e[i]);
+	free(order);
+	free(e);
+
+	return 0;
+}
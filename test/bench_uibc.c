@@ -0,0 +1,436 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * UIBC Benchmark
+ * First measures uibc_encode() per event type, and counts the allocations
+ * it makes (none, hopefully).
+ * Then stands in for a WFD source: listens on a loopback TCP port, starts
+ * miracle-uibcctl against it and feeds it a synthetic stream of touch, key,
+ * zoom, scroll and rotate events at a fixed rate. Every event carries its
+ * sequence number in its payload, so the packets that come in are decoded,
+ * checked field by field against what was sent, and timed from the moment
+ * the event was written. Moves merged by the sender show up as gaps.
+ *
+ * Usage: bench_uibc [-n events] [-r rate] [-s sender-rate] [-x miracle-uibcctl]
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "uibc.h"
+
+#define DEFAULT_UIBCCTL "../src/uibc/miracle-uibcctl"
+
+/* what the stream cycles through */
+static const uint8_t pattern[] = {
+	UIBC_GENERIC_TOUCH_DOWN,
+	UIBC_GENERIC_TOUCH_MOVE,
+	UIBC_GENERIC_TOUCH_MOVE,
+	UIBC_GENERIC_TOUCH_MOVE,
+	UIBC_GENERIC_TOUCH_MOVE,
+	UIBC_GENERIC_TOUCH_UP,
+	UIBC_GENERIC_KEY_DOWN,
+	UIBC_GENERIC_KEY_UP,
+	UIBC_GENERIC_ZOOM,
+	UIBC_GENERIC_VERTICAL_SCROLL,
+	UIBC_GENERIC_HORIZONTAL_SCROLL,
+	UIBC_GENERIC_ROTATE,
+};
+
+static unsigned long allocs;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+/* count what the code under test allocates */
+void *malloc(size_t size)
+{
+	++allocs;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	++allocs;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	++allocs;
+	return __libc_realloc(p, size);
+}
+
+static uint64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* event @seq of the stream, its sequence number is in the payload */
+static void make_event(struct uibc_event *ev, uint32_t seq)
+{
+	uint16_t s = seq;
+
+	memset(ev, 0, sizeof(*ev));
+	ev->type = pattern[seq % sizeof(pattern)];
+
+	switch (ev->type) {
+	case UIBC_GENERIC_TOUCH_DOWN:
+	case UIBC_GENERIC_TOUCH_UP:
+	case UIBC_GENERIC_TOUCH_MOVE:
+		ev->count = 1;
+		ev->pointers[0].id = 0;
+		ev->pointers[0].x = s;
+		ev->pointers[0].y = ~s;
+		break;
+	case UIBC_GENERIC_KEY_DOWN:
+	case UIBC_GENERIC_KEY_UP:
+		ev->key.code1 = s;
+		ev->key.code2 = ~s;
+		break;
+	case UIBC_GENERIC_ZOOM:
+		ev->zoom.x = s;
+		ev->zoom.y = ~s;
+		ev->zoom.integer = s >> 8;
+		ev->zoom.fraction = s;
+		break;
+	case UIBC_GENERIC_VERTICAL_SCROLL:
+	case UIBC_GENERIC_HORIZONTAL_SCROLL:
+		ev->scroll = s;
+		break;
+	case UIBC_GENERIC_ROTATE:
+		ev->rotate.integer = s >> 8;
+		ev->rotate.fraction = s;
+		break;
+	}
+}
+
+static uint16_t be16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+/* sequence number of a packet, checking it against make_event() */
+static int check_packet(const uint8_t *p, size_t len, uint32_t near)
+{
+	struct uibc_event ev;
+	uint8_t expect[UIBC_MAX_PACKET];
+	const uint8_t *body = p + UIBC_HEADER_SIZE + UIBC_GENERIC_HEADER_SIZE;
+	uint16_t s;
+	int32_t seq;
+	int r;
+
+	if (len < UIBC_HEADER_SIZE + UIBC_GENERIC_HEADER_SIZE + 2 ||
+	    p[1] != UIBC_CATEGORY_GENERIC)
+		return -EINVAL;
+
+	switch (p[4]) {
+	case UIBC_GENERIC_TOUCH_DOWN:
+	case UIBC_GENERIC_TOUCH_UP:
+	case UIBC_GENERIC_TOUCH_MOVE:
+		s = be16(body + 2);
+		break;
+	case UIBC_GENERIC_KEY_DOWN:
+	case UIBC_GENERIC_KEY_UP:
+		s = be16(body + 1);
+		break;
+	case UIBC_GENERIC_ZOOM:
+	case UIBC_GENERIC_VERTICAL_SCROLL:
+	case UIBC_GENERIC_HORIZONTAL_SCROLL:
+		s = be16(body);
+		break;
+	case UIBC_GENERIC_ROTATE:
+		s = (body[0] << 8) | body[1];
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* packets come in order, widen to the sequence number next to @near */
+	seq = near + (int16_t)(s - (uint16_t)near);
+
+	if (seq < 0)
+		return -EINVAL;
+
+	make_event(&ev, seq);
+	r = uibc_encode(&ev, expect, sizeof(expect));
+	if (r != (int)len || memcmp(expect, p, len))
+		return -EINVAL;
+
+	return seq;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+static void bench_encode(unsigned long n)
+{
+	static const char *names[] = {
+		"touch down", "touch up", "touch move", "key down", "key up",
+		"zoom", "vscroll", "hscroll", "rotate",
+	};
+	uint8_t buf[UIBC_MAX_PACKET];
+	struct uibc_event ev;
+	volatile int sink = 0;
+	unsigned long i, a;
+	unsigned int t;
+	uint64_t start;
+
+	for (t = 0; t <= UIBC_GENERIC_ROTATE; ++t) {
+		memset(&ev, 0, sizeof(ev));
+		ev.type = t;
+		ev.count = 1;
+
+		a = allocs;
+		start = now_nsec();
+		for (i = 0; i < n; ++i) {
+			ev.pointers[0].x = i;
+			sink += uibc_encode(&ev, buf, sizeof(buf));
+		}
+		printf("encode %-12s %6.1f ns/event %lu allocations\n",
+		       names[t], (double)(now_nsec() - start) / n, allocs - a);
+	}
+}
+
+static int start_sender(const char *path, int port, unsigned int rate,
+			pid_t *pid)
+{
+	char portstr[16], ratestr[16];
+	int fds[2];
+
+	if (pipe(fds) < 0)
+		return -errno;
+
+	*pid = fork();
+	if (*pid < 0)
+		return -errno;
+
+	if (!*pid) {
+		dup2(fds[0], STDIN_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		sprintf(portstr, "%d", port);
+		sprintf(ratestr, "%u", rate);
+		execl(path, path, "--rate", ratestr, "127.0.0.1", portstr,
+		      (char*)NULL);
+		_exit(127);
+	}
+
+	close(fds[0]);
+	return fds[1];
+}
+
+static int bench_e2e(const char *path, unsigned long n, unsigned int rate,
+		     unsigned int sender_rate)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	socklen_t alen = sizeof(addr);
+	struct itimerspec its = { };
+	struct pollfd fds[2];
+	uint8_t buf[4096];
+	uint64_t *sent, *lat, expirations, t;
+	unsigned long written = 0, got = 0, bad = 0, todo;
+	size_t have = 0, off, len;
+	uint32_t next = 0;
+	int lfd, cfd, tfd, in, r, seq;
+	struct uibc_event ev;
+	pid_t pid = -1;
+
+	sent = calloc(n, sizeof(*sent));
+	lat = calloc(n, sizeof(*lat));
+	if (!sent || !lat)
+		return -ENOMEM;
+
+	lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (lfd < 0 || bind(lfd, (void*)&addr, sizeof(addr)) < 0 ||
+	    listen(lfd, 1) < 0 ||
+	    getsockname(lfd, (void*)&addr, &alen) < 0)
+		return -errno;
+
+	in = start_sender(path, ntohs(addr.sin_port), sender_rate, &pid);
+	if (in < 0)
+		return in;
+
+	cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+	close(lfd);
+	if (cfd < 0)
+		return -errno;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	its.it_value.tv_nsec = 1;
+	its.it_interval.tv_nsec = 1000000000ULL / rate;
+	its.it_interval.tv_sec = its.it_interval.tv_nsec / 1000000000ULL;
+	its.it_interval.tv_nsec %= 1000000000ULL;
+	timerfd_settime(tfd, 0, &its, NULL);
+
+	fds[0].fd = tfd;
+	fds[0].events = POLLIN;
+	fds[1].fd = cfd;
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		r = poll(fds, 2, -1);
+		if (r < 0 && errno != EINTR)
+			return -errno;
+
+		if (fds[0].revents && read(tfd, &expirations, 8) == 8) {
+			/* catch up if we were late, but one at a time */
+			for (todo = expirations; todo && written < n; --todo) {
+				make_event(&ev, written);
+				t = now_nsec();
+				ev.time = t / 1000;
+				sent[written++] = t;
+				if (write(in, &ev, sizeof(ev)) != sizeof(ev))
+					return -errno;
+			}
+
+			if (written >= n) {
+				close(in);
+				fds[0].fd = -1;
+			}
+		}
+
+		if (!fds[1].revents)
+			continue;
+
+		r = read(cfd, buf + have, sizeof(buf) - have);
+		if (r <= 0)
+			break;
+
+		t = now_nsec();
+		have += r;
+		for (off = 0; have - off >= UIBC_HEADER_SIZE; off += len) {
+			len = be16(buf + off + 2);
+			if (len < UIBC_HEADER_SIZE) {
+				fprintf(stderr, "broken packet length %zu\n", len);
+				return -EINVAL;
+			}
+			if (have - off < len)
+				break;
+
+			seq = check_packet(buf + off, len, next);
+			if (seq < 0 || (unsigned long)seq >= written) {
+				++bad;
+				continue;
+			}
+
+			lat[got++] = t - sent[seq];
+			next = seq + 1;
+		}
+
+		have -= off;
+		memmove(buf, buf + off, have);
+	}
+
+	close(cfd);
+	close(tfd);
+	waitpid(pid, &r, 0);
+	if (!WIFEXITED(r) || WEXITSTATUS(r)) {
+		fprintf(stderr, "%s failed\n", path);
+		return -EIO;
+	}
+
+	qsort(lat, got, sizeof(*lat), cmp_u64);
+	printf("sent %lu events at %u/s, %lu delivered, %lu merged, %lu invalid\n",
+	       written, rate, got, written - got - bad, bad);
+	if (got) {
+		printf("latency us: p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+		       lat[got / 2] / 1000.0,
+		       lat[got * 90 / 100] / 1000.0,
+		       lat[got * 99 / 100] / 1000.0,
+		       lat[got * 999 / 1000] / 1000.0,
+		       lat[got - 1] / 1000.0);
+	}
+
+	free(sent);
+	free(lat);
+	return bad ? -EINVAL : 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = DEFAULT_UIBCCTL;
+	unsigned int rate = 1000, sender_rate = 0;
+	unsigned long n = 10000;
+	int c, r;
+
+	while ((c = getopt(argc, argv, "n:r:s:x:")) >= 0) {
+		switch (c) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			sender_rate = strtoul(optarg, NULL, 10);
+			break;
+		case 'x':
+			path = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n events] [-r rate] [-s sender-rate] [-x miracle-uibcctl]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (!n)
+		n = 1;
+	if (!rate)
+		rate = 1;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	bench_encode(n * 100);
+
+	if (access(path, X_OK)) {
+		printf("no %s, skipping end-to-end run\n", path);
+		return 0;
+	}
+
+	fflush(stdout);
+	r = bench_e2e(path, n, rate, sender_rate);
+	if (r < 0) {
+		fprintf(stderr, "end-to-end run failed (%d)\n", r);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test_common.h"
+#include "shl_csum.h"
+
+#define TEST_ROUNDS 4096
+#define TEST_MAXLEN 1600
+
+/* plain 16bit-at-a-time reference, as used by gdhcp before */
+static uint16_t ref_csum(const void *addr, size_t count)
+{
+	const uint8_t *source = addr;
+	uint32_t sum = 0;
+	uint16_t tmp;
+
+	while (count > 1) {
+		memcpy(&tmp, source, sizeof(tmp));
+		sum += tmp;
+		source += 2;
+		count -= 2;
+	}
+
+	if (count > 0) {
+		tmp = 0;
+		*(uint8_t*)&tmp = *source;
+		sum += tmp;
+	}
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+static void fill_random(uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		buf[i] = rand();
+}
+
+START_TEST(csum_known)
+{
+	/* RFC 1071 example: 00 01 f2 03 f4 f5 f6 f7 sums to 0xddf2 */
+	static const uint8_t data[] = {
+		0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7,
+	};
+	uint8_t be[2];
+	uint16_t check;
+
+	check = shl_csum(data, sizeof(data));
+	memcpy(be, &check, sizeof(be));
+	ck_assert_int_eq(be[0], 0x22);
+	ck_assert_int_eq(be[1], 0x0d);
+
+	ck_assert_int_eq(shl_csum(NULL, 0), 0xffff);
+	ck_assert_int_eq(shl_csum(data, 1), ref_csum(data, 1));
+}
+END_TEST
+
+START_TEST(csum_random)
+{
+	static uint8_t buf[TEST_MAXLEN + 8];
+	size_t i, off, len;
+
+	srand(0x1071);
+
+	for (i = 0; i < TEST_ROUNDS; ++i) {
+		/* vary alignment and length, including odd tails */
+		off = rand() % 8;
+		len = rand() % (TEST_MAXLEN + 1);
+		fill_random(buf, sizeof(buf));
+
+		ck_assert_int_eq(shl_csum(buf + off, len),
+				 ref_csum(buf + off, len));
+	}
+
+	/* all-ones data must not overflow the accumulator */
+	memset(buf, 0xff, sizeof(buf));
+	ck_assert_int_eq(shl_csum(buf, sizeof(buf)),
+			 ref_csum(buf, sizeof(buf)));
+}
+END_TEST
+
+START_TEST(csum_partial)
+{
+	static uint8_t buf[TEST_MAXLEN];
+	size_t i, split;
+	uint32_t sum;
+
+	srand(0x3309);
+
+	for (i = 0; i < TEST_ROUNDS; ++i) {
+		fill_random(buf, sizeof(buf));
+
+		/* only the final chunk may have an odd length */
+		split = (rand() % sizeof(buf)) & ~1UL;
+		sum = shl_csum_partial(buf, split, 0);
+		sum = shl_csum_partial(buf + split, sizeof(buf) - split - 1,
+				       sum);
+
+		ck_assert_int_eq(shl_csum_fold(sum),
+				 ref_csum(buf, sizeof(buf) - 1));
+	}
+}
+END_TEST
+
+START_TEST(csum_update)
+{
+	static uint8_t buf[576];
+	uint8_t old[16];
+	uint16_t check, from, to;
+	size_t i, off, len;
+
+	srand(0x1624);
+
+	for (i = 0; i < TEST_ROUNDS; ++i) {
+		fill_random(buf, sizeof(buf));
+		check = shl_csum(buf, sizeof(buf));
+
+		/* change a single 16bit word */
+		off = (rand() % (sizeof(buf) / 2)) * 2;
+		memcpy(&from, buf + off, sizeof(from));
+		to = rand();
+		memcpy(buf + off, &to, sizeof(to));
+
+		check = shl_csum_update16(check, from, to);
+		ck_assert_int_eq(check, ref_csum(buf, sizeof(buf)));
+
+		/* change a larger even-sized field, like an address */
+		len = ((rand() % sizeof(old)) & ~1UL) + 2;
+		off = (rand() % ((sizeof(buf) - len) / 2)) * 2;
+		memcpy(old, buf + off, len);
+		fill_random(buf + off, len);
+
+		check = shl_csum_update(check, old, buf + off, len);
+		ck_assert_int_eq(check, ref_csum(buf, sizeof(buf)));
+	}
+}
+END_TEST
+
+TEST_DEFINE_CASE(basic)
+	TEST(csum_known)
+	TEST(csum_random)
+	TEST(csum_partial)
+	TEST(csum_update)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(csum,
+		TEST_CASE(basic),
+		TEST_END
+	)
+)
@@ -0,0 +1,221 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test_common.h"
+#include <net/ethernet.h>
+#include "common.h"
+
+#define HEADER_LEN (sizeof(struct dhcp_packet) - \
+		    sizeof(((struct dhcp_packet*)0)->options))
+
+static struct dhcp_packet packet;
+
+/* copy @len option bytes into a fresh packet and return the packet length */
+static uint16_t set_options(const uint8_t *opts, size_t len)
+{
+	memset(&packet, 0, sizeof(packet));
+	memcpy(packet.options, opts, len);
+
+	return HEADER_LEN + len;
+}
+
+START_TEST(dhcp_index_basic)
+{
+	static const uint8_t opts[] = {
+		DHCP_MESSAGE_TYPE, 1, 2,
+		DHCP_SERVER_ID, 4, 192, 168, 0, 1,
+		DHCP_HOST_NAME, 3, 'f', 'o', 'o',
+		DHCP_END,
+	};
+	struct dhcp_option_index idx;
+	uint16_t len = set_options(opts, sizeof(opts));
+	uint8_t *o;
+
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet, len), 0);
+
+	o = dhcp_option_index_get(&idx, DHCP_MESSAGE_TYPE);
+	ck_assert(o != NULL);
+	ck_assert_int_eq(*o, 2);
+	ck_assert_int_eq(dhcp_option_index_len(&idx, DHCP_MESSAGE_TYPE), 1);
+
+	o = dhcp_option_index_get(&idx, DHCP_SERVER_ID);
+	ck_assert(o != NULL);
+	ck_assert(!memcmp(o, opts + 5, 4));
+	ck_assert_int_eq(dhcp_option_index_len(&idx, DHCP_SERVER_ID), 4);
+
+	ck_assert_int_eq(dhcp_option_index_len(&idx, DHCP_HOST_NAME), 3);
+	ck_assert(!memcmp(dhcp_option_index_get(&idx, DHCP_HOST_NAME),
+			  "foo", 3));
+
+	ck_assert(!dhcp_option_index_get(&idx, DHCP_LEASE_TIME));
+	ck_assert_int_eq(dhcp_option_index_len(&idx, DHCP_LEASE_TIME), 0);
+	ck_assert(!dhcp_option_index_get(&idx, DHCP_END));
+	ck_assert(!dhcp_option_index_get(&idx, DHCP_PADDING));
+}
+END_TEST
+
+START_TEST(dhcp_index_duplicate)
+{
+	static const uint8_t opts[] = {
+		DHCP_MESSAGE_TYPE, 1, 1,
+		DHCP_MESSAGE_TYPE, 1, 3,
+		/* too short for an IP, so the second one is used */
+		DHCP_SERVER_ID, 2, 10, 0,
+		DHCP_SERVER_ID, 4, 10, 0, 0, 1,
+		DHCP_SERVER_ID, 4, 10, 0, 0, 2,
+		DHCP_END,
+	};
+	struct dhcp_option_index idx;
+	uint16_t len = set_options(opts, sizeof(opts));
+	uint8_t *o;
+
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet, len), 0);
+
+	/* the first occurrence wins */
+	o = dhcp_option_index_get(&idx, DHCP_MESSAGE_TYPE);
+	ck_assert(o != NULL);
+	ck_assert_int_eq(*o, 1);
+
+	o = dhcp_option_index_get(&idx, DHCP_SERVER_ID);
+	ck_assert(o != NULL);
+	ck_assert_int_eq(dhcp_option_index_len(&idx, DHCP_SERVER_ID), 4);
+	ck_assert_int_eq(o[3], 1);
+}
+END_TEST
+
+START_TEST(dhcp_index_overlong)
+{
+	static const uint8_t opts[] = {
+		DHCP_MESSAGE_TYPE, 1, 1,
+		DHCP_HOST_NAME, 8, 'f', 'o', 'o',
+	};
+	struct dhcp_option_index idx;
+	uint16_t len = set_options(opts, sizeof(opts));
+
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet, len),
+			 -EBADMSG);
+
+	/* the same length is fine once the packet covers it */
+	len = set_options(opts, sizeof(opts));
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet, len + 5), 0);
+	ck_assert_int_eq(dhcp_option_index_len(&idx, DHCP_HOST_NAME), 8);
+}
+END_TEST
+
+START_TEST(dhcp_index_truncated)
+{
+	static const uint8_t opts[] = {
+		DHCP_MESSAGE_TYPE, 1, 1,
+		DHCP_SERVER_ID,
+	};
+	struct dhcp_option_index idx;
+	uint16_t len = set_options(opts, sizeof(opts));
+
+	/* the final option has no room for its length byte */
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet, len),
+			 -EBADMSG);
+
+	/* nothing but the fixed header */
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet, HEADER_LEN),
+			 -EBADMSG);
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet,
+						 HEADER_LEN - 1),
+			 -EBADMSG);
+}
+END_TEST
+
+START_TEST(dhcp_index_pad_end)
+{
+	static const uint8_t opts[] = {
+		DHCP_PADDING, DHCP_PADDING,
+		DHCP_MESSAGE_TYPE, 1, 5,
+		DHCP_PADDING,
+		DHCP_END,
+		/* garbage after END must be ignored, even if malformed */
+		DHCP_SERVER_ID, 200, 1,
+	};
+	static const uint8_t no_end[] = {
+		DHCP_MESSAGE_TYPE, 1, 5,
+		DHCP_PADDING, DHCP_PADDING,
+	};
+	struct dhcp_option_index idx;
+	uint16_t len;
+	uint8_t *o;
+
+	len = set_options(opts, sizeof(opts));
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet, len), 0);
+
+	o = dhcp_option_index_get(&idx, DHCP_MESSAGE_TYPE);
+	ck_assert(o == packet.options + 4);
+	ck_assert_int_eq(*o, 5);
+	ck_assert(!dhcp_option_index_get(&idx, DHCP_SERVER_ID));
+
+	/* a missing END is tolerated, the packet length bounds the scan */
+	len = set_options(no_end, sizeof(no_end));
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet, len), 0);
+	ck_assert(dhcp_option_index_get(&idx, DHCP_MESSAGE_TYPE) != NULL);
+}
+END_TEST
+
+START_TEST(dhcp_index_overload)
+{
+	static const uint8_t opts[] = {
+		DHCP_OPTION_OVERLOAD, 1, FILE_FIELD,
+		DHCP_MESSAGE_TYPE, 1, 2,
+		DHCP_END,
+	};
+	struct dhcp_option_index idx;
+	uint16_t len = set_options(opts, sizeof(opts));
+	uint8_t *o;
+
+	packet.file[0] = DHCP_SERVER_ID;
+	packet.file[1] = 4;
+	memcpy(packet.file + 2, "\x0a\x00\x00\x01", 4);
+	packet.file[6] = DHCP_END;
+
+	/* sname is not overloaded, so its content must not be looked at */
+	packet.sname[0] = DHCP_LEASE_TIME;
+	packet.sname[1] = 200;
+
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet, len), 0);
+
+	o = dhcp_option_index_get(&idx, DHCP_SERVER_ID);
+	ck_assert(o == packet.file + 2);
+	ck_assert(!dhcp_option_index_get(&idx, DHCP_LEASE_TIME));
+
+	/* a malformed overloaded field drops the whole packet */
+	packet.file[1] = 200;
+	ck_assert_int_eq(dhcp_option_index_build(&idx, &packet, len),
+			 -EBADMSG);
+}
+END_TEST
+
+TEST_DEFINE_CASE(index)
+	TEST(dhcp_index_basic)
+	TEST(dhcp_index_duplicate)
+	TEST(dhcp_index_overlong)
+	TEST(dhcp_index_truncated)
+	TEST(dhcp_index_pad_end)
+	TEST(dhcp_index_overload)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(dhcp,
+		TEST_CASE(index),
+		TEST_END
+	)
+)
@@ -0,0 +1,180 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test_common.h"
+#include "shl_ftable.h"
+#include "shl_htable.h"
+
+struct item {
+	uint64_t key;
+	bool present;
+	unsigned int visited;
+};
+
+#define item_from_ftable(_p) shl_htable_entry((_p), struct item, key)
+
+START_TEST(ftable_basic)
+{
+	struct shl_ftable t = SHL_FTABLE_INIT(t);
+	struct item a = { .key = 1 }, b = { .key = 2 }, c = { .key = 1 };
+	uint64_t *elem;
+
+	ck_assert(!shl_ftable_lookup_u64(&t, 1, &elem));
+	ck_assert(!shl_ftable_remove_u64(&t, 1, NULL));
+
+	ck_assert_int_eq(shl_ftable_insert_u64(&t, &a.key), 0);
+	ck_assert_int_eq(shl_ftable_insert_u64(&t, &b.key), 0);
+	ck_assert_int_eq(shl_ftable_insert_u64(&t, &c.key), -EALREADY);
+
+	ck_assert(shl_ftable_lookup_u64(&t, 1, &elem));
+	ck_assert_ptr_eq(item_from_ftable(elem), &a);
+	ck_assert(shl_ftable_lookup_u64(&t, 2, &elem));
+	ck_assert_ptr_eq(item_from_ftable(elem), &b);
+	ck_assert(!shl_ftable_lookup_u64(&t, 3, NULL));
+
+	ck_assert(shl_ftable_remove_u64(&t, 1, &elem));
+	ck_assert_ptr_eq(elem, &a.key);
+	ck_assert(!shl_ftable_lookup_u64(&t, 1, NULL));
+	ck_assert(shl_ftable_lookup_u64(&t, 2, NULL));
+
+	/* the key is free again */
+	ck_assert_int_eq(shl_ftable_insert_u64(&t, &c.key), 0);
+	ck_assert(shl_ftable_lookup_u64(&t, 1, &elem));
+	ck_assert_ptr_eq(elem, &c.key);
+
+	shl_ftable_clear_u64(&t, NULL, NULL);
+	ck_assert(!shl_ftable_lookup_u64(&t, 2, NULL));
+}
+END_TEST
+
+/* random inserts and removes, checked against the items themselves */
+START_TEST(ftable_churn)
+{
+	struct shl_ftable t;
+	struct item *items;
+	unsigned int i, n = 20000, live = 0;
+	uint64_t *elem;
+
+	shl_ftable_init_u64(&t);
+	items = calloc(n, sizeof(*items));
+	ck_assert(items != NULL);
+
+	/* sequential keys, like RTSP cookies, and keys sharing low bits */
+	for (i = 0; i < n; ++i)
+		items[i].key = i % 2 ? i : (uint64_t)i << 32;
+
+	srand(1);
+	for (i = 0; i < n * 20; ++i) {
+		struct item *it = &items[rand() % n];
+
+		if (it->present) {
+			ck_assert(shl_ftable_remove_u64(&t, it->key, &elem));
+			ck_assert_ptr_eq(elem, &it->key);
+			it->present = false;
+			--live;
+		} else {
+			ck_assert_int_eq(shl_ftable_insert_u64(&t, &it->key),
+					 0);
+			it->present = true;
+			++live;
+		}
+	}
+
+	ck_assert_int_eq(t.elems, live);
+	for (i = 0; i < n; ++i) {
+		ck_assert_int_eq(shl_ftable_lookup_u64(&t, items[i].key,
+						       &elem),
+				 items[i].present);
+		if (items[i].present)
+			ck_assert_ptr_eq(elem, &items[i].key);
+	}
+
+	shl_ftable_clear_u64(&t, NULL, NULL);
+	free(items);
+}
+END_TEST
+
+static void visit_fn(uint64_t *elem, void *ctx)
+{
+	unsigned int *n = ctx;
+
+	++item_from_ftable(elem)->visited;
+	++*n;
+}
+
+START_TEST(ftable_iterate)
+{
+	struct shl_ftable t = SHL_FTABLE_INIT(t);
+	struct item items[300] = { }, *it;
+	unsigned int i, n = 0;
+
+	SHL_FTABLE_FOREACH_MACRO(it, &t, item_from_ftable)
+		ck_abort();
+
+	for (i = 0; i < SHL_ARRAY_LENGTH(items); ++i) {
+		items[i].key = i * 7919;
+		ck_assert_int_eq(shl_ftable_insert_u64(&t, &items[i].key), 0);
+	}
+
+	/* removing the current entry while iterating is allowed */
+	SHL_FTABLE_FOREACH_MACRO(it, &t, item_from_ftable) {
+		++it->visited;
+		if (it->key % 2)
+			shl_ftable_remove_u64(&t, it->key, NULL);
+	}
+
+	for (i = 0; i < SHL_ARRAY_LENGTH(items); ++i)
+		ck_assert_int_eq(items[i].visited, 1);
+
+	shl_ftable_visit_u64(&t, visit_fn, &n);
+	ck_assert_int_eq(n, SHL_ARRAY_LENGTH(items) / 2);
+	ck_assert_int_eq(t.elems, n);
+
+	n = 0;
+	shl_ftable_clear_u64(&t, visit_fn, &n);
+	ck_assert_int_eq(n, SHL_ARRAY_LENGTH(items) / 2);
+	ck_assert_int_eq(t.elems, 0);
+}
+END_TEST
+
+START_TEST(ftable_mac)
+{
+	uint64_t key;
+
+	ck_assert_int_eq(shl_ftable_key_mac("00:11:22:aa:BB:ff", &key), 0);
+	ck_assert(key == 0x001122aabbffULL);
+
+	ck_assert_int_eq(shl_ftable_key_mac("00:11:22:aa:bb", &key), -EINVAL);
+	ck_assert_int_eq(shl_ftable_key_mac("00:11:22:aa:bb:ff:", &key),
+			 -EINVAL);
+	ck_assert_int_eq(shl_ftable_key_mac("p2p-dev-wlan0", &key), -EINVAL);
+}
+END_TEST
+
+TEST_DEFINE_CASE(basic)
+	TEST(ftable_basic)
+	TEST(ftable_churn)
+	TEST(ftable_iterate)
+	TEST(ftable_mac)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(ftable,
+		TEST_CASE(basic),
+		TEST_END
+	)
+)
@@ -0,0 +1,230 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The rtnl helper changes real interface addresses, so every test runs in a
+ * child inside a fresh network namespace and works on its loopback device.
+ * Without CAP_SYS_ADMIN we try an unprivileged user namespace first. If that
+ * is not allowed either, the tests are skipped.
+ */
+
+#include "test_common.h"
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include "rtnl.h"
+
+#define TEST_SKIP 77
+#define TEST_ADDR "10.77.0.1"
+
+struct result {
+	unsigned int called;
+	int error;
+};
+
+static void result_fn(struct rtnl *rtnl, int error, void *data)
+{
+	struct result *res = data;
+
+	++res->called;
+	res->error = error;
+}
+
+static bool enter_netns(void)
+{
+	if (!unshare(CLONE_NEWNET))
+		return true;
+
+	return !unshare(CLONE_NEWUSER | CLONE_NEWNET);
+}
+
+/* number of IPv4 addresses on @ifname, or -1 if @addr is one of them */
+static int count_addrs(const char *ifname, const char *addr)
+{
+	struct ifaddrs *ifa, *i;
+	char buf[INET_ADDRSTRLEN];
+	int n = 0;
+
+	if (getifaddrs(&ifa) < 0)
+		return -2;
+
+	for (i = ifa; i; i = i->ifa_next) {
+		if (!i->ifa_addr || i->ifa_addr->sa_family != AF_INET)
+			continue;
+		if (strcmp(i->ifa_name, ifname))
+			continue;
+
+		inet_ntop(AF_INET, &((struct sockaddr_in*)i->ifa_addr)->sin_addr,
+			  buf, sizeof(buf));
+		if (addr && !strcmp(buf, addr)) {
+			n = -1;
+			break;
+		}
+
+		++n;
+	}
+
+	freeifaddrs(ifa);
+	return n;
+}
+
+/* run @fn in a child inside its own netns and return its exit status */
+static int run_in_netns(int (*fn) (struct rtnl *rtnl))
+{
+	struct rtnl *rtnl;
+	pid_t pid;
+	int r;
+
+	pid = fork();
+	ck_assert(pid >= 0);
+
+	if (!pid) {
+		if (!enter_netns())
+			_exit(TEST_SKIP);
+
+		r = rtnl_new(&rtnl, if_nametoindex("lo"));
+		if (r < 0)
+			_exit(TEST_SKIP);
+
+		r = fn(rtnl);
+		rtnl_free(rtnl);
+		_exit(r);
+	}
+
+	ck_assert_int_eq(waitpid(pid, &r, 0), pid);
+	ck_assert(WIFEXITED(r));
+
+	r = WEXITSTATUS(r);
+	if (r == TEST_SKIP)
+		fprintf(stderr, "network namespaces not available, skipped\n");
+
+	return r;
+}
+
+static int set_and_flush(struct rtnl *rtnl)
+{
+	struct result res = { };
+
+	if (rtnl_set_addr(rtnl, TEST_ADDR "/24", result_fn, &res) < 0)
+		return 1;
+	if (rtnl_wait(rtnl, 1000) < 0)
+		return 2;
+	if (res.called != 1 || res.error)
+		return 3;
+	if (count_addrs("lo", TEST_ADDR) != -1)
+		return 4;
+
+	/* a second set replaces the address instead of adding one */
+	if (rtnl_set_addr(rtnl, "10.77.1.1/255.255.255.0", NULL, NULL) < 0)
+		return 5;
+	if (rtnl_wait(rtnl, 1000) < 0)
+		return 6;
+	if (count_addrs("lo", TEST_ADDR) != 1)
+		return 7;
+
+	if (rtnl_flush_addr(rtnl, result_fn, &res) < 0)
+		return 8;
+	if (rtnl_wait(rtnl, 1000) < 0)
+		return 9;
+	if (res.called != 2 || res.error)
+		return 10;
+	if (count_addrs("lo", NULL) != 0)
+		return 11;
+
+	return 0;
+}
+
+START_TEST(rtnl_set_flush)
+{
+	int r = run_in_netns(set_and_flush);
+
+	ck_assert(r == 0 || r == TEST_SKIP);
+}
+END_TEST
+
+/*
+ * This is what miracle-dhcp does on teardown: a request may still be in
+ * flight when the final flush is queued and waited for synchronously. Its
+ * callback must not run anymore, but the flush must still win.
+ */
+static int detach_and_flush(struct rtnl *rtnl)
+{
+	struct result res = { };
+
+	if (rtnl_set_addr(rtnl, TEST_ADDR "/24", result_fn, &res) < 0)
+		return 1;
+	if (rtnl_is_idle(rtnl))
+		return 2;
+
+	rtnl_detach(rtnl);
+
+	if (rtnl_flush_addr(rtnl, NULL, NULL) < 0)
+		return 3;
+	if (rtnl_wait(rtnl, 1000) < 0)
+		return 4;
+	if (res.called)
+		return 5;
+	if (count_addrs("lo", NULL) != 0)
+		return 6;
+
+	return 0;
+}
+
+START_TEST(rtnl_teardown)
+{
+	int r = run_in_netns(detach_and_flush);
+
+	ck_assert(r == 0 || r == TEST_SKIP);
+}
+END_TEST
+
+static int invalid_addr(struct rtnl *rtnl)
+{
+	if (rtnl_set_addr(rtnl, "10.77.0.1/33", NULL, NULL) != -EINVAL)
+		return 1;
+	if (rtnl_set_addr(rtnl, "10.77.0.1/255.0.255.0", NULL, NULL) != -EINVAL)
+		return 2;
+	if (rtnl_add_addr(rtnl, "10.77.0", NULL, NULL) != -EINVAL)
+		return 3;
+	if (!rtnl_is_idle(rtnl))
+		return 4;
+
+	return 0;
+}
+
+START_TEST(rtnl_invalid)
+{
+	int r = run_in_netns(invalid_addr);
+
+	ck_assert(r == 0 || r == TEST_SKIP);
+}
+END_TEST
+
+TEST_DEFINE_CASE(netns)
+	TEST(rtnl_set_flush)
+	TEST(rtnl_teardown)
+	TEST(rtnl_invalid)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(rtnl,
+		TEST_CASE(netns),
+		TEST_END
+	)
+)
@@ -0,0 +1,247 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test_common.h"
+#include "rtp.h"
+
+/* 1ms between packets, 90 timestamp units each */
+static void feed(struct rtp_stats *st, uint16_t seq, uint32_t ts, uint64_t t)
+{
+	struct rtp_hdr h = {
+		.pt = 33,
+		.seq = seq,
+		.ts = ts,
+		.ssrc = 0x1234,
+		.len = RTP_HEADER_SIZE,
+	};
+
+	rtp_stats_update(st, &h, 1328, t);
+}
+
+START_TEST(rtp_header)
+{
+	uint8_t pkt[64] = {
+		0x80, 0xa1, 0xff, 0xfe,		/* V=2, M, PT=33, seq */
+		0x00, 0x01, 0x5f, 0x90,		/* ts */
+		0xde, 0xad, 0xbe, 0xef,		/* ssrc */
+	};
+	struct rtp_hdr h;
+	int r;
+
+	r = rtp_parse_header(&h, pkt, 12);
+	ck_assert_int_eq(r, 0);
+	ck_assert(h.marker);
+	ck_assert_int_eq(h.pt, 33);
+	ck_assert_int_eq(h.seq, 0xfffe);
+	ck_assert_int_eq(h.ts, 90000);
+	ck_assert_int_eq(h.ssrc, 0xdeadbeef);
+	ck_assert_int_eq(h.len, 12);
+
+	/* one CSRC and a one-word extension */
+	pkt[0] = 0x91;
+	pkt[18] = 0x00;
+	pkt[19] = 0x01;
+	r = rtp_parse_header(&h, pkt, 24);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(h.len, 24);
+	r = rtp_parse_header(&h, pkt, 23);
+	ck_assert_int_eq(r, -EINVAL);
+
+	/* wrong version, short packet */
+	pkt[0] = 0x40;
+	ck_assert_int_eq(rtp_parse_header(&h, pkt, 12), -EINVAL);
+	pkt[0] = 0x80;
+	ck_assert_int_eq(rtp_parse_header(&h, pkt, 11), -EINVAL);
+}
+END_TEST
+
+START_TEST(rtp_sequence)
+{
+	struct rtp_stats st;
+	uint16_t seq = 65530;
+	unsigned int i;
+
+	rtp_stats_init(&st, RTP_MP2T_CLOCK_RATE);
+
+	/* first packet is on probation */
+	feed(&st, seq++, 0, 1000);
+	ck_assert(!st.valid);
+	ck_assert_int_eq(rtp_stats_expected(&st), 0);
+
+	for (i = 1; i < 10; ++i)
+		feed(&st, seq++, i * 90, 1000 + i * 1000);
+
+	/* wrapped around, nothing lost, no jitter */
+	ck_assert(st.valid);
+	ck_assert_int_eq(st.cycles, 1 << 16);
+	ck_assert_int_eq(st.received, 9);
+	ck_assert_int_eq(rtp_stats_expected(&st), 9);
+	ck_assert_int_eq(rtp_stats_lost(&st), 0);
+	ck_assert_int_eq(rtp_stats_jitter(&st), 0);
+	ck_assert_int_eq(st.bursts, 0);
+
+	/* lose 3, then 1 */
+	seq += 3;
+	feed(&st, seq++, 10 * 90, 11000);
+	seq += 1;
+	feed(&st, seq++, 11 * 90, 12000);
+	ck_assert_int_eq(rtp_stats_lost(&st), 4);
+	ck_assert_int_eq(st.bursts, 2);
+	ck_assert_int_eq(st.max_burst, 3);
+	ck_assert_int_eq(st.last_burst, 1);
+
+	/* a late packet fills one of the holes, a duplicate doesn't */
+	feed(&st, seq - 2, 10 * 90, 12100);
+	ck_assert_int_eq(st.reordered, 1);
+	ck_assert_int_eq(rtp_stats_lost(&st), 3);
+	feed(&st, seq - 1, 11 * 90, 12200);
+	ck_assert_int_eq(st.duplicates, 1);
+	ck_assert_int_eq(rtp_stats_lost(&st), 2);
+}
+END_TEST
+
+START_TEST(rtp_jitter)
+{
+	struct rtp_stats st;
+	unsigned int i;
+	uint64_t t = 0;
+
+	rtp_stats_init(&st, RTP_MP2T_CLOCK_RATE);
+
+	/* packets sent every 10ms but arriving alternately 2ms late */
+	for (i = 0; i < 2000; ++i) {
+		t = i * 10000 + ((i & 1) ? 2000 : 0);
+		feed(&st, i, i * 900, t);
+	}
+
+	/* every transit differs by 180 units, which J converges to */
+	ck_assert_int_ge(rtp_stats_jitter(&st), 175);
+	ck_assert_int_le(rtp_stats_jitter(&st), 180);
+	ck_assert_int_ge(rtp_stats_jitter_usec(&st), 1940);
+	ck_assert_int_le(rtp_stats_jitter_usec(&st), 2000);
+	ck_assert_int_eq(rtp_stats_lost(&st), 0);
+}
+END_TEST
+
+START_TEST(rtp_resync)
+{
+	struct rtp_stats st;
+	unsigned int i;
+
+	rtp_stats_init(&st, RTP_MP2T_CLOCK_RATE);
+
+	for (i = 0; i < 10; ++i)
+		feed(&st, 100 + i, i * 90, i * 1000);
+	ck_assert_int_eq(st.received, 9);
+
+	/* a single stray packet far away is dropped */
+	feed(&st, 30000, 0, 20000);
+	ck_assert_int_eq(st.received, 9);
+	ck_assert_int_eq(rtp_stats_lost(&st), 0);
+
+	/* two in a row mean the sender restarted */
+	feed(&st, 40000, 0, 21000);
+	feed(&st, 40001, 90, 22000);
+	ck_assert_int_eq(st.received, 1);
+	ck_assert_int_eq(rtp_stats_expected(&st), 1);
+}
+END_TEST
+
+START_TEST(rtp_rtcp)
+{
+	const uint8_t sr[] = {
+		0x81, 0xc9, 0x00, 0x01,		/* RR, one word, skipped */
+		0x00, 0x00, 0x00, 0x01,
+		0x80, 0xc8, 0x00, 0x06,		/* SR */
+		0x00, 0x00, 0x12, 0x34,		/* ssrc */
+		0xaa, 0xbb, 0xcc, 0xdd,		/* NTP msw */
+		0xee, 0xff, 0x00, 0x11,		/* NTP lsw */
+		0x00, 0x00, 0x00, 0x00,		/* RTP ts */
+		0x00, 0x00, 0x00, 0x00,		/* packets */
+		0x00, 0x00, 0x00, 0x00,		/* octets */
+	};
+	struct rtp_stats st;
+	struct rtcp_rr rr;
+	uint32_t ssrc, lsr;
+	uint8_t buf[128];
+	unsigned int i;
+	int r;
+
+	r = rtcp_parse_sr(sr, sizeof(sr), &ssrc, &lsr);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(ssrc, 0x1234);
+	ck_assert_int_eq(lsr, 0xccddeeff);
+	ck_assert_int_eq(rtcp_parse_sr(sr, 8, &ssrc, &lsr), -ENOENT);
+	ck_assert_int_eq(rtcp_parse_sr(sr, 20, &ssrc, &lsr), -EINVAL);
+
+	rtp_stats_init(&st, RTP_MP2T_CLOCK_RATE);
+	rtp_stats_handle_sr(&st, lsr, 1000000);
+
+	/* 20 packets expected, 5 of them lost */
+	for (i = 0; i < 20; ++i)
+		if (i < 5 || i > 9)
+			feed(&st, i, i * 90, 1000000 + i * 1000);
+
+	rtp_stats_fill_rr(&st, &rr, 1500000);
+	ck_assert_int_eq(rr.ssrc, 0x1234);
+	ck_assert_int_eq(rr.lost, 5);
+	ck_assert_int_eq(rr.fraction, 5 * 256 / 19);
+	ck_assert_int_eq(rr.ext_max_seq, 19);
+	ck_assert_int_eq(rr.lsr, 0xccddeeff);
+	ck_assert_int_eq(rr.dlsr, 32768);
+
+	/* nothing lost since the last report */
+	feed(&st, 20, 20 * 90, 1020000);
+	rtp_stats_fill_rr(&st, &rr, 1600000);
+	ck_assert_int_eq(rr.fraction, 0);
+	ck_assert_int_eq(rr.lost, 5);
+
+	r = rtcp_build_rr(buf, sizeof(buf), 0xdeadbeef, &rr, "sink");
+	ck_assert_int_eq(r, 32 + 16);
+	ck_assert_int_eq(buf[0], 0x81);
+	ck_assert_int_eq(buf[1], RTCP_RR);
+	ck_assert_int_eq(buf[3], 7);
+	ck_assert_int_eq(buf[4], 0xde);
+	ck_assert_int_eq(buf[11], 0x34);
+	ck_assert_int_eq(buf[15], 5);
+	ck_assert_int_eq(buf[33], RTCP_SDES);
+	ck_assert_int_eq(buf[35], 3);
+	ck_assert_int_eq(buf[40], RTCP_SDES_CNAME);
+	ck_assert_int_eq(buf[41], 4);
+	ck_assert(!memcmp(buf + 42, "sink", 4));
+	ck_assert_int_eq(buf[46], 0);
+
+	ck_assert_int_eq(rtcp_build_rr(buf, 40, 1, &rr, "sink"), -ENOBUFS);
+	ck_assert_int_eq(rtcp_build_rr(buf, sizeof(buf), 1, NULL, "sink"),
+			 8 + 16);
+}
+END_TEST
+
+TEST_DEFINE_CASE(basic)
+	TEST(rtp_header)
+	TEST(rtp_sequence)
+	TEST(rtp_jitter)
+	TEST(rtp_resync)
+	TEST(rtp_rtcp)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(rtp,
+		TEST_CASE(basic),
+		TEST_END
+	)
+)
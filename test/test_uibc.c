@@ -0,0 +1,535 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <linux/uhid.h>
+#include <linux/uinput.h>
+#include "test_common.h"
+#include "uibc.h"
+#include "uibc_evdev.h"
+#include "uibc_hidc.h"
+
+/* boot protocol mouse: three buttons, relative x and y */
+static const uint8_t mouse_desc[] = {
+	0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x09, 0x01,
+	0xa1, 0x00, 0x05, 0x09, 0x19, 0x01, 0x29, 0x03,
+	0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01,
+	0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01,
+	0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81,
+	0x25, 0x7f, 0x75, 0x08, 0x95, 0x02, 0x81, 0x06,
+	0xc0, 0xc0,
+};
+
+struct recorder {
+	struct uibc_event ev[16];
+	unsigned int n;
+};
+
+static void record_fn(struct uibc_evdev *dev,
+		      const struct uibc_event *ev,
+		      void *data)
+{
+	struct recorder *rec = data;
+
+	ck_assert_int_lt(rec->n, SHL_ARRAY_LENGTH(rec->ev));
+	rec->ev[rec->n++] = *ev;
+}
+
+static void emit(struct uibc_evdev *dev,
+		 struct recorder *rec,
+		 unsigned int type,
+		 unsigned int code,
+		 int value)
+{
+	struct input_event ie = {
+		.type = type,
+		.code = code,
+		.value = value,
+	};
+
+	uibc_evdev_feed(dev, &ie, record_fn, rec);
+}
+
+START_TEST(uibc_touch)
+{
+	const uint8_t expect[] = {
+		0x00, 0x00, 0x00, 0x0e,		/* header, length */
+		0x00, 0x00, 0x06,		/* touch down, body length */
+		0x01,				/* one pointer */
+		0x00, 0x00, 0x64, 0x00, 0xc8,	/* id 0 at 100x200 */
+		0x00,				/* padding */
+	};
+	struct uibc_event ev = {
+		.type = UIBC_GENERIC_TOUCH_DOWN,
+		.count = 1,
+		.pointers = { { .id = 0, .x = 100, .y = 200 } },
+	};
+	uint8_t buf[UIBC_MAX_PACKET];
+	int r;
+
+	r = uibc_encode(&ev, buf, sizeof(buf));
+	ck_assert_int_eq(r, sizeof(expect));
+	ck_assert(!memcmp(buf, expect, sizeof(expect)));
+
+	/* three pointers is the largest packet there is */
+	ev.type = UIBC_GENERIC_TOUCH_MOVE;
+	ev.count = UIBC_EVENT_MAX_POINTERS;
+	r = uibc_encode(&ev, buf, sizeof(buf));
+	ck_assert_int_eq(r, UIBC_MAX_PACKET);
+	ck_assert_int_eq(buf[3], UIBC_MAX_PACKET);
+	ck_assert_int_eq(buf[4], UIBC_GENERIC_TOUCH_MOVE);
+	ck_assert_int_eq(buf[7], 3);
+
+	ev.count = 0;
+	ck_assert_int_eq(uibc_encode(&ev, buf, sizeof(buf)), -EINVAL);
+	ev.count = UIBC_EVENT_MAX_POINTERS + 1;
+	ck_assert_int_eq(uibc_encode(&ev, buf, sizeof(buf)), -EINVAL);
+}
+END_TEST
+
+START_TEST(uibc_key)
+{
+	const uint8_t expect[] = {
+		0x00, 0x00, 0x00, 0x0c,
+		0x03, 0x00, 0x05,
+		0x00, 0x00, 0x41, 0x00, 0x00,
+	};
+	struct uibc_event ev = {
+		.type = UIBC_GENERIC_KEY_DOWN,
+		.key = { .code1 = 0x41 },
+	};
+	uint8_t buf[UIBC_MAX_PACKET];
+	int r;
+
+	r = uibc_encode(&ev, buf, sizeof(buf));
+	ck_assert_int_eq(r, sizeof(expect));
+	ck_assert(!memcmp(buf, expect, sizeof(expect)));
+
+	ck_assert_int_eq(uibc_encode(&ev, buf, sizeof(expect) - 1), -ENOBUFS);
+
+	ev.type = UIBC_GENERIC_ROTATE + 1;
+	ck_assert_int_eq(uibc_encode(&ev, buf, sizeof(buf)), -EINVAL);
+}
+END_TEST
+
+START_TEST(uibc_evdev_touch)
+{
+	struct uibc_evdev *dev;
+	struct recorder rec = { };
+	int r;
+
+	r = uibc_evdev_new(&dev, UIBC_EVDEV_TOUCH, 1920, 1080);
+	ck_assert_int_eq(r, 0);
+	uibc_evdev_set_range(dev, 0, 4095, 0, 4095);
+
+	/* two contacts land in one frame */
+	emit(dev, &rec, EV_ABS, ABS_MT_SLOT, 0);
+	emit(dev, &rec, EV_ABS, ABS_MT_TRACKING_ID, 10);
+	emit(dev, &rec, EV_ABS, ABS_MT_POSITION_X, 0);
+	emit(dev, &rec, EV_ABS, ABS_MT_POSITION_Y, 0);
+	emit(dev, &rec, EV_ABS, ABS_MT_SLOT, 1);
+	emit(dev, &rec, EV_ABS, ABS_MT_TRACKING_ID, 11);
+	emit(dev, &rec, EV_ABS, ABS_MT_POSITION_X, 4095);
+	emit(dev, &rec, EV_ABS, ABS_MT_POSITION_Y, 2048);
+	/* emulated single touch is ignored */
+	emit(dev, &rec, EV_ABS, ABS_X, 100);
+	ck_assert_int_eq(rec.n, 0);
+	emit(dev, &rec, EV_SYN, SYN_REPORT, 0);
+
+	ck_assert_int_eq(rec.n, 2);
+	ck_assert_int_eq(rec.ev[0].type, UIBC_GENERIC_TOUCH_DOWN);
+	ck_assert_int_eq(rec.ev[0].count, 1);
+	ck_assert_int_eq(rec.ev[0].pointers[0].id, 0);
+	ck_assert_int_eq(rec.ev[0].pointers[0].x, 0);
+	ck_assert_int_eq(rec.ev[1].pointers[0].id, 1);
+	ck_assert_int_eq(rec.ev[1].pointers[0].x, 1919);
+	ck_assert_int_eq(rec.ev[1].pointers[0].y, 539);
+
+	/* both move, then the first lifts */
+	rec.n = 0;
+	emit(dev, &rec, EV_ABS, ABS_MT_POSITION_X, 2048);
+	emit(dev, &rec, EV_ABS, ABS_MT_SLOT, 0);
+	emit(dev, &rec, EV_ABS, ABS_MT_POSITION_Y, 4095);
+	emit(dev, &rec, EV_SYN, SYN_REPORT, 0);
+	emit(dev, &rec, EV_ABS, ABS_MT_TRACKING_ID, -1);
+	emit(dev, &rec, EV_SYN, SYN_REPORT, 0);
+
+	ck_assert_int_eq(rec.n, 2);
+	ck_assert_int_eq(rec.ev[0].type, UIBC_GENERIC_TOUCH_MOVE);
+	ck_assert_int_eq(rec.ev[0].count, 2);
+	ck_assert_int_eq(rec.ev[0].pointers[0].y, 1079);
+	ck_assert_int_eq(rec.ev[0].pointers[1].x, 959);
+	ck_assert_int_eq(rec.ev[1].type, UIBC_GENERIC_TOUCH_UP);
+	ck_assert_int_eq(rec.ev[1].pointers[0].id, 0);
+
+	/*
+	 * A frame the kernel dropped events of is not sent as is. Without a
+	 * device to read the state back from, the remaining contact is
+	 * released, so it cannot stay down on the source.
+	 */
+	rec.n = 0;
+	emit(dev, &rec, EV_ABS, ABS_MT_SLOT, 1);
+	emit(dev, &rec, EV_ABS, ABS_MT_POSITION_X, 0);
+	emit(dev, &rec, EV_SYN, SYN_DROPPED, 0);
+	emit(dev, &rec, EV_ABS, ABS_MT_POSITION_X, 10);
+	emit(dev, &rec, EV_SYN, SYN_REPORT, 0);
+	ck_assert_int_eq(rec.n, 1);
+	ck_assert_int_eq(rec.ev[0].type, UIBC_GENERIC_TOUCH_UP);
+	ck_assert_int_eq(rec.ev[0].pointers[0].id, 1);
+
+	/* nothing is down anymore, so the next drop sends nothing */
+	rec.n = 0;
+	emit(dev, &rec, EV_SYN, SYN_DROPPED, 0);
+	emit(dev, &rec, EV_SYN, SYN_REPORT, 0);
+	ck_assert_int_eq(rec.n, 0);
+
+	uibc_evdev_free(dev);
+}
+END_TEST
+
+START_TEST(uibc_evdev_mouse_keyboard)
+{
+	struct uibc_evdev *mouse, *kbd;
+	struct recorder rec = { };
+
+	ck_assert_int_eq(uibc_evdev_new(&mouse, UIBC_EVDEV_MOUSE, 640, 480), 0);
+	ck_assert_int_eq(uibc_evdev_new(&kbd, UIBC_EVDEV_KEYBOARD, 640, 480), 0);
+
+	/* hovering sends nothing, the cursor stays on screen */
+	emit(mouse, &rec, EV_REL, REL_X, -1000);
+	emit(mouse, &rec, EV_REL, REL_Y, 10);
+	emit(mouse, &rec, EV_SYN, SYN_REPORT, 0);
+	ck_assert_int_eq(rec.n, 0);
+
+	emit(mouse, &rec, EV_KEY, BTN_LEFT, 1);
+	emit(mouse, &rec, EV_SYN, SYN_REPORT, 0);
+	emit(mouse, &rec, EV_REL, REL_X, 5);
+	emit(mouse, &rec, EV_SYN, SYN_REPORT, 0);
+	emit(mouse, &rec, EV_KEY, BTN_LEFT, 0);
+	emit(mouse, &rec, EV_SYN, SYN_REPORT, 0);
+
+	ck_assert_int_eq(rec.n, 3);
+	ck_assert_int_eq(rec.ev[0].type, UIBC_GENERIC_TOUCH_DOWN);
+	ck_assert_int_eq(rec.ev[0].pointers[0].x, 0);
+	ck_assert_int_eq(rec.ev[0].pointers[0].y, 250);
+	ck_assert_int_eq(rec.ev[1].type, UIBC_GENERIC_TOUCH_MOVE);
+	ck_assert_int_eq(rec.ev[1].pointers[0].x, 5);
+	ck_assert_int_eq(rec.ev[2].type, UIBC_GENERIC_TOUCH_UP);
+
+	rec.n = 0;
+	emit(kbd, &rec, EV_KEY, KEY_LEFTSHIFT, 1);
+	emit(kbd, &rec, EV_KEY, KEY_A, 1);
+	emit(kbd, &rec, EV_KEY, KEY_A, 0);
+	emit(kbd, &rec, EV_KEY, KEY_LEFTSHIFT, 0);
+	emit(kbd, &rec, EV_KEY, KEY_1, 1);
+	/* no ASCII for it */
+	emit(kbd, &rec, EV_KEY, KEY_F1, 1);
+
+	ck_assert_int_eq(rec.n, 3);
+	ck_assert_int_eq(rec.ev[0].type, UIBC_GENERIC_KEY_DOWN);
+	ck_assert_int_eq(rec.ev[0].key.code1, 'A');
+	ck_assert_int_eq(rec.ev[1].type, UIBC_GENERIC_KEY_UP);
+	ck_assert_int_eq(rec.ev[2].key.code1, '1');
+
+	/* the release of '1' got lost, it is sent once the drop is over */
+	rec.n = 0;
+	emit(kbd, &rec, EV_SYN, SYN_DROPPED, 0);
+	emit(kbd, &rec, EV_KEY, KEY_1, 0);
+	emit(kbd, &rec, EV_SYN, SYN_REPORT, 0);
+	ck_assert_int_eq(rec.n, 1);
+	ck_assert_int_eq(rec.ev[0].type, UIBC_GENERIC_KEY_UP);
+	ck_assert_int_eq(rec.ev[0].key.code1, '1');
+
+	/* same for a button held down on a mouse */
+	rec.n = 0;
+	emit(mouse, &rec, EV_KEY, BTN_LEFT, 1);
+	emit(mouse, &rec, EV_SYN, SYN_REPORT, 0);
+	emit(mouse, &rec, EV_SYN, SYN_DROPPED, 0);
+	emit(mouse, &rec, EV_SYN, SYN_REPORT, 0);
+	ck_assert_int_eq(rec.n, 2);
+	ck_assert_int_eq(rec.ev[0].type, UIBC_GENERIC_TOUCH_DOWN);
+	ck_assert_int_eq(rec.ev[1].type, UIBC_GENERIC_TOUCH_UP);
+
+	uibc_evdev_free(mouse);
+	uibc_evdev_free(kbd);
+}
+END_TEST
+
+static void uinput_emit(int fd, unsigned int type, unsigned int code, int value)
+{
+	struct input_event ie = {
+		.type = type,
+		.code = code,
+		.value = value,
+	};
+
+	ck_assert_int_eq(write(fd, &ie, sizeof(ie)), sizeof(ie));
+}
+
+/* end to end through a virtual device, needs access to /dev/uinput */
+START_TEST(uibc_evdev_uinput)
+{
+	struct uinput_user_dev udev = { };
+	struct uibc_evdev *dev;
+	struct recorder rec = { };
+	char sysname[64], path[128];
+	int fd, r, i;
+
+	fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	strcpy(udev.name, "miracle-test-touch");
+	udev.id.bustype = BUS_VIRTUAL;
+	udev.absmax[ABS_X] = 999;
+	udev.absmax[ABS_Y] = 999;
+
+	ck_assert_int_eq(ioctl(fd, UI_SET_EVBIT, EV_KEY), 0);
+	ck_assert_int_eq(ioctl(fd, UI_SET_KEYBIT, BTN_TOUCH), 0);
+	ck_assert_int_eq(ioctl(fd, UI_SET_EVBIT, EV_ABS), 0);
+	ck_assert_int_eq(ioctl(fd, UI_SET_ABSBIT, ABS_X), 0);
+	ck_assert_int_eq(ioctl(fd, UI_SET_ABSBIT, ABS_Y), 0);
+	ck_assert_int_eq(write(fd, &udev, sizeof(udev)), sizeof(udev));
+	ck_assert_int_eq(ioctl(fd, UI_DEV_CREATE), 0);
+
+	ck_assert_int_eq(ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname), 0);
+	for (i = 0; i < 64; ++i) {
+		sprintf(path, "/sys/devices/virtual/input/%s/event%d", sysname, i);
+		if (!access(path, F_OK))
+			break;
+	}
+	ck_assert_int_lt(i, 64);
+	sprintf(path, "/dev/input/event%d", i);
+
+	/* udev may take a moment to create the node */
+	for (r = -ENOENT; r == -ENOENT && rec.n < 100; rec.n++) {
+		r = uibc_evdev_open(&dev, path, 100, 100, false);
+		if (r == -ENOENT)
+			usleep(10000);
+	}
+	rec.n = 0;
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(dev->kind, UIBC_EVDEV_TOUCH);
+
+	uinput_emit(fd, EV_ABS, ABS_X, 500);
+	uinput_emit(fd, EV_ABS, ABS_Y, 999);
+	uinput_emit(fd, EV_KEY, BTN_TOUCH, 1);
+	uinput_emit(fd, EV_SYN, SYN_REPORT, 0);
+
+	for (i = 0; i < 100 && !rec.n; ++i) {
+		ck_assert_int_eq(uibc_evdev_dispatch(dev, record_fn, &rec), 0);
+		usleep(1000);
+	}
+
+	ck_assert_int_eq(rec.n, 1);
+	ck_assert_int_eq(rec.ev[0].type, UIBC_GENERIC_TOUCH_DOWN);
+	ck_assert_int_eq(rec.ev[0].pointers[0].x, 49);
+	ck_assert_int_eq(rec.ev[0].pointers[0].y, 99);
+
+	/*
+	 * Pretend the release got lost: the kernel already knows about it,
+	 * so the resync after SYN_DROPPED reads it back and sends the up.
+	 */
+	uinput_emit(fd, EV_KEY, BTN_TOUCH, 0);
+	uinput_emit(fd, EV_SYN, SYN_REPORT, 0);
+
+	rec.n = 0;
+	emit(dev, &rec, EV_SYN, SYN_DROPPED, 0);
+	emit(dev, &rec, EV_SYN, SYN_REPORT, 0);
+	ck_assert_int_eq(rec.n, 1);
+	ck_assert_int_eq(rec.ev[0].type, UIBC_GENERIC_TOUCH_UP);
+
+	/* the release itself arrives late and changes nothing */
+	usleep(10000);
+	ck_assert_int_eq(uibc_evdev_dispatch(dev, record_fn, &rec), 0);
+	ck_assert_int_eq(rec.n, 1);
+
+	uibc_evdev_free(dev);
+	ioctl(fd, UI_DEV_DESTROY);
+	close(fd);
+}
+END_TEST
+
+START_TEST(uibc_hidc)
+{
+	const uint8_t kbd_desc[] = { 0x05, 0x01, 0x09, 0x06, 0xa1, 0x01 };
+	/* extended usage with the digitizer page, after a long item */
+	const uint8_t touch_desc[] = {
+		0xfe, 0x01, 0x00, 0xaa,
+		0x0b, 0x04, 0x00, 0x0d, 0x00, 0xa1, 0x01,
+	};
+	const uint8_t unknown_desc[] = { 0x06, 0x00, 0xff, 0x09, 0x01, 0xa1 };
+	const uint8_t expect[] = {
+		0x00, 0x01, 0x00, 0x0c,		/* HIDC, 12 bytes */
+		0x01, 0x01, 0x00, 0x00, 0x03,	/* USB, mouse, report of 3 */
+		0x01, 0x05, 0xfb,
+	};
+	uint8_t buf[64];
+	int r;
+
+	ck_assert_int_eq(uibc_hidc_type_from_descriptor(mouse_desc,
+							sizeof(mouse_desc)),
+			 UIBC_HIDC_TYPE_MOUSE);
+	ck_assert_int_eq(uibc_hidc_type_from_descriptor(kbd_desc,
+							sizeof(kbd_desc)),
+			 UIBC_HIDC_TYPE_KEYBOARD);
+	ck_assert_int_eq(uibc_hidc_type_from_descriptor(touch_desc,
+							sizeof(touch_desc)),
+			 UIBC_HIDC_TYPE_MULTI_TOUCH);
+	ck_assert_int_eq(uibc_hidc_type_from_descriptor(unknown_desc,
+							sizeof(unknown_desc)),
+			 -EOPNOTSUPP);
+	ck_assert_int_eq(uibc_hidc_type_from_descriptor(kbd_desc, 3),
+			 -EOPNOTSUPP);
+
+	ck_assert_str_eq(uibc_hidc_type_to_str(UIBC_HIDC_TYPE_MOUSE), "Mouse");
+	ck_assert_str_eq(uibc_hidc_path_to_str(uibc_hidc_path_from_bus(BUS_USB)),
+			 "USB");
+
+	/* the report is put in place first */
+	memcpy(buf + UIBC_HIDC_OFFSET, "\x01\x05\xfb", 3);
+	r = uibc_encode_hidc(buf, sizeof(buf), UIBC_HIDC_PATH_USB,
+			     UIBC_HIDC_TYPE_MOUSE, UIBC_HIDC_USAGE_REPORT, 3);
+	ck_assert_int_eq(r, sizeof(expect));
+	ck_assert(!memcmp(buf, expect, sizeof(expect)));
+
+	/* odd lengths get a padding byte */
+	r = uibc_encode_hidc(buf, sizeof(buf), UIBC_HIDC_PATH_USB,
+			     UIBC_HIDC_TYPE_MOUSE, UIBC_HIDC_USAGE_REPORT, 2);
+	ck_assert_int_eq(r, 12);
+	ck_assert_int_eq(buf[11], 0);
+
+	ck_assert_int_eq(uibc_encode_hidc(buf, 11, 1, 1, 0, 2), -ENOBUFS);
+	ck_assert_int_eq(uibc_encode_hidc(buf, sizeof(buf), UIBC_HIDC_PATH_CNT,
+					  1, 0, 2), -EINVAL);
+}
+END_TEST
+
+static int find_hidraw(const char *name, char *path, size_t size)
+{
+	char uevent[512], line[256];
+	struct dirent *d;
+	bool found;
+	FILE *f;
+	DIR *dir;
+
+	dir = opendir("/sys/class/hidraw");
+	if (!dir)
+		return -ENOENT;
+
+	while ((d = readdir(dir))) {
+		snprintf(uevent, sizeof(uevent),
+			 "/sys/class/hidraw/%s/device/uevent", d->d_name);
+		f = fopen(uevent, "re");
+		if (!f)
+			continue;
+
+		found = false;
+		while (fgets(line, sizeof(line), f))
+			if (!strncmp(line, "HID_NAME=", 9) &&
+			    !strncmp(line + 9, name, strlen(name)))
+				found = true;
+		fclose(f);
+
+		if (found) {
+			snprintf(path, size, "/dev/%s", d->d_name);
+			closedir(dir);
+			return 0;
+		}
+	}
+
+	closedir(dir);
+	return -ENOENT;
+}
+
+/* end to end through a virtual HID device, needs access to /dev/uhid */
+START_TEST(uibc_hidc_uhid)
+{
+	struct uhid_event ev = { };
+	struct uibc_hidraw *hid = NULL;
+	uint8_t report[16];
+	char path[64];
+	int fd, r, i;
+
+	fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	ev.type = UHID_CREATE2;
+	strcpy((char*)ev.u.create2.name, "miracle-test-hid");
+	ev.u.create2.bus = BUS_USB;
+	ev.u.create2.rd_size = sizeof(mouse_desc);
+	memcpy(ev.u.create2.rd_data, mouse_desc, sizeof(mouse_desc));
+	ck_assert_int_eq(write(fd, &ev, sizeof(ev)), sizeof(ev));
+
+	/* the hidraw node shows up once the kernel probed the device */
+	for (i = 0, r = -ENOENT; i < 100 && r < 0; ++i) {
+		r = find_hidraw("miracle-test-hid", path, sizeof(path));
+		if (r >= 0)
+			r = uibc_hidraw_open(&hid, path);
+		if (r < 0)
+			usleep(10000);
+	}
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(hid->type, UIBC_HIDC_TYPE_MOUSE);
+	ck_assert_int_eq(hid->path, UIBC_HIDC_PATH_USB);
+	ck_assert_int_eq(hid->desc_len, sizeof(mouse_desc));
+	ck_assert(!memcmp(hid->desc, mouse_desc, sizeof(mouse_desc)));
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_INPUT2;
+	ev.u.input2.size = 3;
+	memcpy(ev.u.input2.data, "\x01\x05\xfb", 3);
+	ck_assert_int_eq(write(fd, &ev, sizeof(ev)), sizeof(ev));
+
+	for (i = 0, r = -1; i < 100 && r < 0; ++i) {
+		r = read(hid->fd, report, sizeof(report));
+		if (r < 0)
+			usleep(1000);
+	}
+	ck_assert_int_eq(r, 3);
+	ck_assert(!memcmp(report, "\x01\x05\xfb", 3));
+
+	uibc_hidraw_free(hid);
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_DESTROY;
+	write(fd, &ev, sizeof(ev));
+	close(fd);
+}
+END_TEST
+
+TEST_DEFINE_CASE(basic)
+	TEST(uibc_touch)
+	TEST(uibc_key)
+	TEST(uibc_hidc)
+TEST_END_CASE
+
+TEST_DEFINE_CASE(devices)
+	TEST(uibc_evdev_touch)
+	TEST(uibc_evdev_mouse_keyboard)
+	TEST(uibc_evdev_uinput)
+	TEST(uibc_hidc_uhid)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(uibc,
+		TEST_CASE(basic),
+		TEST_CASE(devices),
+		TEST_END
+	)
+)
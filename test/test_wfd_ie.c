@@ -0,0 +1,158 @@
+/*
+ * MiracleCast - Wifi-Display/Miracast Implementation
+ *
+ * MiracleCast is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * MiracleCast is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MiracleCast; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test_common.h"
+#include "wfd_ie.h"
+
+START_TEST(wfd_ie_dev_info)
+{
+	struct wfd_ie ie;
+	int r;
+
+	/* primary sink, session available, port 7236, 200Mbps */
+	r = wfd_ie_parse(&ie, "000006" "00111c4400c8");
+	ck_assert_int_eq(r, 0);
+	ck_assert(wfd_ie_has(&ie, WFD_SUBELEM_DEV_INFO));
+	ck_assert_int_eq(wfd_ie_get_dev_type(&ie), WFD_DEV_PRIMARY_SINK);
+	ck_assert_int_eq(ie.rtsp_port, 7236);
+	ck_assert_int_eq(ie.max_throughput, 200);
+	ck_assert_int_eq(wfd_ie_get_caps(&ie),
+			 WFD_CAP_PRIMARY_SINK | WFD_CAP_SESSION_AVAILABLE);
+
+	/* dual-role source, session not available, upper-case hex */
+	r = wfd_ie_parse(&ie, "000006" "00031C440032");
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(wfd_ie_get_dev_type(&ie), WFD_DEV_DUAL_ROLE);
+	ck_assert_int_eq(ie.max_throughput, 50);
+	ck_assert_int_eq(wfd_ie_get_caps(&ie),
+			 WFD_CAP_SOURCE | WFD_CAP_PRIMARY_SINK);
+
+	/* "0x"-prefixed device-information body as sent by wpas events */
+	r = wfd_ie_parse(&ie, "0x01101c440032");
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(wfd_ie_get_dev_type(&ie), WFD_DEV_SOURCE);
+	ck_assert_int_eq(ie.dev_info, 0x0110);
+	ck_assert_int_eq(wfd_ie_get_caps(&ie),
+			 WFD_CAP_SOURCE | WFD_CAP_SESSION_AVAILABLE |
+			 WFD_CAP_CONTENT_PROTECTION);
+
+	/* empty is valid and has no capabilities */
+	r = wfd_ie_parse(&ie, "");
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(ie.present, 0);
+	ck_assert_int_eq(wfd_ie_get_caps(&ie), 0);
+	r = wfd_ie_parse(&ie, NULL);
+	ck_assert_int_eq(r, 0);
+}
+END_TEST
+
+START_TEST(wfd_ie_subelems)
+{
+	struct wfd_ie ie;
+	int r;
+
+	/* dev-info, unknown subelem 10, coupled sink and UIBC ext-cap */
+	r = wfd_ie_parse(&ie, "000006" "0018" "1c44" "0064"
+			      "0a0003" "abcdef"
+			      "060007" "01" "a0b1c2d3e4f5"
+			      "070002" "0001");
+	ck_assert_int_eq(r, 0);
+	ck_assert(wfd_ie_has(&ie, WFD_SUBELEM_DEV_INFO));
+	ck_assert(wfd_ie_has(&ie, WFD_SUBELEM_COUPLED_SINK));
+	ck_assert(wfd_ie_has(&ie, WFD_SUBELEM_EXT_CAP));
+	ck_assert(!wfd_ie_has(&ie, WFD_SUBELEM_ASSOC_BSSID));
+	ck_assert_int_eq(ie.coupled_sink_status, 1);
+	ck_assert_int_eq(ie.coupled_sink_mac[0], 0xa0);
+	ck_assert_int_eq(ie.coupled_sink_mac[5], 0xf5);
+	ck_assert_int_eq(wfd_ie_get_caps(&ie),
+			 WFD_CAP_SOURCE | WFD_CAP_SESSION_AVAILABLE |
+			 WFD_CAP_COUPLED_SINK | WFD_CAP_UIBC);
+
+	/* first occurrence of a subelement wins */
+	r = wfd_ie_parse(&ie, "000006" "00101c440032" "000006" "00111c4400c8");
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(wfd_ie_get_dev_type(&ie), WFD_DEV_SOURCE);
+}
+END_TEST
+
+START_TEST(wfd_ie_invalid)
+{
+	static const char *invalid[] = {
+		"0006001",			/* odd length */
+		"00000600111c44",		/* truncated body */
+		"0000",				/* truncated header */
+		"00000600111c44zzc8",		/* bad hex */
+		"0000020001",			/* dev-info too short */
+		"0x00111c44",			/* short dev-info body */
+		"0x00111c440032ff",		/* long dev-info body */
+		NULL,
+	};
+	struct wfd_ie ie;
+	unsigned int i;
+	int r;
+
+	for (i = 0; invalid[i]; ++i) {
+		r = wfd_ie_parse(&ie, invalid[i]);
+		ck_assert_int_eq(r, -EINVAL);
+		ck_assert_int_eq(ie.present, 0);
+		ck_assert_int_eq(wfd_ie_get_caps(&ie), 0);
+	}
+}
+END_TEST
+
+START_TEST(wfd_ie_single_subelem)
+{
+	struct wfd_ie ie;
+	int r;
+
+	/* what sinkctl passes to WFD_SUBELEM_SET 0: length and body only */
+	r = wfd_ie_parse_subelem(&ie, WFD_SUBELEM_DEV_INFO, "000600111c4400c8");
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(wfd_ie_get_dev_type(&ie), WFD_DEV_PRIMARY_SINK);
+	ck_assert_int_eq(ie.rtsp_port, 7236);
+	ck_assert_int_eq(ie.max_throughput, 200);
+	ck_assert_int_eq(wfd_ie_get_caps(&ie),
+			 WFD_CAP_PRIMARY_SINK | WFD_CAP_SESSION_AVAILABLE);
+
+	r = wfd_ie_parse_subelem(&ie, WFD_SUBELEM_DEV_INFO, "");
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(ie.present, 0);
+
+	/* trailing data */
+	r = wfd_ie_parse_subelem(&ie, WFD_SUBELEM_DEV_INFO, "000600111c4400c800");
+	ck_assert_int_eq(r, -EINVAL);
+	ck_assert_int_eq(ie.present, 0);
+
+	/* too short */
+	r = wfd_ie_parse_subelem(&ie, WFD_SUBELEM_DEV_INFO, "00020011");
+	ck_assert_int_eq(r, -EINVAL);
+}
+END_TEST
+
+TEST_DEFINE_CASE(basic)
+	TEST(wfd_ie_dev_info)
+	TEST(wfd_ie_subelems)
+	TEST(wfd_ie_invalid)
+	TEST(wfd_ie_single_subelem)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(wfd_ie,
+		TEST_CASE(basic),
+		TEST_END
+	)
+)